@@ -0,0 +1,248 @@
+#include "fanout_benchmark.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <sys/resource.h>
+
+#include <boost/asio.hpp>
+
+#include "../video/network.h"
+#include "../server/uring_sender.h"
+
+namespace screenshare::benchmark {
+	namespace {
+		using Socket = boost::asio::ip::tcp::socket;
+
+		/**
+		 * Loopback clients that read and discard everything, on their own thread
+		 */
+		class Receivers {
+		private:
+			boost::asio::io_context mIOContext;
+			std::vector<std::unique_ptr<Socket>> mSockets;
+			std::vector<std::array<std::uint8_t, 64 * 1024>> mBuffers;
+			std::atomic<std::uint64_t> mReceivedBytes = 0;
+			std::jthread mThread;
+
+			void receive(std::size_t index) {
+				mSockets[index]->async_read_some(
+					boost::asio::buffer(mBuffers[index]),
+					[this, index](boost::system::error_code error, std::size_t size) {
+						if (error) {
+							return;
+						}
+
+						mReceivedBytes += size;
+						receive(index);
+					}
+				);
+			}
+		public:
+			Receivers(boost::asio::ip::tcp::endpoint server, std::size_t count)
+				: mBuffers(count) {
+				for (std::size_t i = 0; i < count; i++) {
+					auto socket = std::make_unique<Socket>(mIOContext);
+					socket->connect(server);
+					mSockets.push_back(std::move(socket));
+				}
+			}
+
+			~Receivers() {
+				mIOContext.stop();
+			}
+
+			void start() {
+				for (std::size_t i = 0; i < mSockets.size(); i++) {
+					receive(i);
+				}
+
+				mThread = std::jthread([this]() {
+					mIOContext.run();
+				});
+			}
+
+			void waitFor(std::uint64_t bytes) {
+				while (mReceivedBytes.load() < bytes) {
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+				}
+			}
+		};
+
+		struct BenchmarkPacket {
+			std::unique_ptr<AVPacket, video::AVPacketDeleter> packet;
+			video::network::PacketHeader header;
+			video::network::EncodedPacketPtr encoded;
+		};
+
+		std::vector<BenchmarkPacket> createPackets(const FanoutBenchmarkConfig& config) {
+			std::vector<BenchmarkPacket> packets;
+			for (std::size_t i = 0; i < config.packets; i++) {
+				auto isKeyframe = i % config.keyframeInterval == 0;
+
+				BenchmarkPacket packet { std::unique_ptr<AVPacket, video::AVPacketDeleter>(av_packet_alloc()) };
+				video::handleAVResult(
+					av_new_packet(packet.packet.get(), (int)(isKeyframe ? config.keyframeSize : config.deltaFrameSize)),
+					"Failed to allocate packet"
+				);
+				std::memset(packet.packet->data, (int)i, packet.packet->size);
+				packet.packet->pts = (std::int64_t)i;
+				packet.packet->dts = (std::int64_t)i;
+				packet.packet->flags = isKeyframe ? AV_PKT_FLAG_KEY : 0;
+
+				packet.header = video::network::PacketHeader((std::int64_t)i);
+				packet.encoded = std::make_shared<video::network::EncodedPacket>(packet.header, packet.packet.get());
+				packets.push_back(std::move(packet));
+			}
+
+			return packets;
+		}
+
+		double threadCpuMilliseconds() {
+			rusage usage {};
+			getrusage(RUSAGE_THREAD, &usage);
+			return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1.0E3
+				+ (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1.0E3;
+		}
+
+		void raiseFileLimit() {
+			rlimit limit {};
+			if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+				limit.rlim_cur = limit.rlim_max;
+				setrlimit(RLIMIT_NOFILE, &limit);
+			}
+		}
+
+		using SendAll = std::function<void (boost::asio::io_context& ioContext, std::vector<Socket>& sockets, BenchmarkPacket& packet)>;
+
+		void runCase(const std::string& name,
+					 std::size_t clientCount,
+					 std::vector<BenchmarkPacket>& packets,
+					 const std::function<SendAll (boost::asio::io_context& ioContext)>& createSender) {
+			boost::asio::io_context ioContext;
+			boost::asio::ip::tcp::acceptor acceptor(ioContext, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+
+			std::vector<Socket> sockets;
+			std::unique_ptr<Receivers> receivers;
+			std::jthread connectThread([&]() {
+				receivers = std::make_unique<Receivers>(acceptor.local_endpoint(), clientCount);
+			});
+
+			for (std::size_t i = 0; i < clientCount; i++) {
+				sockets.push_back(acceptor.accept());
+			}
+
+			connectThread.join();
+			receivers->start();
+
+			auto sendAll = createSender(ioContext);
+
+			std::uint64_t totalBytes = 0;
+			auto startTime = std::chrono::steady_clock::now();
+			auto startCpu = threadCpuMilliseconds();
+
+			// Each packet is sent to every client before the next one, as when broadcasting frames.
+			for (auto& packet : packets) {
+				sendAll(ioContext, sockets, packet);
+				totalBytes += packet.encoded->size() * clientCount;
+			}
+
+			auto sendCpu = threadCpuMilliseconds() - startCpu;
+			receivers->waitFor(totalBytes);
+			auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+			std::cout
+				<< std::setw(8) << clientCount
+				<< std::setw(16) << name
+				<< std::setw(12) << std::fixed << std::setprecision(1) << elapsed
+				<< std::setw(14) << sendCpu
+				<< std::setw(12) << (double)totalBytes / 1.0E6 / (elapsed / 1.0E3)
+				<< std::endl;
+		}
+
+		SendAll createAsioSender(boost::asio::io_context&) {
+			return [](boost::asio::io_context& ioContext, std::vector<Socket>& sockets, BenchmarkPacket& packet) {
+				video::network::PacketSender packetSender;
+				std::vector<video::network::PacketSender::AsyncResultPtr> results;
+				for (auto& socket : sockets) {
+					results.push_back(packetSender.sendAsync(socket, packet.header, packet.packet.get()));
+				}
+
+				ioContext.restart();
+				ioContext.run();
+			};
+		}
+
+#ifdef SCREENSHARE_IO_URING
+		SendAll createUringSender(boost::asio::io_context& ioContext, bool zeroCopy) {
+			server::UringSenderConfig config;
+			config.enabled = true;
+			if (!zeroCopy) {
+				config.registeredBufferCount = 0;
+			}
+
+			auto uringSender = std::make_shared<server::UringSender>(ioContext, config);
+			return [uringSender](boost::asio::io_context& ioContext, std::vector<Socket>& sockets, BenchmarkPacket& packet) {
+				std::size_t pending = sockets.size();
+				for (auto& socket : sockets) {
+					uringSender->send(
+						socket.native_handle(),
+						packet.encoded,
+						0,
+						packet.encoded->size(),
+						[&pending](boost::system::error_code error, std::size_t) {
+							if (error) {
+								throw std::runtime_error("Send failed: " + error.message());
+							}
+
+							pending--;
+						}
+					);
+				}
+
+				// The sender always waits for completions, so the io context is only run until the packet is done.
+				ioContext.restart();
+				while (pending > 0) {
+					ioContext.run_one();
+				}
+			};
+		}
+#endif
+	}
+
+	void runFanoutBenchmark(const FanoutBenchmarkConfig& config) {
+		raiseFileLimit();
+		auto packets = createPackets(config);
+
+		std::cout
+			<< std::setw(8) << "clients"
+			<< std::setw(16) << "backend"
+			<< std::setw(12) << "wall ms"
+			<< std::setw(14) << "send cpu ms"
+			<< std::setw(12) << "MB/s"
+			<< std::endl;
+
+		for (auto clientCount : config.clientCounts) {
+			runCase("asio", clientCount, packets, createAsioSender);
+
+#ifdef SCREENSHARE_IO_URING
+			runCase("io_uring", clientCount, packets, [](boost::asio::io_context& ioContext) {
+				return createUringSender(ioContext, false);
+			});
+
+			runCase("io_uring zc", clientCount, packets, [](boost::asio::io_context& ioContext) {
+				return createUringSender(ioContext, true);
+			});
+#endif
+		}
+
+#ifndef SCREENSHARE_IO_URING
+		std::cout << "Built without io_uring support, configure with -DSCREENSHARE_IO_URING=ON to compare." << std::endl;
+#endif
+	}
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace screenshare::benchmark {
+	struct FanoutBenchmarkConfig {
+		std::vector<std::size_t> clientCounts { 1, 10, 50, 100, 250, 500 };
+		std::size_t packets = 300;
+		std::size_t keyframeInterval = 30;
+		std::size_t keyframeSize = 256 * 1024;
+		std::size_t deltaFrameSize = 16 * 1024;
+	};
+
+	/**
+	 * Sends the same packets to a number of loopback clients, comparing the asio send path with the io_uring one
+	 */
+	void runFanoutBenchmark(const FanoutBenchmarkConfig& config);
+}
\ No newline at end of file
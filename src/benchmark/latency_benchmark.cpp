@@ -0,0 +1,179 @@
+#include "latency_benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "../client/input_channel.h"
+#include "../screeninteractor/synthetic.h"
+#include "../server/video_server.h"
+#include "../video/network.h"
+
+namespace screenshare::benchmark {
+	namespace {
+		using Clock = std::chrono::steady_clock;
+
+		constexpr std::chrono::milliseconds CONNECT_TIMEOUT { 5000 };
+
+		void connect(boost::asio::ip::tcp::socket& socket, const boost::asio::ip::tcp::endpoint& endpoint) {
+			auto deadline = Clock::now() + CONNECT_TIMEOUT;
+			while (true) {
+				boost::system::error_code error;
+				socket.connect(endpoint, error);
+				if (!error) {
+					return;
+				}
+
+				socket.close();
+				if (Clock::now() >= deadline) {
+					throw boost::system::system_error(error);
+				}
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+		}
+
+		double percentile(const std::vector<double>& sorted, double fraction) {
+			auto index = (std::size_t)std::ceil(fraction * (double)sorted.size());
+			return sorted[std::clamp<std::size_t>(index, 1, sorted.size()) - 1];
+		}
+
+		void printLatencies(std::vector<double> latencies, std::size_t lost) {
+			std::cout << "Probes: " << latencies.size() << " arrived, " << lost << " lost" << std::endl;
+			if (latencies.empty()) {
+				return;
+			}
+
+			std::sort(latencies.begin(), latencies.end());
+			auto mean = std::accumulate(latencies.begin(), latencies.end(), 0.0) / (double)latencies.size();
+
+			std::cout
+				<< std::setw(10) << "min"
+				<< std::setw(10) << "mean"
+				<< std::setw(10) << "p50"
+				<< std::setw(10) << "p90"
+				<< std::setw(10) << "p99"
+				<< std::setw(10) << "max"
+				<< std::endl;
+
+			std::cout
+				<< std::fixed << std::setprecision(1)
+				<< std::setw(10) << latencies.front()
+				<< std::setw(10) << mean
+				<< std::setw(10) << percentile(latencies, 0.5)
+				<< std::setw(10) << percentile(latencies, 0.9)
+				<< std::setw(10) << percentile(latencies, 0.99)
+				<< std::setw(10) << latencies.back()
+				<< std::endl;
+		}
+	}
+
+	void runLatencyBenchmark(const LatencyBenchmarkConfig& config) {
+		video::VideoEncoderConfig videoEncoderConfig { config.width, config.height, config.frameRate };
+		server::VideoServer videoServer(
+			{ boost::asio::ip::make_address("127.0.0.1"), 0 },
+			videoEncoderConfig
+		);
+
+		std::vector<double> latencies;
+		std::size_t lost = 0;
+		{
+			std::jthread serverThread([&]() {
+				try {
+					videoServer.run(std::make_unique<screeninteractor::SyntheticScreenInteractor>(config.width, config.height));
+				} catch (const std::exception& e) {
+					std::cerr << "Server failed due to: " << e.what() << std::endl;
+				}
+			});
+
+			// Stopped before the thread running it is joined, also when the client fails
+			std::unique_ptr<server::VideoServer, decltype([](server::VideoServer* server) { server->stop(); })> stopServer(&videoServer);
+
+			boost::asio::io_context ioContext;
+			boost::asio::ip::tcp::socket socket(ioContext);
+			connect(socket, videoServer.endpoint());
+			socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+			video::network::AVCodecParametersReceiver codecParameterReceiver(socket, video::protocol::ClientHello {
+				.capabilities = video::protocol::capabilityBit(video::protocol::Capability::RemoteInput)
+			});
+
+			client::InputChannel inputChannel;
+			inputChannel.open(socket, [](boost::system::error_code error) {
+				std::cerr << "Failed to send probe: " << error.message() << std::endl;
+			});
+
+			video::network::PacketReceiver packetReceiver(codecParameterReceiver.codecParameters(), config.decoder);
+			packetReceiver.setProtocolVersion(codecParameterReceiver.serverHello().version);
+
+			std::unique_ptr<AVFrame, video::AVFrameDeleter> frame(av_frame_alloc());
+			std::unique_ptr<AVPacket, video::AVPacketDeleter> packet(av_packet_alloc());
+			if (!frame || !packet) {
+				throw std::runtime_error("Failed to allocate memory for AVFrame and AVPacket");
+			}
+
+			std::mt19937 random(std::random_device{}());
+			std::uniform_real_distribution<double> intervalScale(0.5, 1.5);
+			auto nextInterval = [&]() {
+				return std::chrono::duration_cast<Clock::duration>(config.interval * intervalScale(random));
+			};
+
+			video::PacketDecoder packetDecoder;
+			std::uint16_t sequence = 0;
+			std::optional<Clock::time_point> probeSentTime;
+			auto nextProbeTime = Clock::now() + config.warmup;
+
+			std::cout << "Sending " << config.probes << " probes..." << std::endl;
+			while (latencies.size() + lost < config.probes) {
+				video::network::PacketHeader packetHeader;
+				if (auto error = packetReceiver.receive(socket, packet.get(), packetHeader)) {
+					throw boost::system::system_error(error);
+				}
+
+				packetDecoder.decode(
+					packet.get(),
+					packetReceiver.codecContext(),
+					frame.get(),
+					[](AVFrame*) -> std::uint8_t* {
+						return nullptr;
+					},
+					[&](AVCodecContext*) {
+						auto marker = screeninteractor::marker::read(frame->data[0], frame->linesize[0], frame->width, frame->height);
+						if (probeSentTime && marker == sequence) {
+							auto decodedTime = Clock::now();
+							latencies.push_back(std::chrono::duration<double, std::milli>(decodedTime - *probeSentTime).count());
+							probeSentTime.reset();
+							nextProbeTime = decodedTime + nextInterval();
+						}
+					}
+				);
+
+				auto timeNow = Clock::now();
+				if (probeSentTime && timeNow - *probeSentTime >= config.timeout) {
+					lost++;
+					probeSentTime.reset();
+					nextProbeTime = timeNow + nextInterval();
+				}
+
+				// One probe at a time, so that every change of the marker belongs to the outstanding probe
+				if (!probeSentTime && timeNow >= nextProbeTime) {
+					sequence = sequence == UINT16_MAX ? 1 : sequence + 1;
+					probeSentTime = Clock::now();
+					inputChannel.send(client::ClientAction::latencyProbe(sequence));
+				}
+			}
+
+			inputChannel.close();
+		}
+
+		printLatencies(std::move(latencies), lost);
+	}
+}
\ No newline at end of file
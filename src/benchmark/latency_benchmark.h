@@ -0,0 +1,25 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+
+#include "../video/decoder.h"
+
+namespace screenshare::benchmark {
+	struct LatencyBenchmarkConfig {
+		std::size_t probes = 200;
+		std::chrono::milliseconds interval { 200 }; // Average time between probes, which is randomized so they do not line up with frames
+		std::chrono::milliseconds timeout { 2000 }; // After which a probe counts as lost
+		std::chrono::milliseconds warmup { 1000 };
+		int width = 1280;
+		int height = 720;
+		int frameRate = 30;
+		video::DecoderConfig decoder;
+	};
+
+	/**
+	 * Measures the latency from input to the screen changing, as seen by a client. Runs a server with a synthetic screen
+	 * and a client in the same process, over loopback. The client sends latency probes as client actions, and the time until
+	 * the probe shows up in a decoded frame is its latency. Display is not included, as the client has none.
+	 */
+	void runLatencyBenchmark(const LatencyBenchmarkConfig& config);
+}
\ No newline at end of file
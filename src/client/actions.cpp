@@ -1,5 +1,7 @@
 #include "actions.h"
 
+#include <algorithm>
+
 #include <fmt/format.h>
 
 namespace screenshare::client {
@@ -20,6 +22,22 @@ namespace screenshare::client {
 					data.mouseButtonPressed.x,
 					data.mouseButtonPressed.y
 				);
+			case ClientActionType::MouseMoved:
+				return fmt::format("MouseMoved(x: {}, y: {})", data.mouseMoved.x, data.mouseMoved.y);
+			case ClientActionType::KeyDown:
+				return fmt::format("KeyDown(key sym: {})", data.key.keySym);
+			case ClientActionType::KeyUp:
+				return fmt::format("KeyUp(key sym: {})", data.key.keySym);
+			case ClientActionType::MouseScrolled:
+				return fmt::format(
+					"MouseScrolled(x: {}, y: {}, delta x: {}, delta y: {})",
+					data.mouseScrolled.x,
+					data.mouseScrolled.y,
+					data.mouseScrolled.deltaX,
+					data.mouseScrolled.deltaY
+				);
+			case ClientActionType::LatencyProbe:
+				return fmt::format("LatencyProbe(sequence: {})", data.latencyProbe.sequence);
 			default:
 				return "";
 		}
@@ -48,25 +66,134 @@ namespace screenshare::client {
 		};
 	}
 
-	boost::system::error_code ClientAction::send(boost::asio::ip::tcp::socket& socket) {
+	ClientAction ClientAction::mouseMoved(double x, double y) {
+		return ClientAction {
+			.type = client::ClientActionType::MouseMoved,
+			.data = {
+				.mouseMoved = client::MouseMovedClientAction { x, y }
+			}
+		};
+	}
+
+	ClientAction ClientAction::keyDown(std::uint32_t keySym) {
+		ClientAction clientAction { .type = client::ClientActionType::KeyDown };
+		clientAction.data.key = client::KeyClientAction { keySym };
+		return clientAction;
+	}
+
+	ClientAction ClientAction::keyUp(std::uint32_t keySym) {
+		ClientAction clientAction { .type = client::ClientActionType::KeyUp };
+		clientAction.data.key = client::KeyClientAction { keySym };
+		return clientAction;
+	}
+
+	ClientAction ClientAction::mouseScrolled(double x, double y, std::int32_t deltaX, std::int32_t deltaY) {
+		ClientAction clientAction { .type = client::ClientActionType::MouseScrolled };
+		clientAction.data.mouseScrolled = client::MouseScrolledClientAction { x, y, deltaX, deltaY };
+		return clientAction;
+	}
+
+	ClientAction ClientAction::latencyProbe(std::uint16_t sequence) {
+		ClientAction clientAction { .type = client::ClientActionType::LatencyProbe };
+		clientAction.data.latencyProbe = client::LatencyProbeClientAction { sequence };
+		return clientAction;
+	}
+
+	void ClientAction::write(video::protocol::MessageWriter& writer) const {
+		writer.writeUInt8((std::uint8_t)type);
+		switch (type) {
+			case ClientActionType::NoAction:
+				break;
+			case ClientActionType::KeyPressed:
+				writer.writeBytes(reinterpret_cast<const std::uint8_t*>(data.keyPressed.key), sizeof(data.keyPressed.key));
+				break;
+			case ClientActionType::MouseButtonPressed:
+				writer.writeVarUInt(data.mouseButtonPressed.mouseButton);
+				writer.writeDouble(data.mouseButtonPressed.x);
+				writer.writeDouble(data.mouseButtonPressed.y);
+				break;
+			case ClientActionType::MouseMoved:
+				writer.writeDouble(data.mouseMoved.x);
+				writer.writeDouble(data.mouseMoved.y);
+				break;
+			case ClientActionType::KeyDown:
+			case ClientActionType::KeyUp:
+				writer.writeVarUInt(data.key.keySym);
+				break;
+			case ClientActionType::MouseScrolled:
+				writer.writeDouble(data.mouseScrolled.x);
+				writer.writeDouble(data.mouseScrolled.y);
+				writer.writeVarInt(data.mouseScrolled.deltaX);
+				writer.writeVarInt(data.mouseScrolled.deltaY);
+				break;
+			case ClientActionType::LatencyProbe:
+				writer.writeVarUInt(data.latencyProbe.sequence);
+				break;
+		}
+	}
+
+	bool ClientAction::read(video::protocol::MessageReader& reader, ClientAction& clientAction) {
+		clientAction.clear();
+		clientAction.type = (ClientActionType)reader.readUInt8();
+		switch (clientAction.type) {
+			case ClientActionType::NoAction:
+				break;
+			case ClientActionType::KeyPressed: {
+				std::size_t keySize = 0;
+				auto key = reader.readBytes(keySize);
+				std::copy_n(key, std::min(keySize, sizeof(clientAction.data.keyPressed.key) - 1), clientAction.data.keyPressed.key);
+				break;
+			}
+			case ClientActionType::MouseButtonPressed:
+				clientAction.data.mouseButtonPressed.mouseButton = (std::uint32_t)reader.readVarUInt();
+				clientAction.data.mouseButtonPressed.x = reader.readDouble();
+				clientAction.data.mouseButtonPressed.y = reader.readDouble();
+				break;
+			case ClientActionType::MouseMoved:
+				clientAction.data.mouseMoved.x = reader.readDouble();
+				clientAction.data.mouseMoved.y = reader.readDouble();
+				break;
+			case ClientActionType::KeyDown:
+			case ClientActionType::KeyUp:
+				clientAction.data.key.keySym = (std::uint32_t)reader.readVarUInt();
+				break;
+			case ClientActionType::MouseScrolled:
+				clientAction.data.mouseScrolled.x = reader.readDouble();
+				clientAction.data.mouseScrolled.y = reader.readDouble();
+				clientAction.data.mouseScrolled.deltaX = (std::int32_t)reader.readVarInt();
+				clientAction.data.mouseScrolled.deltaY = (std::int32_t)reader.readVarInt();
+				break;
+			case ClientActionType::LatencyProbe:
+				clientAction.data.latencyProbe.sequence = (std::uint16_t)reader.readVarUInt();
+				break;
+			default:
+				return false;
+		}
+
+		return !reader.failed();
+	}
+
+	boost::system::error_code ClientAction::send(boost::asio::ip::tcp::socket& socket) const {
+		video::protocol::MessageWriter writer(video::protocol::MessageType::ClientAction);
+		write(writer);
+		writer.finish();
+
 		boost::system::error_code error;
-		boost::asio::write(
-			socket,
-			boost::asio::buffer(reinterpret_cast<std::uint8_t*>(this), sizeof(client::ClientAction)),
-			error
-		);
+		boost::asio::write(socket, writer.buffer(), error);
 		return error;
 	}
 
-	void ClientAction::receiveAsync(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-									std::shared_ptr<ClientAction> clientAction,
-									std::function<void(boost::system::error_code, std::shared_ptr<ClientAction>)> callback) {
-		boost::asio::async_read(
-			*socket,
-			boost::asio::buffer(reinterpret_cast<uint8_t*>(clientAction.get()), sizeof(client::ClientAction)),
-			[clientAction, callback](boost::system::error_code error, std::size_t) {
-				callback(error, clientAction);
+	void coalesceMouseMoves(std::vector<ClientAction>& clientActions) {
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < clientActions.size(); i++) {
+			auto superseded = clientActions[i].type == ClientActionType::MouseMoved
+				&& i + 1 < clientActions.size()
+				&& clientActions[i + 1].type == ClientActionType::MouseMoved;
+			if (!superseded) {
+				clientActions[kept++] = clientActions[i];
 			}
-		);
+		}
+
+		clientActions.resize(kept);
 	}
 }
\ No newline at end of file
@@ -1,14 +1,22 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 
+#include "../video/protocol.h"
+
 namespace screenshare::client {
 	enum class ClientActionType {
 		NoAction = 0,
 		KeyPressed,
-		MouseButtonPressed
+		MouseButtonPressed,
+		MouseMoved,
+		KeyDown,
+		KeyUp,
+		MouseScrolled,
+		LatencyProbe
 	};
 
 	struct KeyPressedClientAction {
@@ -21,11 +29,44 @@ namespace screenshare::client {
 		double y = 0.0;
 	};
 
+	struct MouseMovedClientAction {
+		double x = 0.0;
+		double y = 0.0;
+	};
+
+	/**
+	 * A key going down or up, identified by its X keysym, which is also what GDK uses as key value
+	 */
+	struct KeyClientAction {
+		std::uint32_t keySym = 0;
+	};
+
+	/**
+	 * Scrolls at the given position, by the given number of steps. Positive is down and to the right.
+	 */
+	struct MouseScrolledClientAction {
+		double x = 0.0;
+		double y = 0.0;
+		std::int32_t deltaX = 0;
+		std::int32_t deltaY = 0;
+	};
+
+	/**
+	 * Asks a synthetic screen to show the given number, for measuring the latency from input to the screen changing
+	 */
+	struct LatencyProbeClientAction {
+		std::uint16_t sequence = 0;
+	};
+
 	struct ClientAction {
 		ClientActionType type = ClientActionType::NoAction;
 		union {
 			KeyPressedClientAction keyPressed;
 			MouseButtonPressedClientAction mouseButtonPressed;
+			MouseMovedClientAction mouseMoved;
+			KeyClientAction key;
+			MouseScrolledClientAction mouseScrolled;
+			LatencyProbeClientAction latencyProbe;
 		} data = {};
 
 		void clear();
@@ -34,13 +75,20 @@ namespace screenshare::client {
 
 		static ClientAction keyPressed(const std::string& key);
 		static ClientAction mouseButtonPressed(std::uint32_t mouseButton, double x, double y);
+		static ClientAction mouseMoved(double x, double y);
+		static ClientAction keyDown(std::uint32_t keySym);
+		static ClientAction keyUp(std::uint32_t keySym);
+		static ClientAction mouseScrolled(double x, double y, std::int32_t deltaX, std::int32_t deltaY);
+		static ClientAction latencyProbe(std::uint16_t sequence);
 
-		boost::system::error_code send(boost::asio::ip::tcp::socket& socket);
+		void write(video::protocol::MessageWriter& writer) const;
+		static bool read(video::protocol::MessageReader& reader, ClientAction& clientAction);
 
-		static void receiveAsync(
-			std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-			std::shared_ptr<ClientAction> clientAction,
-			std::function<void (boost::system::error_code, std::shared_ptr<ClientAction>)> callback
-		);
+		boost::system::error_code send(boost::asio::ip::tcp::socket& socket) const;
 	};
+
+	/**
+	 * Keeps only the last of each run of consecutive mouse moves, as only where the pointer ends up matters
+	 */
+	void coalesceMouseMoves(std::vector<ClientAction>& clientActions);
 }
\ No newline at end of file
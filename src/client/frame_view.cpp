@@ -0,0 +1,56 @@
+#include "frame_view.h"
+
+namespace screenshare::client {
+	FrameView::FrameView(const std::string& placeholderPath)
+		: mPlaceholder(Gdk::Pixbuf::create_from_file(placeholderPath)) {
+		mFrameReady.connect(sigc::mem_fun(*this, &FrameView::frameReady));
+	}
+
+	void FrameView::setFrameShownHandler(FrameShownHandler frameShownHandler) {
+		mFrameShownHandler = std::move(frameShownHandler);
+	}
+
+	DecodedFramePtr FrameView::present(DecodedFramePtr frame) {
+		// The back slot holds either a frame the main loop has moved past or one it never took
+		auto replaced = std::move(mFrames.back());
+		mFrames.back() = std::move(frame);
+		mFrames.publish();
+		mFrameReady.emit();
+		return replaced;
+	}
+
+	void FrameView::frameReady() {
+		// Several frames can be handed over before the main loop gets to run, of which only the latest is drawn
+		if (!mFrames.update()) {
+			return;
+		}
+
+		auto& frame = mFrames.front();
+		mSurface = Cairo::ImageSurface::create(
+			frame->pixels.data(),
+			Cairo::FORMAT_RGB24,
+			frame->width,
+			frame->height,
+			frame->lineSize
+		);
+
+		if (mFrameShownHandler) {
+			mFrameShownHandler(*frame);
+		}
+
+		queue_draw();
+	}
+
+	bool FrameView::on_draw(const Cairo::RefPtr<Cairo::Context>& context) {
+		if (mSurface) {
+			context->set_source(mSurface, 0, 0);
+		} else if (mPlaceholder) {
+			Gdk::Cairo::set_source_pixbuf(context, mPlaceholder, 0, 0);
+		} else {
+			return false;
+		}
+
+		context->paint();
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+#include <functional>
+#include <string>
+
+#include <cairomm/context.h>
+#include <cairomm/surface.h>
+#include <gdkmm/general.h>
+#include <gdkmm/pixbuf.h>
+#include <glibmm/dispatcher.h>
+#include <gtkmm/drawingarea.h>
+
+#include "playout_buffer.h"
+#include "../misc/concurrency.hpp"
+
+namespace screenshare::client {
+	/**
+	 * Draws the latest presented frame. Frames are handed over from the playout thread through a triple buffer, and the
+	 * main loop is only woken when there is a new one, which is then drawn from its own memory by a Cairo surface.
+	 */
+	class FrameView : public Gtk::DrawingArea {
+	public:
+		/**
+		 * Called on the main loop when a frame is about to be drawn for the first time
+		 */
+		using FrameShownHandler = std::function<void (const DecodedFrame& frame)>;
+	private:
+		Glib::RefPtr<Gdk::Pixbuf> mPlaceholder;
+
+		misc::TripleBuffer<DecodedFramePtr> mFrames;
+		Glib::Dispatcher mFrameReady;
+		Cairo::RefPtr<Cairo::ImageSurface> mSurface;
+
+		FrameShownHandler mFrameShownHandler;
+
+		void frameReady();
+	protected:
+		bool on_draw(const Cairo::RefPtr<Cairo::Context>& context) override;
+	public:
+		/**
+		 * Shows the image at the given path until the first frame
+		 */
+		explicit FrameView(const std::string& placeholderPath);
+
+		void setFrameShownHandler(FrameShownHandler frameShownHandler);
+
+		/**
+		 * Hands the given frame over to be drawn, and returns the one it replaces, which is no longer used.
+		 * Must only be called from one thread at a time.
+		 */
+		DecodedFramePtr present(DecodedFramePtr frame);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "headless_client.h"
+#include "input_channel.h"
+#include "receiver_reporter.h"
+#include "recovery_tracker.h"
+#include "stage_latencies.h"
+#include "../misc/bit_rate_measurement.h"
+#include "../video/clock_sync.h"
+#include "../video/network.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace screenshare::client {
+	namespace {
+		constexpr const char* STATS_HEADER =
+			"client,frame,pts,size,keyframe,latency_ms,capture_ms,convert_ms,encode_ms,network_ms,decode_ms,bit_rate_mbps,gaps,skipped,decode_failures";
+	}
+
+	HeadlessClient::HeadlessClient(boost::asio::ip::tcp::endpoint endpoint, HeadlessClientConfig config)
+		: mEndpoint(std::move(endpoint)),
+		  mConfig(std::move(config)) {
+
+	}
+
+	std::size_t HeadlessClient::run() {
+		std::ofstream statsFile;
+		if (!mConfig.statsPath.empty()) {
+			statsFile.open(mConfig.statsPath);
+			if (!statsFile) {
+				throw std::runtime_error("Failed to open stats output: " + mConfig.statsPath);
+			}
+
+			mStats = &statsFile;
+		} else {
+			mStats = &std::cout;
+		}
+
+		*mStats << STATS_HEADER << std::endl;
+
+		std::mutex doneMutex;
+		std::condition_variable clientDone;
+		std::size_t runningClients = mConfig.clients;
+		std::size_t failedClients = 0;
+
+		std::stop_source stopSource;
+		{
+			std::vector<std::jthread> clients;
+			for (std::size_t clientIndex = 0; clientIndex < mConfig.clients; clientIndex++) {
+				clients.emplace_back([&, clientIndex]() {
+					auto failed = false;
+					try {
+						runClient(stopSource.get_token(), clientIndex);
+					} catch (const std::exception& e) {
+						std::cerr << "Client #" << clientIndex << " failed due to: " << e.what() << std::endl;
+						failed = true;
+					}
+
+					{
+						std::lock_guard lock(doneMutex);
+						runningClients--;
+						failedClients += failed ? 1 : 0;
+					}
+
+					clientDone.notify_one();
+				});
+			}
+
+			std::unique_lock lock(doneMutex);
+			auto allDone = [&]() { return runningClients == 0; };
+			if (mConfig.duration) {
+				clientDone.wait_for(lock, *mConfig.duration, allDone);
+			} else {
+				clientDone.wait(lock, allDone);
+			}
+
+			lock.unlock();
+			stopSource.request_stop();
+		}
+
+		mStats->flush();
+		mStats = nullptr;
+		return failedClients;
+	}
+
+	void HeadlessClient::runClient(std::stop_token stopToken, std::size_t clientIndex) {
+		boost::asio::io_context ioContext;
+		boost::asio::ip::tcp::socket socket(ioContext);
+		socket.connect(mEndpoint);
+		socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+		// Unblocks the receive when stopped
+		std::stop_callback stopReceiving(stopToken, [&]() {
+			boost::system::error_code error;
+			socket.shutdown(boost::asio::socket_base::shutdown_both, error);
+		});
+
+		video::network::AVCodecParametersReceiver codecParameterReceiver(socket, video::protocol::ClientHello {
+			.capabilities = video::protocol::capabilityBit(video::protocol::Capability::Recovery)
+				| video::protocol::capabilityBit(video::protocol::Capability::ClockSync)
+				| video::protocol::capabilityBit(video::protocol::Capability::ReceiverReports)
+		});
+
+		InputChannel inputChannel;
+		inputChannel.open(socket, [clientIndex](boost::system::error_code error) {
+			std::cerr << "Client #" << clientIndex << " failed to send: " << error.message() << std::endl;
+		});
+
+		auto& serverHello = codecParameterReceiver.serverHello();
+		auto canRecover = video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::Recovery);
+		auto syncClock = video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::ClockSync);
+		auto sendReports = video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::ReceiverReports);
+
+		video::network::PacketReceiver packetReceiver(codecParameterReceiver.codecParameters(), mConfig.decoder);
+		packetReceiver.setProtocolVersion(serverHello.version);
+
+		video::clocksync::ClockSynchronizer clockSynchronizer;
+		packetReceiver.setMessageHandler([&](const video::protocol::FrameHeader& header, video::protocol::MessageReader& payload) {
+			video::protocol::ClockSync clockSync;
+			if (header.type == video::protocol::MessageType::ClockSyncResponse && video::protocol::readClockSync(payload, clockSync)) {
+				clockSynchronizer.handleResponse(clockSync, video::clocksync::currentTime());
+			}
+		});
+
+		std::unique_ptr<AVFrame, video::AVFrameDeleter> frame(av_frame_alloc());
+		std::unique_ptr<AVPacket, video::AVPacketDeleter> packet(av_packet_alloc());
+		if (!frame || !packet) {
+			throw std::runtime_error("Failed to allocate memory for AVFrame and AVPacket");
+		}
+
+		RecoveryTracker recoveryTracker;
+		ReceiverReporter receiverReporter;
+		misc::BitRateMeasurement bitRateMeasurement;
+		StageLatencies stageLatencies;
+		video::PacketDecoder packetDecoder;
+		std::vector<std::uint8_t> pixels;
+
+		std::size_t decodedFrames = 0;
+		std::size_t gaps = 0;
+		std::size_t skippedPackets = 0;
+		std::size_t decodeFailures = 0;
+		while (!stopToken.stop_requested() && (!mConfig.frames || decodedFrames < *mConfig.frames)) {
+			if (syncClock && clockSynchronizer.shouldRequest()) {
+				inputChannel.send(clockSynchronizer.createRequest());
+			}
+
+			if (sendReports && receiverReporter.shouldReport()) {
+				inputChannel.send(receiverReporter.createReport(packetReceiver.bufferedBytes()));
+			}
+
+			video::network::PacketHeader packetHeader;
+			if (auto error = packetReceiver.receive(socket, packet.get(), packetHeader)) {
+				if (error == boost::asio::error::eof || stopToken.stop_requested()) {
+					break;
+				}
+
+				throw boost::system::system_error(error);
+			}
+
+			auto receiveTime = video::clocksync::currentTime();
+			auto sendTime = clockSynchronizer.toLocalTime(video::clocksync::toNanoseconds(packetHeader.sendTime));
+			receiverReporter.frameReceived();
+
+			auto isKeyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+			auto wasRecovering = recoveryTracker.recovering();
+			if (!recoveryTracker.accept(packetHeader.encoderPts, packetHeader.referencePts, isKeyframe)) {
+				skippedPackets++;
+				if (!wasRecovering && recoveryTracker.recovering() && recoveryTracker.lastDecodedPts() >= 0) {
+					gaps++;
+					receiverReporter.gapDetected();
+				}
+
+				if (canRecover && recoveryTracker.shouldRequestRecovery()) {
+					video::protocol::MessageWriter writer(video::protocol::MessageType::RecoveryRequest);
+					video::protocol::writeRecoveryRequest(writer, { recoveryTracker.lastDecodedPts() });
+					writer.finish();
+					inputChannel.send(std::move(writer));
+				}
+
+				continue;
+			}
+
+			bitRateMeasurement.add(packet->size * 8);
+
+			auto decodeStartTime = video::clocksync::currentTime();
+			auto response = packetDecoder.decode(
+				packet.get(),
+				packetReceiver.codecContext(),
+				frame.get(),
+				[&](AVFrame* frame) -> std::uint8_t* {
+					if (!mConfig.convert) {
+						return nullptr;
+					}
+
+					pixels.resize((std::size_t)frame->width * (std::size_t)frame->height * video::CONVERT_BYTES_PER_PIXEL);
+					return pixels.data();
+				},
+				[&](AVCodecContext* codecContext) {
+					auto decodedTime = video::clocksync::currentTime();
+					auto stageTimes = packetHeader.stageTimes.value_or(video::network::ServerStageTimes {});
+					auto captureTime = sendTime - (std::int64_t)(stageTimes.capture + stageTimes.convert + stageTimes.encode) * 1000;
+
+					if (packetHeader.stageTimes) {
+						stageLatencies.addServerStages(stageTimes);
+					}
+
+					stageLatencies.add(LatencyStage::Network, (double)(receiveTime - sendTime) / 1.0E6);
+					stageLatencies.add(LatencyStage::Decode, (double)(decodedTime - decodeStartTime) / 1.0E6);
+					stageLatencies.add(LatencyStage::Total, (double)(decodedTime - captureTime) / 1.0E6);
+
+					auto line = fmt::format(
+						"{},{},{},{},{},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{},{},{}\n",
+						clientIndex,
+						decodedFrames,
+						frame->pts,
+						packet->size,
+						isKeyframe ? 1 : 0,
+						(double)(decodedTime - sendTime) / 1.0E6,
+						(double)stageTimes.capture / 1.0E3,
+						(double)stageTimes.convert / 1.0E3,
+						(double)stageTimes.encode / 1.0E3,
+						(double)(receiveTime - sendTime) / 1.0E6,
+						(double)(decodedTime - decodeStartTime) / 1.0E6,
+						bitRateMeasurement.averageBitRate() / 1.0E6,
+						gaps,
+						skippedPackets,
+						decodeFailures
+					);
+
+					std::lock_guard lock(mStatsMutex);
+					*mStats << line;
+				}
+			);
+
+			if (response < 0) {
+				decodeFailures++;
+				receiverReporter.decodeFailed();
+				recoveryTracker.decodeFailed();
+				if (canRecover && recoveryTracker.shouldRequestRecovery()) {
+					video::protocol::MessageWriter writer(video::protocol::MessageType::RecoveryRequest);
+					video::protocol::writeRecoveryRequest(writer, { recoveryTracker.lastDecodedPts() });
+					writer.finish();
+					inputChannel.send(std::move(writer));
+				}
+			} else {
+				decodedFrames++;
+				recoveryTracker.decoded(packetHeader.encoderPts);
+				receiverReporter.frameDecoded((double)(video::clocksync::currentTime() - decodeStartTime) / 1.0E6);
+				receiverReporter.framePresented((double)(video::clocksync::currentTime() - receiveTime) / 1.0E6);
+			}
+		}
+
+		std::cerr
+			<< "Client #" << clientIndex << ": " << decodedFrames << " frames, " << gaps << " gaps, "
+			<< skippedPackets << " skipped, " << decodeFailures << " decode failures"
+			<< std::endl;
+
+		// Written as one block, so that the reports of clients finishing together do not interleave
+		std::string stageReport;
+		for (auto& line : stageLatencies.report()) {
+			stageReport += fmt::format("Client #{} {}\n", clientIndex, line);
+		}
+
+		std::cerr << stageReport;
+	}
+}
\ No newline at end of file
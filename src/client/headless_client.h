@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stop_token>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "../video/decoder.h"
+
+namespace screenshare::client {
+	struct HeadlessClientConfig {
+		std::size_t clients = 1;
+		std::optional<std::chrono::milliseconds> duration; // Stops after this long
+		std::optional<std::size_t> frames; // Each client stops after decoding this many frames
+		bool convert = true; // Converts decoded frames as the player does, which costs about as much as decoding them
+		std::string statsPath; // Where the per-frame stats are written, or standard output when empty, which nothing else writes to
+		video::DecoderConfig decoder;
+	};
+
+	/**
+	 * Receives and decodes the stream without a display, as any number of simulated clients in one process, each on its own
+	 * thread and connection. Writes per-frame stats as CSV, for benchmarking the server and automated measurements.
+	 */
+	class HeadlessClient {
+	private:
+		boost::asio::ip::tcp::endpoint mEndpoint;
+		HeadlessClientConfig mConfig;
+
+		std::mutex mStatsMutex;
+		std::ostream* mStats = nullptr;
+
+		void runClient(std::stop_token stopToken, std::size_t clientIndex);
+	public:
+		HeadlessClient(boost::asio::ip::tcp::endpoint endpoint, HeadlessClientConfig config);
+
+		/**
+		 * Runs until every client is done. Returns the number of clients that failed.
+		 */
+		std::size_t run();
+	};
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "input_channel.h"
+
+namespace screenshare::client {
+	namespace {
+		constexpr std::size_t QUEUE_SIZE = 1024;
+	}
+
+	InputChannel::InputChannel()
+		: mQueue(QUEUE_SIZE) {
+
+	}
+
+	InputChannel::~InputChannel() {
+		close();
+	}
+
+	void InputChannel::open(boost::asio::ip::tcp::socket& socket, ErrorHandler errorHandler) {
+		close();
+
+		// Without the channel thread running, this is the only consumer
+		Message discarded;
+		while (mQueue.tryPop(discarded)) {}
+		mOpen.store(true);
+
+		mThread = std::jthread([this, &socket, errorHandler = std::move(errorHandler)](std::stop_token stopToken) {
+			run(stopToken, socket, errorHandler);
+		});
+	}
+
+	void InputChannel::close() {
+		mOpen.store(false);
+		mThread = {};
+	}
+
+	bool InputChannel::isOpen() const {
+		return mOpen.load();
+	}
+
+	void InputChannel::send(video::protocol::MessageWriter message) {
+		if (!mOpen.load()) {
+			return;
+		}
+
+		Message queued { std::move(message) };
+		mQueue.tryPush(queued);
+	}
+
+	void InputChannel::send(const ClientAction& clientAction) {
+		if (!mOpen.load()) {
+			return;
+		}
+
+		Message queued { clientAction };
+		mQueue.tryPush(queued);
+	}
+
+	void InputChannel::run(std::stop_token stopToken, boost::asio::ip::tcp::socket& socket, ErrorHandler errorHandler) {
+		// Reused for every client action, so that serializing them does not allocate
+		video::protocol::MessageWriter clientActionWriter(video::protocol::MessageType::ClientAction);
+
+		Message message;
+		while (mQueue.wait(stopToken)) {
+			while (mQueue.tryPop(message)) {
+				auto writer = std::get_if<video::protocol::MessageWriter>(&message);
+				if (auto clientAction = std::get_if<ClientAction>(&message)) {
+					clientActionWriter.reset(video::protocol::MessageType::ClientAction);
+					clientAction->write(clientActionWriter);
+					clientActionWriter.finish();
+					writer = &clientActionWriter;
+				}
+
+				boost::system::error_code error;
+				boost::asio::write(socket, writer->buffer(), error);
+				if (error) {
+					mOpen.store(false);
+					errorHandler(error);
+					return;
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <variant>
+
+#include <boost/asio.hpp>
+
+#include "actions.h"
+#include "../misc/concurrency.hpp"
+#include "../video/protocol.h"
+
+namespace screenshare::client {
+	/**
+	 * Writes messages to the server from its own thread as soon as they are queued, so client actions do not wait for video to
+	 * be received and decoded. Every message the client sends goes through the channel, which keeps them from interleaving.
+	 * Client actions are queued as they are and only serialized by the channel, so sending them neither locks nor allocates.
+	 */
+	class InputChannel {
+	public:
+		using ErrorHandler = std::function<void (boost::system::error_code error)>;
+	private:
+		using Message = std::variant<ClientAction, video::protocol::MessageWriter>;
+
+		misc::MpscQueue<Message> mQueue;
+		std::atomic<bool> mOpen = false;
+
+		std::jthread mThread;
+
+		void run(std::stop_token stopToken, boost::asio::ip::tcp::socket& socket, ErrorHandler errorHandler);
+	public:
+		InputChannel();
+		~InputChannel();
+
+		InputChannel(const InputChannel&) = delete;
+		InputChannel& operator=(const InputChannel&) = delete;
+
+		/**
+		 * Starts writing to the given socket, which must stay open until the channel is closed. Only opened once the
+		 * handshake is done, as nothing may be sent before the client hello.
+		 * The socket is only read from elsewhere, as blocking reads and writes can run on different threads.
+		 */
+		void open(boost::asio::ip::tcp::socket& socket, ErrorHandler errorHandler);
+
+		/**
+		 * Stops writing, discarding the messages not yet sent
+		 */
+		void close();
+
+		/**
+		 * Indicates if the channel is open, and so if the handshake with the server is done
+		 */
+		bool isOpen() const;
+
+		/**
+		 * Queues the given message. Ignored when the channel is not open, or when so much is queued that the server has stopped
+		 * reading. Can be called from any thread.
+		 */
+		void send(video::protocol::MessageWriter message);
+		void send(const ClientAction& clientAction);
+	};
+}
\ No newline at end of file
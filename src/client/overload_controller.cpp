@@ -0,0 +1,81 @@
+#include "overload_controller.h"
+
+namespace screenshare::client {
+	namespace {
+		constexpr double LOAD_GAIN = 1.0 / 16.0;
+	}
+
+	std::string overloadModeToString(OverloadMode mode) {
+		switch (mode) {
+			case OverloadMode::Normal:
+				return "normal";
+			case OverloadMode::SkipLoopFilter:
+				return "skip loop filter";
+			case OverloadMode::SkipNonReference:
+				return "skip non-reference frames";
+		}
+
+		return "unknown";
+	}
+
+	OverloadController::OverloadController(OverloadConfig config, AVRational timeBase)
+		: mConfig(config),
+		  mFrameInterval(1000.0 * (double)timeBase.num / (double)timeBase.den) {
+
+	}
+
+	OverloadMode OverloadController::mode() const {
+		return mMode;
+	}
+
+	double OverloadController::load() const {
+		return mLoad;
+	}
+
+	bool OverloadController::frameDecoded(double decodeTime, double queuedTime) {
+		mLoad += (decodeTime / mFrameInterval - mLoad) * LOAD_GAIN;
+		if (!mConfig.enabled) {
+			return false;
+		}
+
+		// Packets piling up also means the decoder cannot keep up, even when the decode time alone looks fine
+		auto timeNow = Clock::now();
+		auto overloaded = mLoad > mConfig.overloadedLoad || queuedTime > 2.0 * mFrameInterval;
+		auto relieved = mLoad < mConfig.relievedLoad && queuedTime < mFrameInterval;
+
+		if (!overloaded) {
+			mOverloadedSince.reset();
+		} else if (!mOverloadedSince) {
+			mOverloadedSince = timeNow;
+		}
+
+		if (!relieved) {
+			mRelievedSince.reset();
+		} else if (!mRelievedSince) {
+			mRelievedSince = timeNow;
+		}
+
+		if (mOverloadedSince && timeNow - *mOverloadedSince >= mConfig.holdTime && mMode != OverloadMode::SkipNonReference) {
+			mMode = (OverloadMode)((int)mMode + 1);
+			mOverloadedSince = timeNow;
+			return true;
+		}
+
+		if (mRelievedSince && timeNow - *mRelievedSince >= mConfig.holdTime && mMode != OverloadMode::Normal) {
+			mMode = (OverloadMode)((int)mMode - 1);
+			mRelievedSince = timeNow;
+			return true;
+		}
+
+		return false;
+	}
+
+	bool OverloadController::shouldSkipToKeyframe(double queuedTime) const {
+		return mConfig.enabled && queuedTime > (double)mConfig.maxBehind.count();
+	}
+
+	void OverloadController::apply(AVCodecContext* codecContext) const {
+		codecContext->skip_loop_filter = mMode >= OverloadMode::SkipLoopFilter ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+		codecContext->skip_frame = mMode >= OverloadMode::SkipNonReference ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "../video/common.h"
+
+namespace screenshare::client {
+	/**
+	 * How much decoding work is shed, from none to the most
+	 */
+	enum class OverloadMode {
+		Normal,
+		SkipLoopFilter, // Leaves out the deblocking filter, which costs quality but no frames
+		SkipNonReference // Also leaves out the frames no other frame refers to, which only exist for some encoders
+	};
+
+	std::string overloadModeToString(OverloadMode mode);
+
+	struct OverloadConfig {
+		bool enabled = true;
+		double overloadedLoad = 0.9; // Decode time relative to the frame interval above which the decoder is overloaded
+		double relievedLoad = 0.5; // Load below which work is no longer shed
+		std::chrono::milliseconds holdTime { 1000 }; // How long the load has to stay beyond a limit before changing mode
+		std::chrono::milliseconds maxBehind { 500 }; // How long packets can wait to be decoded before skipping to the next keyframe
+	};
+
+	/**
+	 * Decides how much decoding work to shed from how long decoding takes relative to the frame interval, and how long
+	 * packets wait to be decoded. Steps up or down one mode at a time, with a hold time in between so it does not flap.
+	 */
+	class OverloadController {
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		OverloadConfig mConfig;
+		double mFrameInterval; // In milliseconds
+
+		OverloadMode mMode = OverloadMode::Normal;
+		double mLoad = 0.0;
+		std::optional<Clock::time_point> mOverloadedSince;
+		std::optional<Clock::time_point> mRelievedSince;
+	public:
+		OverloadController(OverloadConfig config, AVRational timeBase);
+
+		OverloadMode mode() const;
+
+		/**
+		 * Decode time relative to the frame interval, averaged over recent frames
+		 */
+		double load() const;
+
+		/**
+		 * Updates the load with a frame decoded in the given number of milliseconds, after its packet waited the given number of
+		 * milliseconds to be decoded. Returns true if the mode changed.
+		 */
+		bool frameDecoded(double decodeTime, double queuedTime);
+
+		/**
+		 * Indicates if a packet that waited the given number of milliseconds is too far behind to be worth decoding
+		 */
+		bool shouldSkipToKeyframe(double queuedTime) const;
+
+		/**
+		 * Applies the current mode to the given decoder
+		 */
+		void apply(AVCodecContext* codecContext) const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include "playout_buffer.h"
+#include "../video/decoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace screenshare::client {
+	namespace {
+		struct ModeParameters {
+			double jitterFactor; // Multiple of the jitter waited for
+			std::chrono::milliseconds minLatency;
+			std::chrono::milliseconds maxLatency;
+		};
+
+		ModeParameters modeParameters(PlayoutMode mode) {
+			switch (mode) {
+				case PlayoutMode::LowLatency:
+					return { 1.0, std::chrono::milliseconds(0), std::chrono::milliseconds(50) };
+				case PlayoutMode::Balanced:
+					return { 2.5, std::chrono::milliseconds(5), std::chrono::milliseconds(150) };
+				case PlayoutMode::Smooth:
+					return { 4.0, std::chrono::milliseconds(30), std::chrono::milliseconds(500) };
+			}
+
+			return { 2.5, std::chrono::milliseconds(5), std::chrono::milliseconds(150) };
+		}
+
+		// The gain of the jitter estimate of RFC 3550
+		constexpr double JITTER_GAIN = 1.0 / 16.0;
+
+		std::int64_t toNanoseconds(PlayoutBuffer::Clock::time_point time) {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		}
+	}
+
+	PlayoutMode playoutModeFromString(const std::string& name) {
+		if (name == "low-latency") {
+			return PlayoutMode::LowLatency;
+		} else if (name == "balanced") {
+			return PlayoutMode::Balanced;
+		} else if (name == "smooth") {
+			return PlayoutMode::Smooth;
+		}
+
+		throw std::runtime_error("Unknown playout mode: " + name);
+	}
+
+	PlayoutBuffer::PlayoutBuffer(PlayoutConfig config)
+		: mConfig(config) {
+
+	}
+
+	void PlayoutBuffer::reset(AVRational timeBase) {
+		std::lock_guard lock(mMutex);
+		mTimeBase = timeBase;
+		while (!mFrames.empty()) {
+			recycle(std::move(mFrames.front()));
+			mFrames.pop_front();
+		}
+
+		mLastPresentedPts = -1;
+		mTransits.clear();
+		mHasPrevious = false;
+		mJitter = 0.0;
+		mPresentedFrames = 0;
+		mDroppedFrames = 0;
+		mGeneration++;
+	}
+
+	DecodedFramePtr PlayoutBuffer::acquire(int width, int height) {
+		DecodedFramePtr frame;
+		{
+			std::lock_guard lock(mMutex);
+			if (!mFreeFrames.empty()) {
+				frame = std::move(mFreeFrames.back());
+				mFreeFrames.pop_back();
+			}
+		}
+
+		if (!frame) {
+			frame = std::make_unique<DecodedFrame>();
+		}
+
+		frame->width = width;
+		frame->height = height;
+		frame->lineSize = width * video::CONVERT_BYTES_PER_PIXEL;
+		frame->pixels.resize((std::size_t)frame->lineSize * (std::size_t)height);
+		return frame;
+	}
+
+	void PlayoutBuffer::add(DecodedFramePtr frame, Clock::time_point receiveTime) {
+		{
+			std::lock_guard lock(mMutex);
+			frame->mediaTime = av_rescale_q(frame->pts, mTimeBase, AVRational { 1, 1000000000 });
+
+			auto transit = toNanoseconds(receiveTime) - frame->mediaTime;
+			if (mHasPrevious) {
+				mJitter += (std::abs((double)(transit - mPreviousTransit)) - mJitter) * JITTER_GAIN;
+			}
+
+			mHasPrevious = true;
+			mPreviousTransit = transit;
+
+			mTransits.push_back(transit);
+			while (mTransits.size() > mConfig.transitWindow) {
+				mTransits.pop_front();
+			}
+
+			// Too late to be shown once a later frame has been
+			if (frame->pts <= mLastPresentedPts) {
+				mDroppedFrames++;
+				recycle(std::move(frame));
+				return;
+			}
+
+			auto position = std::upper_bound(mFrames.begin(), mFrames.end(), frame->pts, [](std::int64_t pts, const DecodedFramePtr& other) {
+				return pts < other->pts;
+			});
+			mFrames.insert(position, std::move(frame));
+
+			while (mFrames.size() > mConfig.maxFrames) {
+				mDroppedFrames++;
+				recycle(std::move(mFrames.front()));
+				mFrames.pop_front();
+			}
+
+			mGeneration++;
+		}
+
+		mFrameAdded.notify_one();
+	}
+
+	DecodedFramePtr PlayoutBuffer::next(const std::stop_token& stopToken) {
+		std::unique_lock lock(mMutex);
+		while (true) {
+			if (!mFrameAdded.wait(lock, stopToken, [this]() { return !mFrames.empty(); })) {
+				return {};
+			}
+
+			// Of the frames that are due, only the latest is shown
+			auto timeNow = toNanoseconds(Clock::now());
+			while (mFrames.size() > 1 && dueTime(*mFrames[1]) <= timeNow) {
+				mDroppedFrames++;
+				recycle(std::move(mFrames.front()));
+				mFrames.pop_front();
+			}
+
+			auto due = dueTime(*mFrames.front());
+			if (due <= timeNow) {
+				auto frame = std::move(mFrames.front());
+				mFrames.pop_front();
+				mLastPresentedPts = frame->pts;
+				mPresentedFrames++;
+				return frame;
+			}
+
+			// Woken early by added frames, which can be due before the one waited for
+			auto generation = mGeneration;
+			mFrameAdded.wait_for(lock, stopToken, std::chrono::nanoseconds(due - timeNow), [&]() {
+				return mGeneration != generation;
+			});
+
+			if (stopToken.stop_requested()) {
+				return {};
+			}
+		}
+	}
+
+	void PlayoutBuffer::release(DecodedFramePtr frame) {
+		std::lock_guard lock(mMutex);
+		recycle(std::move(frame));
+	}
+
+	PlayoutStatistics PlayoutBuffer::statistics() {
+		std::lock_guard lock(mMutex);
+		return {
+			targetLatency() / 1.0E6,
+			mJitter / 1.0E6,
+			mFrames.size(),
+			mPresentedFrames,
+			mDroppedFrames
+		};
+	}
+
+	double PlayoutBuffer::targetLatency() const {
+		auto parameters = modeParameters(mConfig.mode);
+		return std::clamp(
+			parameters.jitterFactor * mJitter,
+			(double)std::chrono::duration_cast<std::chrono::nanoseconds>(parameters.minLatency).count(),
+			(double)std::chrono::duration_cast<std::chrono::nanoseconds>(parameters.maxLatency).count()
+		);
+	}
+
+	std::int64_t PlayoutBuffer::dueTime(const DecodedFrame& frame) const {
+		// The base is recomputed as the window moves, which lets the schedule follow a sender that runs slower than its pts
+		auto baseTransit = mTransits.empty() ? 0 : *std::min_element(mTransits.begin(), mTransits.end());
+		return frame.mediaTime + baseTransit + (std::int64_t)targetLatency();
+	}
+
+	void PlayoutBuffer::recycle(DecodedFramePtr frame) {
+		if (frame && mFreeFrames.size() < mConfig.maxFrames + 2) {
+			mFreeFrames.push_back(std::move(frame));
+		}
+	}
+}
\ No newline at end of file
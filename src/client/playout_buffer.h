@@ -0,0 +1,119 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+#include "../video/common.h"
+
+namespace screenshare::client {
+	enum class PlayoutMode {
+		LowLatency,
+		Balanced,
+		Smooth
+	};
+
+	PlayoutMode playoutModeFromString(const std::string& name);
+
+	struct PlayoutConfig {
+		PlayoutMode mode = PlayoutMode::Balanced;
+		std::size_t maxFrames = 16; // Frames buffered at most, beyond which the oldest is dropped
+		std::size_t transitWindow = 120; // Frames over which the lowest transit time is taken as the base of the schedule
+	};
+
+	/**
+	 * A decoded frame converted for presentation
+	 */
+	struct DecodedFrame {
+		std::vector<std::uint8_t> pixels;
+		int width = 0;
+		int height = 0;
+		int lineSize = 0;
+
+		std::int64_t pts = 0;
+		std::int64_t mediaTime = 0; // The pts in nanoseconds
+		std::int64_t receiveTime = 0; // When its packet was received
+		std::int64_t captureTime = 0; // When the server started grabbing it, converted to the local clock
+		std::int64_t decodedTime = 0;
+	};
+
+	using DecodedFramePtr = std::unique_ptr<DecodedFrame>;
+
+	struct PlayoutStatistics {
+		double targetLatency = 0.0; // In milliseconds
+		double jitter = 0.0; // In milliseconds
+		std::size_t bufferedFrames = 0;
+		std::size_t presentedFrames = 0;
+		std::size_t droppedFrames = 0; // Missed their slot or did not fit in the buffer
+	};
+
+	/**
+	 * Schedules decoded frames for presentation by their pts rather than by when they happen to be decoded.
+	 * The schedule follows the frames with the lowest transit time, from the pts to arrival, plus a target latency that
+	 * adapts to the measured interarrival jitter (as in RFC 3550). How much latency is traded for smoothness depends on
+	 * the mode. Frames are decoded on one thread and presented from another. Scheduled on the monotonic clock, so that
+	 * steps of the realtime clock neither drop nor hold back the buffered frames.
+	 */
+	class PlayoutBuffer {
+	public:
+		using Clock = std::chrono::steady_clock;
+	private:
+		PlayoutConfig mConfig;
+
+		std::mutex mMutex;
+		std::condition_variable_any mFrameAdded;
+		std::uint64_t mGeneration = 0;
+
+		AVRational mTimeBase { 1, 1 };
+		std::deque<DecodedFramePtr> mFrames;
+		std::vector<DecodedFramePtr> mFreeFrames;
+		std::int64_t mLastPresentedPts = -1;
+
+		std::deque<std::int64_t> mTransits;
+		bool mHasPrevious = false;
+		std::int64_t mPreviousTransit = 0;
+		double mJitter = 0.0; // In nanoseconds
+
+		std::size_t mPresentedFrames = 0;
+		std::size_t mDroppedFrames = 0;
+
+		double targetLatency() const;
+		std::int64_t dueTime(const DecodedFrame& frame) const;
+		void recycle(DecodedFramePtr frame);
+	public:
+		explicit PlayoutBuffer(PlayoutConfig config = {});
+
+		/**
+		 * Starts over for a new stream with the given time base
+		 */
+		void reset(AVRational timeBase);
+
+		/**
+		 * Returns a frame to decode into, reusing the memory of presented frames
+		 */
+		DecodedFramePtr acquire(int width, int height);
+
+		/**
+		 * Schedules the given frame, decoded from a packet received at the given time
+		 */
+		void add(DecodedFramePtr frame, Clock::time_point receiveTime);
+
+		/**
+		 * Waits until the next frame is due and returns it, dropping the frames that missed their slot.
+		 * Returns nothing if stopped first.
+		 */
+		DecodedFramePtr next(const std::stop_token& stopToken);
+
+		/**
+		 * Gives back a frame returned by next once presented
+		 */
+		void release(DecodedFramePtr frame);
+
+		PlayoutStatistics statistics();
+	};
+}
\ No newline at end of file
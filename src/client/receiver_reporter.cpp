@@ -0,0 +1,76 @@
+#include "receiver_reporter.h"
+
+#include <algorithm>
+
+namespace screenshare::client {
+	ReceiverReporter::ReceiverReporter(std::chrono::milliseconds interval)
+		: mInterval(interval) {
+
+	}
+
+	void ReceiverReporter::reset() {
+		std::lock_guard lock(mMutex);
+		mLastReport = Clock::now();
+		mTotals = {};
+		mDecodeTimeSum = 0.0;
+		mDecodeTimeCount = 0;
+		mLatencySum = 0.0;
+		mLatencyCount = 0;
+		mMaxLatency = 0.0;
+	}
+
+	void ReceiverReporter::frameReceived() {
+		std::lock_guard lock(mMutex);
+		mTotals.framesReceived++;
+	}
+
+	void ReceiverReporter::gapDetected() {
+		std::lock_guard lock(mMutex);
+		mTotals.gaps++;
+	}
+
+	void ReceiverReporter::frameDecoded(double decodeTime) {
+		std::lock_guard lock(mMutex);
+		mTotals.framesDecoded++;
+		mDecodeTimeSum += decodeTime;
+		mDecodeTimeCount++;
+	}
+
+	void ReceiverReporter::decodeFailed() {
+		std::lock_guard lock(mMutex);
+		mTotals.decodeErrors++;
+	}
+
+	void ReceiverReporter::framePresented(double latency) {
+		std::lock_guard lock(mMutex);
+		mLatencySum += latency;
+		mLatencyCount++;
+		mMaxLatency = std::max(mMaxLatency, latency);
+	}
+
+	bool ReceiverReporter::shouldReport() {
+		std::lock_guard lock(mMutex);
+		return Clock::now() - mLastReport >= mInterval;
+	}
+
+	video::protocol::MessageWriter ReceiverReporter::createReport(std::size_t bufferedBytes) {
+		std::lock_guard lock(mMutex);
+		auto report = mTotals;
+		report.averageDecodeTime = mDecodeTimeCount > 0 ? mDecodeTimeSum / (double)mDecodeTimeCount : 0.0;
+		report.averageLatency = mLatencyCount > 0 ? mLatencySum / (double)mLatencyCount : 0.0;
+		report.maxLatency = mMaxLatency;
+		report.bufferedBytes = bufferedBytes;
+
+		mLastReport = Clock::now();
+		mDecodeTimeSum = 0.0;
+		mDecodeTimeCount = 0;
+		mLatencySum = 0.0;
+		mLatencyCount = 0;
+		mMaxLatency = 0.0;
+
+		video::protocol::MessageWriter writer(video::protocol::MessageType::ReceiverReport);
+		video::protocol::writeReceiverReport(writer, report);
+		writer.finish();
+		return writer;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+
+#include "../video/protocol.h"
+
+namespace screenshare::client {
+	/**
+	 * Collects what the client experiences into the periodic receiver reports sent to the server.
+	 * Can be used from any thread.
+	 */
+	class ReceiverReporter {
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		std::chrono::milliseconds mInterval;
+
+		std::mutex mMutex;
+		Clock::time_point mLastReport;
+		video::protocol::ReceiverReport mTotals;
+
+		double mDecodeTimeSum = 0.0;
+		std::size_t mDecodeTimeCount = 0;
+		double mLatencySum = 0.0;
+		std::size_t mLatencyCount = 0;
+		double mMaxLatency = 0.0;
+	public:
+		explicit ReceiverReporter(std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+		/**
+		 * Starts over for a new connection
+		 */
+		void reset();
+
+		void frameReceived();
+		void gapDetected();
+		void frameDecoded(double decodeTime);
+		void decodeFailed();
+
+		/**
+		 * A decoded frame has been shown, the given number of milliseconds after its packet was received
+		 */
+		void framePresented(double latency);
+
+		/**
+		 * Indicates if it is time to send another report
+		 */
+		bool shouldReport();
+
+		/**
+		 * Creates a report of the totals and of the time since the previous report, which starts a new interval
+		 */
+		video::protocol::MessageWriter createReport(std::size_t bufferedBytes);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "recovery_tracker.h"
+
+namespace screenshare::client {
+	RecoveryTracker::RecoveryTracker(std::chrono::milliseconds requestInterval)
+		: mRequestInterval(requestInterval) {
+
+	}
+
+	std::int64_t RecoveryTracker::lastDecodedPts() const {
+		return mLastDecodedPts;
+	}
+
+	bool RecoveryTracker::recovering() const {
+		return mRecovering;
+	}
+
+	bool RecoveryTracker::skippingToKeyframe() const {
+		return mSkippingToKeyframe;
+	}
+
+	bool RecoveryTracker::accept(std::int64_t encoderPts, std::int64_t referencePts, bool isKeyframe) {
+		// Replayed packets can overlap with packets that were already received
+		if (encoderPts <= mLastDecodedPts) {
+			return false;
+		}
+
+		if (mSkippingToKeyframe) {
+			if (isKeyframe || Clock::now() - mSkipStart < mRequestInterval) {
+				mSkippingToKeyframe = !isKeyframe;
+				return isKeyframe;
+			}
+
+			mSkippingToKeyframe = false;
+		}
+
+		// Only disposable packets can be missing in between, which nothing decoded later depends on
+		if (isKeyframe || (mLastDecodedPts >= 0 && referencePts <= mLastDecodedPts)) {
+			return true;
+		}
+
+		mRecovering = true;
+		return false;
+	}
+
+	bool RecoveryTracker::shouldRequestRecovery() {
+		if (!mRecovering) {
+			return false;
+		}
+
+		auto timeNow = Clock::now();
+		if (timeNow - mLastRequest < mRequestInterval) {
+			return false;
+		}
+
+		mLastRequest = timeNow;
+		return true;
+	}
+
+	void RecoveryTracker::skipToKeyframe() {
+		mSkippingToKeyframe = true;
+		mSkipStart = Clock::now();
+		mRecovering = false;
+	}
+
+	void RecoveryTracker::decoded(std::int64_t encoderPts) {
+		mLastDecodedPts = encoderPts;
+		mRecovering = false;
+		mLastRequest = {};
+	}
+
+	void RecoveryTracker::decodeFailed() {
+		mRecovering = true;
+		mLastRequest = {};
+	}
+}
\ No newline at end of file
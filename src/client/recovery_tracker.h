@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+namespace screenshare::client {
+	/**
+	 * Tracks whether received packets can be decoded, which requires every packet since the last keyframe that later
+	 * packets can refer to. Each packet carries the pts of the last such packet before it, so that the gaps left by the
+	 * server dropping disposable packets are told apart from lost packets.
+	 */
+	class RecoveryTracker {
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		std::chrono::milliseconds mRequestInterval;
+		std::int64_t mLastDecodedPts = -1;
+		bool mRecovering = false;
+		bool mSkippingToKeyframe = false;
+		Clock::time_point mSkipStart;
+		Clock::time_point mLastRequest;
+	public:
+		explicit RecoveryTracker(std::chrono::milliseconds requestInterval = std::chrono::milliseconds(1000));
+
+		std::int64_t lastDecodedPts() const;
+		bool recovering() const;
+		bool skippingToKeyframe() const;
+
+		/**
+		 * Indicates if the packet with the given pts, and pts of the last packet it can refer to, can be decoded, given what
+		 * has been decoded so far
+		 */
+		bool accept(std::int64_t encoderPts, std::int64_t referencePts, bool isKeyframe);
+
+		/**
+		 * Indicates if a recovery request should be sent now, limiting how often a request is repeated
+		 */
+		bool shouldRequestRecovery();
+
+		/**
+		 * Discards the packets up to the next keyframe, without asking for recovery, as when the decoder is too far behind.
+		 * Recovers as usual if no keyframe arrives within the request interval, as with intra refresh.
+		 */
+		void skipToKeyframe();
+
+		void decoded(std::int64_t encoderPts);
+		void decodeFailed();
+	};
+}
\ No newline at end of file
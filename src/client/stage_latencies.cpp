@@ -0,0 +1,65 @@
+#include "stage_latencies.h"
+
+#include <fmt/format.h>
+
+namespace screenshare::client {
+	std::string latencyStageToString(LatencyStage stage) {
+		switch (stage) {
+			case LatencyStage::Capture:
+				return "capture";
+			case LatencyStage::Convert:
+				return "convert";
+			case LatencyStage::Encode:
+				return "encode";
+			case LatencyStage::Network:
+				return "network";
+			case LatencyStage::Queue:
+				return "queue";
+			case LatencyStage::Decode:
+				return "decode";
+			case LatencyStage::Present:
+				return "present";
+			case LatencyStage::Total:
+				return "total";
+		}
+
+		return "unknown";
+	}
+
+	void StageLatencies::add(LatencyStage stage, double milliseconds) {
+		mHistograms[(std::size_t)stage].add(milliseconds);
+	}
+
+	void StageLatencies::addServerStages(const video::network::ServerStageTimes& stageTimes) {
+		add(LatencyStage::Capture, (double)stageTimes.capture / 1.0E3);
+		add(LatencyStage::Convert, (double)stageTimes.convert / 1.0E3);
+		add(LatencyStage::Encode, (double)stageTimes.encode / 1.0E3);
+	}
+
+	void StageLatencies::reset() {
+		for (auto& histogram : mHistograms) {
+			histogram.reset();
+		}
+	}
+
+	std::vector<std::string> StageLatencies::report() const {
+		std::vector<std::string> lines;
+		for (std::size_t i = 0; i < STAGE_COUNT; i++) {
+			auto& histogram = mHistograms[i];
+			if (histogram.count() == 0) {
+				lines.push_back(fmt::format("{:<8} no samples", latencyStageToString((LatencyStage)i)));
+				continue;
+			}
+
+			lines.push_back(fmt::format(
+				"{:<8} p50 {:7.2f}  p99 {:7.2f}  p99.9 {:7.2f} ms",
+				latencyStageToString((LatencyStage)i),
+				histogram.percentile(0.5),
+				histogram.percentile(0.99),
+				histogram.percentile(0.999)
+			));
+		}
+
+		return lines;
+	}
+}
\ No newline at end of file
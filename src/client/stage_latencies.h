@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <string>
+#include <vector>
+
+#include "../misc/latency_histogram.h"
+#include "../video/network.h"
+
+namespace screenshare::client {
+	/**
+	 * The stages a frame goes through from being grabbed to being presented
+	 */
+	enum class LatencyStage {
+		Capture,
+		Convert,
+		Encode,
+		Network, // From the packet being sent until received, including the send queue of the server
+		Queue, // Waiting to be decoded
+		Decode,
+		Present, // From being decoded until drawn, including the playout buffer
+		Total // From being grabbed until drawn, or decoded when not drawn
+	};
+
+	std::string latencyStageToString(LatencyStage stage);
+
+	/**
+	 * Latency histograms of each stage, combining the stage times the server sends along with each packet with the ones
+	 * measured locally. Not thread safe.
+	 */
+	class StageLatencies {
+	private:
+		static constexpr std::size_t STAGE_COUNT = (std::size_t)LatencyStage::Total + 1;
+		std::array<misc::LatencyHistogram, STAGE_COUNT> mHistograms;
+	public:
+		void add(LatencyStage stage, double milliseconds);
+		void addServerStages(const video::network::ServerStageTimes& stageTimes);
+		void reset();
+
+		/**
+		 * One line per stage
+		 */
+		std::vector<std::string> report() const;
+	};
+}
\ No newline at end of file
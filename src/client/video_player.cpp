@@ -1,23 +1,52 @@
 #include "video_player.h"
 #include "actions.h"
 #include "../misc/bit_rate_measurement.h"
+#include "../video/clock_sync.h"
+#include "../video/shm.h"
+
+#include <cmath>
 
 #include <gtkmm/cssprovider.h>
 
 #include <fmt/format.h>
 
 namespace screenshare::client {
-	VideoPlayer::VideoPlayer(boost::asio::ip::tcp::endpoint endpoint)
+	namespace {
+		// Scrolling is sent as presses of these X buttons to servers without extended input
+		constexpr std::uint32_t SCROLL_UP_BUTTON = 4;
+		constexpr std::uint32_t SCROLL_DOWN_BUTTON = 5;
+		constexpr std::uint32_t SCROLL_LEFT_BUTTON = 6;
+		constexpr std::uint32_t SCROLL_RIGHT_BUTTON = 7;
+	}
+
+	Transport transportFromString(const std::string& name) {
+		if (name == "tcp") {
+			return Transport::Tcp;
+		} else if (name == "udp") {
+			return Transport::Udp;
+		} else if (name == "multicast") {
+			return Transport::Multicast;
+		} else if (name == "shm") {
+			return Transport::SharedMemory;
+		}
+
+		throw std::runtime_error("Unknown transport: " + name);
+	}
+
+	VideoPlayer::VideoPlayer(boost::asio::ip::tcp::endpoint endpoint, VideoPlayerConfig config)
 		: mEndpoint(std::move(endpoint)),
+		  mConfig(config),
 		  mMainBox(Gtk::Orientation::ORIENTATION_VERTICAL),
 		  mControlPanelBox(Gtk::Orientation::ORIENTATION_HORIZONTAL),
 		  mConnectButton("Connect"),
 		  mDisconnectButton("Disconnect"),
 		  mInfoTextBuffer(30),
-		  mFrameInfoTextBuffer(3),
-		  mImage("assets/wait_for_connection.png"),
+		  mFrameInfoTextBuffer(6),
+		  mStageInfoTextBuffer(9),
+		  mFrameView("assets/wait_for_connection.png"),
 		  mCodecParameters({}),
-		  mClientActions({}) {
+		  mStageLatencies({}),
+		  mPlayoutBuffer(config.playout) {
 		set_border_width(10);
 
 		auto css = Gtk::CssProvider::create();
@@ -33,18 +62,29 @@ namespace screenshare::client {
 		add(mMainBox);
 		mMainBox.show();
 
-		mImage.set_valign(Gtk::Align::ALIGN_START);
-		mImage.set_halign(Gtk::Align::ALIGN_START);
+		mFrameView.setFrameShownHandler([this](const DecodedFrame& frame) {
+			auto presentedTime = video::clocksync::currentTime();
+			mReceiverReporter.framePresented((double)(presentedTime - frame.receiveTime) / 1.0E6);
+
+			auto stageLatencies = mStageLatencies.guard();
+			stageLatencies->add(LatencyStage::Present, (double)(presentedTime - frame.decodedTime) / 1.0E6);
+			stageLatencies->add(LatencyStage::Total, (double)(presentedTime - frame.captureTime) / 1.0E6);
+		});
 
-		mImageEventBox.add(mImage);
+		mImageEventBox.add(mFrameView);
 		mImageEventBox.set_size_request(1920, 1080);
-		mImage.show();
+		mFrameView.show();
 
 		mMainBox.pack_start(mImageEventBox, false, false, 0);
 		mImageEventBox.show();
 
+		mImageEventBox.add_events(Gdk::POINTER_MOTION_MASK | Gdk::SCROLL_MASK | Gdk::SMOOTH_SCROLL_MASK);
+		mMainBox.add_events(Gdk::KEY_RELEASE_MASK);
 		mMainBox.signal_key_press_event().connect(sigc::mem_fun(*this, &VideoPlayer::keyPress));
+		mMainBox.signal_key_release_event().connect(sigc::mem_fun(*this, &VideoPlayer::keyRelease));
 		mImageEventBox.signal_button_press_event().connect(sigc::mem_fun(*this, &VideoPlayer::mouseButtonPress));
+		mImageEventBox.signal_motion_notify_event().connect(sigc::mem_fun(*this, &VideoPlayer::mouseMotion));
+		mImageEventBox.signal_scroll_event().connect(sigc::mem_fun(*this, &VideoPlayer::mouseScroll));
 
 		mMainBox.pack_start(mControlPanelBox, false, true, 0);
 		mControlPanelBox.set_margin_top(MARGIN);
@@ -69,51 +109,236 @@ namespace screenshare::client {
 		mInfoTextScroll.show();
 
 		mControlPanelBox.pack_start(mFrameInfoTextView, false, false, 0);
-		mFrameInfoTextView.set_size_request(350, 50);
+		mFrameInfoTextView.set_size_request(350, 95);
 		mFrameInfoTextView.set_margin_left(MARGIN);
 		mFrameInfoTextView.show();
 
+		mControlPanelBox.pack_start(mStageInfoTextView, false, false, 0);
+		mStageInfoTextView.set_size_request(420, 95);
+		mStageInfoTextView.set_margin_left(MARGIN);
+		mStageInfoTextView.show();
+
 		sigc::slot<bool ()> slot = sigc::bind(sigc::mem_fun(*this, &VideoPlayer::onTimerCallback), 0);
-		mTimerSlot = Glib::signal_timeout().connect(slot, 16);
+		// Only updates the text and buttons, as frames are drawn as soon as they are presented
+		mTimerSlot = Glib::signal_timeout().connect(slot, 100);
+
+		mPlayoutThread = std::jthread([&](std::stop_token stopToken) {
+			runPlayout(stopToken);
+		});
 
 		mReceiveThread = std::jthread([&](std::stop_token stopToken) {
 			runFetchData(stopToken);
 		});
 	}
 
-	void VideoPlayer::fetchData(std::stop_token& stopToken) {
+	VideoPlayer::~VideoPlayer() {
+		// The receive and decode threads use most of the members, so they are stopped before any member is destroyed
+		mReceiveThread.request_stop();
+		mReceiveThread = {};
+
+		mPlayoutThread.request_stop();
+		mPlayoutThread = {};
+	}
+
+	void VideoPlayer::fetchData(std::stop_token& stopToken, StreamSession& session) {
 		boost::asio::io_context ioContext;
 		boost::asio::ip::tcp::resolver resolver(ioContext);
 
 		boost::asio::ip::tcp::socket socket(ioContext);
+		socket.open(mEndpoint.protocol());
+
+		// Unblocks connecting, the handshake and receiving when stopped, which also aborts a connection attempt in progress
+		std::stop_callback stopReceiving(stopToken, [&]() {
+			boost::system::error_code error;
+			socket.shutdown(boost::asio::socket_base::shutdown_both, error);
+		});
+
+		if (stopToken.stop_requested()) {
+			return;
+		}
+
 		socket.connect(mEndpoint);
 
-		video::network::AVCodecParametersReceiver codecParameterReceiver(socket);
-		mCodecParameters.guard().get() = *codecParameterReceiver.codecParameters();
-		video::network::PacketReceiver packetReceiver(codecParameterReceiver.codecParameters());
+		// Client actions are small and should reach the server right away, instead of waiting for earlier ones to be acknowledged.
+		socket.set_option(boost::asio::ip::tcp::no_delay(true));
 
-		std::unique_ptr<AVFrame, decltype([](auto* ptr) { av_frame_free(&ptr); })> frame(av_frame_alloc());
-		if (!frame) {
-			throw std::runtime_error("Failed to allocate memory for AVFrame");
+		auto capabilities = video::protocol::capabilityBit(video::protocol::Capability::RemoteInput)
+			| video::protocol::capabilityBit(video::protocol::Capability::ExtendedInput)
+			| video::protocol::capabilityBit(video::protocol::Capability::Recovery)
+			| video::protocol::capabilityBit(video::protocol::Capability::ClockSync)
+			| video::protocol::capabilityBit(video::protocol::Capability::ReceiverReports);
+		if (mConfig.transport == Transport::Udp || mConfig.transport == Transport::Multicast) {
+			capabilities |= video::protocol::capabilityBit(video::protocol::Capability::UdpTransport);
 		}
 
-		std::unique_ptr<AVPacket, decltype([](auto* ptr) { av_packet_free(&ptr); })> packet(av_packet_alloc());
-		if (!packet) {
-			throw std::runtime_error("Failed to allocate memory for AVPacket");
+		if (mConfig.transport == Transport::Multicast) {
+			capabilities |= video::protocol::capabilityBit(video::protocol::Capability::Multicast);
 		}
 
-		addInfoLine(fmt::format(
-			"Stream started {}x{} @ {} FPS",
-			codecParameterReceiver.codecParameters()->width,
-			codecParameterReceiver.codecParameters()->height,
-			(double)codecParameterReceiver.timeBase().den / (double)codecParameterReceiver.timeBase().num
+		if (mConfig.transport == Transport::SharedMemory) {
+			capabilities |= video::protocol::capabilityBit(video::protocol::Capability::SharedMemory);
+		}
+
+		capabilities |= video::protocol::capabilityBit(video::protocol::Capability::Resumption);
+
+		video::network::AVCodecParametersReceiver codecParameterReceiver(socket, video::protocol::ClientHello {
+			.capabilities = capabilities,
+			.resumeToken = session.resumeToken,
+			.lastDecodedPts = session.recoveryTracker.lastDecodedPts()
+		});
+		mCodecParameters.guard().get() = *codecParameterReceiver.codecParameters();
+
+		mExtendedInput.store(video::protocol::hasCapability(
+			codecParameterReceiver.serverHello().capabilities,
+			video::protocol::Capability::ExtendedInput
 		));
 
-		video::PacketDecoder packetDecoder;
-        misc::BitRateMeasurement bitRateMeasurement;
-		while (!stopToken.stop_requested()) {
-			video::network::PacketHeader packetHeader;
-			if (auto error = packetReceiver.receive(socket, packet.get(), packetHeader)) {
+		// Only opened once the handshake is done, as nothing may be sent before the client hello
+		mInputChannel.open(socket, [this](boost::system::error_code error) {
+			addInfoLine(fmt::format("Failed to send input: {}", error.message()));
+		});
+		std::unique_ptr<InputChannel, decltype([](auto* ptr) { ptr->close(); })> inputChannel(&mInputChannel);
+
+		// A resumed session continues right after the last decoded packet, which the decoder still has the references of.
+		auto& serverHello = codecParameterReceiver.serverHello();
+		auto codecParameters = codecParameterReceiver.codecParameters();
+		auto resumed = serverHello.resumed
+			&& session.packetReceiver
+			&& session.codecId == codecParameters->codec_id
+			&& session.width == codecParameters->width
+			&& session.height == codecParameters->height;
+		session.lostTime.reset();
+		session.resumeToken = serverHello.resumeToken;
+		if (resumed) {
+			session.packetReceiver->discardBuffered();
+			addInfoLine("Resumed session.");
+		} else {
+			session.packetReceiver = std::make_unique<video::network::PacketReceiver>(codecParameters, mConfig.decoder);
+			session.codecId = codecParameters->codec_id;
+			session.width = codecParameters->width;
+			session.height = codecParameters->height;
+			session.recoveryTracker = RecoveryTracker();
+		}
+
+		auto& packetReceiver = *session.packetReceiver;
+		packetReceiver.setProtocolVersion(serverHello.version);
+
+		// Packets arrive over UDP when both sides support it, while client actions always go over the TCP connection.
+		std::unique_ptr<video::network::PacketSource> packetSource;
+		if (video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::SharedMemory)) {
+			// The segment only exists on the host of the server, so opening it fails when connecting from elsewhere.
+			auto sharedMemorySource = std::make_unique<video::shm::SharedMemoryPacketSource>(serverHello.sharedMemoryName);
+			sharedMemorySource->setProtocolVersion(serverHello.version);
+			packetSource = std::move(sharedMemorySource);
+			addInfoLine(fmt::format("Receiving from shared memory {}.", serverHello.sharedMemoryName));
+		} else if (video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::Multicast)) {
+			boost::asio::ip::udp::endpoint multicastGroup(
+				boost::asio::ip::make_address(serverHello.multicastAddress),
+				serverHello.multicastPort
+			);
+
+			// The group is joined on the interface used to reach the server, which is the loopback interface when testing locally.
+			auto udpSource = std::make_unique<video::udp::UdpPacketSource>(
+				boost::asio::ip::udp::endpoint(mEndpoint.address(), mEndpoint.port()),
+				serverHello.sessionId,
+				multicastGroup,
+				serverHello.multicastKey,
+				socket.local_endpoint().address(),
+				mConfig.reassembler
+			);
+			udpSource->setProtocolVersion(serverHello.version);
+			packetSource = std::move(udpSource);
+			addInfoLine(fmt::format("Receiving from multicast group {}:{}.", serverHello.multicastAddress, serverHello.multicastPort));
+		} else if (video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::UdpTransport)) {
+			auto udpSource = std::make_unique<video::udp::UdpPacketSource>(
+				boost::asio::ip::udp::endpoint(mEndpoint.address(), mEndpoint.port()),
+				serverHello.sessionId,
+				mConfig.reassembler
+			);
+			udpSource->setProtocolVersion(serverHello.version);
+			packetSource = std::move(udpSource);
+			addInfoLine("Receiving over UDP.");
+		} else {
+			if (mConfig.transport != Transport::Tcp) {
+				addInfoLine("Server does not support the transport, receiving over TCP.");
+			}
+
+			packetSource = std::make_unique<video::network::TcpPacketSource>(socket, packetReceiver);
+		}
+
+		auto syncClock = video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::ClockSync);
+		video::clocksync::ClockSynchronizer clockSynchronizer;
+		auto handleControlMessage = [&](const video::protocol::FrameHeader& header, video::protocol::MessageReader& payload) {
+			video::protocol::ClockSync clockSync;
+			if (header.type == video::protocol::MessageType::ClockSyncResponse && video::protocol::readClockSync(payload, clockSync)) {
+				clockSynchronizer.handleResponse(clockSync, video::clocksync::currentTime());
+			}
+		};
+
+		// Control messages arrive in between packets over TCP, while nothing else reads the connection for the other
+		// transports. Shutting down the receive side makes the control thread see the end of the stream when leaving.
+		std::jthread controlThread;
+		if (dynamic_cast<video::network::TcpPacketSource*>(packetSource.get())) {
+			packetReceiver.setMessageHandler(handleControlMessage);
+		} else {
+			packetReceiver.setMessageHandler(nullptr);
+			controlThread = std::jthread([&]() {
+				video::protocol::FrameReader frameReader;
+				video::protocol::FrameHeader header;
+				while (!frameReader.readHeader(socket, header) && !frameReader.fill(socket, header.size)) {
+					video::protocol::MessageReader payload(frameReader.data(), header.size);
+					handleControlMessage(header, payload);
+					frameReader.consume(header.size);
+				}
+			});
+		}
+
+		std::unique_ptr<boost::asio::ip::tcp::socket, decltype([](auto* ptr) {
+			boost::system::error_code error;
+			ptr->shutdown(boost::asio::socket_base::shutdown_receive, error);
+		})> stopControlThread(&socket);
+
+		if (!resumed) {
+			addInfoLine(fmt::format(
+				"Stream started {}x{} @ {} FPS",
+				codecParameters->width,
+				codecParameters->height,
+				(double)codecParameterReceiver.timeBase().den / (double)codecParameterReceiver.timeBase().num
+			));
+		}
+
+		auto canRecover = video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::Recovery);
+
+		auto sendReports = video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::ReceiverReports);
+		if (!resumed) {
+			mReceiverReporter.reset();
+			mPlayoutBuffer.reset(codecParameterReceiver.timeBase());
+		}
+
+		// Declared last, as the decode stage uses everything above and is stopped when leaving
+		DecodeStage decodeStage(mConfig.decodeQueueSize);
+		std::jthread decodeThread([&](std::stop_token decodeStopToken) {
+			decodePackets(decodeStopToken, decodeStage, session, canRecover, codecParameterReceiver.timeBase(), clockSynchronizer);
+		});
+
+		while (!stopToken.stop_requested() && decodeStage.running.load()) {
+			if (syncClock && clockSynchronizer.shouldRequest()) {
+				mInputChannel.send(clockSynchronizer.createRequest());
+			}
+
+			if (sendReports && mReceiverReporter.shouldReport()) {
+				mInputChannel.send(mReceiverReporter.createReport(packetSource->bufferedBytes()));
+			}
+
+			ReceivedPacket received;
+			if (!decodeStage.freePackets.tryPop(received)) {
+				received.packet.reset(av_packet_alloc());
+				if (!received.packet) {
+					throw std::runtime_error("Failed to allocate memory for AVPacket");
+				}
+			}
+
+			if (auto error = packetSource->receive(received.packet.get(), received.header)) {
 				if (error == boost::asio::error::eof) {
 					addInfoLine("Connection closed by server.");
 					break;
@@ -122,76 +347,281 @@ namespace screenshare::client {
 				}
 			}
 
-            bitRateMeasurement.add(packet->size * 8);
+			// Both relative to the local clock, as the send time is converted from the clock of the server
+			received.receiveTime = video::clocksync::currentTime();
+			received.sendTime = clockSynchronizer.toLocalTime(video::clocksync::toNanoseconds(received.header.sendTime));
+			received.steadyReceiveTime = PlayoutBuffer::Clock::now();
+			mReceiverReporter.frameReceived();
 
-			if (!mPixBuf) {
-				mPixBuf = Gdk::Pixbuf::create(
-					Gdk::Colorspace::COLORSPACE_RGB,
-					false,
-					8,
-					codecParameterReceiver.codecParameters()->width,
-					codecParameterReceiver.codecParameters()->height
-				);
+			// Counted before being queued, so that the decode stage never sees a queued keyframe it does not know of
+			auto isKeyframe = (received.packet->flags & AV_PKT_FLAG_KEY) != 0;
+			if (isKeyframe) {
+				decodeStage.queuedKeyframes.fetch_add(1);
 			}
 
-			auto response = packetDecoder.decode(
-				packet.get(),
-				packetReceiver.codecContext(),
-				frame.get(),
-				mPixBuf->get_pixels(),
-				[&](AVCodecContext* codecContext) {
-					std::timespec currentTime {};
-					std::timespec_get(&currentTime, TIME_UTC);
-
-					mFrameInfoTextBuffer.addLines({
-						fmt::format("PTS: {} (delay: {})", frame->pts, packetHeader.encoderPts - frame->pts),
-						fmt::format("Frame number: {}", frame->coded_picture_number),
-						fmt::format(
-                            "Time since packet sent {:.2f} ms, current bit rate: {:.2f} Mbits/s",
-                            misc::elapsedSeconds(currentTime, packetHeader.sendTime) * 1000.0,
-                            (bitRateMeasurement.averageBitRate()) / (1.0E6)
-                        )
-					});
+			// Rather than blocking the socket, a packet the decoder has no room for is dropped, which the recovery tracker then
+			// sees as a gap like any lost packet.
+			if (!decodeStage.packets.tryPush(received)) {
+				if (isKeyframe) {
+					decodeStage.queuedKeyframes.fetch_sub(1);
 				}
-			);
 
-			if (response < 0) {
-				addInfoLine(fmt::format("Failed to decode packet ({})", response));
-				break;
+				decodeStage.droppedPackets.fetch_add(1);
 			}
+		}
+	}
+
+	VideoPlayer::DecodeStage::DecodeStage(std::size_t queueSize)
+		: packets(queueSize),
+		  freePackets(queueSize) {
+
+	}
 
-			decltype(mClientActions)::Type clientActions;
-			{
-				clientActions = std::move(mClientActions.guard().get());
+	void VideoPlayer::decodePackets(std::stop_token stopToken,
+									DecodeStage& decodeStage,
+									StreamSession& session,
+									bool canRecover,
+									AVRational timeBase,
+									const video::clocksync::ClockSynchronizer& clockSynchronizer) {
+		try {
+			std::unique_ptr<AVFrame, decltype([](auto* ptr) { av_frame_free(&ptr); })> frame(av_frame_alloc());
+			if (!frame) {
+				throw std::runtime_error("Failed to allocate memory for AVFrame");
 			}
 
-			for (auto& clientAction : clientActions) {
-				if (auto error = clientAction.send(socket)) {
-					std::cout << "Failed to send action: " << error << std::endl;
-					return;
+			auto& packetReceiver = *session.packetReceiver;
+			auto& recoveryTracker = session.recoveryTracker;
+			auto codecContext = packetReceiver.codecContext();
+
+			video::PacketDecoder packetDecoder;
+			misc::BitRateMeasurement bitRateMeasurement;
+			std::size_t skippedPackets = 0;
+
+			// Starts over with every connection, which includes a resumed decoder still shedding work
+			OverloadController overloadController(mConfig.overload, timeBase);
+			overloadController.apply(codecContext);
+			auto decoderThreading = video::describeDecoderThreading(codecContext);
+
+			ReceivedPacket received;
+			DecodedFramePtr decodedFrame;
+			auto lastStageReport = std::chrono::steady_clock::now();
+			while (decodeStage.packets.wait(stopToken) && decodeStage.packets.tryPop(received)) {
+				auto& packet = received.packet;
+				auto& packetHeader = received.header;
+
+				auto isKeyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+				if (isKeyframe) {
+					decodeStage.queuedKeyframes.fetch_sub(1);
+				}
+
+				// When behind, everything before the latest queued keyframe is skipped instead of decoded, as the keyframe
+				// does not depend on it.
+				if (decodeStage.queuedKeyframes.load() > 0 && decodeStage.packets.size() >= mConfig.skipThreshold) {
+					skippedPackets++;
+					decodeStage.freePackets.tryPush(received);
+					continue;
+				}
+
+				// Decoding what is this far behind would only keep the decoder behind, so it waits for the next keyframe instead
+				auto decodeStartTime = video::clocksync::currentTime();
+				auto queuedTime = std::chrono::duration<double, std::milli>(PlayoutBuffer::Clock::now() - received.steadyReceiveTime).count();
+				if (!isKeyframe
+					&& !recoveryTracker.skippingToKeyframe()
+					&& recoveryTracker.lastDecodedPts() >= 0
+					&& overloadController.shouldSkipToKeyframe(queuedTime)) {
+					addInfoLine(fmt::format("Decoder {:.0f} ms behind, skipping to the next keyframe.", queuedTime));
+					recoveryTracker.skipToKeyframe();
+				}
+
+				auto wasRecovering = recoveryTracker.recovering();
+				if (!recoveryTracker.accept(packetHeader.encoderPts, packetHeader.referencePts, isKeyframe)) {
+					if (recoveryTracker.skippingToKeyframe()) {
+						skippedPackets++;
+					}
+
+					// Not counted before the first keyframe, which the client always has to wait for
+					if (!wasRecovering && recoveryTracker.recovering() && recoveryTracker.lastDecodedPts() >= 0) {
+						mReceiverReporter.gapDetected();
+					}
+
+					if (canRecover && recoveryTracker.shouldRequestRecovery()) {
+						addInfoLine(fmt::format("Lost packets, recovering from pts {}.", recoveryTracker.lastDecodedPts()));
+						requestRecovery(recoveryTracker.lastDecodedPts());
+					}
+
+					decodeStage.freePackets.tryPush(received);
+					continue;
 				}
+
+				bitRateMeasurement.add(packet->size * 8);
+
+				auto response = packetDecoder.decode(
+					packet.get(),
+					codecContext,
+					frame.get(),
+					[&](AVFrame* frame) {
+						decodedFrame = mPlayoutBuffer.acquire(frame->width, frame->height);
+						return decodedFrame->pixels.data();
+					},
+					[&](AVCodecContext* codecContext) {
+						auto decodedTime = video::clocksync::currentTime();
+						auto clockEstimate = clockSynchronizer.estimate();
+						auto playoutStatistics = mPlayoutBuffer.statistics();
+
+						// The server stages come before the send time, and are counted as nothing when the server does not send them
+						auto stageTimes = packetHeader.stageTimes.value_or(video::network::ServerStageTimes {});
+						auto serverTime = (std::int64_t)(stageTimes.capture + stageTimes.convert + stageTimes.encode) * 1000;
+
+						decodedFrame->pts = frame->pts;
+						decodedFrame->receiveTime = received.receiveTime;
+						decodedFrame->captureTime = received.sendTime - serverTime;
+						decodedFrame->decodedTime = decodedTime;
+						mPlayoutBuffer.add(std::move(decodedFrame), received.steadyReceiveTime);
+
+						{
+							auto stageLatencies = mStageLatencies.guard();
+							if (packetHeader.stageTimes) {
+								stageLatencies->addServerStages(stageTimes);
+							}
+
+							stageLatencies->add(LatencyStage::Network, (double)(received.receiveTime - received.sendTime) / 1.0E6);
+							stageLatencies->add(LatencyStage::Queue, queuedTime);
+							stageLatencies->add(LatencyStage::Decode, (double)(decodedTime - decodeStartTime) / 1.0E6);
+
+							if (std::chrono::steady_clock::now() - lastStageReport >= std::chrono::seconds(1)) {
+								auto lines = stageLatencies->report();
+								lines.insert(lines.begin(), "Stage latencies this session:");
+								mStageInfoTextBuffer.addLines(std::move(lines));
+								lastStageReport = std::chrono::steady_clock::now();
+							}
+						}
+
+						mFrameInfoTextBuffer.addLines({
+							fmt::format("PTS: {} (delay: {})", frame->pts, packetHeader.encoderPts - frame->pts),
+							clockEstimate.synchronized
+								? fmt::format(
+									"Frame number: {}, clock offset: {:.2f} ± {:.2f} ms",
+									frame->coded_picture_number,
+									clockEstimate.offset,
+									clockEstimate.roundTrip / 2.0
+								)
+								: fmt::format("Frame number: {}, clocks not synchronized", frame->coded_picture_number),
+							fmt::format(
+								"Latency {:.2f} ms (network {:.2f} ms), current bit rate: {:.2f} Mbits/s",
+								(double)(decodedTime - received.sendTime) / 1.0E6,
+								(double)(received.receiveTime - received.sendTime) / 1.0E6,
+								(bitRateMeasurement.averageBitRate()) / (1.0E6)
+							),
+							fmt::format(
+								"Queued {:.2f} ms, decoded {:.2f} ms ({} queued, {} skipped, {} dropped)",
+								queuedTime,
+								(double)(decodedTime - decodeStartTime) / 1.0E6,
+								decodeStage.packets.size(),
+								skippedPackets,
+								decodeStage.droppedPackets.load()
+							),
+							fmt::format(
+								"Playout delay {:.2f} ms (jitter {:.2f} ms), {} buffered, {} late",
+								playoutStatistics.targetLatency,
+								playoutStatistics.jitter,
+								playoutStatistics.bufferedFrames,
+								playoutStatistics.droppedFrames
+							),
+							fmt::format(
+								"Decoder {}, load {:.2f}, mode: {}",
+								decoderThreading,
+								overloadController.load(),
+								overloadModeToString(overloadController.mode())
+							)
+						});
+					}
+				);
+
+				if (response < 0) {
+					addInfoLine(fmt::format("Failed to decode packet ({})", response));
+					mReceiverReporter.decodeFailed();
+					if (!canRecover) {
+						break;
+					}
+
+					recoveryTracker.decodeFailed();
+					if (recoveryTracker.shouldRequestRecovery()) {
+						requestRecovery(recoveryTracker.lastDecodedPts());
+					}
+				} else {
+					auto decodeTime = (double)(video::clocksync::currentTime() - decodeStartTime) / 1.0E6;
+					recoveryTracker.decoded(packetHeader.encoderPts);
+					mReceiverReporter.frameDecoded(decodeTime);
+
+					if (overloadController.frameDecoded(decodeTime, queuedTime)) {
+						overloadController.apply(codecContext);
+						addInfoLine(fmt::format(
+							"Decoder load {:.2f}, switched to mode: {}.",
+							overloadController.load(),
+							overloadModeToString(overloadController.mode())
+						));
+					}
+				}
+
+				decodeStage.freePackets.tryPush(received);
 			}
+		} catch (const std::exception& e) {
+			addInfoLine(fmt::format("Failed to decode due to: {}", e.what()));
 		}
+
+		decodeStage.running.store(false);
+	}
+
+	void VideoPlayer::requestRecovery(std::int64_t lastDecodedPts) {
+		video::protocol::MessageWriter writer(video::protocol::MessageType::RecoveryRequest);
+		video::protocol::writeRecoveryRequest(writer, { lastDecodedPts });
+		writer.finish();
+		mInputChannel.send(std::move(writer));
 	}
 
 	void VideoPlayer::runFetchData(std::stop_token& stopToken) {
 		mIsConnected.store(true);
+		mStageLatencies.guard()->reset();
 
-		try {
-			fetchData(stopToken);
-			addInfoLine("Stream ended.");
-		} catch (const std::exception& e) {
-			addInfoLine(fmt::format("Failed to connect due to: {}", e.what()));
+		StreamSession session;
+		while (true) {
+			try {
+				fetchData(stopToken, session);
+				addInfoLine("Stream ended.");
+				break;
+			} catch (const std::exception& e) {
+				// Once a session has been established, a lost connection is retried until the server no longer keeps it.
+				auto timeNow = std::chrono::steady_clock::now();
+				if (session.resumeToken != 0 && !session.lostTime) {
+					session.lostTime = timeNow;
+					addInfoLine(fmt::format("Connection lost due to: {}, reconnecting.", e.what()));
+				}
+
+				if (stopToken.stop_requested() || !session.lostTime || timeNow - *session.lostTime > mConfig.resumeWindow) {
+					addInfoLine(fmt::format("Failed to connect due to: {}", e.what()));
+					break;
+				}
+			}
+
+			// Waits a bit before retrying, unless disconnected meanwhile
+			std::mutex retryMutex;
+			std::condition_variable_any retryCondition;
+			std::unique_lock lock(retryMutex);
+			if (retryCondition.wait_for(lock, stopToken, std::chrono::milliseconds(100), [&]() { return stopToken.stop_requested(); })) {
+				break;
+			}
 		}
 
 		mIsConnected.store(false);
 	}
 
-	bool VideoPlayer::onTimerCallback(int) {
-		if (mPixBuf) {
-			mImage.set(mPixBuf);
+	void VideoPlayer::runPlayout(std::stop_token stopToken) {
+		while (auto frame = mPlayoutBuffer.next(stopToken)) {
+			mPlayoutBuffer.release(mFrameView.present(std::move(frame)));
 		}
+	}
 
+	bool VideoPlayer::onTimerCallback(int) {
 		if (auto buffer = mInfoTextBuffer.gtkBufferIfUnchanged()) {
 			mInfoTextView.set_buffer(buffer);
 
@@ -203,6 +633,10 @@ namespace screenshare::client {
 			mFrameInfoTextView.set_buffer(buffer);
 		}
 
+		if (auto buffer = mStageInfoTextBuffer.gtkBufferIfUnchanged()) {
+			mStageInfoTextView.set_buffer(buffer);
+		}
+
         if (mIsConnected.load()) {
             mConnectButton.set_sensitive(false);
             mDisconnectButton.set_sensitive(true);
@@ -233,22 +667,88 @@ namespace screenshare::client {
 	}
 
 	bool VideoPlayer::keyPress(GdkEventKey* key) {
-		mClientActions.guard()->push_back(client::ClientAction::keyPressed(key->string));
+		if (mExtendedInput.load()) {
+			mInputChannel.send(client::ClientAction::keyDown(key->keyval));
+		} else {
+			mInputChannel.send(client::ClientAction::keyPressed(key->string));
+		}
+
+		return false;
+	}
+
+	bool VideoPlayer::keyRelease(GdkEventKey* key) {
+		if (mExtendedInput.load()) {
+			mInputChannel.send(client::ClientAction::keyUp(key->keyval));
+		}
+
 		return false;
 	}
 
 	bool VideoPlayer::mouseButtonPress(GdkEventButton* mouseButton) {
-		auto [width, height] = [&]() {
-			auto codecParameters = mCodecParameters.guard();
-			return std::make_tuple(codecParameters->width, codecParameters->height);
-		}();
-
-		mClientActions.guard()->push_back(client::ClientAction::mouseButtonPressed(
-			mouseButton->button,
-			mouseButton->x / width,
-			mouseButton->y / height
-		));
+		if (!mInputChannel.isOpen()) {
+			return false;
+		}
+
+		auto [x, y] = toStreamPosition(mouseButton->x, mouseButton->y);
+		mInputChannel.send(client::ClientAction::mouseButtonPressed(mouseButton->button, x, y));
+		return false;
+	}
+
+	bool VideoPlayer::mouseMotion(GdkEventMotion* motion) {
+		if (!mInputChannel.isOpen() || !mExtendedInput.load()) {
+			return false;
+		}
+
+		auto [x, y] = toStreamPosition(motion->x, motion->y);
+		mInputChannel.send(client::ClientAction::mouseMoved(x, y));
+		return false;
+	}
+
+	bool VideoPlayer::mouseScroll(GdkEventScroll* scroll) {
+		std::int32_t deltaX = 0;
+		std::int32_t deltaY = 0;
+		switch (scroll->direction) {
+			case GDK_SCROLL_UP:
+				deltaY = -1;
+				break;
+			case GDK_SCROLL_DOWN:
+				deltaY = 1;
+				break;
+			case GDK_SCROLL_LEFT:
+				deltaX = -1;
+				break;
+			case GDK_SCROLL_RIGHT:
+				deltaX = 1;
+				break;
+			case GDK_SCROLL_SMOOTH:
+				deltaX = (std::int32_t)std::lround(scroll->delta_x);
+				deltaY = (std::int32_t)std::lround(scroll->delta_y);
+				break;
+		}
 
+		if ((deltaX == 0 && deltaY == 0) || !mInputChannel.isOpen()) {
+			return false;
+		}
+
+		auto [x, y] = toStreamPosition(scroll->x, scroll->y);
+		if (mExtendedInput.load()) {
+			mInputChannel.send(client::ClientAction::mouseScrolled(x, y, deltaX, deltaY));
+			return false;
+		}
+
+		auto pressButton = [&](std::int32_t delta, std::uint32_t negativeButton, std::uint32_t positiveButton) {
+			for (std::int32_t step = 0; step < std::abs(delta); step++) {
+				mInputChannel.send(client::ClientAction::mouseButtonPressed(delta < 0 ? negativeButton : positiveButton, x, y));
+			}
+		};
+
+		pressButton(deltaY, SCROLL_UP_BUTTON, SCROLL_DOWN_BUTTON);
+		pressButton(deltaX, SCROLL_LEFT_BUTTON, SCROLL_RIGHT_BUTTON);
 		return false;
 	}
+
+	std::tuple<double, double> VideoPlayer::toStreamPosition(double x, double y) {
+		auto codecParameters = mCodecParameters.guard();
+		return std::make_tuple(x / codecParameters->width, y / codecParameters->height);
+	}
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #pragma once
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <thread>
+#include <tuple>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/array.hpp>
@@ -10,7 +15,6 @@
 #include <gtkmm/main.h>
 #include <gtkmm/window.h>
 #include <gtkmm/button.h>
-#include <gtkmm/image.h>
 #include <gtkmm/box.h>
 #include <gdkmm/pixbuf.h>
 #include <glibmm/main.h>
@@ -19,18 +23,48 @@
 #include <gtkmm/eventbox.h>
 #include <gtkmm/scrolledwindow.h>
 
+#include "frame_view.h"
 #include "info_text_buffer.h"
 #include "actions.h"
+#include "input_channel.h"
+#include "overload_controller.h"
+#include "playout_buffer.h"
+#include "receiver_reporter.h"
+#include "recovery_tracker.h"
+#include "stage_latencies.h"
 
 #include "../misc/concurrency.hpp"
 
+#include "../video/clock_sync.h"
 #include "../video/network.h"
 #include "../video/decoder.h"
+#include "../video/udp.h"
 
 namespace screenshare::client {
+	enum class Transport {
+		Tcp,
+		Udp,
+		Multicast,
+		SharedMemory
+	};
+
+	Transport transportFromString(const std::string& name);
+
+	struct VideoPlayerConfig {
+		Transport transport = Transport::Tcp;
+		video::udp::ReassemblerConfig reassembler;
+		std::chrono::milliseconds resumeWindow { 10000 }; // How long to keep reconnecting after losing the connection
+		std::size_t decodeQueueSize = 64; // Packets received but not yet decoded, beyond which received packets are dropped
+		std::size_t skipThreshold = 8; // Queued packets at which the decoder skips ahead to the latest queued keyframe
+		PlayoutConfig playout;
+		video::DecoderConfig decoder;
+		OverloadConfig overload;
+	};
+
 	class VideoPlayer : public Gtk::Window {
 	private:
 		boost::asio::ip::tcp::endpoint mEndpoint;
+		VideoPlayerConfig mConfig;
 
 		Gtk::Box mMainBox;
 		Gtk::Box mControlPanelBox;
@@ -45,8 +79,10 @@ namespace screenshare::client {
 		InfoTextBuffer mFrameInfoTextBuffer;
 		Gtk::TextView mFrameInfoTextView;
 
-		Gtk::Image mImage;
-		Glib::RefPtr<Gdk::Pixbuf> mPixBuf;
+		InfoTextBuffer mStageInfoTextBuffer;
+		Gtk::TextView mStageInfoTextView;
+
+		FrameView mFrameView;
 		Gtk::EventBox mImageEventBox;
 
 		sigc::connection mTimerSlot;
@@ -55,21 +91,85 @@ namespace screenshare::client {
 		std::jthread mReceiveThread;
 
 		misc::ResourceMutex<AVCodecParameters> mCodecParameters;
-		misc::ResourceMutex<std::vector<client::ClientAction>> mClientActions;
+		InputChannel mInputChannel;
+		std::atomic<bool> mExtendedInput = false; // Otherwise only key and button presses are sent, which any server takes
+
+		ReceiverReporter mReceiverReporter;
+
+		// Recorded by the decode thread and when frames are drawn
+		misc::ResourceMutex<StageLatencies> mStageLatencies;
+
+		PlayoutBuffer mPlayoutBuffer;
+		std::jthread mPlayoutThread;
 
 		void addInfoLine(std::string line);
 
 		void connectButtonClicked();
 		void disconnectButtonClicked();
 		bool keyPress(GdkEventKey* key);
+		bool keyRelease(GdkEventKey* key);
 		bool mouseButtonPress(GdkEventButton* mouseButton);
+		bool mouseMotion(GdkEventMotion* motion);
+		bool mouseScroll(GdkEventScroll* scroll);
+		std::tuple<double, double> toStreamPosition(double x, double y);
 
 		bool onTimerCallback(int);
 
+		/**
+		 * What is kept across the connections of a session, which lets a lost connection resume where it left off
+		 */
+		struct StreamSession {
+			std::uint64_t resumeToken = 0;
+			std::optional<std::chrono::steady_clock::time_point> lostTime;
+
+			std::unique_ptr<video::network::PacketReceiver> packetReceiver;
+			AVCodecID codecId = AV_CODEC_ID_NONE;
+			int width = 0;
+			int height = 0;
+
+			RecoveryTracker recoveryTracker;
+		};
+
+		/**
+		 * A packet handed from the receive stage to the decode stage
+		 */
+		struct ReceivedPacket {
+			std::unique_ptr<AVPacket, video::AVPacketDeleter> packet;
+			video::network::PacketHeader header;
+			std::int64_t receiveTime = 0;
+			std::int64_t sendTime = 0; // Converted to the local clock
+			PlayoutBuffer::Clock::time_point steadyReceiveTime; // For scheduling, which must not follow steps of the realtime clock
+		};
+
+		/**
+		 * Joins the receive stage, which reads the socket, with the decode stage, which decodes and converts, so that neither
+		 * waits for the other. Packets are returned after decoding, which lets the receive stage reuse them.
+		 */
+		struct DecodeStage {
+			misc::SpscQueue<ReceivedPacket> packets;
+			misc::SpscQueue<ReceivedPacket> freePackets;
+			std::atomic<std::size_t> queuedKeyframes = 0;
+			std::atomic<std::size_t> droppedPackets = 0;
+			std::atomic<bool> running = true;
+
+			explicit DecodeStage(std::size_t queueSize);
+		};
+
 		void runFetchData(std::stop_token& stopToken);
-		void fetchData(std::stop_token& stopToken);
+		void fetchData(std::stop_token& stopToken, StreamSession& session);
+		void decodePackets(
+			std::stop_token stopToken,
+			DecodeStage& decodeStage,
+			StreamSession& session,
+			bool canRecover,
+			AVRational timeBase,
+			const video::clocksync::ClockSynchronizer& clockSynchronizer
+		);
+		void requestRecovery(std::int64_t lastDecodedPts);
+
+		void runPlayout(std::stop_token stopToken);
 	public:
-		explicit VideoPlayer(boost::asio::ip::tcp::endpoint endpoint);
-		~VideoPlayer() override = default;
+		explicit VideoPlayer(boost::asio::ip::tcp::endpoint endpoint, VideoPlayerConfig config = {});
+		~VideoPlayer() override;
 	};
 }
\ No newline at end of file
@@ -1,20 +1,104 @@
+#include <iostream>
 #include <string>
 
 #include "misc/network.h"
+#include "misc/command_line.h"
 
 #include "client/video_player.h"
+#include "client/headless_client.h"
 
 #include "screeninteractor/x11.h"
 #include "server/video_server.h"
+#include "server/relay.h"
+
+#include "benchmark/fanout_benchmark.h"
+#include "benchmark/latency_benchmark.h"
 
 using namespace screenshare;
 
-void mainServer(const std::string& bind, int windowId) {
-	server::VideoServer videoServer(misc::tcpEndpointFromString(bind), { 1920, 1080, 30 });
+server::StreamServerConfig streamServerConfigFromCommandLine(const misc::CommandLine& commandLine) {
+	server::ClientConnectionConfig clientConnectionConfig;
+	clientConnectionConfig.dropPolicy = server::dropPolicyFromString(commandLine.get("drop-policy", "skip-to-keyframe"));
+	clientConnectionConfig.maxQueuedPackets = (std::size_t)commandLine.getInt("max-queued-packets", (std::int64_t)clientConnectionConfig.maxQueuedPackets);
+	clientConnectionConfig.pacer.rate = commandLine.getNonNegativeDouble("pacing-rate", 0.0) * 1.0E6 / 8.0;
+
+	video::udp::UdpTransportConfig udpConfig;
+	if (commandLine.has("multicast")) {
+		udpConfig.multicast.group = misc::udpEndpointFromString(commandLine.get("multicast"));
+	}
+
+	if (commandLine.has("multicast-interface")) {
+		udpConfig.multicast.outboundInterface = boost::asio::ip::make_address(commandLine.get("multicast-interface"));
+	}
+
+	udpConfig.enabled = commandLine.has("udp") || udpConfig.multicast.group.has_value();
+	udpConfig.fec.groupSize = (std::size_t)commandLine.getInt("fec-group", 0);
+	udpConfig.lossInjector.lossRate = commandLine.getDouble("udp-loss", 0.0);
+	udpConfig.lossInjector.delay = std::chrono::milliseconds(commandLine.getInt("udp-delay", 0));
+	udpConfig.lossInjector.jitter = std::chrono::milliseconds(commandLine.getInt("udp-jitter", 0));
+
+	video::shm::SharedMemoryConfig sharedMemoryConfig;
+	sharedMemoryConfig.name = commandLine.get("shm", "");
+	sharedMemoryConfig.capacity = (std::size_t)commandLine.getInt("shm-capacity", (std::int64_t)sharedMemoryConfig.capacity);
+
+	server::UringSenderConfig uringConfig;
+	uringConfig.enabled = commandLine.has("io-uring");
+
+	server::HttpEgressConfig httpConfig;
+	if (commandLine.has("http")) {
+		httpConfig.bind = misc::tcpEndpointFromString(commandLine.get("http"));
+	}
+
+	httpConfig.segmentDuration = std::chrono::milliseconds(commandLine.getInt("http-segment-duration", httpConfig.segmentDuration.count()));
+	httpConfig.partDuration = std::chrono::milliseconds(commandLine.getInt("http-part-duration", httpConfig.partDuration.count()));
+
+	server::BandwidthSchedulerConfig schedulerConfig;
+	schedulerConfig.uplinkRate = commandLine.getNonNegativeDouble("uplink-rate", 0.0) * 1.0E6 / 8.0;
+	schedulerConfig.viewerWeight = commandLine.getPositiveDouble("viewer-weight", schedulerConfig.viewerWeight);
+	schedulerConfig.controllerWeight = commandLine.getPositiveDouble("controller-weight", schedulerConfig.controllerWeight);
+	schedulerConfig.viewerCap = commandLine.getNonNegativeDouble("viewer-cap", 0.0) * 1.0E6 / 8.0;
+	schedulerConfig.controllerCap = commandLine.getNonNegativeDouble("controller-cap", 0.0) * 1.0E6 / 8.0;
+
+	auto ioThreads = (std::size_t)commandLine.getInt("io-threads", 0);
+	return { clientConnectionConfig, udpConfig, sharedMemoryConfig, {}, uringConfig, ioThreads, httpConfig, schedulerConfig };
+}
+
+void mainServer(const std::string& bind, int windowId, const misc::CommandLine& commandLine) {
+	video::VideoEncoderConfig videoEncoderConfig { 1920, 1080, 30 };
+	videoEncoderConfig.intraRefresh = commandLine.has("intra-refresh");
+
+	server::VideoServer videoServer(misc::tcpEndpointFromString(bind), videoEncoderConfig, streamServerConfigFromCommandLine(commandLine));
 	videoServer.run(std::unique_ptr<screeninteractor::ScreenInteractor>(new screeninteractor::ScreenInteractorX11({ ":0", windowId })));
 }
 
-int mainClient(const std::string& endpoint) {
+void mainRelay(const std::string& upstream, const std::string& bind, const misc::CommandLine& commandLine) {
+	server::Relay relay(misc::tcpEndpointFromString(upstream), misc::tcpEndpointFromString(bind), streamServerConfigFromCommandLine(commandLine));
+	relay.run();
+}
+
+video::DecoderConfig decoderConfigFromCommandLine(const misc::CommandLine& commandLine) {
+	video::DecoderConfig decoderConfig;
+	decoderConfig.threading = video::decoderThreadingFromString(commandLine.get("decoder-threading", "slice"));
+	decoderConfig.threadCount = (int)commandLine.getInt("decoder-threads", decoderConfig.threadCount);
+	decoderConfig.lowDelay = !commandLine.has("no-low-delay");
+
+	// Frame threading also changes what the overload controller measures, see DecoderConfig
+	if (decoderConfig.threading == video::DecoderThreading::Frame && decoderConfig.lowDelay) {
+		std::cerr << "Low delay cannot be combined with frame threading, decoding without it." << std::endl;
+		decoderConfig.lowDelay = false;
+	}
+
+	return decoderConfig;
+}
+
+int mainClient(const std::string& endpoint, const misc::CommandLine& commandLine) {
+	client::VideoPlayerConfig videoPlayerConfig;
+	videoPlayerConfig.transport = client::transportFromString(commandLine.get("transport", "tcp"));
+	videoPlayerConfig.reassembler.deadline = std::chrono::milliseconds(commandLine.getInt("udp-deadline", videoPlayerConfig.reassembler.deadline.count()));
+	videoPlayerConfig.playout.mode = client::playoutModeFromString(commandLine.get("playout-mode", "balanced"));
+	videoPlayerConfig.decoder = decoderConfigFromCommandLine(commandLine);
+	videoPlayerConfig.overload.enabled = !commandLine.has("no-overload-shedding");
+
 	std::string programName = "screenshare";
 	std::vector<char*> programArguments { (char*)programName.c_str() };
 	auto numProgramArguments = (int)programArguments.size();
@@ -26,17 +110,85 @@ int mainClient(const std::string& endpoint) {
 		"com.screenshare",
 		Gio::ApplicationFlags::APPLICATION_NON_UNIQUE
 	);
-	client::VideoPlayer videoPlayer(misc::tcpEndpointFromString(endpoint));
+	client::VideoPlayer videoPlayer(misc::tcpEndpointFromString(endpoint), videoPlayerConfig);
 	return app->run(videoPlayer);
 }
 
+int mainHeadlessClient(const std::string& endpoint, const misc::CommandLine& commandLine) {
+	client::HeadlessClientConfig config;
+	config.clients = (std::size_t)commandLine.getInt("clients", (std::int64_t)config.clients);
+	if (commandLine.has("duration")) {
+		config.duration = std::chrono::milliseconds((std::int64_t)(commandLine.getDouble("duration", 0.0) * 1000.0));
+	}
+
+	if (commandLine.has("frames")) {
+		config.frames = (std::size_t)commandLine.getInt("frames", 0);
+	}
+
+	config.convert = !commandLine.has("no-convert");
+	config.statsPath = commandLine.get("stats", "");
+	config.decoder = decoderConfigFromCommandLine(commandLine);
+
+	// Many clients decoding in one process would otherwise each start a thread per core
+	if (!commandLine.has("decoder-threads") && config.clients > 1) {
+		config.decoder.threading = video::DecoderThreading::Single;
+	}
+
+	client::HeadlessClient headlessClient(misc::tcpEndpointFromString(endpoint), config);
+	return headlessClient.run() == 0 ? 0 : 1;
+}
+
+void mainFanoutBenchmark(const misc::CommandLine& commandLine) {
+	benchmark::FanoutBenchmarkConfig config;
+	config.packets = (std::size_t)commandLine.getInt("packets", (std::int64_t)config.packets);
+	if (commandLine.has("clients")) {
+		config.clientCounts = { (std::size_t)commandLine.getInt("clients", 1) };
+	}
+
+	benchmark::runFanoutBenchmark(config);
+}
+
+void mainLatencyBenchmark(const misc::CommandLine& commandLine) {
+	benchmark::LatencyBenchmarkConfig config;
+	config.probes = (std::size_t)commandLine.getInt("probes", (std::int64_t)config.probes);
+	config.interval = std::chrono::milliseconds(commandLine.getInt("interval", config.interval.count()));
+	config.width = (int)commandLine.getInt("width", config.width);
+	config.height = (int)commandLine.getInt("height", config.height);
+	config.frameRate = (int)commandLine.getInt("fps", config.frameRate);
+	config.decoder = decoderConfigFromCommandLine(commandLine);
+
+	benchmark::runLatencyBenchmark(config);
+}
+
 int main(int argc, char* argv[]) {
-	if ((argc >= 3) && std::string(argv[1]) == "client") {
-		return mainClient(argv[2]);
+	misc::CommandLine commandLine(argc, argv);
+	auto& arguments = commandLine.positional();
+
+	if ((arguments.size() >= 2) && arguments[0] == "client") {
+		return mainClient(arguments[1], commandLine);
+	}
+
+	if ((arguments.size() >= 2) && arguments[0] == "client-headless") {
+		return mainHeadlessClient(arguments[1], commandLine);
+	}
+
+	if ((arguments.size() >= 3) && arguments[0] == "server") {
+		mainServer(arguments[1], std::stoi(arguments[2]), commandLine);
+		return 0;
+	}
+
+	if ((arguments.size() >= 3) && arguments[0] == "relay") {
+		mainRelay(arguments[1], arguments[2], commandLine);
+		return 0;
+	}
+
+	if ((arguments.size() >= 1) && arguments[0] == "benchmark-fanout") {
+		mainFanoutBenchmark(commandLine);
+		return 0;
 	}
 
-	if ((argc >= 4) && std::string(argv[1]) == "server") {
-		mainServer(argv[2], std::stoi(argv[3]));
+	if ((arguments.size() >= 1) && arguments[0] == "benchmark-latency") {
+		mainLatencyBenchmark(commandLine);
 		return 0;
 	}
 
@@ -0,0 +1,74 @@
+#include "command_line.h"
+
+#include <stdexcept>
+
+namespace screenshare::misc {
+	CommandLine::CommandLine(int argc, char* argv[]) {
+		for (int i = 1; i < argc; i++) {
+			std::string argument = argv[i];
+			if (argument.starts_with("--")) {
+				auto pos = argument.find('=');
+				if (pos != std::string::npos) {
+					mOptions[argument.substr(2, pos - 2)] = argument.substr(pos + 1);
+				} else {
+					mOptions[argument.substr(2)] = "true";
+				}
+			} else {
+				mPositional.push_back(std::move(argument));
+			}
+		}
+	}
+
+	const std::vector<std::string>& CommandLine::positional() const {
+		return mPositional;
+	}
+
+	bool CommandLine::has(const std::string& name) const {
+		return mOptions.contains(name);
+	}
+
+	std::string CommandLine::get(const std::string& name, const std::string& defaultValue) const {
+		auto option = mOptions.find(name);
+		if (option != mOptions.end()) {
+			return option->second;
+		}
+
+		return defaultValue;
+	}
+
+	std::int64_t CommandLine::getInt(const std::string& name, std::int64_t defaultValue) const {
+		auto option = mOptions.find(name);
+		if (option != mOptions.end()) {
+			return std::stoll(option->second);
+		}
+
+		return defaultValue;
+	}
+
+	double CommandLine::getDouble(const std::string& name, double defaultValue) const {
+		auto option = mOptions.find(name);
+		if (option != mOptions.end()) {
+			return std::stod(option->second);
+		}
+
+		return defaultValue;
+	}
+
+	double CommandLine::getPositiveDouble(const std::string& name, double defaultValue) const {
+		auto value = getDouble(name, defaultValue);
+		if (!(value > 0.0)) {
+			throw std::runtime_error("Option --" + name + " must be above zero.");
+		}
+
+		return value;
+	}
+
+	double CommandLine::getNonNegativeDouble(const std::string& name, double defaultValue) const {
+		auto value = getDouble(name, defaultValue);
+		if (!(value >= 0.0)) {
+			throw std::runtime_error("Option --" + name + " must not be negative.");
+		}
+
+		return value;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace screenshare::misc {
+	/**
+	 * Splits the command line into positional arguments and --name=value options
+	 */
+	class CommandLine {
+	private:
+		std::vector<std::string> mPositional;
+		std::unordered_map<std::string, std::string> mOptions;
+	public:
+		CommandLine(int argc, char* argv[]);
+
+		const std::vector<std::string>& positional() const;
+
+		bool has(const std::string& name) const;
+		std::string get(const std::string& name, const std::string& defaultValue = "") const;
+		std::int64_t getInt(const std::string& name, std::int64_t defaultValue) const;
+		double getDouble(const std::string& name, double defaultValue) const;
+
+		/**
+		 * As getDouble, but throws if the value is not above zero
+		 */
+		double getPositiveDouble(const std::string& name, double defaultValue) const;
+
+		/**
+		 * As getDouble, but throws if the value is below zero
+		 */
+		double getNonNegativeDouble(const std::string& name, double defaultValue) const;
+	};
+}
\ No newline at end of file
@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <stop_token>
+#include <vector>
 
 namespace screenshare::misc {
 	/**
@@ -93,4 +101,283 @@ namespace screenshare::misc {
 			mMutex.unlock();
 		}
 	};
+
+	/**
+	 * Bounded queue between exactly one producer and one consumer thread, which never lock.
+	 * The capacity is rounded up to a power of two.
+	 */
+	template<typename T>
+	class SpscQueue {
+	private:
+		static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+		std::vector<T> mSlots;
+		std::size_t mMask;
+
+		// Kept on separate cache lines, as each is written by its own thread
+		alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> mHead = 0;
+		alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> mTail = 0;
+		alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> mWakeups = 0;
+	public:
+		explicit SpscQueue(std::size_t capacity)
+			: mSlots(std::bit_ceil(std::max(capacity, std::size_t(1)))),
+			  mMask(mSlots.size() - 1) {
+
+		}
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		std::size_t capacity() const {
+			return mSlots.size();
+		}
+
+		/**
+		 * The number of queued items, which is only exact when called from the producer or the consumer
+		 */
+		std::size_t size() const {
+			return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire);
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		/**
+		 * Moves the given value into the queue, unless it is full. Must only be called by the producer.
+		 */
+		bool tryPush(T& value) {
+			auto tail = mTail.load(std::memory_order_relaxed);
+			if (tail - mHead.load(std::memory_order_acquire) == mSlots.size()) {
+				return false;
+			}
+
+			mSlots[tail & mMask] = std::move(value);
+			mTail.store(tail + 1, std::memory_order_release);
+
+			mWakeups.fetch_add(1, std::memory_order_release);
+			mWakeups.notify_one();
+			return true;
+		}
+
+		/**
+		 * Moves the oldest value out of the queue, unless it is empty. Must only be called by the consumer.
+		 */
+		bool tryPop(T& value) {
+			auto head = mHead.load(std::memory_order_relaxed);
+			if (head == mTail.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			value = std::move(mSlots[head & mMask]);
+			mHead.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Blocks the consumer until an item is queued. Returns false if stopped first.
+		 */
+		bool wait(const std::stop_token& stopToken) {
+			std::stop_callback wakeOnStop(stopToken, [this]() {
+				mWakeups.fetch_add(1, std::memory_order_release);
+				mWakeups.notify_all();
+			});
+
+			while (true) {
+				auto wakeups = mWakeups.load(std::memory_order_acquire);
+				if (!empty()) {
+					return true;
+				}
+
+				if (stopToken.stop_requested()) {
+					return false;
+				}
+
+				mWakeups.wait(wakeups, std::memory_order_acquire);
+			}
+		}
+	};
+
+	/**
+	 * Bounded queue from any number of producer threads to one consumer thread, which never lock. Each slot carries a
+	 * sequence number telling whether it is free for the producer claiming it, or filled for the consumer.
+	 * The capacity is rounded up to a power of two.
+	 */
+	template<typename T>
+	class MpscQueue {
+	private:
+		static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+		struct Slot {
+			std::atomic<std::size_t> sequence = 0;
+			T value {};
+		};
+
+		std::unique_ptr<Slot[]> mSlots;
+		std::size_t mCapacity;
+		std::size_t mMask;
+
+		// Kept on separate cache lines, as the tail is contended by the producers while the head is only written by the consumer
+		alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> mHead = 0;
+		alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> mTail = 0;
+		alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> mWakeups = 0;
+	public:
+		explicit MpscQueue(std::size_t capacity)
+			: mSlots(std::make_unique<Slot[]>(std::bit_ceil(std::max(capacity, std::size_t(1))))),
+			  mCapacity(std::bit_ceil(std::max(capacity, std::size_t(1)))),
+			  mMask(mCapacity - 1) {
+			for (std::size_t i = 0; i < mCapacity; i++) {
+				mSlots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		std::size_t capacity() const {
+			return mCapacity;
+		}
+
+		/**
+		 * The number of queued items, which is only approximate while producers are pushing
+		 */
+		std::size_t size() const {
+			auto head = mHead.load(std::memory_order_acquire);
+			auto tail = mTail.load(std::memory_order_acquire);
+			return tail > head ? tail - head : 0;
+		}
+
+		/**
+		 * Indicates if there is nothing for the consumer to pop. Must only be called by the consumer.
+		 */
+		bool empty() const {
+			auto head = mHead.load(std::memory_order_relaxed);
+			return mSlots[head & mMask].sequence.load(std::memory_order_acquire) != head + 1;
+		}
+
+		/**
+		 * Moves the given value into the queue, unless it is full. Can be called from any thread.
+		 */
+		bool tryPush(T& value) {
+			auto tail = mTail.load(std::memory_order_relaxed);
+			while (true) {
+				auto& slot = mSlots[tail & mMask];
+				auto sequence = slot.sequence.load(std::memory_order_acquire);
+				auto difference = (std::intptr_t)sequence - (std::intptr_t)tail;
+				if (difference == 0) {
+					// Claims the slot, after which no other producer touches it until the consumer has emptied it
+					if (mTail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+						slot.value = std::move(value);
+						slot.sequence.store(tail + 1, std::memory_order_release);
+						break;
+					}
+				} else if (difference < 0) {
+					// Still holds the value from a lap ago, which the consumer has not popped
+					return false;
+				} else {
+					tail = mTail.load(std::memory_order_relaxed);
+				}
+			}
+
+			mWakeups.fetch_add(1, std::memory_order_release);
+			mWakeups.notify_one();
+			return true;
+		}
+
+		/**
+		 * Moves the oldest value out of the queue, unless it is empty. Must only be called by the consumer.
+		 */
+		bool tryPop(T& value) {
+			auto head = mHead.load(std::memory_order_relaxed);
+			auto& slot = mSlots[head & mMask];
+			if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+				return false;
+			}
+
+			value = std::move(slot.value);
+			slot.sequence.store(head + mCapacity, std::memory_order_release);
+			mHead.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Blocks the consumer until an item is queued. Returns false if stopped first.
+		 */
+		bool wait(const std::stop_token& stopToken) {
+			std::stop_callback wakeOnStop(stopToken, [this]() {
+				mWakeups.fetch_add(1, std::memory_order_release);
+				mWakeups.notify_all();
+			});
+
+			while (true) {
+				auto wakeups = mWakeups.load(std::memory_order_acquire);
+				if (!empty()) {
+					return true;
+				}
+
+				if (stopToken.stop_requested()) {
+					return false;
+				}
+
+				mWakeups.wait(wakeups, std::memory_order_acquire);
+			}
+		}
+	};
+
+	/**
+	 * Hands the latest of the values written by one thread to another, without either waiting or tearing.
+	 * The writer fills the back slot and publishes it as the middle slot, which the reader swaps with its front slot.
+	 * Values the reader did not take in time are overwritten.
+	 */
+	template<typename T>
+	class TripleBuffer {
+	private:
+		static constexpr std::uint8_t INDEX_MASK = 0x3;
+		static constexpr std::uint8_t FRESH_BIT = 0x4; // Set when the middle slot holds a value the reader has not taken
+
+		std::array<T, 3> mSlots {};
+		std::uint8_t mBack = 0;
+		std::atomic<std::uint8_t> mMiddle = 1;
+		std::uint8_t mFront = 2;
+	public:
+		TripleBuffer() = default;
+
+		TripleBuffer(const TripleBuffer&) = delete;
+		TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+		/**
+		 * The slot the writer fills. Must only be used by the writer.
+		 */
+		T& back() {
+			return mSlots[mBack];
+		}
+
+		/**
+		 * Makes the back slot the latest value, and gives the writer a new back slot
+		 */
+		void publish() {
+			auto previous = mMiddle.exchange(mBack | FRESH_BIT, std::memory_order_acq_rel);
+			mBack = previous & INDEX_MASK;
+		}
+
+		/**
+		 * Takes the latest value as the front slot, if one was published since. Must only be used by the reader.
+		 */
+		bool update() {
+			if (!(mMiddle.load(std::memory_order_relaxed) & FRESH_BIT)) {
+				return false;
+			}
+
+			auto previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+			mFront = previous & INDEX_MASK;
+			return true;
+		}
+
+		/**
+		 * The slot the reader uses. Must only be used by the reader.
+		 */
+		T& front() {
+			return mSlots[mFront];
+		}
+	};
 }
\ No newline at end of file
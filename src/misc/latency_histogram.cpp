@@ -0,0 +1,87 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <fmt/format.h>
+
+namespace screenshare::misc {
+	std::size_t LatencyHistogram::bucketIndex(std::uint64_t value) {
+		if (value < SUB_BUCKET_COUNT) {
+			return (std::size_t)value;
+		}
+
+		// Shifted down to between half and all of the sub-buckets, the shift tells the bucket and the rest the sub-bucket
+		auto shift = (std::size_t)std::bit_width(value) - SUB_BUCKET_BITS;
+		auto subBucket = (std::size_t)(value >> shift) - HALF_SUB_BUCKET_COUNT;
+		return SUB_BUCKET_COUNT + (shift - 1) * HALF_SUB_BUCKET_COUNT + subBucket;
+	}
+
+	std::uint64_t LatencyHistogram::highestValueInBucket(std::size_t index) {
+		if (index < SUB_BUCKET_COUNT) {
+			return index;
+		}
+
+		auto shift = (index - SUB_BUCKET_COUNT) / HALF_SUB_BUCKET_COUNT + 1;
+		auto subBucket = (std::uint64_t)((index - SUB_BUCKET_COUNT) % HALF_SUB_BUCKET_COUNT + HALF_SUB_BUCKET_COUNT);
+		return ((subBucket + 1) << shift) - 1;
+	}
+
+	void LatencyHistogram::add(double milliseconds) {
+		auto value = (std::uint64_t)std::llround(std::max(milliseconds, 0.0) * 1.0E3);
+		mCounts[bucketIndex(value)]++;
+		mCount++;
+		mMax = std::max(mMax, value);
+	}
+
+	void LatencyHistogram::merge(const LatencyHistogram& other) {
+		for (std::size_t i = 0; i < BUCKET_COUNT; i++) {
+			mCounts[i] += other.mCounts[i];
+		}
+
+		mCount += other.mCount;
+		mMax = std::max(mMax, other.mMax);
+	}
+
+	void LatencyHistogram::reset() {
+		mCounts.fill(0);
+		mCount = 0;
+		mMax = 0;
+	}
+
+	std::uint64_t LatencyHistogram::count() const {
+		return mCount;
+	}
+
+	double LatencyHistogram::percentile(double fraction) const {
+		if (mCount == 0) {
+			return 0.0;
+		}
+
+		auto target = std::max<std::uint64_t>((std::uint64_t)std::ceil(fraction * (double)mCount), 1);
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i < BUCKET_COUNT; i++) {
+			seen += mCounts[i];
+			if (seen >= target) {
+				return (double)std::min(highestValueInBucket(i), mMax) / 1.0E3;
+			}
+		}
+
+		return max();
+	}
+
+	double LatencyHistogram::max() const {
+		return (double)mMax / 1.0E3;
+	}
+
+	std::string LatencyHistogram::summary() const {
+		return fmt::format(
+			"p50 {:.2f} ms, p99 {:.2f} ms, p99.9 {:.2f} ms, max {:.2f} ms",
+			percentile(0.5),
+			percentile(0.99),
+			percentile(0.999),
+			max()
+		);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace screenshare::misc {
+	/**
+	 * Counts latencies in buckets that double in size, each split into linear sub-buckets, like HdrHistogram. Percentiles are
+	 * within about 6% over any range without keeping the samples. Recording neither allocates nor locks, and is not thread safe.
+	 */
+	class LatencyHistogram {
+	private:
+		static constexpr int SUB_BUCKET_BITS = 5;
+		static constexpr std::size_t SUB_BUCKET_COUNT = std::size_t(1) << SUB_BUCKET_BITS;
+		static constexpr std::size_t HALF_SUB_BUCKET_COUNT = SUB_BUCKET_COUNT / 2;
+		static constexpr std::size_t BUCKET_COUNT = SUB_BUCKET_COUNT + (64 - SUB_BUCKET_BITS) * HALF_SUB_BUCKET_COUNT;
+
+		// Values are in microseconds
+		std::array<std::uint64_t, BUCKET_COUNT> mCounts {};
+		std::uint64_t mCount = 0;
+		std::uint64_t mMax = 0;
+
+		static std::size_t bucketIndex(std::uint64_t value);
+		static std::uint64_t highestValueInBucket(std::size_t index);
+	public:
+		void add(double milliseconds);
+		void merge(const LatencyHistogram& other);
+		void reset();
+
+		std::uint64_t count() const;
+
+		/**
+		 * The latency in milliseconds that the given fraction of the samples are at or below
+		 */
+		double percentile(double fraction) const;
+		double max() const;
+
+		/**
+		 * Formats p50, p99, p99.9 and max
+		 */
+		std::string summary() const;
+	};
+}
\ No newline at end of file
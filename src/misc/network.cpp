@@ -1,4 +1,9 @@
 #include "network.h"
+#include <cerrno>
+#include <cstring>
+
+#include <sys/random.h>
+
 #include <boost/algorithm/string.hpp>
 
 namespace screenshare::misc {
@@ -13,4 +18,25 @@ namespace screenshare::misc {
 			throw std::runtime_error("Expected ':'.");
 		}
 	}
+
+	boost::asio::ip::udp::endpoint udpEndpointFromString(const std::string& endpoint) {
+		auto tcpEndpoint = tcpEndpointFromString(endpoint);
+		return { tcpEndpoint.address(), tcpEndpoint.port() };
+	}
+
+	std::uint64_t randomToken() {
+		std::uint64_t token = 0;
+		while (token == 0) {
+			auto size = getrandom(&token, sizeof(token), 0);
+			if (size < 0 && errno != EINTR) {
+				throw std::runtime_error(std::string("Failed to generate token: ") + std::strerror(errno));
+			}
+
+			if (size != (ssize_t)sizeof(token)) {
+				token = 0;
+			}
+		}
+
+		return token;
+	}
 }
\ No newline at end of file
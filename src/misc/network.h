@@ -1,8 +1,15 @@
 #pragma once
+#include <cstdint>
 #include <string>
 
 #include <boost/asio.hpp>
 
 namespace screenshare::misc {
 	boost::asio::ip::tcp::endpoint tcpEndpointFromString(const std::string& endpoint);
+	boost::asio::ip::udp::endpoint udpEndpointFromString(const std::string& endpoint);
+
+	/**
+	 * A non-zero value from the random source of the kernel, for tokens that must not be guessable
+	 */
+	std::uint64_t randomToken();
 }
\ No newline at end of file
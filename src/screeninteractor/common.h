@@ -30,6 +30,11 @@ namespace screenshare::screeninteractor {
 	public:
 		virtual ~ClientActionHandler() = default;
 		virtual bool handleClientAction(const client::ClientAction& clientAction) = 0;
+
+		/**
+		 * Called after a batch of actions has been handled, which may have been buffered until now
+		 */
+		virtual void flushClientActions() {}
 	};
 
 	class ScreenInteractor : public ScreenGrabber, public ClientActionHandler {
@@ -0,0 +1,119 @@
+#include "synthetic.h"
+#include "../client/actions.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace screenshare::screeninteractor {
+	namespace {
+		constexpr int BYTES_PER_PIXEL = 4;
+		constexpr int BAR_WIDTH = 64;
+		constexpr int BAR_SPEED = 8; // Pixels per frame
+
+		constexpr std::uint8_t BACKGROUND = 96;
+		constexpr std::uint8_t BAR = 192;
+
+		// Limited range luma of black and white is 16 and 235, which leaves a wide margin for encoding errors
+		constexpr int DARK_LUMA = 96;
+		constexpr int BRIGHT_LUMA = 160;
+
+		void fillBlock(std::uint8_t* pixels, int lineSize, int x, int width, int height, std::uint8_t value) {
+			for (int y = 0; y < height; y++) {
+				auto row = pixels + (std::size_t)y * lineSize + (std::size_t)x * BYTES_PER_PIXEL;
+				std::fill(row, row + (std::size_t)width * BYTES_PER_PIXEL, value);
+			}
+		}
+
+		int blockLuma(const std::uint8_t* luma, int lineSize, int blockIndex) {
+			// Only the middle of the block, away from the edges where the encoder smears neighbouring blocks together
+			constexpr int SAMPLE_SIZE = marker::BLOCK_SIZE / 2;
+			constexpr int SAMPLE_OFFSET = (marker::BLOCK_SIZE - SAMPLE_SIZE) / 2;
+
+			int sum = 0;
+			for (int y = SAMPLE_OFFSET; y < SAMPLE_OFFSET + SAMPLE_SIZE; y++) {
+				auto row = luma + (std::size_t)y * lineSize + (std::size_t)blockIndex * marker::BLOCK_SIZE;
+				for (int x = SAMPLE_OFFSET; x < SAMPLE_OFFSET + SAMPLE_SIZE; x++) {
+					sum += row[x];
+				}
+			}
+
+			return sum / (SAMPLE_SIZE * SAMPLE_SIZE);
+		}
+	}
+
+	namespace marker {
+		void draw(std::uint8_t* pixels, int lineSize, std::uint16_t value) {
+			for (int bit = 0; bit < BITS; bit++) {
+				auto set = ((value >> bit) & 1) != 0;
+				fillBlock(pixels, lineSize, 2 * bit * BLOCK_SIZE, BLOCK_SIZE, HEIGHT, set ? 255 : 0);
+				fillBlock(pixels, lineSize, (2 * bit + 1) * BLOCK_SIZE, BLOCK_SIZE, HEIGHT, set ? 0 : 255);
+			}
+		}
+
+		std::optional<std::uint16_t> read(const std::uint8_t* luma, int lineSize, int width, int height) {
+			if (width < WIDTH || height < HEIGHT) {
+				return {};
+			}
+
+			std::uint16_t value = 0;
+			for (int bit = 0; bit < BITS; bit++) {
+				auto first = blockLuma(luma, lineSize, 2 * bit);
+				auto second = blockLuma(luma, lineSize, 2 * bit + 1);
+				if (first >= BRIGHT_LUMA && second <= DARK_LUMA) {
+					value |= (std::uint16_t)(1 << bit);
+				} else if (!(first <= DARK_LUMA && second >= BRIGHT_LUMA)) {
+					return {};
+				}
+			}
+
+			return value;
+		}
+	}
+
+	SyntheticScreenInteractor::SyntheticScreenInteractor(int width, int height)
+		: mWidth(width),
+		  mHeight(height),
+		  mPixels((std::size_t)width * (std::size_t)height * BYTES_PER_PIXEL) {
+		if (width < marker::WIDTH || height < 2 * marker::HEIGHT) {
+			throw std::runtime_error("The synthetic screen is too small for the marker.");
+		}
+	}
+
+	int SyntheticScreenInteractor::width() const {
+		return mWidth;
+	}
+
+	int SyntheticScreenInteractor::height() const {
+		return mHeight;
+	}
+
+	std::optional<GrabbedFrame> SyntheticScreenInteractor::grab() {
+		auto lineSize = mWidth * BYTES_PER_PIXEL;
+		std::fill(mPixels.begin(), mPixels.end(), BACKGROUND);
+
+		// Keeps the encoder busy with some motion below the marker, as a real screen would
+		auto barX = (int)((mFrameIndex * BAR_SPEED) % (std::uint64_t)(mWidth - BAR_WIDTH));
+		auto barY = 2 * marker::HEIGHT;
+		fillBlock(mPixels.data() + (std::size_t)barY * lineSize, lineSize, barX, BAR_WIDTH, mHeight - barY, BAR);
+
+		marker::draw(mPixels.data(), lineSize, mMarker.load());
+		mFrameIndex++;
+
+		return {{
+			mWidth,
+			mHeight,
+			AVPixelFormat::AV_PIX_FMT_BGRA,
+			mPixels.data(),
+			lineSize
+		}};
+	}
+
+	bool SyntheticScreenInteractor::handleClientAction(const client::ClientAction& clientAction) {
+		if (clientAction.type != client::ClientActionType::LatencyProbe) {
+			return false;
+		}
+
+		mMarker.store(clientAction.data.latencyProbe.sequence);
+		return true;
+	}
+}
\ No newline at end of file
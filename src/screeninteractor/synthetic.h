@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "common.h"
+
+namespace screenshare::screeninteractor {
+	/**
+	 * Shows a number as a row of black and white blocks at the top left of a frame, each bit as a pair of blocks of opposite
+	 * colors. The blocks are large and aligned to macroblocks, so the number survives encoding.
+	 */
+	namespace marker {
+		constexpr int BITS = 16;
+		constexpr int BLOCK_SIZE = 16;
+		constexpr int WIDTH = 2 * BITS * BLOCK_SIZE;
+		constexpr int HEIGHT = BLOCK_SIZE;
+
+		void draw(std::uint8_t* pixels, int lineSize, std::uint16_t value);
+
+		/**
+		 * Reads the number from the luma plane of a decoded frame. Returns nothing unless every pair of blocks is clearly
+		 * of opposite colors, as when the frame is still changing over to a new number.
+		 */
+		std::optional<std::uint16_t> read(const std::uint8_t* luma, int lineSize, int width, int height);
+	}
+
+	/**
+	 * Generates frames instead of grabbing them, with a moving bar as content and the sequence number of the latest latency
+	 * probe as marker. Used for measuring the latency from input to the screen changing without a display.
+	 */
+	class SyntheticScreenInteractor : public ScreenInteractor {
+	private:
+		int mWidth;
+		int mHeight;
+		std::vector<std::uint8_t> mPixels;
+		std::uint64_t mFrameIndex = 0;
+		std::atomic<std::uint16_t> mMarker = 0;
+	public:
+		SyntheticScreenInteractor(int width, int height);
+
+		int width() const override;
+		int height() const override;
+
+		std::optional<GrabbedFrame> grab() override;
+		bool handleClientAction(const client::ClientAction& clientAction) override;
+	};
+}
\ No newline at end of file
@@ -1,22 +1,42 @@
 #include "x11.h"
 
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
-#include <thread>
 
 #include <X11/extensions/XTest.h>
 #include <X11/Xutil.h>
+#include <poll.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
 namespace screenshare::screeninteractor {
+	namespace {
+		// How long to wait for the window manager to give the window focus before injecting anyway
+		constexpr std::chrono::milliseconds FOCUS_TIMEOUT { 100 };
+
+		constexpr unsigned int SCROLL_UP_BUTTON = 4;
+		constexpr unsigned int SCROLL_DOWN_BUTTON = 5;
+		constexpr unsigned int SCROLL_LEFT_BUTTON = 6;
+		constexpr unsigned int SCROLL_RIGHT_BUTTON = 7;
+	}
+
 	ScreenInteractorX11::ScreenInteractorX11(const GrabberSpec& spec)
 		: mDisplay(XOpenDisplay(spec.displayName.c_str())),
+		  mInputDisplay(XOpenDisplay(spec.displayName.c_str())),
 		  mWindowId(spec.windowId),
 		  mX11SharedMemory({}) {
 		XWindowAttributes attributes;
 		XGetWindowAttributes(mDisplay, spec.windowId, &attributes);
 		mWidth = attributes.width;
 		mHeight = attributes.height;
+		mRootWindow = attributes.root;
+
+		// Focus changes are tracked from events, instead of activating the window before every injected event.
+		// Queried once after selecting them, as no event arrives for a window that already has focus.
+		mActiveWindowAtom = XInternAtom(mInputDisplay, "_NET_ACTIVE_WINDOW", False);
+		XSelectInput(mInputDisplay, mWindowId, FocusChangeMask);
+		mFocused = queryFocus();
 
 		auto screen = DefaultScreen(mDisplay);
 		mX11SharedMemory.shmseg = 0;
@@ -49,6 +69,7 @@ namespace screenshare::screeninteractor {
 	ScreenInteractorX11::~ScreenInteractorX11() {
 		XShmDetach(mDisplay, &mX11SharedMemory);
 		XDestroyImage(mImage);
+		XCloseDisplay(mInputDisplay);
 		XCloseDisplay(mDisplay);
 	}
 
@@ -75,69 +96,167 @@ namespace screenshare::screeninteractor {
 	}
 
 	bool ScreenInteractorX11::handleClientAction(const client::ClientAction& clientAction) {
+		// Events are only buffered here, and sent when the whole batch has been handled
 		switch (clientAction.type) {
 			case client::ClientActionType::NoAction:
+			case client::ClientActionType::LatencyProbe:
 				break;
 			case client::ClientActionType::KeyPressed: {
 				std::string key { clientAction.data.keyPressed.key };
-				auto keyCode = XKeysymToKeycode(mDisplay, XStringToKeysym(key.c_str()));
+				auto keyCode = XKeysymToKeycode(mInputDisplay, XStringToKeysym(key.c_str()));
 
-				makeWindowActive();
+				ensureFocused();
+				XTestFakeKeyEvent(mInputDisplay, keyCode, True, CurrentTime);
+				XTestFakeKeyEvent(mInputDisplay, keyCode, False, CurrentTime);
+				return true;
+			}
+			case client::ClientActionType::MouseButtonPressed: {
+				auto mouseButton = clientAction.data.mouseButtonPressed.mouseButton;
+				warpPointer(clientAction.data.mouseButtonPressed.x, clientAction.data.mouseButtonPressed.y);
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+				ensureFocused();
+				XTestFakeButtonEvent(mInputDisplay, mouseButton, True, CurrentTime);
+				XTestFakeButtonEvent(mInputDisplay, mouseButton, False, CurrentTime);
+				return true;
+			}
+			case client::ClientActionType::MouseMoved: {
+				warpPointer(clientAction.data.mouseMoved.x, clientAction.data.mouseMoved.y);
+				return true;
+			}
+			case client::ClientActionType::KeyDown:
+			case client::ClientActionType::KeyUp: {
+				auto keyCode = XKeysymToKeycode(mInputDisplay, clientAction.data.key.keySym);
+				if (keyCode == 0) {
+					return false;
+				}
 
-				XTestFakeKeyEvent(mDisplay, keyCode, True, 0);
-				XFlush(mDisplay);
+				ensureFocused();
+				XTestFakeKeyEvent(mInputDisplay, keyCode, clientAction.type == client::ClientActionType::KeyDown, CurrentTime);
+				return true;
+			}
+			case client::ClientActionType::MouseScrolled: {
+				auto& mouseScrolled = clientAction.data.mouseScrolled;
+				warpPointer(mouseScrolled.x, mouseScrolled.y);
 
-				XTestFakeKeyEvent(mDisplay, keyCode, False, 0);
-				XFlush(mDisplay);
+				// Scrolling goes to the window under the pointer, so it does not need focus
+				auto scroll = [&](std::int32_t delta, unsigned int negativeButton, unsigned int positiveButton) {
+					auto button = delta < 0 ? negativeButton : positiveButton;
+					for (std::int32_t step = 0; step < std::abs(delta); step++) {
+						XTestFakeButtonEvent(mInputDisplay, button, True, CurrentTime);
+						XTestFakeButtonEvent(mInputDisplay, button, False, CurrentTime);
+					}
+				};
 
+				scroll(mouseScrolled.deltaY, SCROLL_UP_BUTTON, SCROLL_DOWN_BUTTON);
+				scroll(mouseScrolled.deltaX, SCROLL_LEFT_BUTTON, SCROLL_RIGHT_BUTTON);
 				return true;
 			}
-			case client::ClientActionType::MouseButtonPressed: {
-				auto mouseButton = clientAction.data.mouseButtonPressed.mouseButton;
-				auto x = (int)(clientAction.data.mouseButtonPressed.x * mWidth);
-				auto y = (int)(clientAction.data.mouseButtonPressed.y * mHeight);
+		}
 
-				XWarpPointer(mDisplay, None, mWindowId, 0, 0, 0, 0, x, y);
-				XFlush(mDisplay);
+		return false;
+	}
 
-				makeWindowActive();
+	void ScreenInteractorX11::flushClientActions() {
+		XFlush(mInputDisplay);
+	}
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	void ScreenInteractorX11::warpPointer(double x, double y) {
+		XWarpPointer(mInputDisplay, None, mWindowId, 0, 0, 0, 0, (int)(x * mWidth), (int)(y * mHeight));
+	}
 
-				XTestFakeButtonEvent(mDisplay, mouseButton, True, CurrentTime);
-				XFlush(mDisplay);
+	void ScreenInteractorX11::updateFocus() {
+		while (XPending(mInputDisplay) > 0) {
+			XEvent event {};
+			XNextEvent(mInputDisplay, &event);
 
-				XTestFakeButtonEvent(mDisplay, mouseButton, False, CurrentTime);
-				XFlush(mDisplay);
+			// Focus moving because of grabs, such as while a menu is open, does not mean the window lost it
+			if (event.type == FocusIn) {
+				mFocused = true;
+			} else if (event.type == FocusOut && event.xfocus.mode == NotifyNormal) {
+				mFocused = false;
+				mActivationIgnored = false;
+			}
+		}
+	}
+
+	bool ScreenInteractorX11::queryFocus() {
+		Window focusWindow = None;
+		int revertTo = 0;
+		XGetInputFocus(mInputDisplay, &focusWindow, &revertTo);
+
+		// Keyboard input then goes to the window under the pointer
+		if (focusWindow == PointerRoot) {
+			return true;
+		}
 
+		// Focus can be on a window inside the grabbed one
+		while (focusWindow != None && focusWindow != mRootWindow) {
+			if (focusWindow == (Window)mWindowId) {
 				return true;
 			}
+
+			Window root;
+			Window parent;
+			Window* children = nullptr;
+			unsigned int numChildren = 0;
+			if (!XQueryTree(mInputDisplay, focusWindow, &root, &parent, &children, &numChildren)) {
+				break;
+			}
+
+			if (children != nullptr) {
+				XFree(children);
+			}
+
+			focusWindow = parent;
 		}
 
 		return false;
 	}
 
+	void ScreenInteractorX11::ensureFocused() {
+		updateFocus();
+		if (mFocused || mActivationIgnored) {
+			return;
+		}
+
+		makeWindowActive();
+
+		auto deadline = std::chrono::steady_clock::now() + FOCUS_TIMEOUT;
+		while (!mFocused) {
+			auto timeLeft = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			if (timeLeft.count() <= 0) {
+				break;
+			}
+
+			pollfd connection { ConnectionNumber(mInputDisplay), POLLIN, 0 };
+			poll(&connection, 1, (int)timeLeft.count());
+			updateFocus();
+		}
+
+		// The event can be missed, as when focus ends up on a window inside this one
+		if (!mFocused) {
+			mFocused = queryFocus();
+			mActivationIgnored = !mFocused;
+		}
+	}
+
 	void ScreenInteractorX11::makeWindowActive() {
 		XEvent event {};
 		event.type = ClientMessage;
-		event.xclient.display = mDisplay;
+		event.xclient.display = mInputDisplay;
 		event.xclient.window = mWindowId;
-		event.xclient.message_type = XInternAtom(mDisplay, "_NET_ACTIVE_WINDOW", False);
+		event.xclient.message_type = mActiveWindowAtom;
 		event.xclient.format = 32;
 		event.xclient.data.l[0] = 2L; /* 2 == Message from a window pager */
 		event.xclient.data.l[1] = CurrentTime;
 
-		XWindowAttributes windowAttributes {};
-		XGetWindowAttributes(mDisplay, mWindowId, &windowAttributes);
 		XSendEvent(
-			mDisplay,
-			windowAttributes.screen->root,
+			mInputDisplay,
+			mRootWindow,
 			False,
 			SubstructureNotifyMask | SubstructureRedirectMask,
 			&event
 		);
-		XFlush(mDisplay);
+		XFlush(mInputDisplay);
 	}
 }
\ No newline at end of file
@@ -12,10 +12,19 @@
 #include "../client/actions.h"
 
 namespace screenshare::screeninteractor {
+	/**
+	 * Grabs and controls a window. Client actions use a display connection of their own, so they can be handled on
+	 * another thread than the one grabbing.
+	 */
 	class ScreenInteractorX11 : public ScreenInteractor {
 	private:
 		Display* mDisplay = nullptr;
+		Display* mInputDisplay = nullptr;
 		int mWindowId;
+		Window mRootWindow;
+		Atom mActiveWindowAtom;
+		bool mFocused = false;
+		bool mActivationIgnored = false; // Without a window manager, or one refusing, activating is not retried until focus changes
 		int mWidth;
 		int mHeight;
 
@@ -23,6 +32,10 @@ namespace screenshare::screeninteractor {
 		XImage* mImage = nullptr;
 
 		void makeWindowActive();
+		void updateFocus();
+		bool queryFocus();
+		void ensureFocused();
+		void warpPointer(double x, double y);
 	public:
 		struct GrabberSpec {
 			std::string displayName;
@@ -37,5 +50,6 @@ namespace screenshare::screeninteractor {
 
 		std::optional<GrabbedFrame> grab() override;
 		virtual bool handleClientAction(const client::ClientAction& clientAction) override;
+		virtual void flushClientActions() override;
 	};
 }
\ No newline at end of file
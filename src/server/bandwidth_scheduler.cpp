@@ -0,0 +1,234 @@
+#include "bandwidth_scheduler.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace screenshare::server {
+	bool BandwidthSchedulerConfig::enabled() const {
+		return uplinkRate > 0.0 || viewerCap > 0.0 || controllerCap > 0.0;
+	}
+
+	BandwidthScheduler::BandwidthScheduler(boost::asio::io_context& ioContext, BandwidthSchedulerConfig config)
+		: mStrand(boost::asio::make_strand(ioContext)),
+		  mTimer(mStrand),
+		  mConfig(config),
+		  mTokens((double)config.burstSize),
+		  mLastRefill(Clock::now()),
+		  mLastReport(Clock::now()) {
+
+	}
+
+	std::size_t BandwidthScheduler::chunkSize() const {
+		return mConfig.chunkSize;
+	}
+
+	double BandwidthScheduler::weight(ClientRole role) const {
+		return role == ClientRole::Controller ? mConfig.controllerWeight : mConfig.viewerWeight;
+	}
+
+	double BandwidthScheduler::cap(ClientRole role) const {
+		return role == ClientRole::Controller ? mConfig.controllerCap : mConfig.viewerCap;
+	}
+
+	void BandwidthScheduler::add(ClientId clientId) {
+		boost::asio::post(mStrand, [this, clientId]() {
+			mClients[clientId].capTokens = (double)mConfig.burstSize;
+		});
+	}
+
+	void BandwidthScheduler::setRole(ClientId clientId, ClientRole role) {
+		boost::asio::post(mStrand, [this, clientId, role]() {
+			auto client = mClients.find(clientId);
+			if (client != mClients.end() && client->second.role != role) {
+				client->second.role = role;
+				std::cout << "Client #" << clientId << " is now scheduled as a " << (role == ClientRole::Controller ? "controller" : "viewer") << std::endl;
+			}
+		});
+	}
+
+	void BandwidthScheduler::remove(ClientId clientId) {
+		boost::asio::post(mStrand, [this, clientId]() {
+			auto client = mClients.find(clientId);
+			if (client == mClients.end()) {
+				return;
+			}
+
+			if (client->second.grantHandler) {
+				client->second.grantHandler();
+			}
+
+			std::erase(mWaiting, clientId);
+			mClients.erase(client);
+			if (mTurn == clientId) {
+				mTurn.reset();
+			}
+
+			dispatch();
+		});
+	}
+
+	void BandwidthScheduler::request(ClientId clientId, std::size_t size, GrantHandler grantHandler) {
+		boost::asio::post(mStrand, [this, clientId, size, grantHandler = std::move(grantHandler)]() mutable {
+			auto client = mClients.find(clientId);
+			if (client == mClients.end()) {
+				grantHandler();
+				return;
+			}
+
+			client->second.requestSize = size;
+			client->second.requestTime = Clock::now();
+			client->second.grantHandler = std::move(grantHandler);
+
+			// A client only has one request at a time, so it would otherwise lose its turn whenever it is writing
+			if (mTurn == clientId && client->second.deficit >= (double)size) {
+				mWaiting.push_front(clientId);
+			} else {
+				mWaiting.push_back(clientId);
+			}
+
+			dispatch();
+		});
+	}
+
+	void BandwidthScheduler::idle(ClientId clientId) {
+		boost::asio::post(mStrand, [this, clientId]() {
+			auto client = mClients.find(clientId);
+			if (client != mClients.end() && !client->second.grantHandler) {
+				client->second.deficit = 0.0;
+				if (mTurn == clientId) {
+					mTurn.reset();
+				}
+			}
+		});
+	}
+
+	void BandwidthScheduler::refill(Clock::time_point timeNow) {
+		auto elapsed = std::chrono::duration<double>(timeNow - mLastRefill).count();
+		mLastRefill = timeNow;
+
+		if (mConfig.uplinkRate > 0.0) {
+			mTokens = std::min((double)mConfig.burstSize, mTokens + elapsed * mConfig.uplinkRate);
+		}
+
+		for (auto& [clientId, client] : mClients) {
+			auto clientCap = cap(client.role);
+			if (clientCap > 0.0) {
+				client.capTokens = std::min((double)mConfig.burstSize, client.capTokens + elapsed * clientCap);
+			}
+		}
+	}
+
+	void BandwidthScheduler::dispatch() {
+		refill(Clock::now());
+
+		// Clients held back by their cap are passed over, until every waiting client has been passed over in a row
+		std::optional<double> wait;
+		std::size_t passedOver = 0;
+		while (!mWaiting.empty() && passedOver < mWaiting.size()) {
+			auto clientId = mWaiting.front();
+			auto& client = mClients.at(clientId);
+			auto size = std::min((double)client.requestSize, (double)mConfig.burstSize);
+
+			auto clientCap = cap(client.role);
+			if (clientCap > 0.0 && client.capTokens < size) {
+				auto capWait = (size - client.capTokens) / clientCap;
+				wait = wait ? std::min(*wait, capWait) : capWait;
+				mWaiting.push_back(clientId);
+				mWaiting.pop_front();
+				passedOver++;
+				continue;
+			}
+
+			// The turn of the client ends when it has used up its deficit, and it gets another quantum for the next round
+			if (client.deficit < (double)client.requestSize) {
+				client.deficit += (double)mConfig.quantum * weight(client.role);
+				if (mTurn == clientId) {
+					mTurn.reset();
+				}
+
+				mWaiting.push_back(clientId);
+				mWaiting.pop_front();
+				passedOver = 0;
+				continue;
+			}
+
+			// The link is shared, so the client keeps its turn until there is room
+			if (mConfig.uplinkRate > 0.0 && mTokens < size) {
+				auto linkWait = (size - mTokens) / mConfig.uplinkRate;
+				wait = wait ? std::min(*wait, linkWait) : linkWait;
+				break;
+			}
+
+			mWaiting.pop_front();
+			grant(clientId, client);
+		}
+
+		if (wait) {
+			mTimer.expires_after(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(*wait)));
+			mTimer.async_wait([this](boost::system::error_code error) {
+				if (!error) {
+					dispatch();
+				}
+			});
+		}
+	}
+
+	void BandwidthScheduler::grant(ClientId clientId, ScheduledClient& client) {
+		auto size = (double)client.requestSize;
+		client.deficit -= size;
+		if (mConfig.uplinkRate > 0.0) {
+			mTokens -= size;
+		}
+
+		if (cap(client.role) > 0.0) {
+			client.capTokens -= size;
+		}
+
+		auto wait = std::chrono::duration<double, std::milli>(Clock::now() - client.requestTime).count();
+		auto& statistics = client.statistics;
+		statistics.averageWait = statistics.grantedBytes == 0 ? wait : 0.9 * statistics.averageWait + 0.1 * wait;
+		statistics.maxWait = std::max(statistics.maxWait, wait);
+		statistics.grantedBytes += client.requestSize;
+
+		mTurn = clientId;
+
+		auto grantHandler = std::move(client.grantHandler);
+		client.grantHandler = nullptr;
+		grantHandler();
+	}
+
+	void BandwidthScheduler::reportStatistics() {
+		boost::asio::post(mStrand, [this]() {
+			auto timeNow = Clock::now();
+			auto elapsed = std::chrono::duration<double>(timeNow - mLastReport).count();
+			mLastReport = timeNow;
+			if (elapsed <= 0.0) {
+				return;
+			}
+
+			double totalThroughput = 0.0;
+			for (auto& [clientId, client] : mClients) {
+				auto& statistics = client.statistics;
+				statistics.throughput = (double)(statistics.grantedBytes - client.reportedBytes) / elapsed;
+				client.reportedBytes = statistics.grantedBytes;
+				totalThroughput += statistics.throughput;
+
+				std::cout
+					<< "Client #" << clientId
+					<< " scheduled as " << (client.role == ClientRole::Controller ? "controller" : "viewer")
+					<< " (weight " << weight(client.role) << ")"
+					<< ": " << statistics.throughput * 8.0 / 1.0E6 << " Mbits/s"
+					<< ", grant wait avg " << statistics.averageWait << " ms, max " << statistics.maxWait << " ms"
+					<< std::endl;
+				statistics.maxWait = 0.0;
+			}
+
+			if (mConfig.uplinkRate > 0.0) {
+				std::cout
+					<< "Uplink: " << totalThroughput * 8.0 / 1.0E6 << " of " << mConfig.uplinkRate * 8.0 / 1.0E6 << " Mbits/s"
+					<< ", " << mWaiting.size() << " clients waiting"
+					<< std::endl;
+			}
+		});
+	}
+}
\ No newline at end of file
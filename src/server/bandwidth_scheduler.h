@@ -0,0 +1,118 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+namespace screenshare::server {
+	using ClientId = std::uint64_t;
+
+	/**
+	 * Clients controlling the shared screen are served before passive viewers, as they notice latency the most
+	 */
+	enum class ClientRole {
+		Viewer,
+		Controller
+	};
+
+	struct BandwidthSchedulerConfig {
+		double uplinkRate = 0.0; // In bytes per second, shared by all TCP clients. 0 only applies the caps.
+		std::size_t burstSize = 64 * 1024;
+		std::size_t quantum = 16 * 1024; // Bytes a client of weight 1 can send per round
+		std::size_t chunkSize = 16 * 1024; // Packets are split into chunks of this size, so large ones do not hold up the round
+
+		double viewerWeight = 1.0;
+		double controllerWeight = 4.0;
+		double viewerCap = 0.0; // In bytes per second, 0 for no cap
+		double controllerCap = 0.0;
+
+		bool enabled() const;
+	};
+
+	struct SchedulerStatistics {
+		std::uint64_t grantedBytes = 0;
+		double throughput = 0.0; // In bytes per second, since the previous report
+
+		// Time from a chunk being requested until it is granted, in milliseconds
+		double averageWait = 0.0;
+		double maxWait = 0.0;
+	};
+
+	/**
+	 * Shares the uplink between the TCP clients by deficit round robin. Each round, a client may send a quantum scaled by
+	 * the weight of its role, and a client catching up is held to its share instead of filling the link for everyone.
+	 * Clients are also held to the cap of their role. Runs on a strand of its own, so it can be used from any thread.
+	 */
+	class BandwidthScheduler {
+	public:
+		using GrantHandler = std::function<void ()>;
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct ScheduledClient {
+			ClientRole role = ClientRole::Viewer;
+			double deficit = 0.0;
+			double capTokens = 0.0;
+
+			std::size_t requestSize = 0;
+			Clock::time_point requestTime;
+			GrantHandler grantHandler;
+
+			SchedulerStatistics statistics;
+			std::uint64_t reportedBytes = 0;
+		};
+
+		boost::asio::strand<boost::asio::io_context::executor_type> mStrand;
+		boost::asio::steady_timer mTimer;
+		BandwidthSchedulerConfig mConfig;
+
+		std::unordered_map<ClientId, ScheduledClient> mClients;
+		std::deque<ClientId> mWaiting; // Clients with a request, in round robin order
+		std::optional<ClientId> mTurn; // Served last and with deficit left, so its next request continues the turn
+
+		double mTokens;
+		Clock::time_point mLastRefill;
+		Clock::time_point mLastReport;
+
+		double weight(ClientRole role) const;
+		double cap(ClientRole role) const;
+		void refill(Clock::time_point timeNow);
+		void dispatch();
+		void grant(ClientId clientId, ScheduledClient& client);
+	public:
+		BandwidthScheduler(boost::asio::io_context& ioContext, BandwidthSchedulerConfig config);
+
+		BandwidthScheduler(const BandwidthScheduler&) = delete;
+		BandwidthScheduler& operator=(const BandwidthScheduler&) = delete;
+
+		std::size_t chunkSize() const;
+
+		void add(ClientId clientId);
+		void setRole(ClientId clientId, ClientRole role);
+
+		/**
+		 * Removes the client, granting its pending request so that its sender can see that it is closed
+		 */
+		void remove(ClientId clientId);
+
+		/**
+		 * Requests to send the given number of bytes, calling the handler from the strand of the scheduler once granted.
+		 * A client has at most one request at a time.
+		 */
+		void request(ClientId clientId, std::size_t size, GrantHandler grantHandler);
+
+		/**
+		 * Tells that the client has nothing more to send, which ends its turn and resets its deficit
+		 */
+		void idle(ClientId clientId);
+
+		/**
+		 * Prints the throughput and grant delays per client
+		 */
+		void reportStatistics();
+	};
+}
\ No newline at end of file
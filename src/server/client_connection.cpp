@@ -0,0 +1,531 @@
+#include "client_connection.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace screenshare::server {
+	namespace {
+		using PacketBuffers = std::array<boost::asio::const_buffer, 2>;
+
+		PacketBuffers sliceBuffers(const PacketBuffers& buffers, std::size_t offset, std::size_t size) {
+			PacketBuffers slice;
+			std::size_t count = 0;
+			for (auto& buffer : buffers) {
+				if (size == 0) {
+					break;
+				}
+
+				if (offset >= buffer.size()) {
+					offset -= buffer.size();
+					continue;
+				}
+
+				slice[count] = boost::asio::buffer(buffer + offset, std::min(size, buffer.size() - offset));
+				size -= slice[count].size();
+				offset = 0;
+				count++;
+			}
+
+			return slice;
+		}
+	}
+
+	DropPolicy dropPolicyFromString(const std::string& name) {
+		if (name == "skip-to-keyframe") {
+			return DropPolicy::SkipToKeyframe;
+		} else if (name == "drop-non-reference") {
+			return DropPolicy::DropNonReference;
+		} else if (name == "disconnect") {
+			return DropPolicy::Disconnect;
+		}
+
+		throw std::runtime_error("Unknown drop policy: " + name);
+	}
+
+	ClientConnection::ClientConnection(ClientId id,
+									   Socket socket,
+									   video::protocol::Capabilities capabilities,
+									   ClientConnectionConfig config)
+		: mId(id),
+		  mSocket(std::move(socket)),
+		  mCapabilities(capabilities),
+		  mConfig(config),
+		  mFrameReader(1024),
+		  mPacer(config.pacer),
+		  mPacingTimer(mSocket.get_executor()),
+		  mSendSignal(mSocket.get_executor()),
+		  mLastActivityTime(std::chrono::steady_clock::now().time_since_epoch().count()) {
+
+	}
+
+	ClientConnection::Socket::executor_type ClientConnection::executor() {
+		return mSocket.get_executor();
+	}
+
+	ClientId ClientConnection::id() const {
+		return mId;
+	}
+
+	video::protocol::Capabilities ClientConnection::capabilities() const {
+		return mCapabilities;
+	}
+
+	std::uint64_t ClientConnection::sessionId() const {
+		return mSessionId;
+	}
+
+	void ClientConnection::setSessionId(std::uint64_t sessionId) {
+		mSessionId = sessionId;
+	}
+
+	std::uint64_t ClientConnection::resumeToken() const {
+		return mResumeToken;
+	}
+
+	void ClientConnection::setResumeToken(std::uint64_t resumeToken) {
+		mResumeToken = resumeToken;
+	}
+
+	std::uint32_t ClientConnection::protocolVersion() const {
+		return mProtocolVersion;
+	}
+
+	void ClientConnection::setProtocolVersion(std::uint32_t version) {
+		mProtocolVersion = version;
+	}
+
+	const std::optional<boost::asio::ip::udp::endpoint>& ClientConnection::mediaEndpoint() const {
+		return mMediaEndpoint;
+	}
+
+	void ClientConnection::setMediaEndpoint(boost::asio::ip::udp::endpoint endpoint) {
+		mMediaEndpoint = endpoint;
+	}
+
+	void ClientConnection::setUringSender(UringSender* uringSender) {
+		mUringSender = uringSender;
+	}
+
+	void ClientConnection::setScheduler(BandwidthScheduler* scheduler) {
+		mScheduler = scheduler;
+	}
+
+	const ClientConnectionStatistics& ClientConnection::statistics() const {
+		return mStatistics;
+	}
+
+	std::chrono::steady_clock::duration ClientConnection::idleTime() const {
+		std::chrono::steady_clock::time_point lastActivityTime(std::chrono::steady_clock::duration(mLastActivityTime.load()));
+		return std::chrono::steady_clock::now() - lastActivityTime;
+	}
+
+	void ClientConnection::updateActivityTime() {
+		mLastActivityTime.store(std::chrono::steady_clock::now().time_since_epoch().count());
+	}
+
+	const ReceiverStatistics& ClientConnection::receiverStatistics() const {
+		return mReceiverStatistics;
+	}
+
+	void ClientConnection::handleReceiverReport(const video::protocol::ReceiverReport& receiverReport) {
+		auto timeNow = std::chrono::steady_clock::now();
+		auto& statistics = mReceiverStatistics;
+		if (statistics.reports > 0) {
+			auto elapsed = std::chrono::duration<double>(timeNow - statistics.receivedTime).count();
+			auto decodedFrames = receiverReport.framesDecoded - std::min(receiverReport.framesDecoded, statistics.latest.framesDecoded);
+			statistics.decodedFrameRate = elapsed > 0.0 ? (double)decodedFrames / elapsed : 0.0;
+			statistics.newGaps = receiverReport.gaps - std::min(receiverReport.gaps, statistics.latest.gaps);
+		}
+
+		statistics.latest = receiverReport;
+		statistics.receivedTime = timeNow;
+		statistics.reports++;
+	}
+
+	void ClientConnection::reportStatistics() {
+		boost::asio::post(mSocket.get_executor(), [self = shared_from_this()]() {
+			auto& statistics = self->mStatistics;
+			std::cout
+				<< "Client #" << self->mId
+				<< ": sent " << statistics.sentPackets << " packets (" << (double)statistics.sentBytes / 1.0E6 << " MB)"
+				<< ", dropped " << statistics.droppedPackets
+				<< ", queue delay avg " << statistics.averageQueueDelay << " ms, max " << statistics.maxQueueDelay << " ms"
+				<< std::endl;
+			if (statistics.queueDelays.count() > 0) {
+				std::cout << "Client #" << self->mId << " queue delay: " << statistics.queueDelays.summary() << std::endl;
+			}
+
+			statistics.maxQueueDelay = 0.0;
+			statistics.queueDelays.reset();
+
+			auto& receiverStatistics = self->mReceiverStatistics;
+			if (receiverStatistics.reports > 0) {
+				auto& report = receiverStatistics.latest;
+				std::cout
+					<< "Client #" << self->mId
+					<< " reports: decoded " << report.framesDecoded << "/" << report.framesReceived << " frames"
+					<< " (" << receiverStatistics.decodedFrameRate << " FPS)"
+					<< ", decode errors " << report.decodeErrors
+					<< ", gaps " << report.gaps << " (+" << receiverStatistics.newGaps << ")"
+					<< ", decode time " << report.averageDecodeTime << " ms"
+					<< ", latency avg " << report.averageLatency << " ms, max " << report.maxLatency << " ms"
+					<< ", buffered " << (double)report.bufferedBytes / 1.0E3 << " kB"
+					<< std::endl;
+			}
+		});
+	}
+
+	void ClientConnection::start(MessageHandler messageHandler, CloseHandler closeHandler) {
+		mMessageHandler = std::move(messageHandler);
+		mCloseHandler = std::move(closeHandler);
+
+		boost::asio::co_spawn(mSocket.get_executor(), receiveLoop(shared_from_this()), boost::asio::detached);
+		boost::asio::co_spawn(mSocket.get_executor(), sendLoop(shared_from_this()), boost::asio::detached);
+	}
+
+	boost::asio::awaitable<void> ClientConnection::receiveLoop(std::shared_ptr<ClientConnection> self) {
+		while (!mClosed) {
+			boost::system::error_code error;
+			auto size = co_await mSocket.async_read_some(
+				mFrameReader.prepare(),
+				boost::asio::redirect_error(boost::asio::use_awaitable, error)
+			);
+
+			if (mClosed) {
+				co_return;
+			}
+
+			if (error) {
+				close(error);
+				co_return;
+			}
+
+			mFrameReader.commit(size);
+			updateActivityTime();
+
+			video::protocol::FrameHeader header;
+			video::protocol::MessageReader payload;
+			while (mFrameReader.nextFrame(header, payload, error)) {
+				mMessageHandler(*this, header, payload);
+			}
+
+			if (error) {
+				close(error);
+				co_return;
+			}
+		}
+	}
+
+	void ClientConnection::enqueue(video::network::EncodedPacketPtr packet) {
+		if (mClosed) {
+			return;
+		}
+
+		// A client can only start decoding from a keyframe, both when joining and after dropping packets.
+		if (mWaitingForKeyframe) {
+			if (!packet->isKeyframe()) {
+				mStatistics.droppedPackets++;
+				return;
+			}
+
+			mWaitingForKeyframe = false;
+		}
+
+		if (isBacklogged() && !handleBacklog(*packet)) {
+			return;
+		}
+
+		auto& versionPacket = video::network::packetForVersion(packet, mProtocolVersion);
+		mQueuedBytes += versionPacket->size();
+		mSendQueue.push_back({ versionPacket, std::chrono::steady_clock::now() });
+		mSendSignal.cancel();
+	}
+
+	void ClientConnection::replay(const std::vector<video::network::EncodedPacketPtr>& packets) {
+		if (mClosed) {
+			return;
+		}
+
+		// Whatever is queued follows the gap the client is recovering from, so the replay supersedes it.
+		std::deque<QueuedPacket> keep;
+		if (!mSendQueue.empty() && (mSending || mSentOfCurrent > 0)) {
+			keep.push_back(std::move(mSendQueue.front()));
+		}
+
+		mSendQueue = std::move(keep);
+		mQueuedBytes = mSendQueue.empty() ? 0 : mSendQueue.front().packet->size();
+
+		auto timeNow = std::chrono::steady_clock::now();
+		for (auto& packet : packets) {
+			auto& versionPacket = video::network::packetForVersion(packet, mProtocolVersion);
+			mQueuedBytes += versionPacket->size();
+			mSendQueue.push_back({ versionPacket, timeNow });
+		}
+
+		mWaitingForKeyframe = false;
+		mSendSignal.cancel();
+	}
+
+	void ClientConnection::sendMessage(std::shared_ptr<const video::protocol::MessageWriter> message) {
+		if (mClosed) {
+			return;
+		}
+
+		// Messages are not paced, so they only wait for the rest of a packet that is partly sent
+		mControlQueue.push_back(std::move(message));
+		mSendSignal.cancel();
+		mPacingTimer.cancel();
+	}
+
+	bool ClientConnection::isBacklogged() const {
+		return mSendQueue.size() >= mConfig.maxQueuedPackets || mQueuedBytes >= mConfig.maxQueuedBytes;
+	}
+
+	void ClientConnection::dropQueued(const std::function<bool (const video::network::EncodedPacket&)>& predicate) {
+		// The front packet might be in the middle of being written, so it is always kept.
+		std::deque<QueuedPacket> keep;
+		for (std::size_t i = 0; i < mSendQueue.size(); i++) {
+			auto& queuedPacket = mSendQueue[i];
+			if ((i == 0 && (mSending || mSentOfCurrent > 0)) || !predicate(*queuedPacket.packet)) {
+				keep.push_back(std::move(queuedPacket));
+			} else {
+				mQueuedBytes -= queuedPacket.packet->size();
+				mStatistics.droppedPackets++;
+			}
+		}
+
+		mSendQueue = std::move(keep);
+	}
+
+	bool ClientConnection::handleBacklog(const video::network::EncodedPacket& packet) {
+		switch (mConfig.dropPolicy) {
+			case DropPolicy::Disconnect:
+				std::cout << "Disconnecting client #" << mId << " due to send backlog." << std::endl;
+				close(boost::system::errc::make_error_code(boost::system::errc::no_buffer_space));
+				return false;
+			case DropPolicy::DropNonReference:
+				dropQueued([](const video::network::EncodedPacket& queued) { return queued.isDisposable(); });
+				if (packet.isDisposable()) {
+					mStatistics.droppedPackets++;
+					return false;
+				}
+
+				if (!isBacklogged()) {
+					return true;
+				}
+				[[fallthrough]];
+			case DropPolicy::SkipToKeyframe: {
+				auto droppedBefore = mStatistics.droppedPackets;
+				dropQueued([](const video::network::EncodedPacket&) { return true; });
+
+				if (packet.isKeyframe()) {
+					return true;
+				}
+
+				mStatistics.droppedPackets++;
+				mWaitingForKeyframe = true;
+				std::cout
+					<< "Client #" << mId << " is falling behind, skipping to next keyframe (dropped "
+					<< (mStatistics.droppedPackets - droppedBefore) << " packets)."
+					<< std::endl;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	boost::asio::awaitable<void> ClientConnection::sendLoop(std::shared_ptr<ClientConnection> self) {
+		while (!mClosed) {
+			// Frames cannot be interleaved, so control messages go out as soon as the current packet is complete.
+			if (mSentOfCurrent == 0 && !mControlQueue.empty()) {
+				auto message = std::move(mControlQueue.front());
+				mControlQueue.pop_front();
+
+				boost::system::error_code error;
+				auto size = co_await boost::asio::async_write(
+					mSocket,
+					message->buffer(),
+					boost::asio::redirect_error(boost::asio::use_awaitable, error)
+				);
+
+				if (mClosed) {
+					co_return;
+				}
+
+				if (error) {
+					close(error);
+					co_return;
+				}
+
+				mStatistics.sentBytes += size;
+				updateActivityTime();
+				continue;
+			}
+
+			if (mSendQueue.empty()) {
+				if (mScheduler) {
+					mScheduler->idle(mId);
+				}
+
+				// Woken up by cancelling the wait, whenever something is queued
+				mSendSignal.expires_at(std::chrono::steady_clock::time_point::max());
+				boost::system::error_code error;
+				co_await mSendSignal.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+				continue;
+			}
+
+			auto remaining = mSendQueue.front().packet->size() - mSentOfCurrent;
+			auto chunkSize = mPacer.enabled() ? std::min(remaining, mPacer.chunkSize()) : remaining;
+			if (mScheduler) {
+				chunkSize = std::min(chunkSize, mScheduler->chunkSize());
+			}
+
+			auto delay = mPacer.delay(chunkSize, remaining);
+			if (delay.count() > 0) {
+				mPacingTimer.expires_after(delay);
+				boost::system::error_code error;
+				co_await mPacingTimer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+				continue;
+			}
+
+			// The front packet is kept while waiting, as it is marked as being sent
+			mSending = true;
+			auto packet = mSendQueue.front().packet;
+			if (mScheduler) {
+				co_await waitForGrant(chunkSize);
+				if (mClosed) {
+					co_return;
+				}
+			}
+
+			auto [error, size] = co_await writeChunk(packet, chunkSize);
+			mSending = false;
+
+			if (mClosed) {
+				co_return;
+			}
+
+			if (error) {
+				close(error);
+				co_return;
+			}
+
+			mPacer.consume(size);
+			mStatistics.sentBytes += size;
+			updateActivityTime();
+			mSentOfCurrent += size;
+
+			if (mSentOfCurrent == packet->size()) {
+				packetSent(mSendQueue.front());
+				mSendQueue.pop_front();
+				mQueuedBytes -= packet->size();
+				mSentOfCurrent = 0;
+			}
+		}
+	}
+
+	boost::asio::awaitable<void> ClientConnection::waitForGrant(std::size_t size) {
+		auto token = boost::asio::use_awaitable;
+		co_await boost::asio::async_initiate<decltype(token), void ()>(
+			[this, size](auto handler) {
+				// Granted on the strand of the scheduler, so the coroutine is resumed on the strand of the connection.
+				auto sharedHandler = std::make_shared<decltype(handler)>(std::move(handler));
+				mScheduler->request(mId, size, [executor = mSocket.get_executor(), sharedHandler]() {
+					boost::asio::post(executor, [sharedHandler]() {
+						(*sharedHandler)();
+					});
+				});
+			},
+			token
+		);
+	}
+
+	boost::asio::awaitable<std::pair<boost::system::error_code, std::size_t>> ClientConnection::writeChunk(
+		const video::network::EncodedPacketPtr& packet,
+		std::size_t size
+	) {
+		boost::system::error_code error;
+
+#ifdef SCREENSHARE_IO_URING
+		if (mUringSender != nullptr) {
+			auto token = boost::asio::redirect_error(boost::asio::use_awaitable, error);
+			auto sent = co_await boost::asio::async_initiate<decltype(token), void (boost::system::error_code, std::size_t)>(
+				[this, &packet, size](auto handler) {
+					// The sender completes on its own thread, so the coroutine is resumed on the strand of the connection.
+					auto sharedHandler = std::make_shared<decltype(handler)>(std::move(handler));
+					mUringSender->send(
+						mSocket.native_handle(),
+						packet,
+						mSentOfCurrent,
+						size,
+						[executor = mSocket.get_executor(), sharedHandler](boost::system::error_code error, std::size_t size) {
+							boost::asio::post(executor, [sharedHandler, error, size]() {
+								(*sharedHandler)(error, size);
+							});
+						}
+					);
+				},
+				token
+			);
+			co_return std::make_pair(error, sent);
+		}
+#endif
+
+		auto sent = co_await boost::asio::async_write(
+			mSocket,
+			sliceBuffers(packet->buffers(), mSentOfCurrent, size),
+			boost::asio::redirect_error(boost::asio::use_awaitable, error)
+		);
+		co_return std::make_pair(error, sent);
+	}
+
+	void ClientConnection::packetSent(const QueuedPacket& queuedPacket) {
+		auto queueDelay = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queuedPacket.queuedTime).count();
+
+		mStatistics.sentPackets++;
+		mStatistics.averageQueueDelay = mStatistics.sentPackets == 1 ? queueDelay : 0.9 * mStatistics.averageQueueDelay + 0.1 * queueDelay;
+		mStatistics.maxQueueDelay = std::max(mStatistics.maxQueueDelay, queueDelay);
+		mStatistics.queueDelays.add(queueDelay);
+	}
+
+	void ClientConnection::close() {
+		close({});
+	}
+
+	void ClientConnection::close(boost::system::error_code error) {
+		if (mClosed) {
+			return;
+		}
+
+		mClosed = true;
+		mSendQueue.clear();
+		mControlQueue.clear();
+		mQueuedBytes = 0;
+		mPacingTimer.cancel();
+		mSendSignal.cancel();
+
+#ifdef SCREENSHARE_IO_URING
+		if (mUringSender != nullptr) {
+			mUringSender->cancel(mSocket.native_handle());
+		}
+#endif
+
+		if (mScheduler) {
+			mScheduler->remove(mId);
+		}
+
+		boost::system::error_code closeError;
+		mSocket.close(closeError);
+
+		// Deferred, since the owner typically removes the connection from a container that might be iterated right now.
+		boost::asio::post(
+			mSocket.get_executor(),
+			[self = shared_from_this(), error]() {
+				if (self->mCloseHandler) {
+					self->mCloseHandler(*self, error);
+				}
+			}
+		);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,219 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+
+#include <boost/asio.hpp>
+
+#include "../misc/latency_histogram.h"
+#include "../video/network.h"
+#include "../video/protocol.h"
+#include "bandwidth_scheduler.h"
+#include "send_pacer.h"
+#include "uring_sender.h"
+
+namespace screenshare::server {
+	/**
+	 * What to do with a client whose send queue has grown past the backlog threshold
+	 */
+	enum class DropPolicy {
+		SkipToKeyframe,
+		DropNonReference,
+		Disconnect
+	};
+
+	DropPolicy dropPolicyFromString(const std::string& name);
+
+	struct ClientConnectionConfig {
+		std::size_t maxQueuedPackets = 90;
+		std::size_t maxQueuedBytes = 16 * 1024 * 1024;
+		DropPolicy dropPolicy = DropPolicy::SkipToKeyframe;
+		SendPacerConfig pacer;
+	};
+
+	struct ClientConnectionStatistics {
+		std::uint64_t sentPackets = 0;
+		std::uint64_t sentBytes = 0;
+		std::uint64_t droppedPackets = 0;
+
+		// Time from a packet being queued until it has been completely written, in milliseconds
+		double averageQueueDelay = 0.0;
+		double maxQueueDelay = 0.0;
+		misc::LatencyHistogram queueDelays; // Since the last report
+	};
+
+	/**
+	 * What a client reports about itself, aggregated from its receiver reports
+	 */
+	struct ReceiverStatistics {
+		video::protocol::ReceiverReport latest;
+		std::chrono::steady_clock::time_point receivedTime;
+		std::uint64_t reports = 0;
+
+		// Between the two most recent reports
+		double decodedFrameRate = 0.0;
+		std::uint64_t newGaps = 0;
+	};
+
+	/**
+	 * A connected client with its own bounded queue of outgoing packets, served by coroutines on the strand of its socket.
+	 * Unless stated otherwise, functions must be called from that strand.
+	 */
+	class ClientConnection : public std::enable_shared_from_this<ClientConnection> {
+	public:
+		using Socket = boost::asio::ip::tcp::socket;
+		using MessageHandler = std::function<void (
+			ClientConnection& connection,
+			const video::protocol::FrameHeader& header,
+			video::protocol::MessageReader& payload
+		)>;
+		using CloseHandler = std::function<void (ClientConnection& connection, boost::system::error_code error)>;
+	private:
+		ClientId mId;
+		Socket mSocket;
+		video::protocol::Capabilities mCapabilities;
+		ClientConnectionConfig mConfig;
+
+		std::uint64_t mSessionId = 0;
+		std::uint64_t mResumeToken = 0;
+		std::uint32_t mProtocolVersion = video::protocol::PROTOCOL_VERSION;
+		std::optional<boost::asio::ip::udp::endpoint> mMediaEndpoint;
+
+		video::protocol::FrameReader mFrameReader;
+		MessageHandler mMessageHandler;
+		CloseHandler mCloseHandler;
+
+		struct QueuedPacket {
+			video::network::EncodedPacketPtr packet;
+			std::chrono::steady_clock::time_point queuedTime;
+		};
+
+		std::deque<QueuedPacket> mSendQueue;
+		std::size_t mQueuedBytes = 0;
+		std::size_t mSentOfCurrent = 0;
+		std::deque<std::shared_ptr<const video::protocol::MessageWriter>> mControlQueue;
+		bool mSending = false;
+
+		UringSender* mUringSender = nullptr;
+		BandwidthScheduler* mScheduler = nullptr;
+
+		SendPacer mPacer;
+		boost::asio::steady_timer mPacingTimer;
+		boost::asio::steady_timer mSendSignal;
+		bool mWaitingForKeyframe = true;
+		bool mClosed = false;
+
+		// When anything was last received from or sent to the client, read from other threads
+		std::atomic<std::chrono::steady_clock::rep> mLastActivityTime;
+		void updateActivityTime();
+
+		ClientConnectionStatistics mStatistics;
+		ReceiverStatistics mReceiverStatistics;
+
+		boost::asio::awaitable<void> receiveLoop(std::shared_ptr<ClientConnection> self);
+		boost::asio::awaitable<void> sendLoop(std::shared_ptr<ClientConnection> self);
+		boost::asio::awaitable<void> waitForGrant(std::size_t size);
+		boost::asio::awaitable<std::pair<boost::system::error_code, std::size_t>> writeChunk(
+			const video::network::EncodedPacketPtr& packet,
+			std::size_t size
+		);
+		void packetSent(const QueuedPacket& queuedPacket);
+
+		bool isBacklogged() const;
+		void dropQueued(const std::function<bool (const video::network::EncodedPacket&)>& predicate);
+		bool handleBacklog(const video::network::EncodedPacket& packet);
+
+		void close(boost::system::error_code error);
+	public:
+		ClientConnection(
+			ClientId id,
+			Socket socket,
+			video::protocol::Capabilities capabilities,
+			ClientConnectionConfig config
+		);
+
+		ClientConnection(const ClientConnection&) = delete;
+		ClientConnection& operator=(const ClientConnection&) = delete;
+
+		/**
+		 * The strand the connection runs on
+		 */
+		Socket::executor_type executor();
+
+		// Set before the connection starts and then only read, so these can be used from any thread
+		ClientId id() const;
+		video::protocol::Capabilities capabilities() const;
+
+		std::uint64_t sessionId() const;
+		void setSessionId(std::uint64_t sessionId);
+
+		/**
+		 * The token a client resumes the session with after losing its connection, 0 if it cannot
+		 */
+		std::uint64_t resumeToken() const;
+		void setResumeToken(std::uint64_t resumeToken);
+
+		/**
+		 * The version negotiated with the client, which decides the packet headers it is sent
+		 */
+		std::uint32_t protocolVersion() const;
+		void setProtocolVersion(std::uint32_t version);
+
+		/**
+		 * Where packets are sent when the client uses the UDP transport, known once the client has registered.
+		 * Owned by the stream server, so only used from its strand.
+		 */
+		const std::optional<boost::asio::ip::udp::endpoint>& mediaEndpoint() const;
+		void setMediaEndpoint(boost::asio::ip::udp::endpoint endpoint);
+
+		/**
+		 * Sends packets through the given io_uring sender instead of the socket itself, which must outlive the connection
+		 */
+		void setUringSender(UringSender* uringSender);
+
+		/**
+		 * Sends packets when granted by the given scheduler, which must outlive the connection
+		 */
+		void setScheduler(BandwidthScheduler* scheduler);
+
+		const ClientConnectionStatistics& statistics() const;
+
+		/**
+		 * How long nothing has been received from or sent to the client. Can be called from any thread.
+		 */
+		std::chrono::steady_clock::duration idleTime() const;
+
+		/**
+		 * Empty until the client has sent a receiver report
+		 */
+		const ReceiverStatistics& receiverStatistics() const;
+		void handleReceiverReport(const video::protocol::ReceiverReport& receiverReport);
+
+		/**
+		 * Prints the statistics and resets the maximum queue delay. Can be called from any thread.
+		 */
+		void reportStatistics();
+
+		void start(MessageHandler messageHandler, CloseHandler closeHandler);
+
+		/**
+		 * Queues the given packet, applying the drop policy if the client is not keeping up
+		 */
+		void enqueue(video::network::EncodedPacketPtr packet);
+
+		/**
+		 * Replaces the queued packets with the given ones, which the client needs to continue decoding
+		 */
+		void replay(const std::vector<video::network::EncodedPacketPtr>& packets);
+
+		/**
+		 * Sends a control message, which takes priority over queued packets
+		 */
+		void sendMessage(std::shared_ptr<const video::protocol::MessageWriter> message);
+
+		void close();
+	};
+}
\ No newline at end of file
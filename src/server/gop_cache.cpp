@@ -0,0 +1,51 @@
+#include "gop_cache.h"
+
+namespace screenshare::server {
+	GopCache::GopCache(std::size_t maxBytes)
+		: mMaxBytes(maxBytes) {
+
+	}
+
+	void GopCache::add(video::network::EncodedPacketPtr packet) {
+		if (packet->isKeyframe()) {
+			mPackets.clear();
+			mBytes = 0;
+		} else if (mPackets.empty()) {
+			// Without the keyframe the cached packets cannot be decoded anyway
+			return;
+		}
+
+		// A cache that has grown this large is no longer useful, so wait for the next keyframe.
+		if (mBytes + packet->size() > mMaxBytes) {
+			mPackets.clear();
+			mBytes = 0;
+			return;
+		}
+
+		mBytes += packet->size();
+		mPackets.push_back(std::move(packet));
+	}
+
+	std::optional<std::vector<video::network::EncodedPacketPtr>> GopCache::after(std::int64_t encoderPts) const {
+		if (mPackets.empty() || encoderPts < mPackets.front()->encoderPts) {
+			return {};
+		}
+
+		std::vector<video::network::EncodedPacketPtr> packets;
+		for (auto& packet : mPackets) {
+			if (packet->encoderPts > encoderPts) {
+				packets.push_back(packet);
+			}
+		}
+
+		return packets;
+	}
+
+	const std::deque<video::network::EncodedPacketPtr>& GopCache::packets() const {
+		return mPackets;
+	}
+
+	std::size_t GopCache::bytes() const {
+		return mBytes;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include "../video/network.h"
+
+namespace screenshare::server {
+	/**
+	 * The packets since the most recent keyframe, which is everything needed to start decoding at the live edge
+	 */
+	class GopCache {
+	private:
+		std::deque<video::network::EncodedPacketPtr> mPackets;
+		std::size_t mBytes = 0;
+		std::size_t mMaxBytes;
+	public:
+		explicit GopCache(std::size_t maxBytes = 32 * 1024 * 1024);
+
+		void add(video::network::EncodedPacketPtr packet);
+
+		/**
+		 * Returns the cached packets following the given encoder pts, or nothing if the cache does not reach back that far
+		 */
+		std::optional<std::vector<video::network::EncodedPacketPtr>> after(std::int64_t encoderPts) const;
+
+		const std::deque<video::network::EncodedPacketPtr>& packets() const;
+		std::size_t bytes() const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,425 @@
+#include "http_egress.h"
+
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace screenshare::server {
+	namespace http = boost::beast::http;
+
+	namespace {
+		const std::string TEXT_CONTENT_TYPE = "text/plain";
+		const std::string PLAYLIST_CONTENT_TYPE = "application/vnd.apple.mpegurl";
+
+		std::optional<std::uint64_t> parseNumber(std::string_view text) {
+			std::uint64_t value = 0;
+			auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+			if (error != std::errc() || end != text.data() + text.size()) {
+				return {};
+			}
+
+			return value;
+		}
+
+		std::optional<std::uint64_t> queryValue(std::string_view query, std::string_view name) {
+			while (!query.empty()) {
+				auto separator = query.find('&');
+				auto parameter = query.substr(0, separator);
+				if (parameter.size() > name.size() && parameter.starts_with(name) && parameter[name.size()] == '=') {
+					return parseNumber(parameter.substr(name.size() + 1));
+				}
+
+				query = separator == std::string_view::npos ? std::string_view() : query.substr(separator + 1);
+			}
+
+			return {};
+		}
+
+		// The file name between the given prefix and the extension of segments, such as 12 in /segment/12.m4s
+		std::optional<std::string_view> segmentName(std::string_view path, std::string_view prefix) {
+			constexpr std::string_view extension = ".m4s";
+			if (!path.starts_with(prefix) || !path.ends_with(extension) || path.size() <= prefix.size() + extension.size()) {
+				return {};
+			}
+
+			return path.substr(prefix.size(), path.size() - prefix.size() - extension.size());
+		}
+
+		MediaData toMediaData(const std::string& text) {
+			return std::make_shared<const std::vector<std::uint8_t>>(text.begin(), text.end());
+		}
+	}
+
+	HttpEgress::HttpEgress(boost::asio::io_context& ioContext, HttpEgressConfig config)
+		: mStrand(boost::asio::make_strand(ioContext)),
+		  mAcceptor(mStrand, *config.bind),
+		  mConfig(std::move(config)),
+		  mSegments(mConfig.segmentCount) {
+
+	}
+
+	void HttpEgress::start(const AVCodecParameters* codecParameters, AVRational timeBase, RefreshHandler refreshHandler) {
+		try {
+			mMuxer = std::make_unique<video::fmp4::FragmentMuxer>(codecParameters, timeBase);
+		} catch (const std::exception& error) {
+			std::cout << "Failed to mux the stream for HTTP, not serving it: " << error.what() << std::endl;
+			return;
+		}
+
+		mTimeBase = timeBase;
+		mRefreshHandler = std::move(refreshHandler);
+		mInitSegment = std::make_shared<const std::vector<std::uint8_t>>(mMuxer->initSegment());
+
+		auto codec = video::fmp4::codecString(codecParameters);
+		mContentType = codec.empty() ? "video/mp4" : fmt::format("video/mp4; codecs=\"{}\"", codec);
+
+		boost::asio::co_spawn(mStrand, acceptLoop(), boost::asio::detached);
+	}
+
+	void HttpEgress::add(video::network::EncodedPacketPtr packet) {
+		boost::asio::post(mStrand, [this, packet = std::move(packet)]() {
+			if (mMuxer) {
+				mux(packet);
+			}
+		});
+	}
+
+	double HttpEgress::toSeconds(std::int64_t duration) const {
+		return (double)duration * av_q2d(mTimeBase);
+	}
+
+	void HttpEgress::mux(const video::network::EncodedPacketPtr& packet) {
+		auto pts = packet->packet->pts;
+		auto isKeyframe = packet->isKeyframe();
+
+		if (!mSegmentStartPts) {
+			// Players can only start at a keyframe
+			if (!isKeyframe) {
+				return;
+			}
+
+			mSegmentStartPts = pts;
+			mPartStartPts = pts;
+			mPartStartsSegment = true;
+			mPartIndependent = true;
+		} else {
+			auto segmentDuration = toSeconds(pts - *mSegmentStartPts);
+			auto partTarget = std::chrono::duration<double>(mConfig.partDuration).count();
+			if (isKeyframe && segmentDuration >= std::chrono::duration<double>(mConfig.segmentDuration).count()) {
+				finishPart(pts);
+				mSegmentStartPts = pts;
+				mPartStartsSegment = true;
+				mPartIndependent = true;
+				mRefreshRequested = false;
+			} else if (isKeyframe || (partTarget > 0.0 && toSeconds(pts + 1 - mPartStartPts) > partTarget)) {
+				// Parts are kept within the target, with the packet lasting one tick, and keyframes start parts of their own.
+				finishPart(pts);
+				mPartIndependent = isKeyframe;
+			}
+
+			// Intra refresh streams have no periodic keyframes to cut segments at
+			if (!mRefreshRequested && segmentDuration >= 2.0 * std::chrono::duration<double>(mConfig.segmentDuration).count()) {
+				mRefreshRequested = true;
+				if (mRefreshHandler) {
+					mRefreshHandler();
+				}
+			}
+		}
+
+		mMuxer->add(packet->packet.get());
+	}
+
+	void HttpEgress::finishPart(std::int64_t endPts) {
+		auto data = mMuxer->flush();
+		if (!data.empty()) {
+			mSegments.add(
+				{ std::make_shared<const std::vector<std::uint8_t>>(std::move(data)), toSeconds(endPts - mPartStartPts), mPartIndependent },
+				mPartStartsSegment
+			);
+			mPartStartsSegment = false;
+
+			for (auto timer : mWaiting) {
+				timer->cancel();
+			}
+		}
+
+		mPartStartPts = endPts;
+	}
+
+	bool HttpEgress::partAvailable(std::uint64_t sequence, std::optional<std::size_t> part) const {
+		auto& segments = mSegments.segments();
+		if (segments.empty()) {
+			return false;
+		}
+
+		// Segments already removed have been available
+		if (sequence < segments.front().sequence) {
+			return true;
+		}
+
+		auto segment = mSegments.find(sequence);
+		return segment && (segment->complete || (part && *part < segment->parts.size()));
+	}
+
+	double HttpEgress::targetDuration() const {
+		auto duration = std::chrono::duration<double>(mConfig.segmentDuration).count();
+		for (auto& segment : mSegments.segments()) {
+			duration = std::max(duration, segment.duration);
+		}
+
+		return std::ceil(duration);
+	}
+
+	std::string HttpEgress::playlist() const {
+		auto lowLatency = mConfig.partDuration.count() > 0;
+		auto partTarget = std::chrono::duration<double>(mConfig.partDuration).count();
+		auto& segments = mSegments.segments();
+
+		std::string playlist = "#EXTM3U\n";
+		playlist += fmt::format("#EXT-X-VERSION:{}\n", lowLatency ? 9 : 7);
+		playlist += fmt::format("#EXT-X-TARGETDURATION:{}\n", (int)targetDuration());
+		if (lowLatency) {
+			playlist += fmt::format("#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK={:.3f}\n", 3.0 * partTarget);
+			playlist += fmt::format("#EXT-X-PART-INF:PART-TARGET={:.3f}\n", partTarget);
+		}
+
+		playlist += fmt::format("#EXT-X-MEDIA-SEQUENCE:{}\n", segments.empty() ? 0 : segments.front().sequence);
+		playlist += "#EXT-X-MAP:URI=\"init.mp4\"\n";
+
+		for (std::size_t i = 0; i < segments.size(); i++) {
+			auto& segment = segments[i];
+
+			// Parts are only listed close to the live edge, where low latency players are
+			if (lowLatency && i + 3 >= segments.size()) {
+				for (std::size_t part = 0; part < segment.parts.size(); part++) {
+					playlist += fmt::format(
+						"#EXT-X-PART:DURATION={:.3f},URI=\"part/{}.{}.m4s\"{}\n",
+						segment.parts[part].duration,
+						segment.sequence,
+						part,
+						segment.parts[part].independent ? ",INDEPENDENT=YES" : ""
+					);
+				}
+			}
+
+			if (segment.complete) {
+				playlist += fmt::format("#EXTINF:{:.3f},\nsegment/{}.m4s\n", segment.duration, segment.sequence);
+			}
+		}
+
+		if (lowLatency && !segments.empty()) {
+			playlist += fmt::format("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part/{}.{}.m4s\"\n", segments.back().sequence, segments.back().parts.size());
+		}
+
+		return playlist;
+	}
+
+	boost::asio::awaitable<void> HttpEgress::acceptLoop() {
+		std::cout << "Serving HTTP at " << mAcceptor.local_endpoint() << std::endl;
+
+		while (true) {
+			Socket socket(mStrand);
+
+			boost::system::error_code error;
+			co_await mAcceptor.async_accept(socket, boost::asio::redirect_error(boost::asio::use_awaitable, error));
+			if (error == boost::asio::error::operation_aborted) {
+				co_return;
+			}
+
+			if (error) {
+				std::cout << "Failed to accept HTTP client due to: " << error << std::endl;
+				continue;
+			}
+
+			boost::asio::co_spawn(mStrand, serve(std::move(socket)), boost::asio::detached);
+		}
+	}
+
+	boost::asio::awaitable<void> HttpEgress::serve(Socket socket) {
+		boost::beast::flat_buffer buffer;
+		while (true) {
+			Request request;
+			boost::system::error_code error;
+			co_await http::async_read(socket, buffer, request, boost::asio::redirect_error(boost::asio::use_awaitable, error));
+			if (error) {
+				break;
+			}
+
+			error = co_await handleRequest(socket, request);
+			if (error || !request.keep_alive()) {
+				break;
+			}
+		}
+
+		boost::system::error_code error;
+		socket.shutdown(Socket::shutdown_send, error);
+	}
+
+	boost::asio::awaitable<void> HttpEgress::waitForPart(std::chrono::steady_clock::time_point deadline) {
+		boost::asio::steady_timer timer(mStrand, deadline);
+		mWaiting.insert(&timer);
+
+		boost::system::error_code error;
+		co_await timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+		mWaiting.erase(&timer);
+	}
+
+	boost::asio::awaitable<boost::system::error_code> HttpEgress::handleRequest(Socket& socket, const Request& request) {
+		auto target = std::string_view(request.target().data(), request.target().size());
+		auto querySeparator = target.find('?');
+		auto path = target.substr(0, querySeparator);
+		auto query = querySeparator == std::string_view::npos ? std::string_view() : target.substr(querySeparator + 1);
+
+		if (request.method() != http::verb::get) {
+			co_return co_await respond(socket, request, http::status::method_not_allowed, TEXT_CONTENT_TYPE, {});
+		}
+
+		if (path == "/stream.mp4") {
+			co_return co_await streamFragments(socket, request);
+		}
+
+		if (path == "/init.mp4") {
+			std::vector<MediaData> body { mInitSegment };
+			co_return co_await respond(socket, request, http::status::ok, mContentType, std::move(body));
+		}
+
+		// Blocking playlist reload: held until the given part (or the whole segment) exists, within three target durations
+		auto deadline = std::chrono::steady_clock::now()
+			+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(3.0 * targetDuration()));
+		if (path == "/live.m3u8") {
+			auto sequence = queryValue(query, "_HLS_msn");
+			std::optional<std::size_t> part = queryValue(query, "_HLS_part");
+			if (sequence && mConfig.partDuration.count() > 0) {
+				auto& segments = mSegments.segments();
+				if (*sequence > (segments.empty() ? 0 : segments.back().sequence) + 2) {
+					co_return co_await respond(socket, request, http::status::bad_request, TEXT_CONTENT_TYPE, {});
+				}
+
+				while (!partAvailable(*sequence, part) && std::chrono::steady_clock::now() < deadline) {
+					co_await waitForPart(deadline);
+				}
+			}
+
+			std::vector<MediaData> body { toMediaData(playlist()) };
+			co_return co_await respond(socket, request, http::status::ok, PLAYLIST_CONTENT_TYPE, std::move(body));
+		}
+
+		if (auto name = segmentName(path, "/segment/")) {
+			auto sequence = parseNumber(*name);
+			auto segment = sequence ? mSegments.find(*sequence) : nullptr;
+			if (!segment || !segment->complete) {
+				co_return co_await respond(socket, request, http::status::not_found, TEXT_CONTENT_TYPE, {});
+			}
+
+			std::vector<MediaData> body;
+			for (auto& part : segment->parts) {
+				body.push_back(part.data);
+			}
+
+			co_return co_await respond(socket, request, http::status::ok, mContentType, std::move(body));
+		}
+
+		// The preload hint refers to the part being produced, which is sent as soon as it is done
+		if (auto name = segmentName(path, "/part/")) {
+			auto separator = name->find('.');
+			auto sequence = parseNumber(name->substr(0, separator));
+			auto part = separator == std::string_view::npos ? std::nullopt : parseNumber(name->substr(separator + 1));
+			if (sequence && part) {
+				while (!partAvailable(*sequence, *part) && std::chrono::steady_clock::now() < deadline) {
+					co_await waitForPart(deadline);
+				}
+
+				auto segment = mSegments.find(*sequence);
+				if (segment && *part < segment->parts.size()) {
+					std::vector<MediaData> body { segment->parts[*part].data };
+					co_return co_await respond(socket, request, http::status::ok, mContentType, std::move(body));
+				}
+			}
+
+			co_return co_await respond(socket, request, http::status::not_found, TEXT_CONTENT_TYPE, {});
+		}
+
+		co_return co_await respond(socket, request, http::status::not_found, TEXT_CONTENT_TYPE, {});
+	}
+
+	boost::asio::awaitable<boost::system::error_code> HttpEgress::streamFragments(Socket& socket, const Request& request) {
+		http::response<http::empty_body> response { http::status::ok, request.version() };
+		response.set(http::field::content_type, mContentType);
+		response.set(http::field::cache_control, "no-cache");
+		response.set(http::field::access_control_allow_origin, "*");
+		response.keep_alive(false);
+		response.chunked(true);
+
+		boost::system::error_code error;
+		http::response_serializer<http::empty_body> serializer(response);
+		co_await http::async_write_header(socket, serializer, boost::asio::redirect_error(boost::asio::use_awaitable, error));
+		if (error) {
+			co_return error;
+		}
+
+		co_await boost::asio::async_write(
+			socket,
+			http::make_chunk(boost::asio::buffer(*mInitSegment)),
+			boost::asio::redirect_error(boost::asio::use_awaitable, error)
+		);
+
+		// Starts at the live edge, and continues from there if the client falls behind what is kept
+		std::optional<PartPosition> position;
+		while (!error) {
+			auto& segments = mSegments.segments();
+			if (!position || (!segments.empty() && position->sequence < segments.front().sequence)) {
+				position = mSegments.liveEdge();
+			}
+
+			auto segment = position ? mSegments.find(position->sequence) : nullptr;
+			if (segment && position->part < segment->parts.size()) {
+				auto data = segment->parts[position->part].data;
+				position->part++;
+
+				co_await boost::asio::async_write(
+					socket,
+					http::make_chunk(boost::asio::buffer(*data)),
+					boost::asio::redirect_error(boost::asio::use_awaitable, error)
+				);
+			} else if (segment && segment->complete) {
+				position = PartPosition { position->sequence + 1, 0 };
+			} else {
+				co_await waitForPart(std::chrono::steady_clock::now() + std::chrono::seconds(10));
+			}
+		}
+
+		co_return error;
+	}
+
+	boost::asio::awaitable<boost::system::error_code> HttpEgress::respond(Socket& socket,
+																		  const Request& request,
+																		  http::status status,
+																		  const std::string& contentType,
+																		  std::vector<MediaData> body) {
+		std::vector<boost::asio::const_buffer> buffers;
+		std::size_t size = 0;
+		for (auto& data : body) {
+			buffers.push_back(boost::asio::buffer(*data));
+			size += data->size();
+		}
+
+		http::response<http::empty_body> response { status, request.version() };
+		response.set(http::field::content_type, contentType);
+		response.set(http::field::cache_control, "no-cache");
+		response.set(http::field::access_control_allow_origin, "*");
+		response.keep_alive(request.keep_alive());
+		response.content_length(size);
+
+		boost::system::error_code error;
+		http::response_serializer<http::empty_body> serializer(response);
+		co_await http::async_write_header(socket, serializer, boost::asio::redirect_error(boost::asio::use_awaitable, error));
+		if (!error && size > 0) {
+			co_await boost::asio::async_write(socket, buffers, boost::asio::redirect_error(boost::asio::use_awaitable, error));
+		}
+
+		co_return error;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "../video/common.h"
+#include "../video/fmp4.h"
+#include "../video/network.h"
+#include "segment_ring.h"
+
+namespace screenshare::server {
+	struct HttpEgressConfig {
+		std::optional<boost::asio::ip::tcp::endpoint> bind; // Nothing is served over HTTP when not set
+		std::chrono::milliseconds segmentDuration { 2000 }; // Segments are cut at the first keyframe after this long
+		std::chrono::milliseconds partDuration { 200 }; // 0 disables low latency HLS, cutting fragments only at segments
+		std::size_t segmentCount = 6;
+	};
+
+	/**
+	 * Serves the stream over HTTP as fragmented MP4 muxed from the encoded packets, so browsers can watch without a second encode:
+	 * - /stream.mp4: the init segment followed by fragments as they are produced, for Media Source Extensions
+	 * - /live.m3u8: an HLS playlist, with low latency parts and blocking playlist reloads when parts are enabled
+	 * - /init.mp4, /segment/<sequence>.m4s and /part/<sequence>.<part>.m4s: what the playlist refers to
+	 * Both the muxing and the requests run on one strand, which serves everything from the segments kept in memory.
+	 */
+	class HttpEgress {
+	public:
+		using RefreshHandler = std::function<void ()>;
+	private:
+		using Socket = boost::asio::ip::tcp::socket;
+		using Request = boost::beast::http::request<boost::beast::http::empty_body>;
+
+		boost::asio::strand<boost::asio::io_context::executor_type> mStrand;
+		boost::asio::ip::tcp::acceptor mAcceptor;
+		HttpEgressConfig mConfig;
+
+		std::unique_ptr<video::fmp4::FragmentMuxer> mMuxer;
+		AVRational mTimeBase { 0, 0 };
+		std::string mContentType;
+		MediaData mInitSegment;
+		RefreshHandler mRefreshHandler;
+
+		SegmentRing mSegments;
+		std::optional<std::int64_t> mSegmentStartPts;
+		std::int64_t mPartStartPts = 0;
+		bool mPartStartsSegment = false;
+		bool mPartIndependent = false;
+		bool mRefreshRequested = false;
+
+		// Timers of the requests waiting for parts not yet produced, which are cancelled when a part is added
+		std::unordered_set<boost::asio::steady_timer*> mWaiting;
+
+		double toSeconds(std::int64_t duration) const;
+		void mux(const video::network::EncodedPacketPtr& packet);
+		void finishPart(std::int64_t endPts);
+		bool partAvailable(std::uint64_t sequence, std::optional<std::size_t> part) const;
+		double targetDuration() const;
+		std::string playlist() const;
+
+		boost::asio::awaitable<void> acceptLoop();
+		boost::asio::awaitable<void> serve(Socket socket);
+		boost::asio::awaitable<void> waitForPart(std::chrono::steady_clock::time_point deadline);
+
+		boost::asio::awaitable<boost::system::error_code> handleRequest(Socket& socket, const Request& request);
+		boost::asio::awaitable<boost::system::error_code> streamFragments(Socket& socket, const Request& request);
+		boost::asio::awaitable<boost::system::error_code> respond(
+			Socket& socket,
+			const Request& request,
+			boost::beast::http::status status,
+			const std::string& contentType,
+			std::vector<MediaData> body
+		);
+	public:
+		HttpEgress(boost::asio::io_context& ioContext, HttpEgressConfig config);
+
+		HttpEgress(const HttpEgress&) = delete;
+		HttpEgress& operator=(const HttpEgress&) = delete;
+
+		/**
+		 * Starts serving the stream described by the given codec parameters. The refresh handler is called when a segment
+		 * has gone on for long without a keyframe, as with intra refresh.
+		 */
+		void start(const AVCodecParameters* codecParameters, AVRational timeBase, RefreshHandler refreshHandler);
+
+		/**
+		 * Muxes the packet into the current part. Can be called from any thread.
+		 */
+		void add(video::network::EncodedPacketPtr packet);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "relay.h"
+#include "../video/clock_sync.h"
+
+#include <iostream>
+
+namespace screenshare::server {
+	Relay::Relay(boost::asio::ip::tcp::endpoint upstream, boost::asio::ip::tcp::endpoint bind, StreamServerConfig config)
+		: mUpstream(upstream),
+		  mBind(bind),
+		  mConfig(std::move(config)) {
+
+	}
+
+	void Relay::run() {
+		boost::asio::io_context upstreamIOContext;
+		boost::asio::ip::tcp::socket socket(upstreamIOContext);
+		socket.connect(mUpstream);
+
+		// Remote input is not forwarded, so only packets and keyframes are requested from upstream.
+		video::network::AVCodecParametersReceiver codecParameterReceiver(
+			socket,
+			video::protocol::capabilityBit(video::protocol::Capability::ClockSync)
+				| video::protocol::capabilityBit(video::protocol::Capability::Recovery)
+		);
+		std::cout
+			<< "Relaying " << mUpstream
+			<< " (" << codecParameterReceiver.codecParameters()->width << "x" << codecParameterReceiver.codecParameters()->height << ")"
+			<< std::endl;
+
+		// Clients can only recover through the relay when it can in turn ask upstream for a keyframe.
+		auto canRecover = video::protocol::hasCapability(
+			codecParameterReceiver.serverHello().capabilities,
+			video::protocol::Capability::Recovery
+		);
+		mStreamServer = std::make_unique<StreamServer>(
+			mIOContext,
+			mBind,
+			mConfig,
+			canRecover ? video::protocol::capabilityBit(video::protocol::Capability::Recovery) : 0
+		);
+
+		StreamServer::RefreshHandler refreshHandler;
+		if (canRecover) {
+			refreshHandler = [this]() {
+				mRefreshRequested = true;
+			};
+		}
+
+		mStreamServer->start(
+			codecParameterReceiver.codecParameters(),
+			codecParameterReceiver.timeBase(),
+			{},
+			std::move(refreshHandler)
+		);
+
+		// Packets keep the send time of the origin, converted to the clock of the relay which its own clients synchronize with.
+		auto syncClock = video::protocol::hasCapability(
+			codecParameterReceiver.serverHello().capabilities,
+			video::protocol::Capability::ClockSync
+		);
+		video::clocksync::ClockSynchronizer clockSynchronizer;
+
+		video::network::PacketReceiver packetReceiver;
+		packetReceiver.setProtocolVersion(codecParameterReceiver.serverHello().version);
+		packetReceiver.setMessageHandler([&](const video::protocol::FrameHeader& header, video::protocol::MessageReader& payload) {
+			video::protocol::ClockSync clockSync;
+			if (header.type == video::protocol::MessageType::ClockSyncResponse && video::protocol::readClockSync(payload, clockSync)) {
+				clockSynchronizer.handleResponse(clockSync, video::clocksync::currentTime());
+			}
+		});
+
+		std::unique_ptr<AVPacket, video::AVPacketDeleter> packet(av_packet_alloc());
+		if (!packet) {
+			throw std::runtime_error("Failed to allocate memory for AVPacket");
+		}
+
+		std::int64_t lastEncoderPts = -1;
+		while (true) {
+			if (mRefreshRequested.exchange(false)) {
+				// The relay has everything upstream sent, so only its clients are missing a keyframe
+				video::protocol::MessageWriter writer(video::protocol::MessageType::RecoveryRequest);
+				video::protocol::writeRecoveryRequest(writer, { .lastDecodedPts = lastEncoderPts, .keyframe = true });
+				writer.finish();
+
+				boost::system::error_code error;
+				boost::asio::write(socket, writer.buffer(), error);
+				if (error) {
+					std::cout << "Upstream closed due to: " << error << std::endl;
+					break;
+				}
+			}
+
+			if (syncClock && clockSynchronizer.shouldRequest()) {
+				boost::system::error_code error;
+				boost::asio::write(socket, clockSynchronizer.createRequest().buffer(), error);
+				if (error) {
+					std::cout << "Upstream closed due to: " << error << std::endl;
+					break;
+				}
+			}
+
+			video::network::PacketHeader header;
+			if (auto error = packetReceiver.receive(socket, packet.get(), header)) {
+				std::cout << "Upstream closed due to: " << error << std::endl;
+				break;
+			}
+
+			lastEncoderPts = header.encoderPts;
+			header.sendTime = video::clocksync::toTimespec(
+				clockSynchronizer.toLocalTime(video::clocksync::toNanoseconds(header.sendTime))
+			);
+
+			// The relayed packet shares the received buffer, so the next packet is received into a new one.
+			mStreamServer->broadcast(std::make_shared<video::network::EncodedPacket>(header, packet.get()));
+		}
+
+		mStreamServer->stop();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include <atomic>
+#include <memory>
+
+#include <boost/asio.hpp>
+
+#include "stream_server.h"
+
+namespace screenshare::server {
+	/**
+	 * Receives the stream of an upstream server and serves the encoded packets as they are to its own clients.
+	 * Relays can be chained to distribute a stream as a tree.
+	 */
+	class Relay {
+	private:
+		boost::asio::ip::tcp::endpoint mUpstream;
+		boost::asio::ip::tcp::endpoint mBind;
+		StreamServerConfig mConfig;
+
+		boost::asio::io_context mIOContext;
+		std::unique_ptr<StreamServer> mStreamServer; // Created once the capabilities of upstream are known
+
+		// Set by clients that need a keyframe, and sent upstream in between receiving packets
+		std::atomic<bool> mRefreshRequested = false;
+	public:
+		Relay(boost::asio::ip::tcp::endpoint upstream, boost::asio::ip::tcp::endpoint bind, StreamServerConfig config = {});
+
+		void run();
+	};
+}
\ No newline at end of file
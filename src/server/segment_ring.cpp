@@ -0,0 +1,70 @@
+#include "segment_ring.h"
+
+namespace screenshare::server {
+	std::size_t MediaSegment::size() const {
+		std::size_t size = 0;
+		for (auto& part : parts) {
+			size += part.data->size();
+		}
+
+		return size;
+	}
+
+	SegmentRing::SegmentRing(std::size_t maxSegments)
+		: mMaxSegments(maxSegments) {
+
+	}
+
+	void SegmentRing::add(MediaPart part, bool startsSegment) {
+		if (startsSegment || mSegments.empty()) {
+			if (!mSegments.empty()) {
+				mSegments.back().complete = true;
+			}
+
+			MediaSegment segment;
+			segment.sequence = mNextSequence++;
+			mSegments.push_back(std::move(segment));
+
+			while (mSegments.size() > mMaxSegments + 1) {
+				mSegments.pop_front();
+			}
+		}
+
+		auto& segment = mSegments.back();
+		segment.duration += part.duration;
+		segment.parts.push_back(std::move(part));
+	}
+
+	const std::deque<MediaSegment>& SegmentRing::segments() const {
+		return mSegments;
+	}
+
+	const MediaSegment* SegmentRing::find(std::uint64_t sequence) const {
+		if (mSegments.empty() || sequence < mSegments.front().sequence || sequence > mSegments.back().sequence) {
+			return nullptr;
+		}
+
+		return &mSegments[sequence - mSegments.front().sequence];
+	}
+
+	bool SegmentRing::contains(std::uint64_t sequence, std::optional<std::size_t> part) const {
+		auto segment = find(sequence);
+		if (!segment) {
+			return false;
+		}
+
+		return part ? *part < segment->parts.size() : segment->complete;
+	}
+
+	std::optional<PartPosition> SegmentRing::liveEdge() const {
+		for (auto segment = mSegments.rbegin(); segment != mSegments.rend(); ++segment) {
+			for (auto part = segment->parts.size(); part > 0; part--) {
+				if (segment->parts[part - 1].independent) {
+					return PartPosition { segment->sequence, part - 1 };
+				}
+			}
+		}
+
+		return {};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace screenshare::server {
+	using MediaData = std::shared_ptr<const std::vector<std::uint8_t>>;
+
+	/**
+	 * A fragment of a segment, which is served on its own to low latency players
+	 */
+	struct MediaPart {
+		MediaData data;
+		double duration = 0.0; // In seconds
+		bool independent = false; // Starts with a keyframe
+	};
+
+	struct MediaSegment {
+		std::uint64_t sequence = 0;
+		std::vector<MediaPart> parts;
+		double duration = 0.0;
+		bool complete = false;
+
+		std::size_t size() const;
+	};
+
+	struct PartPosition {
+		std::uint64_t sequence = 0;
+		std::size_t part = 0;
+	};
+
+	/**
+	 * The most recent segments of a stream, kept in memory for serving over HTTP. Segments always start with a keyframe,
+	 * and the last one is open until the next segment starts.
+	 */
+	class SegmentRing {
+	private:
+		std::size_t mMaxSegments;
+		std::deque<MediaSegment> mSegments;
+		std::uint64_t mNextSequence = 0;
+	public:
+		/**
+		 * Creates a ring keeping the given number of complete segments, besides the open one
+		 */
+		explicit SegmentRing(std::size_t maxSegments = 6);
+
+		/**
+		 * Adds the part to the open segment, or completes that segment and starts a new one with the part
+		 */
+		void add(MediaPart part, bool startsSegment);
+
+		const std::deque<MediaSegment>& segments() const;
+		const MediaSegment* find(std::uint64_t sequence) const;
+
+		/**
+		 * Indicates if the given part exists, or with no part given, if the segment is complete
+		 */
+		bool contains(std::uint64_t sequence, std::optional<std::size_t> part) const;
+
+		/**
+		 * The latest part starting with a keyframe, which is where a new viewer starts
+		 */
+		std::optional<PartPosition> liveEdge() const;
+	};
+}
\ No newline at end of file
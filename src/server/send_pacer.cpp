@@ -0,0 +1,50 @@
+#include "send_pacer.h"
+
+#include <algorithm>
+
+namespace screenshare::server {
+	SendPacer::SendPacer(SendPacerConfig config)
+		: mConfig(config),
+		  mTokens((double)config.burstSize),
+		  mLastRefill(Clock::now()) {
+
+	}
+
+	bool SendPacer::enabled() const {
+		return mConfig.rate > 0.0;
+	}
+
+	std::size_t SendPacer::chunkSize() const {
+		return mConfig.chunkSize;
+	}
+
+	void SendPacer::refill(double rate) {
+		auto timeNow = Clock::now();
+		auto elapsed = std::chrono::duration<double>(timeNow - mLastRefill).count();
+		mTokens = std::min((double)mConfig.burstSize, mTokens + elapsed * rate);
+		mLastRefill = timeNow;
+	}
+
+	std::chrono::microseconds SendPacer::delay(std::size_t chunkSize, std::size_t remainingSize) {
+		if (!enabled()) {
+			return {};
+		}
+
+		auto frameInterval = std::chrono::duration<double>(mConfig.frameInterval).count();
+		auto rate = std::max(mConfig.rate, (double)remainingSize / frameInterval);
+		refill(rate);
+
+		auto missing = std::min((double)chunkSize, (double)mConfig.burstSize) - mTokens;
+		if (missing <= 0.0) {
+			return {};
+		}
+
+		return std::chrono::microseconds((std::int64_t)(1.0E6 * missing / rate));
+	}
+
+	void SendPacer::consume(std::size_t size) {
+		if (enabled()) {
+			mTokens -= (double)size;
+		}
+	}
+}
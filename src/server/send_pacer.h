@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+namespace screenshare::server {
+	struct SendPacerConfig {
+		double rate = 0.0; // In bytes per second, 0 disables pacing
+		std::size_t burstSize = 64 * 1024;
+		std::size_t chunkSize = 16 * 1024;
+		std::chrono::microseconds frameInterval { 33333 };
+	};
+
+	/**
+	 * Token bucket that spreads large packets over time. A packet is never paced slower than what is needed to
+	 * send it within one frame interval, so pacing smooths out keyframe bursts without building up latency.
+	 */
+	class SendPacer {
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		SendPacerConfig mConfig;
+		double mTokens;
+		Clock::time_point mLastRefill;
+
+		void refill(double rate);
+	public:
+		explicit SendPacer(SendPacerConfig config);
+
+		bool enabled() const;
+		std::size_t chunkSize() const;
+
+		/**
+		 * Returns how long to wait before the next chunk can be sent, given the bytes remaining of the current packet
+		 */
+		std::chrono::microseconds delay(std::size_t chunkSize, std::size_t remainingSize);
+
+		void consume(std::size_t size);
+	};
+}
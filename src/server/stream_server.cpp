@@ -0,0 +1,533 @@
+#include "stream_server.h"
+#include "../misc/network.h"
+#include "../video/clock_sync.h"
+
+#include <iostream>
+
+namespace screenshare::server {
+	StreamServer::StreamServer(boost::asio::io_context& ioContext,
+							   boost::asio::ip::tcp::endpoint bind,
+							   StreamServerConfig config,
+							   video::protocol::Capabilities capabilities)
+		: mIOContext(ioContext),
+		  mStrand(boost::asio::make_strand(ioContext)),
+		  mAcceptor(mStrand, bind),
+		  mStatisticsTimer(mStrand),
+		  mConfig(std::move(config)),
+		  mCapabilities(capabilities) {
+		std::cout << "Running at " << bind << std::endl;
+
+		if (mConfig.udp.enabled) {
+			mUdpSender = std::make_unique<video::udp::UdpSender>(
+				mStrand,
+				boost::asio::ip::udp::endpoint(bind.address(), mAcceptor.local_endpoint().port()),
+				mConfig.udp
+			);
+			std::cout << "UDP transport at " << mUdpSender->socket().local_endpoint() << std::endl;
+			if (mUdpSender->multicastGroup()) {
+				std::cout << "Multicast to " << *mUdpSender->multicastGroup() << std::endl;
+			}
+		}
+
+		if (mConfig.uring.enabled) {
+#ifdef SCREENSHARE_IO_URING
+			try {
+				mUringSender = std::make_unique<UringSender>(mIOContext, mConfig.uring);
+				std::cout << "Sending through io_uring" << (mUringSender->zeroCopy() ? " with zero copy" : "") << std::endl;
+			} catch (const std::exception& error) {
+				std::cout << "Failed to use io_uring, using the default send path: " << error.what() << std::endl;
+			}
+#else
+			std::cout << "Built without io_uring support, using the default send path" << std::endl;
+#endif
+		}
+
+		if (!mConfig.sharedMemory.name.empty()) {
+			mSharedMemoryWriter = std::make_unique<video::shm::SharedMemoryWriter>(mConfig.sharedMemory);
+			std::cout << "Shared memory transport at " << mConfig.sharedMemory.name << std::endl;
+		}
+
+		if (mConfig.http.bind) {
+			mHttpEgress = std::make_unique<HttpEgress>(mIOContext, mConfig.http);
+		}
+
+		if (mConfig.scheduler.enabled()) {
+			mScheduler = std::make_unique<BandwidthScheduler>(mIOContext, mConfig.scheduler);
+			if (mConfig.scheduler.uplinkRate > 0.0) {
+				std::cout << "Scheduling an uplink of " << mConfig.scheduler.uplinkRate * 8.0 / 1.0E6 << " Mbits/s" << std::endl;
+			}
+		}
+	}
+
+	void StreamServer::start(const AVCodecParameters* codecParameters,
+							 AVRational timeBase,
+							 MessageHandler messageHandler,
+							 RefreshHandler refreshHandler) {
+		mCodecParameters = decltype(mCodecParameters) { avcodec_parameters_alloc() };
+		if (!mCodecParameters || avcodec_parameters_copy(mCodecParameters.get(), codecParameters) < 0) {
+			throw std::runtime_error("Failed to copy codec parameters.");
+		}
+
+		mTimeBase = timeBase;
+		mMessageHandler = std::move(messageHandler);
+		mRefreshHandler = std::move(refreshHandler);
+		mConfig.clientConnection.pacer.frameInterval = std::chrono::microseconds((std::int64_t)(1.0E6 * av_q2d(timeBase)));
+
+		boost::asio::co_spawn(mStrand, acceptLoop(), boost::asio::detached);
+		boost::asio::co_spawn(mStrand, statisticsLoop(), boost::asio::detached);
+
+		if (mHttpEgress) {
+			mHttpEgress->start(mCodecParameters.get(), timeBase, mRefreshHandler);
+		}
+
+		if (mUdpSender) {
+			mUdpSender->start([this](const boost::asio::ip::udp::endpoint& sender, const std::uint8_t* data, std::size_t size) {
+				handleDatagram(sender, data, size);
+			});
+		}
+
+		auto numThreads = mConfig.ioThreads > 0 ? mConfig.ioThreads : std::max(1U, std::thread::hardware_concurrency());
+		for (std::size_t i = 0; i < numThreads; i++) {
+			mThreads.emplace_back([this](std::stop_token stopToken) {
+				boost::system::error_code error;
+
+				while (!error.failed() && !stopToken.stop_requested()) {
+					mIOContext.run(error);
+				}
+
+				if (error) {
+					std::cout << "Context done with error: " << error << std::endl;
+				}
+			});
+		}
+	}
+
+	StreamServer::~StreamServer() {
+		stop();
+	}
+
+	void StreamServer::stop() {
+		for (auto& thread : mThreads) {
+			thread.request_stop();
+		}
+
+		mIOContext.stop();
+		mThreads.clear();
+	}
+
+	boost::asio::ip::tcp::endpoint StreamServer::endpoint() const {
+		return mAcceptor.local_endpoint();
+	}
+
+	boost::asio::awaitable<void> StreamServer::acceptLoop() {
+		while (true) {
+			// Every client gets its own strand, so that the clients are served in parallel by the threads of the io context.
+			Socket socket(boost::asio::make_strand(mIOContext));
+
+			boost::system::error_code error;
+			co_await mAcceptor.async_accept(socket, boost::asio::redirect_error(boost::asio::use_awaitable, error));
+			if (error == boost::asio::error::operation_aborted) {
+				co_return;
+			}
+
+			if (error) {
+				std::cout << "Failed to accept client due to: " << error << std::endl;
+				continue;
+			}
+
+			video::protocol::ServerHello offer;
+			offer.capabilities = serverCapabilities();
+			// Anyone who knows these can take over the stream of the client, so they must not be guessable
+			offer.sessionId = misc::randomToken();
+			offer.resumeToken = misc::randomToken();
+			if (mUdpSender && mUdpSender->multicastGroup()) {
+				offer.multicastAddress = mUdpSender->multicastGroup()->address().to_string();
+				offer.multicastPort = mUdpSender->multicastGroup()->port();
+				offer.multicastKey = mUdpSender->multicastKey();
+			}
+			offer.sharedMemoryName = mConfig.sharedMemory.name;
+
+			// The handshake runs on the strand of the client, so that a slow client does not hold up accepting others.
+			auto executor = socket.get_executor();
+			boost::asio::co_spawn(executor, handshake(std::move(socket), mNextClientId++, std::move(offer)), boost::asio::detached);
+		}
+	}
+
+	boost::asio::awaitable<void> StreamServer::handshake(Socket socket, ClientId clientId, video::protocol::ServerHello offer) {
+		video::protocol::ClientHello clientHello;
+		auto error = co_await video::network::receiveClientHello(socket, clientHello);
+		if (error) {
+			std::cout << "Failed to receive client hello due to: " << error << std::endl;
+			co_return;
+		}
+
+		// A resumed session keeps its session id and token, and continues from the last packet the client decoded.
+		std::optional<std::int64_t> resumeFrom;
+		if (video::protocol::hasCapability(clientHello.capabilities & offer.capabilities, video::protocol::Capability::Resumption)
+			&& clientHello.resumeToken != 0) {
+			auto sessionId = co_await boost::asio::co_spawn(mStrand, resumeSession(clientHello.resumeToken), boost::asio::use_awaitable);
+			if (sessionId) {
+				offer.sessionId = *sessionId;
+				offer.resumeToken = clientHello.resumeToken;
+				offer.resumed = true;
+				resumeFrom = clientHello.lastDecodedPts;
+			}
+		}
+
+		video::protocol::ServerHello serverHello;
+		error = co_await video::network::answerClientHello(
+			socket,
+			mCodecParameters.get(),
+			mTimeBase,
+			clientHello,
+			offer,
+			serverHello
+		);
+
+		if (error) {
+			std::cout << "Failed to send codec parameters due to: " << error << std::endl;
+			co_return;
+		}
+
+		std::cout
+			<< "Accepted client #" << clientId << ": " << socket.remote_endpoint(error)
+			<< " (protocol version: " << serverHello.version << ", capabilities: " << serverHello.capabilities << ")"
+			<< (serverHello.resumed ? ", resumed session" : "")
+			<< std::endl;
+
+		auto client = std::make_shared<ClientConnection>(
+			clientId,
+			std::move(socket),
+			serverHello.capabilities,
+			mConfig.clientConnection
+		);
+		client->setSessionId(serverHello.sessionId);
+		client->setProtocolVersion(serverHello.version);
+		if (video::protocol::hasCapability(serverHello.capabilities, video::protocol::Capability::Resumption)) {
+			client->setResumeToken(serverHello.resumeToken);
+		}
+#ifdef SCREENSHARE_IO_URING
+		client->setUringSender(mUringSender.get());
+#endif
+
+		// Datagrams and the shared memory ring are shared by their clients, so only TCP clients take turns
+		if (mScheduler && receivesOverTcp(serverHello.capabilities)) {
+			mScheduler->add(client->id());
+			client->setScheduler(mScheduler.get());
+		}
+
+		boost::asio::post(mStrand, [this, client, resumeFrom]() {
+			addClient(client, resumeFrom);
+		});
+	}
+
+	boost::asio::awaitable<std::optional<std::uint64_t>> StreamServer::resumeSession(std::uint64_t resumeToken) {
+		auto timeNow = std::chrono::steady_clock::now();
+		std::erase_if(mDetachedSessions, [&](const auto& entry) {
+			return timeNow - entry.second.detachedTime > mConfig.recovery.resumeWindow;
+		});
+
+		if (auto detached = mDetachedSessions.find(resumeToken); detached != mDetachedSessions.end()) {
+			auto sessionId = detached->second.sessionId;
+			mDetachedSessions.erase(detached);
+			co_return sessionId;
+		}
+
+		// After roaming, the old connection often still looks alive to the server. It is only replaced by the new one once
+		// nothing has gone through it for a while, so that a connection that is still being served is never cut off.
+		if (auto active = mResumeTokens.find(resumeToken); active != mResumeTokens.end()) {
+			auto client = mClients.at(active->second);
+			if (client->idleTime() < mConfig.recovery.takeOverIdleTime) {
+				std::cout << "Not resuming the session of client #" << client->id() << ", which is still active" << std::endl;
+				co_return std::nullopt;
+			}
+
+			mResumeTokens.erase(active);
+			boost::asio::post(client->executor(), [client]() {
+				client->close();
+			});
+			co_return client->sessionId();
+		}
+
+		co_return std::nullopt;
+	}
+
+	void StreamServer::addClient(std::shared_ptr<ClientConnection> client, std::optional<std::int64_t> resumeFrom) {
+		mClients[client->id()] = client;
+		mSessions[client->sessionId()] = client->id();
+		if (client->resumeToken() != 0) {
+			mResumeTokens[client->resumeToken()] = client->id();
+		}
+
+		client->start(
+			[this](ClientConnection& connection, const video::protocol::FrameHeader& header, video::protocol::MessageReader& payload) {
+				handleClientMessage(connection, header, payload);
+			},
+			[this](ClientConnection& connection, boost::system::error_code error) {
+				std::cout
+					<< "Removing client #" << connection.id() << " due to: " << error
+					<< " (sent: " << connection.statistics().sentPackets
+					<< ", dropped: " << connection.statistics().droppedPackets << " packets)"
+					<< std::endl;
+
+				boost::asio::post(mStrand, [this, clientId = connection.id()]() {
+					removeClient(clientId);
+				});
+			}
+		);
+
+		// TCP clients start from the cached keyframe instead of waiting for the next one.
+		if (resumeFrom) {
+			// A client that missed nothing continues with the next packet, like the connection was never lost
+			auto missed = mGopCache.after(*resumeFrom);
+			if (receivesOverTcp(client->capabilities()) && missed && missed->empty()) {
+				boost::asio::post(client->executor(), [client]() {
+					client->replay({});
+				});
+			} else {
+				handleRecoveryRequest(client, { *resumeFrom });
+			}
+		} else if (receivesOverTcp(client->capabilities()) && !mGopCache.packets().empty()) {
+			boost::asio::post(client->executor(), [client, packets = std::vector(mGopCache.packets().begin(), mGopCache.packets().end())]() {
+				client->replay(packets);
+			});
+		}
+	}
+
+	void StreamServer::removeClient(ClientId clientId) {
+		auto client = mClients.find(clientId);
+		if (client == mClients.end()) {
+			return;
+		}
+
+		// The session might already have been taken over by a client resuming it
+		auto& connection = *client->second;
+		if (auto session = mSessions.find(connection.sessionId()); session != mSessions.end() && session->second == clientId) {
+			mSessions.erase(session);
+		}
+
+		if (auto resumeToken = mResumeTokens.find(connection.resumeToken()); resumeToken != mResumeTokens.end() && resumeToken->second == clientId) {
+			mResumeTokens.erase(resumeToken);
+			mDetachedSessions[connection.resumeToken()] = { connection.sessionId(), std::chrono::steady_clock::now() };
+		}
+
+		mLastRecoveryRequests.erase(clientId);
+		mClients.erase(client);
+	}
+
+	video::protocol::Capabilities StreamServer::serverCapabilities() const {
+		auto capabilities = mCapabilities
+			| video::protocol::capabilityBit(video::protocol::Capability::ClockSync)
+			| video::protocol::capabilityBit(video::protocol::Capability::ReceiverReports)
+			| video::protocol::capabilityBit(video::protocol::Capability::Resumption);
+		if (mUdpSender) {
+			capabilities |= video::protocol::capabilityBit(video::protocol::Capability::UdpTransport);
+			if (mUdpSender->multicastGroup()) {
+				capabilities |= video::protocol::capabilityBit(video::protocol::Capability::Multicast);
+			}
+		}
+
+		if (mSharedMemoryWriter) {
+			capabilities |= video::protocol::capabilityBit(video::protocol::Capability::SharedMemory);
+		}
+
+		return capabilities;
+	}
+
+	bool StreamServer::receivesOverTcp(video::protocol::Capabilities capabilities) {
+		return !video::protocol::hasCapability(capabilities, video::protocol::Capability::UdpTransport)
+			&& !video::protocol::hasCapability(capabilities, video::protocol::Capability::SharedMemory);
+	}
+
+	void StreamServer::handleClientMessage(ClientConnection& connection,
+										   const video::protocol::FrameHeader& header,
+										   video::protocol::MessageReader& payload) {
+		if (header.type == video::protocol::MessageType::RecoveryRequest
+			&& video::protocol::hasCapability(connection.capabilities(), video::protocol::Capability::Recovery)) {
+			video::protocol::RecoveryRequest recoveryRequest;
+			if (video::protocol::readRecoveryRequest(payload, recoveryRequest)) {
+				// Called on the strand of the client, while the recovery state belongs to the server
+				boost::asio::post(mStrand, [this, connection = connection.shared_from_this(), recoveryRequest]() {
+					handleRecoveryRequest(connection, recoveryRequest);
+				});
+			}
+		} else if (header.type == video::protocol::MessageType::ClockSyncRequest
+				   && video::protocol::hasCapability(connection.capabilities(), video::protocol::Capability::ClockSync)) {
+			auto receiveTime = video::clocksync::currentTime();
+			video::protocol::ClockSync clockSync;
+			if (video::protocol::readClockSync(payload, clockSync)) {
+				// Stamped when queued, so time spent waiting for a packet being sent counts towards the round trip, which
+				// makes the client discard the sample.
+				clockSync.serverReceiveTime = receiveTime;
+				clockSync.serverSendTime = video::clocksync::currentTime();
+
+				auto response = std::make_shared<video::protocol::MessageWriter>(video::protocol::MessageType::ClockSyncResponse);
+				video::protocol::writeClockSync(*response, clockSync);
+				response->finish();
+				connection.sendMessage(std::move(response));
+			}
+		} else if (header.type == video::protocol::MessageType::ReceiverReport
+				   && video::protocol::hasCapability(connection.capabilities(), video::protocol::Capability::ReceiverReports)) {
+			video::protocol::ReceiverReport receiverReport;
+			if (video::protocol::readReceiverReport(payload, receiverReport)) {
+				connection.handleReceiverReport(receiverReport);
+			}
+		} else {
+			// Whoever sends input is controlling the screen, and gets the larger share of the uplink
+			if (header.type == video::protocol::MessageType::ClientAction
+				&& video::protocol::hasCapability(connection.capabilities(), video::protocol::Capability::RemoteInput)
+				&& mScheduler) {
+				mScheduler->setRole(connection.id(), ClientRole::Controller);
+			}
+
+			if (mMessageHandler) {
+				mMessageHandler(connection, header, payload);
+			}
+		}
+	}
+
+	void StreamServer::handleRecoveryRequest(const std::shared_ptr<ClientConnection>& connection,
+											 const video::protocol::RecoveryRequest& recoveryRequest) {
+		// Asking again from the same point means the replay did not help, for example since the data itself was bad.
+		auto lastRequest = mLastRecoveryRequests.find(connection->id());
+		auto repeated = lastRequest != mLastRecoveryRequests.end() && lastRequest->second == recoveryRequest.lastDecodedPts;
+		mLastRecoveryRequests[connection->id()] = recoveryRequest.lastDecodedPts;
+
+		// Replaying what the client is missing only affects that client, while a new keyframe is sent to everyone.
+		// Datagrams and the shared memory ring cannot be replayed to a single client, since they are shared by all their clients.
+		if (receivesOverTcp(connection->capabilities()) && !repeated && !recoveryRequest.keyframe) {
+			auto packets = mGopCache.after(recoveryRequest.lastDecodedPts);
+			if (!packets) {
+				// Too far behind for the missing packets alone, so start over from the cached keyframe
+				packets = std::vector(mGopCache.packets().begin(), mGopCache.packets().end());
+			}
+
+			std::size_t replayBytes = 0;
+			for (auto& packet : *packets) {
+				replayBytes += packet->size();
+			}
+
+			if (!packets->empty() && replayBytes <= mConfig.recovery.maxReplayBytes) {
+				std::cout
+					<< "Client #" << connection->id() << " recovering from pts " << recoveryRequest.lastDecodedPts
+					<< ", replaying " << packets->size() << " packets (" << replayBytes << " bytes)"
+					<< std::endl;
+				boost::asio::post(connection->executor(), [connection, packets = std::move(*packets)]() {
+					connection->replay(packets);
+				});
+				return;
+			}
+		}
+
+		std::cout << "Client #" << connection->id() << " recovering from pts " << recoveryRequest.lastDecodedPts << ", requesting keyframe" << std::endl;
+		if (mRefreshHandler) {
+			mRefreshHandler();
+		}
+	}
+
+	void StreamServer::handleDatagram(const boost::asio::ip::udp::endpoint& sender, const std::uint8_t* data, std::size_t size) {
+		video::udp::DatagramType type;
+		std::uint64_t sessionId = 0;
+		if (!video::udp::parseSessionDatagram(data, size, type, sessionId)) {
+			return;
+		}
+
+		auto session = mSessions.find(sessionId);
+		if (session == mSessions.end()) {
+			return;
+		}
+
+		auto& client = mClients.at(session->second);
+		switch (type) {
+			case video::udp::DatagramType::Register:
+				if (client->mediaEndpoint() != sender) {
+					std::cout << "Client #" << client->id() << " receives over UDP at " << sender << std::endl;
+					client->setMediaEndpoint(sender);
+				}
+				break;
+			case video::udp::DatagramType::Nack:
+				if (client->mediaEndpoint() == sender) {
+					mUdpSender->retransmit(data, size, sender);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	boost::asio::awaitable<void> StreamServer::statisticsLoop() {
+		while (true) {
+			mStatisticsTimer.expires_after(std::chrono::seconds(5));
+
+			boost::system::error_code error;
+			co_await mStatisticsTimer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+			if (error) {
+				co_return;
+			}
+
+			for (auto& [clientId, client] : mClients) {
+				client->reportStatistics();
+			}
+
+			if (mScheduler) {
+				mScheduler->reportStatistics();
+			}
+		}
+	}
+
+	void StreamServer::broadcast(video::network::EncodedPacketPtr packet) {
+		boost::asio::post(
+			mStrand,
+			[this, packet = std::move(packet)]() {
+				send(packet);
+			}
+		);
+	}
+
+	void StreamServer::send(const video::network::EncodedPacketPtr& packet) {
+		mGopCache.add(packet);
+
+		// Always written, so that new local viewers can start from the latest keyframe in the ring.
+		if (mSharedMemoryWriter) {
+			mSharedMemoryWriter->write(*packet);
+		}
+
+		if (mHttpEgress) {
+			mHttpEgress->add(packet);
+		}
+
+		// Packetized once for all UDP clients, which also keeps retransmissions valid for every one of them.
+		std::vector<video::udp::DatagramPtr> datagrams;
+		bool packetized = false;
+		auto packetizeOnce = [&]() -> const std::vector<video::udp::DatagramPtr>& {
+			if (!packetized) {
+				datagrams = mUdpSender->packetize(*packet);
+				packetized = true;
+			}
+
+			return datagrams;
+		};
+
+		bool anyMulticast = false;
+		for (auto& [clientId, client] : mClients) {
+			if (video::protocol::hasCapability(client->capabilities(), video::protocol::Capability::SharedMemory)) {
+				continue;
+			} else if (video::protocol::hasCapability(client->capabilities(), video::protocol::Capability::Multicast)) {
+				anyMulticast = true;
+			} else if (video::protocol::hasCapability(client->capabilities(), video::protocol::Capability::UdpTransport)) {
+				if (client->mediaEndpoint()) {
+					mUdpSender->send(packetizeOnce(), *client->mediaEndpoint());
+				}
+			} else {
+				boost::asio::post(client->executor(), [client = client, packet]() {
+					client->enqueue(packet);
+				});
+			}
+		}
+
+		// However many viewers have joined the group, each packet is sent once.
+		if (anyMulticast) {
+			mUdpSender->sendMulticast(packetizeOnce());
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,153 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+#include "../video/common.h"
+#include "../video/network.h"
+#include "../video/protocol.h"
+#include "../video/shm.h"
+#include "../video/udp.h"
+#include "bandwidth_scheduler.h"
+#include "client_connection.h"
+#include "gop_cache.h"
+#include "http_egress.h"
+#include "uring_sender.h"
+
+namespace screenshare::server {
+	struct RecoveryConfig {
+		std::size_t maxReplayBytes = 4 * 1024 * 1024; // Larger recoveries force a keyframe instead of replaying
+		std::chrono::milliseconds minRefreshInterval { 500 };
+		std::chrono::milliseconds resumeWindow { 10000 }; // How long after losing its connection a client can resume its session
+		std::chrono::milliseconds takeOverIdleTime { 2000 }; // How long a connection must have been stuck before a resuming client replaces it
+	};
+
+	struct StreamServerConfig {
+		ClientConnectionConfig clientConnection;
+		video::udp::UdpTransportConfig udp;
+		video::shm::SharedMemoryConfig sharedMemory;
+		RecoveryConfig recovery;
+		UringSenderConfig uring;
+		std::size_t ioThreads = 0; // Threads running the io context, 0 uses one per core
+		HttpEgressConfig http;
+		BandwidthSchedulerConfig scheduler;
+	};
+
+	/**
+	 * Accepts clients and fans encoded packets out to them, independent of where the packets come from.
+	 * The io context is run by a pool of threads, where the server state is kept on one strand and every client has its own.
+	 */
+	class StreamServer {
+	public:
+		using MessageHandler = ClientConnection::MessageHandler;
+		using RefreshHandler = std::function<void ()>;
+	private:
+		using Socket = boost::asio::ip::tcp::socket;
+
+		boost::asio::io_context& mIOContext;
+		boost::asio::strand<boost::asio::io_context::executor_type> mStrand;
+		boost::asio::ip::tcp::acceptor mAcceptor;
+		boost::asio::steady_timer mStatisticsTimer;
+		std::vector<std::jthread> mThreads;
+
+		StreamServerConfig mConfig;
+		video::protocol::Capabilities mCapabilities;
+		std::unique_ptr<AVCodecParameters, video::AVCodecParametersDeleter> mCodecParameters;
+		AVRational mTimeBase { 0, 0 };
+
+		MessageHandler mMessageHandler;
+		RefreshHandler mRefreshHandler;
+
+#ifdef SCREENSHARE_IO_URING
+		std::unique_ptr<UringSender> mUringSender; // Declared before the clients, which refer to it
+#endif
+		std::unique_ptr<BandwidthScheduler> mScheduler; // Also referred to by the clients
+
+		ClientId mNextClientId = 1;
+		std::unordered_map<ClientId, std::shared_ptr<ClientConnection>> mClients;
+
+		std::unique_ptr<video::udp::UdpSender> mUdpSender;
+		std::unordered_map<std::uint64_t, ClientId> mSessions;
+
+		struct DetachedSession {
+			std::uint64_t sessionId = 0;
+			std::chrono::steady_clock::time_point detachedTime;
+		};
+
+		// Sessions by resume token, of the connected clients and of the ones that can still be resumed
+		std::unordered_map<std::uint64_t, ClientId> mResumeTokens;
+		std::unordered_map<std::uint64_t, DetachedSession> mDetachedSessions;
+
+		std::unique_ptr<video::shm::SharedMemoryWriter> mSharedMemoryWriter;
+		std::unique_ptr<HttpEgress> mHttpEgress;
+
+		GopCache mGopCache;
+		std::unordered_map<ClientId, std::int64_t> mLastRecoveryRequests;
+
+		boost::asio::awaitable<void> acceptLoop();
+		boost::asio::awaitable<void> handshake(Socket socket, ClientId clientId, video::protocol::ServerHello offer);
+		boost::asio::awaitable<void> statisticsLoop();
+		boost::asio::awaitable<std::optional<std::uint64_t>> resumeSession(std::uint64_t resumeToken);
+		void addClient(std::shared_ptr<ClientConnection> client, std::optional<std::int64_t> resumeFrom);
+		void removeClient(ClientId clientId);
+
+		video::protocol::Capabilities serverCapabilities() const;
+		static bool receivesOverTcp(video::protocol::Capabilities capabilities);
+		void handleClientMessage(
+			ClientConnection& connection,
+			const video::protocol::FrameHeader& header,
+			video::protocol::MessageReader& payload
+		);
+		void handleRecoveryRequest(const std::shared_ptr<ClientConnection>& connection, const video::protocol::RecoveryRequest& recoveryRequest);
+		void handleDatagram(const boost::asio::ip::udp::endpoint& sender, const std::uint8_t* data, std::size_t size);
+
+		void send(const video::network::EncodedPacketPtr& packet);
+	public:
+		/**
+		 * Creates a server offering the given capabilities, on top of the transport capabilities from the configuration
+		 */
+		StreamServer(
+			boost::asio::io_context& ioContext,
+			boost::asio::ip::tcp::endpoint bind,
+			StreamServerConfig config,
+			video::protocol::Capabilities capabilities
+		);
+
+		~StreamServer();
+
+		StreamServer(const StreamServer&) = delete;
+		StreamServer& operator=(const StreamServer&) = delete;
+
+		/**
+		 * Starts accepting clients of the stream described by the given codec parameters, and the threads running the io context.
+		 * Messages not handled by the server itself go to the message handler, and the refresh handler is called when
+		 * clients can only recover through a new keyframe. Both are called from the threads of the io context.
+		 */
+		void start(
+			const AVCodecParameters* codecParameters,
+			AVRational timeBase,
+			MessageHandler messageHandler,
+			RefreshHandler refreshHandler
+		);
+
+		/**
+		 * Stops the io context and waits for its threads
+		 */
+		void stop();
+
+		/**
+		 * The endpoint clients connect to, with the port chosen by the system when bound to port 0
+		 */
+		boost::asio::ip::tcp::endpoint endpoint() const;
+
+		/**
+		 * Sends the packet to every client. Can be called from any thread.
+		 */
+		void broadcast(video::network::EncodedPacketPtr packet);
+	};
+}
\ No newline at end of file
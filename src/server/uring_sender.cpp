@@ -0,0 +1,564 @@
+#include "uring_sender.h"
+
+#ifdef SCREENSHARE_IO_URING
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace screenshare::server {
+#ifdef SCREENSHARE_IO_URING
+	bool uringSupported() {
+		return true;
+	}
+
+	namespace {
+		std::runtime_error uringError(const std::string& message, int error) {
+			return std::runtime_error(message + ": " + std::strerror(error));
+		}
+
+		template<typename T>
+		T* ringPointer(void* ring, std::uint32_t offset) {
+			return reinterpret_cast<T*>(reinterpret_cast<std::uint8_t*>(ring) + offset);
+		}
+
+		// Operations are pointers, so these never collide with them
+		constexpr std::uint64_t CANCEL_USER_DATA = 0;
+		constexpr std::uint64_t TIMEOUT_USER_DATA = 1;
+
+		// How long closing waits for the kernel to give back the operations in progress
+		constexpr std::chrono::seconds CLOSE_TIMEOUT { 1 };
+	}
+
+	IoUring::IoUring(unsigned entries) {
+		mFd = (int)syscall(SYS_io_uring_setup, entries, &mParams);
+		if (mFd < 0) {
+			throw uringError("Failed to create io_uring", errno);
+		}
+
+		if ((mParams.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+			close(mFd);
+			throw std::runtime_error("io_uring requires Linux 5.4 or later");
+		}
+
+		// Both queues share a single mapping, with the submission entries mapped separately.
+		mRingSize = std::max(
+			mParams.sq_off.array + mParams.sq_entries * sizeof(unsigned),
+			mParams.cq_off.cqes + mParams.cq_entries * sizeof(io_uring_cqe)
+		);
+		mRing = mmap(nullptr, mRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+		if (mRing == MAP_FAILED) {
+			auto error = errno;
+			close(mFd);
+			throw uringError("Failed to map io_uring", error);
+		}
+
+		mSqesSize = mParams.sq_entries * sizeof(io_uring_sqe);
+		mSqes = reinterpret_cast<io_uring_sqe*>(mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES));
+		if (mSqes == MAP_FAILED) {
+			auto error = errno;
+			munmap(mRing, mRingSize);
+			close(mFd);
+			throw uringError("Failed to map io_uring", error);
+		}
+
+		mSqHead = ringPointer<unsigned>(mRing, mParams.sq_off.head);
+		mSqTail = ringPointer<unsigned>(mRing, mParams.sq_off.tail);
+		mSqMask = *ringPointer<unsigned>(mRing, mParams.sq_off.ring_mask);
+		mSqArray = ringPointer<unsigned>(mRing, mParams.sq_off.array);
+		mSqTailLocal = *mSqTail;
+
+		mCqHead = ringPointer<unsigned>(mRing, mParams.cq_off.head);
+		mCqTail = ringPointer<unsigned>(mRing, mParams.cq_off.tail);
+		mCqMask = *ringPointer<unsigned>(mRing, mParams.cq_off.ring_mask);
+		mCqes = ringPointer<io_uring_cqe>(mRing, mParams.cq_off.cqes);
+
+		constexpr unsigned MAX_PROBE_OPERATIONS = 256;
+		std::vector<std::uint8_t> probeMemory(sizeof(io_uring_probe) + MAX_PROBE_OPERATIONS * sizeof(io_uring_probe_op));
+		auto probe = reinterpret_cast<io_uring_probe*>(probeMemory.data());
+		mSupportedOperations.resize(MAX_PROBE_OPERATIONS, false);
+		if (registerResource(IORING_REGISTER_PROBE, probe, MAX_PROBE_OPERATIONS) == 0) {
+			for (unsigned i = 0; i < probe->ops_len && i < MAX_PROBE_OPERATIONS; i++) {
+				mSupportedOperations[probe->ops[i].op] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+			}
+		}
+	}
+
+	IoUring::~IoUring() {
+		munmap(mSqes, mSqesSize);
+		munmap(mRing, mRingSize);
+		close(mFd);
+	}
+
+	int IoUring::fd() const {
+		return mFd;
+	}
+
+	bool IoUring::supportsOperation(std::uint8_t opcode) const {
+		return mSupportedOperations[opcode];
+	}
+
+	int IoUring::registerResource(unsigned opcode, const void* argument, unsigned count) {
+		if (syscall(SYS_io_uring_register, mFd, opcode, argument, count) < 0) {
+			return -errno;
+		}
+
+		return 0;
+	}
+
+	io_uring_sqe* IoUring::nextSubmission() {
+		auto head = std::atomic_ref(*mSqHead).load(std::memory_order_acquire);
+		if (mSqTailLocal - head >= mParams.sq_entries) {
+			return nullptr;
+		}
+
+		auto index = mSqTailLocal & mSqMask;
+		mSqArray[index] = index;
+		mSqTailLocal++;
+		mUnsubmitted++;
+
+		auto submission = &mSqes[index];
+		std::memset(submission, 0, sizeof(io_uring_sqe));
+		return submission;
+	}
+
+	bool IoUring::hasUnsubmitted() const {
+		return mUnsubmitted > 0;
+	}
+
+	int IoUring::submit() {
+		std::atomic_ref(*mSqTail).store(mSqTailLocal, std::memory_order_release);
+
+		auto submitted = (int)syscall(SYS_io_uring_enter, mFd, mUnsubmitted, 0, 0, nullptr, 0);
+		if (submitted < 0) {
+			return -errno;
+		}
+
+		mUnsubmitted -= (unsigned)submitted;
+		return submitted;
+	}
+
+	int IoUring::wait() {
+		if (syscall(SYS_io_uring_enter, mFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+			return -errno;
+		}
+
+		return 0;
+	}
+
+	std::size_t IoUring::drainCompletions(const std::function<void (const io_uring_cqe& completion)>& handler) {
+		std::size_t count = 0;
+		while (true) {
+			auto head = std::atomic_ref(*mCqHead).load(std::memory_order_relaxed);
+			auto tail = std::atomic_ref(*mCqTail).load(std::memory_order_acquire);
+			if (head == tail) {
+				break;
+			}
+
+			// Copied out first, since the handler might cause more completions to be drained
+			auto completion = mCqes[head & mCqMask];
+			std::atomic_ref(*mCqHead).store(head + 1, std::memory_order_release);
+
+			handler(completion);
+			count++;
+		}
+
+		return count;
+	}
+
+	UringSender::UringSender(boost::asio::io_context& ioContext, UringSenderConfig config)
+		: mIOContext(ioContext),
+		  mConfig(config),
+		  mEventDescriptor(ioContext),
+		  mRing(config.entries) {
+		// Completions are signalled through an eventfd, so that they are handled by the io context like any other event.
+		auto eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (eventFd < 0) {
+			throw uringError("Failed to create eventfd", errno);
+		}
+
+		mEventDescriptor.assign(eventFd);
+		if (auto error = mRing.registerResource(IORING_REGISTER_EVENTFD, &eventFd, 1); error < 0) {
+			throw uringError("Failed to register eventfd", -error);
+		}
+
+		setupZeroCopy();
+		waitForCompletions();
+	}
+
+	UringSender::~UringSender() {
+		std::lock_guard lock(mMutex);
+		mClosing = true;
+
+		// The kernel might still use the memory of the operations in progress, so they are cancelled and given back before
+		// anything is freed. Cancelling can complete operations, which removes them from the set.
+		std::vector<Operation*> operations(mOperations.begin(), mOperations.end());
+		for (auto operation : operations) {
+			if (!mOperations.contains(operation) || operation->completed) {
+				continue;
+			}
+
+			auto submission = waitForSubmission();
+			if (submission == nullptr) {
+				break;
+			}
+
+			submission->opcode = IORING_OP_ASYNC_CANCEL;
+			submission->addr = (std::uint64_t)operation;
+			submission->user_data = CANCEL_USER_DATA;
+		}
+
+		// Zero copy sends are only given back once the data has left the socket, which a stuck client might never let happen
+		__kernel_timespec timeout { .tv_sec = CLOSE_TIMEOUT.count(), .tv_nsec = 0 };
+		if (auto submission = waitForSubmission(); submission != nullptr) {
+			submission->opcode = IORING_OP_TIMEOUT;
+			submission->addr = (std::uint64_t)&timeout;
+			submission->len = 1;
+			submission->user_data = TIMEOUT_USER_DATA;
+		}
+
+		auto timedOut = false;
+		while (!mOperations.empty() && !timedOut) {
+			if (mRing.hasUnsubmitted()) {
+				mRing.submit();
+			}
+
+			auto drained = mRing.drainCompletions([&](const io_uring_cqe& completion) {
+				if (completion.user_data == TIMEOUT_USER_DATA) {
+					timedOut = true;
+				} else {
+					handleCompletion(completion);
+				}
+			});
+
+			if (drained == 0) {
+				if (auto result = mRing.wait(); result < 0 && result != -EINTR) {
+					break;
+				}
+			}
+		}
+
+		// Nobody waits for the handlers anymore
+		mCompletions.clear();
+
+		// What the kernel still has is left allocated, as freeing it would let the kernel use freed memory
+		if (!mOperations.empty()) {
+			std::cout << "Closing io_uring before the kernel gave back " << mOperations.size() << " sends" << std::endl;
+			mOperations.clear();
+			mRegisteredMemory.release();
+		}
+	}
+
+	bool UringSender::zeroCopy() const {
+		return mZeroCopy;
+	}
+
+	void UringSender::setupZeroCopy() {
+		if (mConfig.registeredBufferCount == 0 || !mRing.supportsOperation(IORING_OP_SEND_ZC)) {
+			return;
+		}
+
+		mRegisteredMemory = std::make_unique<std::uint8_t[]>(mConfig.registeredBufferCount * mConfig.registeredBufferSize);
+
+		std::vector<iovec> buffers;
+		for (std::size_t i = 0; i < mConfig.registeredBufferCount; i++) {
+			auto data = mRegisteredMemory.get() + i * mConfig.registeredBufferSize;
+			buffers.push_back({ data, mConfig.registeredBufferSize });
+			mRegisteredBuffers.push_back({ data });
+		}
+
+		if (auto error = mRing.registerResource(IORING_REGISTER_BUFFERS, buffers.data(), (unsigned)buffers.size()); error < 0) {
+			std::cout << "Zero copy sends disabled, failed to register buffers: " << std::strerror(-error) << std::endl;
+			mRegisteredBuffers.clear();
+			mRegisteredMemory.reset();
+			return;
+		}
+
+		mZeroCopy = true;
+	}
+
+	int UringSender::acquireRegisteredBuffer(const video::network::EncodedPacketPtr& packet) {
+		// Every client sending the same packet shares the buffer, so the packet is only copied once.
+		auto registered = mRegisteredPackets.find(packet.get());
+		if (registered != mRegisteredPackets.end()) {
+			mRegisteredBuffers[registered->second].users++;
+			return registered->second;
+		}
+
+		if (packet->size() > mConfig.registeredBufferSize) {
+			return -1;
+		}
+
+		for (std::size_t i = 0; i < mRegisteredBuffers.size(); i++) {
+			auto& buffer = mRegisteredBuffers[i];
+			if (buffer.users == 0) {
+				auto data = buffer.data;
+				for (auto& packetBuffer : packet->buffers()) {
+					std::memcpy(data, packetBuffer.data(), packetBuffer.size());
+					data += packetBuffer.size();
+				}
+
+				buffer.packet = packet;
+				buffer.users = 1;
+				mRegisteredPackets[packet.get()] = (int)i;
+				return (int)i;
+			}
+		}
+
+		return -1;
+	}
+
+	void UringSender::releaseRegisteredBuffer(int index) {
+		auto& buffer = mRegisteredBuffers[index];
+		buffer.users--;
+		if (buffer.users == 0) {
+			mRegisteredPackets.erase(buffer.packet.get());
+			buffer.packet.reset();
+		}
+	}
+
+	void UringSender::send(int fd,
+						   video::network::EncodedPacketPtr packet,
+						   std::size_t offset,
+						   std::size_t size,
+						   CompletionHandler handler) {
+		std::lock_guard lock(mMutex);
+
+		auto operation = new Operation();
+		operation->fd = fd;
+		operation->packet = std::move(packet);
+		operation->offset = offset;
+		operation->size = size;
+		operation->handler = std::move(handler);
+		mOperations.insert(operation);
+
+		if (mZeroCopy && size >= mConfig.zeroCopyThreshold) {
+			operation->registeredBuffer = acquireRegisteredBuffer(operation->packet);
+		}
+
+		submit(operation);
+	}
+
+	void UringSender::cancel(int fd) {
+		std::lock_guard lock(mMutex);
+
+		// Cannot be given up on, since the sends would otherwise continue on whatever socket reuses the descriptor
+		auto submission = waitForSubmission();
+		if (submission == nullptr) {
+			return;
+		}
+
+		submission->opcode = IORING_OP_ASYNC_CANCEL;
+		submission->fd = fd;
+		submission->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		submission->user_data = CANCEL_USER_DATA;
+
+		// Submitted right away, since the socket is about to be closed and its descriptor reused
+		mRing.submit();
+	}
+
+	io_uring_sqe* UringSender::nextSubmission() {
+		auto submission = mRing.nextSubmission();
+		if (submission == nullptr) {
+			mRing.submit();
+			submission = mRing.nextSubmission();
+		}
+
+		return submission;
+	}
+
+	io_uring_sqe* UringSender::waitForSubmission() {
+		while (true) {
+			if (auto submission = mRing.nextSubmission()) {
+				return submission;
+			}
+
+			// The kernel takes no more submissions while the completion queue is full, until completions have been reaped.
+			// Their handlers are called by the next completion event, which is still pending for them.
+			auto result = mRing.submit();
+			if (result == -EBUSY || result == -EAGAIN) {
+				mRing.drainCompletions([this](const io_uring_cqe& completion) {
+					handleCompletion(completion);
+				});
+			} else if (result < 0) {
+				std::cout << "Failed to submit to io_uring: " << std::strerror(-result) << std::endl;
+				return nullptr;
+			}
+		}
+	}
+
+	void UringSender::submit(Operation* operation) {
+		auto submission = nextSubmission();
+		if (submission == nullptr) {
+			auto handler = std::move(operation->handler);
+			auto sent = operation->sent;
+			operation->completed = true;
+			if (operation->pendingNotifications == 0) {
+				destroy(operation);
+			}
+
+			boost::asio::post(mIOContext, [handler = std::move(handler), sent]() {
+				handler(boost::system::errc::make_error_code(boost::system::errc::no_buffer_space), sent);
+			});
+			return;
+		}
+
+		auto offset = operation->offset + operation->sent;
+		auto remaining = operation->size - operation->sent;
+
+		// MSG_WAITALL makes the kernel retry short sends on its own, instead of completing early.
+		if (operation->registeredBuffer >= 0) {
+			submission->opcode = IORING_OP_SEND_ZC;
+			submission->addr = (std::uint64_t)(mRegisteredBuffers[operation->registeredBuffer].data + offset);
+			submission->len = (std::uint32_t)remaining;
+			submission->ioprio = IORING_RECVSEND_FIXED_BUF;
+			submission->buf_index = (std::uint16_t)operation->registeredBuffer;
+		} else {
+			std::size_t count = 0;
+			for (auto& buffer : operation->packet->buffers()) {
+				if (remaining == 0) {
+					break;
+				}
+
+				if (offset >= buffer.size()) {
+					offset -= buffer.size();
+					continue;
+				}
+
+				auto size = std::min(remaining, buffer.size() - offset);
+				operation->iov[count++] = { (std::uint8_t*)buffer.data() + offset, size };
+				remaining -= size;
+				offset = 0;
+			}
+
+			operation->message = {};
+			operation->message.msg_iov = operation->iov.data();
+			operation->message.msg_iovlen = count;
+
+			submission->opcode = IORING_OP_SENDMSG;
+			submission->addr = (std::uint64_t)&operation->message;
+			submission->len = 1;
+		}
+
+		submission->fd = operation->fd;
+		submission->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		submission->user_data = (std::uint64_t)operation;
+		scheduleFlush();
+	}
+
+	void UringSender::scheduleFlush() {
+		if (mFlushScheduled) {
+			return;
+		}
+
+		// Deferred, so that the sends queued by the handlers already waiting to run, typically for the other clients of the
+		// same packet, go out together.
+		mFlushScheduled = true;
+		boost::asio::post(mIOContext, [this]() {
+			flush();
+		});
+	}
+
+	void UringSender::flush() {
+		std::lock_guard lock(mMutex);
+
+		mFlushScheduled = false;
+		if (mRing.hasUnsubmitted()) {
+			auto result = mRing.submit();
+			if (result == -EAGAIN || result == -EBUSY) {
+				scheduleFlush();
+			} else if (result < 0) {
+				std::cout << "Failed to submit to io_uring: " << std::strerror(-result) << std::endl;
+			}
+		}
+	}
+
+	void UringSender::waitForCompletions() {
+		mEventDescriptor.async_read_some(
+			boost::asio::buffer(&mEventCount, sizeof(mEventCount)),
+			[this](boost::system::error_code error, std::size_t) {
+				if (error) {
+					return;
+				}
+
+				std::vector<Completion> completions;
+				{
+					std::lock_guard lock(mMutex);
+					mRing.drainCompletions([this](const io_uring_cqe& completion) {
+						handleCompletion(completion);
+					});
+					completions.swap(mCompletions);
+				}
+
+				for (auto& completion : completions) {
+					completion.handler(completion.error, completion.size);
+				}
+
+				waitForCompletions();
+			}
+		);
+	}
+
+	void UringSender::handleCompletion(const io_uring_cqe& completion) {
+		if (completion.user_data == CANCEL_USER_DATA || completion.user_data == TIMEOUT_USER_DATA) {
+			return;
+		}
+
+		auto operation = reinterpret_cast<Operation*>(completion.user_data);
+
+		// Zero copy sends complete twice: once sent, and once the kernel no longer uses the buffer.
+		if ((completion.flags & IORING_CQE_F_NOTIF) != 0) {
+			operation->pendingNotifications--;
+			if (operation->completed && operation->pendingNotifications == 0) {
+				destroy(operation);
+			}
+			return;
+		}
+
+		if ((completion.flags & IORING_CQE_F_MORE) != 0) {
+			operation->pendingNotifications++;
+		}
+
+		if (completion.res < 0) {
+			finish(operation, boost::system::error_code(-completion.res, boost::system::system_category()));
+			return;
+		}
+
+		operation->sent += (std::size_t)completion.res;
+		if (operation->sent < operation->size && completion.res > 0 && !mClosing) {
+			submit(operation);
+			return;
+		}
+
+		finish(operation, operation->sent < operation->size ? boost::asio::error::eof : boost::system::error_code());
+	}
+
+	void UringSender::finish(Operation* operation, boost::system::error_code error) {
+		operation->completed = true;
+		mCompletions.push_back({ std::move(operation->handler), error, operation->sent });
+
+		if (operation->pendingNotifications == 0) {
+			destroy(operation);
+		}
+	}
+
+	void UringSender::destroy(Operation* operation) {
+		if (operation->registeredBuffer >= 0) {
+			releaseRegisteredBuffer(operation->registeredBuffer);
+		}
+
+		mOperations.erase(operation);
+		delete operation;
+	}
+#else
+	bool uringSupported() {
+		return false;
+	}
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,194 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "../video/network.h"
+
+#ifdef SCREENSHARE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace screenshare::server {
+	struct UringSenderConfig {
+		bool enabled = false;
+		unsigned entries = 1024;
+		std::size_t zeroCopyThreshold = 64 * 1024; // Smaller packets are cheaper to copy than to track until the kernel is done with them
+		std::size_t registeredBufferSize = 1024 * 1024;
+		std::size_t registeredBufferCount = 4; // Registered buffers count against RLIMIT_MEMLOCK
+	};
+
+	/**
+	 * Returns true if the binary was built with io_uring support
+	 */
+	bool uringSupported();
+
+#ifdef SCREENSHARE_IO_URING
+	/**
+	 * A minimal io_uring instance, using the kernel interface directly
+	 */
+	class IoUring {
+	private:
+		int mFd = -1;
+		io_uring_params mParams {};
+		std::vector<bool> mSupportedOperations;
+
+		void* mRing = nullptr;
+		std::size_t mRingSize = 0;
+		io_uring_sqe* mSqes = nullptr;
+		std::size_t mSqesSize = 0;
+
+		unsigned* mSqHead = nullptr;
+		unsigned* mSqTail = nullptr;
+		unsigned mSqMask = 0;
+		unsigned* mSqArray = nullptr;
+		unsigned mSqTailLocal = 0;
+		unsigned mUnsubmitted = 0;
+
+		unsigned* mCqHead = nullptr;
+		unsigned* mCqTail = nullptr;
+		unsigned mCqMask = 0;
+		io_uring_cqe* mCqes = nullptr;
+	public:
+		explicit IoUring(unsigned entries);
+		~IoUring();
+
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+
+		int fd() const;
+		bool supportsOperation(std::uint8_t opcode) const;
+
+		/**
+		 * Registers resources with the ring, returning a negated errno on failure
+		 */
+		int registerResource(unsigned opcode, const void* argument, unsigned count);
+
+		/**
+		 * Returns a cleared submission entry, or null if the submission queue is full
+		 */
+		io_uring_sqe* nextSubmission();
+		bool hasUnsubmitted() const;
+		int submit();
+
+		/**
+		 * Blocks until at least one completion is available, returning a negated errno on failure
+		 */
+		int wait();
+
+		/**
+		 * Calls the handler for every available completion
+		 */
+		std::size_t drainCompletions(const std::function<void (const io_uring_cqe& completion)>& handler);
+	};
+
+	/**
+	 * Sends packets through io_uring. All sends queued from the same handler of the io context are submitted in a single
+	 * system call, and large packets are copied once into a registered buffer and sent from there to every client
+	 * without further copies. Can be used from any thread, while completion handlers are called on the threads of the
+	 * io context.
+	 */
+	class UringSender {
+	public:
+		using CompletionHandler = std::function<void (boost::system::error_code error, std::size_t size)>;
+	private:
+		struct Operation {
+			int fd = -1;
+			video::network::EncodedPacketPtr packet;
+			std::size_t offset = 0;
+			std::size_t size = 0;
+			std::size_t sent = 0;
+			CompletionHandler handler;
+
+			int registeredBuffer = -1;
+			std::size_t pendingNotifications = 0;
+			bool completed = false;
+
+			std::array<iovec, 2> iov {};
+			msghdr message {};
+		};
+
+		struct Completion {
+			CompletionHandler handler;
+			boost::system::error_code error;
+			std::size_t size = 0;
+		};
+
+		struct RegisteredBuffer {
+			std::uint8_t* data = nullptr;
+			video::network::EncodedPacketPtr packet;
+			std::size_t users = 0;
+		};
+
+		boost::asio::io_context& mIOContext;
+		UringSenderConfig mConfig;
+		std::mutex mMutex;
+		bool mFlushScheduled = false;
+		bool mClosing = false;
+		std::vector<Completion> mCompletions; // Called once the lock has been released
+
+		boost::asio::posix::stream_descriptor mEventDescriptor;
+		std::uint64_t mEventCount = 0;
+
+		bool mZeroCopy = false;
+		std::unique_ptr<std::uint8_t[]> mRegisteredMemory;
+		std::vector<RegisteredBuffer> mRegisteredBuffers;
+		std::unordered_map<const video::network::EncodedPacket*, int> mRegisteredPackets;
+
+		std::unordered_set<Operation*> mOperations;
+
+		// Declared last, so that the ring is closed before the memory given to the kernel is freed
+		IoUring mRing;
+
+		void setupZeroCopy();
+		int acquireRegisteredBuffer(const video::network::EncodedPacketPtr& packet);
+		void releaseRegisteredBuffer(int index);
+
+		io_uring_sqe* nextSubmission();
+		io_uring_sqe* waitForSubmission();
+		void submit(Operation* operation);
+		void scheduleFlush();
+		void flush();
+
+		void waitForCompletions();
+		void handleCompletion(const io_uring_cqe& completion);
+		void finish(Operation* operation, boost::system::error_code error);
+		void destroy(Operation* operation);
+	public:
+		UringSender(boost::asio::io_context& ioContext, UringSenderConfig config);
+		~UringSender();
+
+		UringSender(const UringSender&) = delete;
+		UringSender& operator=(const UringSender&) = delete;
+
+		/**
+		 * Sends the given range of the packet frame, calling the handler once all of it has been sent or failed
+		 */
+		void send(
+			int fd,
+			video::network::EncodedPacketPtr packet,
+			std::size_t offset,
+			std::size_t size,
+			CompletionHandler handler
+		);
+
+		/**
+		 * Cancels the sends in progress to the given socket, which must be called before the socket is closed
+		 */
+		void cancel(int fd);
+
+		bool zeroCopy() const;
+	};
+#else
+	class UringSender;
+#endif
+}
\ No newline at end of file
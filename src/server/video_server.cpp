@@ -7,19 +7,33 @@
 
 namespace screenshare::server {
 	namespace {
+		constexpr std::chrono::seconds STAGE_REPORT_INTERVAL { 5 };
+
+		std::uint32_t elapsedMicroseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+			return (std::uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+		}
+
 		template<typename T>
 		T alignValue(T value, T alignment) {
 			return (value / alignment) * alignment;
 		}
 	}
 
-	VideoServer::VideoServer(boost::asio::ip::tcp::endpoint bind, video::VideoEncoderConfig videoEncoderConfig)
-		: mVideoEncoder("mp4"),
-		  mVideoEncoderConfig(videoEncoderConfig),
-		  mAcceptor(mIOContext, bind),
-		  mClientSockets({}),
-		  mClientActions({}) {
-		std::cout << "Running at " << bind << std::endl;
+	VideoServer::VideoServer(boost::asio::ip::tcp::endpoint bind,
+							 video::VideoEncoderConfig videoEncoderConfig,
+							 StreamServerConfig config)
+		: mVideoEncoderConfig(videoEncoderConfig),
+		  mVideoEncoder("mp4"),
+		  mStreamServer(
+			  mIOContext,
+			  bind,
+			  config,
+			  video::protocol::capabilityBit(video::protocol::Capability::RemoteInput)
+			  | video::protocol::capabilityBit(video::protocol::Capability::ExtendedInput)
+			  | video::protocol::capabilityBit(video::protocol::Capability::Recovery)
+		  ),
+		  mMinRefreshInterval(config.recovery.minRefreshInterval) {
+
 	}
 
 	void VideoServer::run(std::unique_ptr<screeninteractor::ScreenInteractor> screenInteractor) {
@@ -33,131 +47,112 @@ namespace screenshare::server {
 			throw std::runtime_error("Failed to create video stream.");
 		}
 
-		accept(mVideoStream);
-
-		mIOContextThread = std::jthread([&](std::stop_token stopToken) {
-			boost::system::error_code error;
+		std::unique_ptr<AVCodecParameters, video::AVCodecParametersDeleter> codecParameters(avcodec_parameters_alloc());
+		if (!codecParameters || avcodec_parameters_from_context(codecParameters.get(), mVideoStream->encoder.get()) < 0) {
+			throw std::runtime_error("Failed to get codec parameters.");
+		}
 
-			while (!error.failed() && !stopToken.stop_requested()) {
-				mIOContext.run(error);
+		mStreamServer.start(
+			codecParameters.get(),
+			mVideoStream->encoder->time_base,
+			[this](ClientConnection& connection, const video::protocol::FrameHeader& header, video::protocol::MessageReader& payload) {
+				handleClientMessage(connection, header, payload);
+			},
+			[this]() {
+				mRefreshRequested.store(true);
 			}
-
-			std::cout << "Context done with error: " << error << std::endl;
-		});
+		);
 
 		auto streamFrameRate = (double)mVideoStream->encoder->time_base.den / (double)mVideoStream->encoder->time_base.num;
 		std::cout << "Grabbing: " << screenInteractor->width() << "x" << screenInteractor->height() << " @ " << streamFrameRate << " FPS" << std::endl;
 
+		std::jthread inputThread([&](std::stop_token stopToken) {
+			applyClientActions(stopToken, *screenInteractor);
+		});
+
 		video::Converter converter;
-		video::network::PacketSender packetSender;
-		while (!mIOContextThread.get_stop_token().stop_requested()) {
+		mLastStageReport = std::chrono::steady_clock::now();
+		while (!mStopRequested.load()) {
 			misc::RateSleeper rateSleeper(streamFrameRate);
 
+			auto captureStartTime = std::chrono::steady_clock::now();
 			auto grabbedFrame = screenInteractor->grab();
 			if (!grabbedFrame) {
 				std::cout << "Failed to grab frame." << std::endl;
 				break;
 			}
 
+			auto convertStartTime = std::chrono::steady_clock::now();
 			if (!nextFrame(mVideoStream, converter, *grabbedFrame)) {
 				break;
 			}
 
-			std::vector<std::tuple<ClientId, Socket*>> clientSockets;
-			{
-				auto guard = mClientSockets.guard();
-				for (auto& [clientId, socket] : guard.get()) {
-					clientSockets.emplace_back(clientId, socket.get());
-				}
-			}
+			video::network::ServerStageTimes stageTimes;
+			stageTimes.capture = elapsedMicroseconds(captureStartTime, convertStartTime);
+			stageTimes.convert = elapsedMicroseconds(convertStartTime, std::chrono::steady_clock::now());
+			mCaptureTimes.add((double)stageTimes.capture / 1.0E3);
+			mConvertTimes.add((double)stageTimes.convert / 1.0E3);
 
-			auto [done, socketErrors] = encodeFrameAndSend(clientSockets, mVideoStream, packetSender);
-
-			{
-				auto guard = mClientSockets.guard();
-				for (auto& [clientId, socketError] : socketErrors) {
-					if (socketError) {
-						std::cout << "Removing client #" << clientId << " due to: " << socketError << std::endl;
-						guard->erase(clientId);
-					}
-				}
-			}
-
-			if (done) {
+			if (encodeFrameAndSend(mVideoStream, stageTimes)) {
 				break;
 			}
 
-			{
-				auto guard = mClientActions.guard();
-				auto clientActions = std::move(guard.get());
-				for (auto& clientAction : clientActions) {
-					if (!screenInteractor->handleClientAction(clientAction)) {
-						std::cout << "Unhandled command: " << clientAction.toString() << std::endl;
-					}
-				}
+			if (std::chrono::steady_clock::now() - mLastStageReport >= STAGE_REPORT_INTERVAL) {
+				reportStageTimes();
 			}
 		}
 
 		std::cout << "Done encoding." << std::endl;
 
-		mIOContextThread.request_stop();
-		mIOContext.stop();
-
-		if (mIOContextThread.joinable()) {
-			mIOContextThread.join();
-		}
+		mStreamServer.stop();
 	}
 
 	void VideoServer::stop() {
-		mIOContextThread.request_stop();
+		mStopRequested.store(true);
 	}
 
-	void VideoServer::accept(video::OutputStream* videoStream) {
-		auto socket = std::make_shared<Socket>(mIOContext);
-
-		mAcceptor.async_accept(
-			*socket,
-			[this, videoStream, socket](boost::system::error_code acceptFailed) {
-				if (!acceptFailed) {
-					if (auto error = screenshare::video::network::sendAVCodecParameters(*socket, videoStream->encoder.get())) {
-						std::cout << "Failed to send codec parameters due to: " << error << std::endl;
-					} else {
-						{
-							auto guard = mClientSockets.guard();
-							auto clientId = mNextClientId++;
-							std::cout << "Accepted client #" << clientId << ": " << socket->remote_endpoint() << std::endl;
-							guard.get()[clientId] = socket;
-						}
-
-						receiveFromClient(socket, std::make_shared<client::ClientAction>());
-					}
-				} else {
-					std::cout << "Failed to accept client due to: " << acceptFailed << std::endl;
-				}
+	boost::asio::ip::tcp::endpoint VideoServer::endpoint() const {
+		return mStreamServer.endpoint();
+	}
 
-				accept(videoStream);
+	void VideoServer::handleClientMessage(ClientConnection& connection,
+										  const video::protocol::FrameHeader& header,
+										  video::protocol::MessageReader& payload) {
+		if (header.type == video::protocol::MessageType::ClientAction
+			&& video::protocol::hasCapability(connection.capabilities(), video::protocol::Capability::RemoteInput)) {
+			client::ClientAction clientAction;
+			if (client::ClientAction::read(payload, clientAction) && !mClientActions.tryPush(clientAction)) {
+				mDroppedClientActions.fetch_add(1, std::memory_order_relaxed);
 			}
-		);
+		}
 	}
 
-	void VideoServer::receiveFromClient(std::shared_ptr<Socket> socket, std::shared_ptr<client::ClientAction> clientAction) {
-		clientAction->clear();
+	void VideoServer::applyClientActions(std::stop_token stopToken, screeninteractor::ClientActionHandler& clientActionHandler) {
+		std::vector<client::ClientAction> clientActions;
+		clientActions.reserve(mClientActions.capacity());
 
-		client::ClientAction::receiveAsync(
-			socket,
-			std::move(clientAction),
-			[this, socket](boost::system::error_code error, std::shared_ptr<client::ClientAction> clientAction) {
-				if (!error) {
-					std::cout << "Got client action: " << clientAction->toString() << std::endl;
+		while (mClientActions.wait(stopToken)) {
+			// Bounded by the reserved capacity, so that the batch never allocates
+			clientActions.clear();
+			client::ClientAction queued;
+			while (clientActions.size() < clientActions.capacity() && mClientActions.tryPop(queued)) {
+				clientActions.push_back(queued);
+			}
 
-					{
-						mClientActions.guard()->push_back(*clientAction);
-					}
+			if (auto dropped = mDroppedClientActions.exchange(0, std::memory_order_relaxed); dropped > 0) {
+				std::cout << "Dropped " << dropped << " client actions, as input could not keep up." << std::endl;
+			}
 
-					receiveFromClient(socket, clientAction);
+			// Everything queued meanwhile is injected as one batch, where only the last of consecutive mouse moves matters
+			client::coalesceMouseMoves(clientActions);
+			for (auto& clientAction : clientActions) {
+				if (!clientActionHandler.handleClientAction(clientAction)) {
+					std::cout << "Unhandled command: " << clientAction.toString() << std::endl;
 				}
 			}
-		);
+
+			clientActionHandler.flushClientActions();
+		}
 	}
 
 	bool VideoServer::nextFrame(video::OutputStream* videoStream,
@@ -182,22 +177,29 @@ namespace screenshare::server {
 		}
 
 		videoStream->frame->pts = videoStream->nextPts++;
+
+		// Recovery requests from several clients close together are served by the same keyframe.
+		videoStream->frame->pict_type = AV_PICTURE_TYPE_NONE;
+		auto timeNow = std::chrono::steady_clock::now();
+		if (timeNow - mLastRefresh >= mMinRefreshInterval && mRefreshRequested.exchange(false)) {
+			videoStream->frame->pict_type = AV_PICTURE_TYPE_I;
+			mLastRefresh = timeNow;
+		}
+
 		return true;
 	}
 
-	std::tuple<bool, std::vector<VideoServer::SendResult>> VideoServer::encodeFrameAndSend(std::vector<std::tuple<ClientId, Socket*>>& sockets,
-																						   video::OutputStream* videoStream,
-																						   video::network::PacketSender& packetSender) {
+	bool VideoServer::encodeFrameAndSend(video::OutputStream* videoStream, video::network::ServerStageTimes stageTimes) {
+		auto encodeStartTime = std::chrono::steady_clock::now();
 		if (avcodec_send_frame(videoStream->encoder.get(), videoStream->frame.get()) < 0) {
 			std::cout << "avcodec_send_frame failed" << std::endl;
-			return { true, {} };
+			return true;
 		}
 
 		bool done = false;
 		auto packet = videoStream->packet.get();
 		auto stream = videoStream->stream;
 
-		std::vector<SendResult> socketErrors;
 		while (true) {
 			auto response = avcodec_receive_packet(videoStream->encoder.get(), packet);
 			if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
@@ -212,21 +214,31 @@ namespace screenshare::server {
 			av_packet_rescale_ts(packet, videoStream->encoder->time_base, stream->time_base);
 			packet->stream_index = stream->index;
 
-			std::vector<std::tuple<ClientId, video::network::PacketSender::AsyncResultPtr>> sendResults;
+			// The packet references the encoder output, so the clients share it without any copy.
 			video::network::PacketHeader header { videoStream->frame->pts };
-			for (auto& [clientId, socket] : sockets) {
-				sendResults.emplace_back(clientId, packetSender.sendAsync(*socket, header, packet));
+			header.referencePts = mLastReferencePts;
+			stageTimes.encode = elapsedMicroseconds(encodeStartTime, std::chrono::steady_clock::now());
+			header.stageTimes = stageTimes;
+			mEncodeTimes.add((double)stageTimes.encode / 1.0E3);
+			mStreamServer.broadcast(std::make_shared<video::network::EncodedPacket>(header, packet));
+
+			// Clients can skip over the disposable packets in between, which are dropped before other packets
+			if ((packet->flags & AV_PKT_FLAG_DISPOSABLE) == 0) {
+				mLastReferencePts = header.encoderPts;
 			}
+		}
 
-			for (auto [clientId, sendResult] : sendResults) {
-				sendResult->done.wait(false);
+		return done;
+	}
 
-				if (sendResult->error) {
-					socketErrors.emplace_back(clientId, sendResult->error);
-				}
-			}
-		}
+	void VideoServer::reportStageTimes() {
+		std::cout << "Capture: " << mCaptureTimes.summary() << std::endl;
+		std::cout << "Convert: " << mConvertTimes.summary() << std::endl;
+		std::cout << "Encode: " << mEncodeTimes.summary() << std::endl;
 
-		return { done, socketErrors };
+		mCaptureTimes.reset();
+		mConvertTimes.reset();
+		mEncodeTimes.reset();
+		mLastStageReport = std::chrono::steady_clock::now();
 	}
 }
\ No newline at end of file
@@ -1,20 +1,23 @@
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <thread>
+#include <vector>
 
 #include <boost/asio.hpp>
 
 #include "../screeninteractor//common.h"
 #include "../client/actions.h"
 #include "../misc/concurrency.hpp"
+#include "../misc/latency_histogram.h"
 #include "../video/encoder.h"
+#include "../video/network.h"
+#include "../video/protocol.h"
+#include "stream_server.h"
 
 namespace screenshare::video {
 	class OutputStream;
 	class Converter;
-
-	namespace network {
-		class PacketSender;
-	}
 }
 
 namespace screenshare::screeninteractor {
@@ -24,21 +27,29 @@ namespace screenshare::screeninteractor {
 namespace screenshare::server {
 	class VideoServer {
 	private:
-		using Socket = boost::asio::ip::tcp::socket;
-		using ClientId = std::uint64_t;
-
 		video::VideoEncoderConfig mVideoEncoderConfig;
 		video::VideoEncoder mVideoEncoder;
 		video::OutputStream* mVideoStream;
 
 		boost::asio::io_context mIOContext;
-		std::jthread mIOContextThread;
-		boost::asio::ip::tcp::acceptor mAcceptor;
+		StreamServer mStreamServer;
+		std::atomic<bool> mStopRequested = false;
 
-		std::uint64_t mNextClientId = 1;
-		misc::ResourceMutex<std::unordered_map<ClientId, std::shared_ptr<Socket>>> mClientSockets;
+		std::chrono::milliseconds mMinRefreshInterval;
+		std::atomic<bool> mRefreshRequested = false;
+		std::chrono::steady_clock::time_point mLastRefresh;
+		std::int64_t mLastReferencePts = -1; // Encoder pts of the last packet that was not disposable
 
-		misc::ResourceMutex<std::vector<client::ClientAction>> mClientActions;
+		// Client actions are applied by a thread of their own, so input is not held back by grabbing and encoding.
+		// Queued from the threads serving the clients without locking, and dropped when the input thread falls this far behind.
+		misc::MpscQueue<client::ClientAction> mClientActions { 1024 };
+		std::atomic<std::size_t> mDroppedClientActions = 0;
+
+		// Only used by the thread grabbing and encoding
+		misc::LatencyHistogram mCaptureTimes;
+		misc::LatencyHistogram mConvertTimes;
+		misc::LatencyHistogram mEncodeTimes;
+		std::chrono::steady_clock::time_point mLastStageReport;
 
 		bool nextFrame(
 			video::OutputStream* videoStream,
@@ -46,22 +57,26 @@ namespace screenshare::server {
 			const screeninteractor::GrabbedFrame& grabbedFrame
 		);
 
-		using SendResult = std::tuple<ClientId, boost::system::error_code>;
-		std::tuple<bool, std::vector<SendResult>> encodeFrameAndSend(
-			std::vector<std::tuple<ClientId, Socket*>>& sockets,
-			video::OutputStream* videoStream,
-			video::network::PacketSender& packetSender
-		);
+		bool encodeFrameAndSend(video::OutputStream* videoStream, video::network::ServerStageTimes stageTimes);
+		void reportStageTimes();
+
+		void applyClientActions(std::stop_token stopToken, screeninteractor::ClientActionHandler& clientActionHandler);
 
-		void accept(video::OutputStream* acceptFailed);
-		void receiveFromClient(
-			std::shared_ptr<Socket> socket,
-			std::shared_ptr<client::ClientAction> clientAction
+		void handleClientMessage(
+			ClientConnection& connection,
+			const video::protocol::FrameHeader& header,
+			video::protocol::MessageReader& payload
 		);
 	public:
-		explicit VideoServer(boost::asio::ip::tcp::endpoint bind, video::VideoEncoderConfig videoEncoderConfig);
+		explicit VideoServer(
+			boost::asio::ip::tcp::endpoint bind,
+			video::VideoEncoderConfig videoEncoderConfig,
+			StreamServerConfig config = {}
+		);
 
 		void run(std::unique_ptr<screeninteractor::ScreenInteractor> screenInteractor);
 		void stop();
+
+		boost::asio::ip::tcp::endpoint endpoint() const;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "clock_sync.h"
+
+namespace screenshare::video::clocksync {
+	namespace {
+		// Offsets close in time differ mostly by noise, so the drift is only fitted once the samples span long enough.
+		constexpr double MIN_DRIFT_SPAN = 10.0E9;
+	}
+
+	std::int64_t currentTime() {
+		std::timespec time {};
+		std::timespec_get(&time, TIME_UTC);
+		return toNanoseconds(time);
+	}
+
+	std::int64_t toNanoseconds(const std::timespec& time) {
+		return (std::int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+	}
+
+	std::timespec toTimespec(std::int64_t time) {
+		std::timespec result {};
+		result.tv_sec = time / 1000000000;
+		result.tv_nsec = (long)(time % 1000000000);
+		if (result.tv_nsec < 0) {
+			result.tv_sec--;
+			result.tv_nsec += 1000000000;
+		}
+
+		return result;
+	}
+
+	ClockSynchronizer::ClockSynchronizer(ClockSyncConfig config)
+		: mConfig(config) {
+
+	}
+
+	bool ClockSynchronizer::shouldRequest() {
+		std::lock_guard lock(mMutex);
+		auto interval = mRecent.size() < mConfig.filterSize ? mConfig.initialInterval : mConfig.interval;
+		auto now = currentTime();
+		if (now - mLastRequestTime < std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()) {
+			return false;
+		}
+
+		mLastRequestTime = now;
+		return true;
+	}
+
+	protocol::MessageWriter ClockSynchronizer::createRequest() {
+		protocol::MessageWriter writer(protocol::MessageType::ClockSyncRequest);
+		protocol::writeClockSync(writer, { currentTime() });
+		writer.finish();
+		return writer;
+	}
+
+	void ClockSynchronizer::handleResponse(const protocol::ClockSync& clockSync, std::int64_t receiveTime) {
+		Sample sample;
+		sample.localTime = clockSync.clientSendTime + (receiveTime - clockSync.clientSendTime) / 2;
+		sample.offset = ((double)(clockSync.serverReceiveTime - clockSync.clientSendTime) + (double)(clockSync.serverSendTime - receiveTime)) / 2.0;
+		sample.roundTrip = (double)(receiveTime - clockSync.clientSendTime) - (double)(clockSync.serverSendTime - clockSync.serverReceiveTime);
+
+		// Happens when either clock is stepped during the exchange
+		if (sample.roundTrip < 0.0) {
+			return;
+		}
+
+		std::lock_guard lock(mMutex);
+		mRecent.push_back(sample);
+		while (mRecent.size() > mConfig.filterSize) {
+			mRecent.pop_front();
+		}
+
+		auto best = bestSample();
+		if (mFiltered.empty() || mFiltered.back().localTime != best->localTime) {
+			mFiltered.push_back(*best);
+			while (mFiltered.size() > mConfig.driftWindow) {
+				mFiltered.pop_front();
+			}
+
+			updateDrift();
+		}
+	}
+
+	const ClockSynchronizer::Sample* ClockSynchronizer::bestSample() const {
+		const Sample* best = nullptr;
+		for (auto& sample : mRecent) {
+			if (!best || sample.roundTrip < best->roundTrip) {
+				best = &sample;
+			}
+		}
+
+		return best;
+	}
+
+	void ClockSynchronizer::updateDrift() {
+		auto span = (double)(mFiltered.back().localTime - mFiltered.front().localTime);
+		if (mFiltered.size() < 4 || span < MIN_DRIFT_SPAN) {
+			mDrift = 0.0;
+			return;
+		}
+
+		double meanTime = 0.0;
+		double meanOffset = 0.0;
+		for (auto& sample : mFiltered) {
+			meanTime += (double)(sample.localTime - mFiltered.front().localTime);
+			meanOffset += sample.offset;
+		}
+
+		meanTime /= (double)mFiltered.size();
+		meanOffset /= (double)mFiltered.size();
+
+		double covariance = 0.0;
+		double variance = 0.0;
+		for (auto& sample : mFiltered) {
+			auto time = (double)(sample.localTime - mFiltered.front().localTime) - meanTime;
+			covariance += time * (sample.offset - meanOffset);
+			variance += time * time;
+		}
+
+		mDrift = variance > 0.0 ? covariance / variance : 0.0;
+	}
+
+	ClockEstimate ClockSynchronizer::estimate() const {
+		std::lock_guard lock(mMutex);
+		auto best = bestSample();
+		if (!best) {
+			return {};
+		}
+
+		auto elapsed = (double)(currentTime() - best->localTime);
+		return {
+			true,
+			(best->offset + mDrift * elapsed) / 1.0E6,
+			best->roundTrip / 1.0E6,
+			mDrift * 1.0E6
+		};
+	}
+
+	std::int64_t ClockSynchronizer::toLocalTime(std::int64_t serverTime) const {
+		std::lock_guard lock(mMutex);
+		auto best = bestSample();
+		if (!best) {
+			return serverTime;
+		}
+
+		auto localTime = serverTime - (std::int64_t)best->offset;
+		auto offset = best->offset + mDrift * (double)(localTime - best->localTime);
+		return serverTime - (std::int64_t)offset;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+
+#include "protocol.h"
+
+namespace screenshare::video::clocksync {
+	/**
+	 * Nanoseconds of the realtime clock, which packets are stamped with
+	 */
+	std::int64_t currentTime();
+	std::int64_t toNanoseconds(const std::timespec& time);
+	std::timespec toTimespec(std::int64_t time);
+
+	struct ClockSyncConfig {
+		std::chrono::milliseconds interval { 1000 };
+		std::chrono::milliseconds initialInterval { 100 }; // Used until the filter is full, so an estimate is available quickly
+		std::size_t filterSize = 8; // The sample with the lowest round trip of the most recent ones is used
+		std::size_t driftWindow = 64; // Number of filtered samples the drift is fitted over
+	};
+
+	struct ClockEstimate {
+		bool synchronized = false;
+		double offset = 0.0; // Server clock minus local clock, in milliseconds
+		double roundTrip = 0.0; // Of the sample the offset comes from, in milliseconds. Half of it bounds the error of the offset.
+		double drift = 0.0; // Rate of the server clock relative to the local one, in parts per million
+	};
+
+	/**
+	 * Estimates the offset and drift between the local clock and the clock of a server from clock sync exchanges.
+	 * Like NTP, the sample with the lowest round trip among the most recent ones is trusted the most, as queueing delays
+	 * are what make the path asymmetric. The drift is the slope of a least squares fit of the filtered offsets.
+	 * Can be used from any thread.
+	 */
+	class ClockSynchronizer {
+	private:
+		struct Sample {
+			std::int64_t localTime = 0;
+			double offset = 0.0; // In nanoseconds
+			double roundTrip = 0.0;
+		};
+
+		ClockSyncConfig mConfig;
+
+		mutable std::mutex mMutex;
+		std::int64_t mLastRequestTime = 0;
+		std::deque<Sample> mRecent;
+		std::deque<Sample> mFiltered;
+		double mDrift = 0.0;
+
+		const Sample* bestSample() const;
+		void updateDrift();
+	public:
+		explicit ClockSynchronizer(ClockSyncConfig config = {});
+
+		/**
+		 * Indicates if it is time to send another request
+		 */
+		bool shouldRequest();
+
+		/**
+		 * Creates a request stamped with the current time
+		 */
+		protocol::MessageWriter createRequest();
+
+		/**
+		 * Adds the sample given by the response, received at the given local time
+		 */
+		void handleResponse(const protocol::ClockSync& clockSync, std::int64_t receiveTime);
+
+		ClockEstimate estimate() const;
+
+		/**
+		 * Converts a time of the server clock to the local clock, or returns it as it is if not yet synchronized
+		 */
+		std::int64_t toLocalTime(std::int64_t serverTime) const;
+	};
+}
\ No newline at end of file
@@ -62,4 +62,17 @@ namespace screenshare::video {
 			av_packet_free(&ptr);
 		}
 	};
+
+	struct AVIOContextDeleter {
+		void operator()(AVIOContext* ptr) {
+			av_freep(&ptr->buffer);
+			avio_context_free(&ptr);
+		}
+	};
+
+	struct AVCodecParametersDeleter {
+		void operator()(AVCodecParameters* ptr) {
+			avcodec_parameters_free(&ptr);
+		}
+	};
 }
\ No newline at end of file
@@ -3,8 +3,6 @@
 
 namespace screenshare::video {
 	namespace {
-		constexpr AVPixelFormat CONVERT_RGB_FORMAT = AV_PIX_FMT_RGB24;
-
 		void printDecodedFrame(AVCodecContext* codecContext, AVFrame* frame) {
 			std::cout
 				<< "Frame " << codecContext->frame_number
@@ -14,13 +12,56 @@ namespace screenshare::video {
 		}
 	}
 
+	DecoderThreading decoderThreadingFromString(const std::string& name) {
+		if (name == "single") {
+			return DecoderThreading::Single;
+		} else if (name == "slice") {
+			return DecoderThreading::Slice;
+		} else if (name == "frame") {
+			return DecoderThreading::Frame;
+		}
+
+		throw std::runtime_error("Unknown decoder threading: " + name);
+	}
+
+	void configureDecoder(AVCodecContext* codecContext, const DecoderConfig& config) {
+		switch (config.threading) {
+			case DecoderThreading::Single:
+				codecContext->thread_count = 1;
+				break;
+			case DecoderThreading::Slice:
+				codecContext->thread_count = config.threadCount;
+				codecContext->thread_type = FF_THREAD_SLICE;
+				break;
+			case DecoderThreading::Frame:
+				codecContext->thread_count = config.threadCount;
+				codecContext->thread_type = FF_THREAD_FRAME;
+				break;
+		}
+
+		// libavcodec falls back to a single thread when low delay is set together with frame threading
+		if (config.lowDelay && config.threading != DecoderThreading::Frame) {
+			codecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+		}
+	}
+
+	std::string describeDecoderThreading(const AVCodecContext* codecContext) {
+		if (codecContext->active_thread_type & FF_THREAD_FRAME) {
+			return std::to_string(codecContext->thread_count) + " frame threads";
+		} else if (codecContext->active_thread_type & FF_THREAD_SLICE) {
+			return std::to_string(codecContext->thread_count) + " slice threads";
+		}
+
+		return "single threaded";
+	}
+
 	int PacketDecoder::decode(AVPacket* packet,
 							  AVCodecContext* codecContext,
 							  AVFrame* frame,
-							  std::uint8_t* destination,
+							  DestinationProvider destinationProvider,
 							  std::function<void (AVCodecContext*)> callback) {
-		if (auto response = avcodec_send_packet(codecContext, packet) < 0) {
-			std::cout << "Error while sending a packet to the decoder: " << makeAvErrorString(response) << std::endl;
+		if (auto response = avcodec_send_packet(codecContext, packet); response < 0) {
+			std::cerr << "Error while sending a packet to the decoder: " << makeAvErrorString(response) << std::endl;
 			return response;
 		}
 
@@ -29,12 +70,18 @@ namespace screenshare::video {
 			if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
 				break;
 			} else if (response < 0) {
-				std::cout << "Error while receiving a frame from the decoder: " << makeAvErrorString(response) << std::endl;
+				std::cerr << "Error while receiving a frame from the decoder: " << makeAvErrorString(response) << std::endl;
 				return response;
 			}
 
 //			printDecodedFrame(codecContext, frame);
 
+			auto destination = destinationProvider(frame);
+			if (!destination) {
+				callback(codecContext);
+				continue;
+			}
+
 			if (!mConversion) {
 				mConversion = decltype(mConversion) {
 					sws_getContext(
@@ -44,7 +91,7 @@ namespace screenshare::video {
 
 						frame->width,
 						frame->height,
-						CONVERT_RGB_FORMAT,
+						CONVERT_FORMAT,
 
 						SWS_FAST_BILINEAR,
 						nullptr,
@@ -57,7 +104,7 @@ namespace screenshare::video {
 			std::uint8_t* destinationPtrs[AV_NUM_DATA_POINTERS] = {};
 			int destinationLineSizes[AV_NUM_DATA_POINTERS] = {};
 			destinationPtrs[0] = destination;
-			destinationLineSizes[0] = frame->width * 3;
+			destinationLineSizes[0] = frame->width * CONVERT_BYTES_PER_PIXEL;
 
 			if (sws_scale(mConversion.get(), frame->data, frame->linesize, 0, frame->height, destinationPtrs, destinationLineSizes) >= 0) {
 				callback(codecContext);
@@ -1,7 +1,9 @@
 #pragma once
+#include <functional>
 #include <memory>
 #include <iostream>
 #include <optional>
+#include <string>
 
 #include <boost/system/error_code.hpp>
 #include <boost/asio.hpp>
@@ -10,15 +12,54 @@
 #include "../misc/time_measurement.h"
 
 namespace screenshare::video {
+	/**
+	 * Decoded frames are converted to native endian xRGB, which Cairo draws as it is
+	 */
+	constexpr AVPixelFormat CONVERT_FORMAT = AV_PIX_FMT_0RGB32;
+	constexpr int CONVERT_BYTES_PER_PIXEL = 4;
+
+	enum class DecoderThreading {
+		Single,
+		Slice, // Decodes the slices of a frame in parallel, which adds no delay but needs an encoder that splits frames into slices
+		Frame // Decodes consecutive frames in parallel, which delays every frame by one frame per extra thread
+	};
+
+	DecoderThreading decoderThreadingFromString(const std::string& name);
+
+	/**
+	 * With frame threading, the frame that comes out of decoding a packet is an earlier one, so the decode time the overload
+	 * controller measures per packet is that of the pipeline rather than of the packet.
+	 */
+	struct DecoderConfig {
+		DecoderThreading threading = DecoderThreading::Slice;
+		int threadCount = 0; // Zero picks one thread per core
+		bool lowDelay = true; // Outputs frames as soon as they are decoded. Not applied with frame threading, which it turns off.
+	};
+
+	/**
+	 * Applies the given config to a decoder that is not yet opened
+	 */
+	void configureDecoder(AVCodecContext* codecContext, const DecoderConfig& config);
+
+	/**
+	 * Describes the threading the given opened decoder actually uses, which depends on what the codec supports
+	 */
+	std::string describeDecoderThreading(const AVCodecContext* codecContext);
+
 	class PacketDecoder {
 	private:
 		std::unique_ptr<SwsContext, SwsContextDeleter> mConversion;
 	public:
+		/**
+		 * Returns where to convert the given decoded frame to, in the convert format, or null to leave it unconverted
+		 */
+		using DestinationProvider = std::function<std::uint8_t* (AVFrame* frame)>;
+
 		int decode(
 			AVPacket* packet,
 			AVCodecContext* codecContext,
 			AVFrame* frame,
-			std::uint8_t* destination,
+			DestinationProvider destinationProvider,
 			std::function<void (AVCodecContext* codecContext)> callback
 		);
 	};
@@ -152,6 +152,9 @@ namespace screenshare::video {
 				outputStream->encoder->gop_size = 30;
 				handleAVResult(av_opt_set(outputStream->encoder->priv_data, "preset", "ultrafast", 0), "Failed to set preset");
 				handleAVResult(av_opt_set(outputStream->encoder->priv_data, "tune", "zerolatency", 0), "Failed to set tune");
+				if (config.intraRefresh) {
+					handleAVResult(av_opt_set(outputStream->encoder->priv_data, "intra-refresh", "1", 0), "Failed to set intra-refresh");
+				}
 				break;
 			default:
 				break;
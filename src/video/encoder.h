@@ -41,6 +41,7 @@ namespace screenshare::video {
 		int width = 0;
 		int height = 0;
 		int frameRate = 0;
+		bool intraRefresh = false; // Refresh in waves of intra blocks instead of periodic keyframes
 	};
 
 	class VideoEncoder {
@@ -0,0 +1,125 @@
+#include "fmp4.h"
+
+#include <iostream>
+#include <utility>
+
+#include <fmt/format.h>
+
+namespace screenshare::video::fmp4 {
+	namespace {
+		constexpr int IO_BUFFER_SIZE = 64 * 1024;
+
+		// Profile, constraints and level of an H.264 stream, which follow the header of its sequence parameter set.
+		// The extradata is either an avcC box or, as x264 outputs it, NAL units in Annex B format.
+		std::string avcCodecString(const std::uint8_t* data, std::size_t size) {
+			if (size >= 4 && data[0] == 1) {
+				return fmt::format("avc1.{:02x}{:02x}{:02x}", data[1], data[2], data[3]);
+			}
+
+			for (std::size_t i = 0; i + 6 < size; i++) {
+				if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1F) == 7) {
+					return fmt::format("avc1.{:02x}{:02x}{:02x}", data[i + 4], data[i + 5], data[i + 6]);
+				}
+			}
+
+			return "";
+		}
+	}
+
+	FragmentMuxer::FragmentMuxer(const AVCodecParameters* codecParameters, AVRational timeBase)
+		: mTimeBase(timeBase) {
+		AVFormatContext* formatContextPtr = nullptr;
+		avformat_alloc_output_context2(&formatContextPtr, nullptr, "mp4", nullptr);
+		if (!formatContextPtr) {
+			throw std::runtime_error("Failed to create output format context.");
+		}
+
+		mFormatContext = decltype(mFormatContext) { formatContextPtr };
+
+		mStream = avformat_new_stream(mFormatContext.get(), nullptr);
+		if (!mStream) {
+			throw std::runtime_error("Failed to allocate stream.");
+		}
+
+		handleAVResult(avcodec_parameters_copy(mStream->codecpar, codecParameters), "Failed to copy codec parameters.");
+		mStream->codecpar->codec_tag = 0;
+		mStream->time_base = timeBase;
+
+		auto buffer = (std::uint8_t*)av_malloc(IO_BUFFER_SIZE);
+		if (!buffer) {
+			throw std::runtime_error("Failed to allocate IO buffer.");
+		}
+
+		mIOContext = decltype(mIOContext) { avio_alloc_context(buffer, IO_BUFFER_SIZE, 1, this, nullptr, &FragmentMuxer::writeOutput, nullptr) };
+		if (!mIOContext) {
+			av_free(buffer);
+			throw std::runtime_error("Failed to allocate AVIOContext.");
+		}
+
+		mFormatContext->pb = mIOContext.get();
+
+		mPacket = decltype(mPacket) { av_packet_alloc() };
+		if (!mPacket) {
+			throw std::runtime_error("Failed to allocate memory for AVPacket");
+		}
+
+		// The moov box describes the track without any samples, and every fragment is only cut when flushing.
+		// Fragments address their data relative to their own moof, which is what Media Source Extensions require.
+		AVDictionary* options = nullptr;
+		av_dict_set(&options, "movflags", "empty_moov+default_base_moof+frag_custom", 0);
+		auto response = avformat_write_header(mFormatContext.get(), &options);
+		av_dict_free(&options);
+		handleAVResult(response, "Failed to write header: " + makeAvErrorString(response));
+
+		avio_flush(mIOContext.get());
+		mInitSegment = std::exchange(mOutput, {});
+	}
+
+	int FragmentMuxer::writeOutput(void* opaque, std::uint8_t* data, int size) {
+		auto& output = static_cast<FragmentMuxer*>(opaque)->mOutput;
+		output.insert(output.end(), data, data + size);
+		return size;
+	}
+
+	const std::vector<std::uint8_t>& FragmentMuxer::initSegment() const {
+		return mInitSegment;
+	}
+
+	bool FragmentMuxer::add(const AVPacket* packet) {
+		if (av_packet_ref(mPacket.get(), packet) < 0) {
+			return false;
+		}
+
+		// The duration of the last sample in a fragment comes from the packet, which the encoder leaves unset
+		if (mPacket->duration == 0) {
+			mPacket->duration = 1;
+		}
+
+		av_packet_rescale_ts(mPacket.get(), mTimeBase, mStream->time_base);
+		mPacket->stream_index = mStream->index;
+
+		auto response = av_write_frame(mFormatContext.get(), mPacket.get());
+		av_packet_unref(mPacket.get());
+		if (response < 0) {
+			std::cout << "Failed to mux packet: " << makeAvErrorString(response) << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	std::vector<std::uint8_t> FragmentMuxer::flush() {
+		// Without a packet, the muxer writes what it has buffered as a fragment
+		av_write_frame(mFormatContext.get(), nullptr);
+		avio_flush(mIOContext.get());
+		return std::exchange(mOutput, {});
+	}
+
+	std::string codecString(const AVCodecParameters* codecParameters) {
+		if (codecParameters->codec_id == AV_CODEC_ID_H264 && codecParameters->extradata) {
+			return avcCodecString(codecParameters->extradata, (std::size_t)codecParameters->extradata_size);
+		}
+
+		return "";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+namespace screenshare::video::fmp4 {
+	/**
+	 * Muxes already encoded packets into fragmented MP4, as played by browsers through Media Source Extensions and by HLS.
+	 * The output is an init segment describing the track, followed by self-contained fragments (moof and mdat) which are
+	 * cut wherever the caller flushes. Nothing is re-encoded.
+	 */
+	class FragmentMuxer {
+	private:
+		std::unique_ptr<AVFormatContext, AVFormatContextDeleter> mFormatContext;
+		std::unique_ptr<AVIOContext, AVIOContextDeleter> mIOContext;
+		AVStream* mStream = nullptr;
+		AVRational mTimeBase;
+		std::unique_ptr<AVPacket, AVPacketDeleter> mPacket;
+
+		std::vector<std::uint8_t> mOutput;
+		std::vector<std::uint8_t> mInitSegment;
+
+		static int writeOutput(void* opaque, std::uint8_t* data, int size);
+	public:
+		/**
+		 * Creates a muxer of packets with timestamps in the given time base, which is expected to be the frame interval
+		 */
+		FragmentMuxer(const AVCodecParameters* codecParameters, AVRational timeBase);
+
+		FragmentMuxer(const FragmentMuxer&) = delete;
+		FragmentMuxer& operator=(const FragmentMuxer&) = delete;
+
+		/**
+		 * The ftyp and moov boxes, which a player needs before any fragment
+		 */
+		const std::vector<std::uint8_t>& initSegment() const;
+
+		bool add(const AVPacket* packet);
+
+		/**
+		 * Ends the current fragment, returning it. Empty if no packets were added since the previous flush.
+		 */
+		std::vector<std::uint8_t> flush();
+	};
+
+	/**
+	 * The codec as given to the codecs parameter of a MIME type (RFC 6381), such as avc1.42c01f. Empty if not known.
+	 */
+	std::string codecString(const AVCodecParameters* codecParameters);
+}
\ No newline at end of file
@@ -1,61 +1,130 @@
 #include "decoder.h"
 #include "network.h"
 
+#include <cstring>
+
 namespace screenshare::video::network {
-	boost::system::error_code sendAVCodecParameters(boost::asio::ip::tcp::socket& socket, AVCodecContext* codecContext) {
-		CustomCodecParameters customCodecParameters;
-		customCodecParameters.timeBase = codecContext->time_base;
+	namespace {
+		// Flags of the packet headers of version 2, as the timestamps of relayed or remuxed packets can be missing
+		constexpr std::uint64_t HEADER_HAS_PTS = 1 << 0;
+		constexpr std::uint64_t HEADER_HAS_DTS = 1 << 1;
+
+		/**
+		 * Differences of timestamps wrap around instead of overflowing, so that any two values round trip
+		 */
+		std::int64_t wrappingSubtract(std::int64_t value, std::int64_t other) {
+			return (std::int64_t)((std::uint64_t)value - (std::uint64_t)other);
+		}
+
+		/**
+		 * Sizes the packet for the given payload, reusing its current buffer when large enough
+		 */
+		void preparePacket(AVPacket* packet, const AVPacket& packetFields, std::size_t packetSize) {
+			// Buffers still referenced elsewhere, such as by packets queued for relaying, must not be overwritten.
+			if (packet->buf == nullptr
+				|| !av_buffer_is_writable(packet->buf)
+				|| packetSize + AV_INPUT_BUFFER_PADDING_SIZE > packet->buf->size) {
+				av_packet_unref(packet);
+				if (av_new_packet(packet, (int)packetSize) < 0) {
+					throw std::runtime_error("Failed to allocate memory for AVPacket");
+				}
+			} else {
+				packet->data = packet->buf->data;
+				packet->size = (int)packetSize;
+				std::memset(packet->data + packetSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+			}
+
+			packet->pts = packetFields.pts;
+			packet->dts = packetFields.dts;
+			packet->duration = packetFields.duration;
+			packet->flags = packetFields.flags;
+			packet->stream_index = packetFields.stream_index;
+		}
+	}
 
-		AVCodecParameters codecParameters {};
-		if (avcodec_parameters_from_context(&codecParameters, codecContext) < 0) {
-			throw std::runtime_error("Failed to get codec parameters.");
+	boost::asio::awaitable<boost::system::error_code> receiveClientHello(boost::asio::ip::tcp::socket& socket,
+																		 protocol::ClientHello& clientHello) {
+		protocol::FrameHeader frameHeader;
+		std::vector<std::uint8_t> payload;
+		if (auto error = co_await protocol::asyncReadFrame(socket, frameHeader, payload)) {
+			co_return error;
 		}
 
+		protocol::MessageReader reader(payload.data(), payload.size());
+		if (frameHeader.type != protocol::MessageType::ClientHello || !protocol::readClientHello(reader, clientHello)) {
+			co_return protocol::makeProtocolError();
+		}
+
+		co_return boost::system::error_code {};
+	}
+
+	boost::asio::awaitable<boost::system::error_code> answerClientHello(boost::asio::ip::tcp::socket& socket,
+																		const AVCodecParameters* codecParameters,
+																		AVRational timeBase,
+																		const protocol::ClientHello& clientHello,
+																		const protocol::ServerHello& offer,
+																		protocol::ServerHello& serverHello) {
+		serverHello = protocol::negotiate(clientHello, offer.capabilities);
+		serverHello.sessionId = offer.sessionId;
+		serverHello.multicastAddress = offer.multicastAddress;
+		serverHello.multicastPort = offer.multicastPort;
+		serverHello.multicastKey = offer.multicastKey;
+		serverHello.sharedMemoryName = offer.sharedMemoryName;
+		serverHello.resumeToken = offer.resumeToken;
+		serverHello.resumed = offer.resumed;
+
+		protocol::MessageWriter writer(protocol::MessageType::ServerHello);
+		protocol::writeServerHello(writer, serverHello);
+		if (serverHello.status == protocol::HandshakeStatus::Ok) {
+			writer.writeRational(timeBase);
+			protocol::writeCodecParameters(writer, codecParameters);
+		}
+		writer.finish();
+
 		boost::system::error_code error;
-		boost::asio::write(
-			socket,
-			std::array {
-				boost::asio::buffer(reinterpret_cast<std::uint8_t*>(&customCodecParameters), sizeof(customCodecParameters)),
-				boost::asio::buffer(reinterpret_cast<std::uint8_t*>(&codecParameters), sizeof(codecParameters)),
-				boost::asio::buffer(codecParameters.extradata, codecParameters.extradata_size),
-			},
-			error
-		);
+		co_await boost::asio::async_write(socket, writer.buffer(), boost::asio::redirect_error(boost::asio::use_awaitable, error));
+		if (!error && serverHello.status != protocol::HandshakeStatus::Ok) {
+			co_return protocol::makeProtocolError();
+		}
+
+		co_return error;
+	}
+
+	AVCodecParametersReceiver::AVCodecParametersReceiver(boost::asio::ip::tcp::socket& socket, protocol::Capabilities capabilities)
+		: AVCodecParametersReceiver(socket, protocol::ClientHello { .capabilities = capabilities }) {
 
-		return error;
 	}
 
-	AVCodecParametersReceiver::AVCodecParametersReceiver(boost::asio::ip::tcp::socket& socket) {
+	AVCodecParametersReceiver::AVCodecParametersReceiver(boost::asio::ip::tcp::socket& socket, const protocol::ClientHello& clientHello) {
+		protocol::MessageWriter writer(protocol::MessageType::ClientHello);
+		protocol::writeClientHello(writer, clientHello);
+		writer.finish();
+
 		boost::system::error_code error;
-		boost::asio::read(
-			socket,
-			boost::asio::buffer(reinterpret_cast<std::uint8_t*>(&mCustomCodecParameters), sizeof(mCustomCodecParameters)),
-			error
-		);
+		boost::asio::write(socket, writer.buffer(), error);
 		if (error) {
-			throw std::runtime_error("Failed to retrieve codec parameters.");
+			throw std::runtime_error("Failed to send client hello.");
 		}
 
-		boost::asio::read(
-			socket,
-			boost::asio::buffer(reinterpret_cast<std::uint8_t*>(&mCodecParameters), sizeof(mCodecParameters)),
-			error
-		);
-		if (error) {
+		protocol::FrameHeader frameHeader;
+		std::vector<std::uint8_t> payload;
+		if (protocol::readFrame(socket, frameHeader, payload) || frameHeader.type != protocol::MessageType::ServerHello) {
 			throw std::runtime_error("Failed to retrieve codec parameters.");
 		}
 
-		mCodecExtraData = std::make_unique<std::uint8_t[]>(mCodecParameters.extradata_size);
-		boost::asio::read(
-			socket,
-			boost::asio::buffer(reinterpret_cast<std::uint8_t*>(mCodecExtraData.get()), mCodecParameters.extradata_size),
-			error
-		);
-		if (error) {
-			throw std::runtime_error("Failed to retrieve codec parameters.");
+		protocol::MessageReader reader(payload.data(), payload.size());
+		if (!protocol::readServerHello(reader, mServerHello)) {
+			throw std::runtime_error("Invalid server hello.");
+		}
+
+		if (mServerHello.status != protocol::HandshakeStatus::Ok) {
+			throw std::runtime_error("Unsupported protocol version.");
 		}
 
-		mCodecParameters.extradata = mCodecExtraData.get();
+		mCustomCodecParameters.timeBase = reader.readRational();
+		if (!protocol::readCodecParameters(reader, &mCodecParameters, mCodecExtraData)) {
+			throw std::runtime_error("Failed to retrieve codec parameters.");
+		}
 	}
 
 	AVCodecParameters* AVCodecParametersReceiver::codecParameters() {
@@ -66,38 +135,196 @@ namespace screenshare::video::network {
 		return mCustomCodecParameters.timeBase;
 	}
 
-	namespace {
-		AVPacketSerialized serializePacket(const PacketHeader& header, AVPacket* packet) {
-			AVPacketSerialized packetSerialized;
+	const protocol::ServerHello& AVCodecParametersReceiver::serverHello() const {
+		return mServerHello;
+	}
 
-			packetSerialized.header = header;
+	void writePacketHeader(protocol::MessageWriter& writer,
+						   const PacketHeader& header,
+						   const AVPacket* packet,
+						   std::uint32_t version) {
+		writer.writeVarUInt(packet->size);
+		if (version < protocol::OPTIONAL_FIELDS_VERSION) {
+			writer.writeVarInt(packet->pts);
+			writer.writeVarInt(wrappingSubtract(packet->pts, packet->dts));
+			writer.writeVarInt(packet->duration);
+			writer.writeVarUInt(packet->flags);
+			writer.writeVarUInt(packet->stream_index);
+			writer.writeVarInt(wrappingSubtract(packet->pts, header.encoderPts));
+			writer.writeVarInt(header.sendTime.tv_sec);
+			writer.writeVarUInt(header.sendTime.tv_nsec);
+			return;
+		}
 
-			packetSerialized.packet = *packet;
-			packetSerialized.packet.data = nullptr;
-			packetSerialized.packet.buf = nullptr;
-			packetSerialized.packet.side_data = nullptr;
-			packetSerialized.packet.side_data_elems = 0;
+		auto hasPts = packet->pts != AV_NOPTS_VALUE;
+		auto hasDts = packet->dts != AV_NOPTS_VALUE;
+		writer.writeVarUInt((hasPts ? HEADER_HAS_PTS : 0) | (hasDts ? HEADER_HAS_DTS : 0));
+		if (hasPts) {
+			writer.writeVarInt(packet->pts);
+		}
 
-			return packetSerialized;
+		if (hasDts) {
+			writer.writeVarInt(hasPts ? wrappingSubtract(packet->pts, packet->dts) : packet->dts);
+		}
+
+		writer.writeVarInt(packet->duration);
+		writer.writeVarUInt(packet->flags);
+		writer.writeVarUInt(packet->stream_index);
+		writer.writeVarInt(wrappingSubtract(hasPts ? packet->pts : 0, header.encoderPts));
+		writer.writeVarInt(header.sendTime.tv_sec);
+		writer.writeVarUInt(header.sendTime.tv_nsec);
+
+		// The optional fields take up the rest of the header, until the packet data
+		if (header.referencePts != wrappingSubtract(header.encoderPts, 1)) {
+			writer.writeVarUInt((std::uint64_t)PacketHeaderField::ReferencePts);
+			auto begin = writer.beginBytes();
+			writer.writeVarInt(wrappingSubtract(header.encoderPts, header.referencePts));
+			writer.endBytes(begin);
+		}
+
+		if (header.stageTimes) {
+			writer.writeVarUInt((std::uint64_t)PacketHeaderField::StageTimes);
+			auto begin = writer.beginBytes();
+			writer.writeVarUInt(header.stageTimes->capture);
+			writer.writeVarUInt(header.stageTimes->convert);
+			writer.writeVarUInt(header.stageTimes->encode);
+			writer.endBytes(begin);
 		}
 	}
 
+	bool readPacketHeader(protocol::MessageReader& reader,
+						  std::size_t frameSize,
+						  std::uint32_t version,
+						  PacketHeader& header,
+						  AVPacket* packet,
+						  std::size_t& packetSize) {
+		packetSize = reader.readVarUInt();
+		if (version < protocol::OPTIONAL_FIELDS_VERSION) {
+			packet->pts = reader.readVarInt();
+			packet->dts = wrappingSubtract(packet->pts, reader.readVarInt());
+			packet->duration = reader.readVarInt();
+			packet->flags = (int)reader.readVarUInt();
+			packet->stream_index = (int)reader.readVarUInt();
+			header.encoderPts = wrappingSubtract(packet->pts, reader.readVarInt());
+			header.referencePts = wrappingSubtract(header.encoderPts, 1);
+			header.sendTime.tv_sec = reader.readVarInt();
+			header.sendTime.tv_nsec = (long)reader.readVarUInt();
+			header.stageTimes.reset();
+			return !reader.failed() && reader.position() + packetSize == frameSize;
+		}
+
+		auto headerFlags = reader.readVarUInt();
+		auto hasPts = (headerFlags & HEADER_HAS_PTS) != 0;
+		packet->pts = hasPts ? reader.readVarInt() : AV_NOPTS_VALUE;
+		if ((headerFlags & HEADER_HAS_DTS) != 0) {
+			auto dts = reader.readVarInt();
+			packet->dts = hasPts ? wrappingSubtract(packet->pts, dts) : dts;
+		} else {
+			packet->dts = AV_NOPTS_VALUE;
+		}
+
+		packet->duration = reader.readVarInt();
+		packet->flags = (int)reader.readVarUInt();
+		packet->stream_index = (int)reader.readVarUInt();
+		header.encoderPts = wrappingSubtract(hasPts ? packet->pts : 0, reader.readVarInt());
+		header.referencePts = wrappingSubtract(header.encoderPts, 1);
+		header.sendTime.tv_sec = reader.readVarInt();
+		header.sendTime.tv_nsec = (long)reader.readVarUInt();
+		header.stageTimes.reset();
+		if (reader.failed() || packetSize > frameSize) {
+			return false;
+		}
+
+		auto headerEnd = frameSize - packetSize;
+		while (!reader.failed() && reader.position() < headerEnd) {
+			auto field = reader.readVarUInt();
+			std::size_t fieldSize = 0;
+			auto fieldData = reader.readBytes(fieldSize);
+			protocol::MessageReader fieldReader(fieldData, fieldSize);
+
+			// Fields can grow at their end, so what follows the known values is left unread
+			if (field == (std::uint64_t)PacketHeaderField::ReferencePts) {
+				header.referencePts = wrappingSubtract(header.encoderPts, fieldReader.readVarInt());
+			} else if (field == (std::uint64_t)PacketHeaderField::StageTimes) {
+				ServerStageTimes stageTimes;
+				stageTimes.capture = (std::uint32_t)fieldReader.readVarUInt();
+				stageTimes.convert = (std::uint32_t)fieldReader.readVarUInt();
+				stageTimes.encode = (std::uint32_t)fieldReader.readVarUInt();
+				header.stageTimes = stageTimes;
+			}
+
+			if (fieldReader.failed()) {
+				return false;
+			}
+		}
+
+		return !reader.failed() && reader.position() == headerEnd;
+	}
+
 	PacketHeader::PacketHeader(std::int64_t encoderPts)
-		: encoderPts(encoderPts) {
+		: encoderPts(encoderPts),
+		  referencePts(wrappingSubtract(encoderPts, 1)) {
 		std::timespec_get(&sendTime, TIME_UTC);
 	}
 
+	EncodedPacket::EncodedPacket(const PacketHeader& header, const AVPacket* packet)
+		: EncodedPacket(header, packet, protocol::PROTOCOL_VERSION) {
+		legacyPacket = std::make_shared<EncodedPacket>(header, packet, 1);
+	}
+
+	EncodedPacket::EncodedPacket(const PacketHeader& header, const AVPacket* packet, std::uint32_t version)
+		: packet(av_packet_clone(packet)),
+		  encoderPts(header.encoderPts),
+		  headerWriter(protocol::MessageType::Packet) {
+		if (!this->packet) {
+			throw std::runtime_error("Failed to allocate memory for AVPacket");
+		}
+
+		writePacketHeader(headerWriter, header, packet, version);
+		headerWriter.finish(packet->size);
+	}
+
+	const EncodedPacketPtr& packetForVersion(const EncodedPacketPtr& packet, std::uint32_t version) {
+		if (version < protocol::OPTIONAL_FIELDS_VERSION && packet->legacyPacket) {
+			return packet->legacyPacket;
+		}
+
+		return packet;
+	}
+
+	bool EncodedPacket::isKeyframe() const {
+		return (packet->flags & AV_PKT_FLAG_KEY) != 0;
+	}
+
+	bool EncodedPacket::isDisposable() const {
+		return (packet->flags & AV_PKT_FLAG_DISPOSABLE) != 0;
+	}
+
+	std::size_t EncodedPacket::size() const {
+		return headerWriter.buffer().size() + packet->size;
+	}
+
+	std::array<boost::asio::const_buffer, 2> EncodedPacket::buffers() const {
+		return {
+			headerWriter.buffer(),
+			boost::asio::const_buffer(packet->data, packet->size),
+		};
+	}
+
 	boost::system::error_code PacketSender::send(boost::asio::ip::tcp::socket& socket,
 												 const PacketHeader& header,
 												 AVPacket* packet) {
 		boost::system::error_code error;
 
-		auto packetSerialized = serializePacket(header, packet);
+		protocol::MessageWriter headerWriter(protocol::MessageType::Packet);
+		writePacketHeader(headerWriter, header, packet);
+		headerWriter.finish(packet->size);
+
 		boost::asio::write(
 			socket,
 			std::array {
-				boost::asio::buffer(reinterpret_cast<std::uint8_t*>(&packetSerialized), sizeof(packetSerialized)),
-				boost::asio::buffer(packet->data, packet->size),
+				headerWriter.buffer(),
+				boost::asio::const_buffer(packet->data, packet->size),
 			},
 			error
 		);
@@ -106,12 +333,14 @@ namespace screenshare::video::network {
 	}
 
 	PacketSender::AsyncResult::AsyncResult(const PacketHeader& header, AVPacket* packet)
-		: packetSerialized(serializePacket(header, packet)),
-		  buffers({
-			  boost::asio::buffer(reinterpret_cast<std::uint8_t*>(&packetSerialized), sizeof(packetSerialized)),
-			  boost::asio::buffer(packet->data, packet->size),
-		  }) {
-
+		: headerWriter(protocol::MessageType::Packet) {
+		writePacketHeader(headerWriter, header, packet);
+		headerWriter.finish(packet->size);
+
+		buffers = {
+			headerWriter.buffer(),
+			boost::asio::const_buffer(packet->data, packet->size),
+		};
 	}
 
 	PacketSender::AsyncResultPtr PacketSender::sendAsync(boost::asio::ip::tcp::socket& socket,
@@ -132,7 +361,9 @@ namespace screenshare::video::network {
 		return asyncResult;
 	}
 
-	PacketReceiver::PacketReceiver(AVCodecParameters* codecParameters) {
+	PacketReceiver::PacketReceiver() = default;
+
+	PacketReceiver::PacketReceiver(AVCodecParameters* codecParameters, const DecoderConfig& decoderConfig) {
 		auto codec = avcodec_find_decoder(codecParameters->codec_id);
 		if (codec == nullptr) {
 			throw std::runtime_error("ERROR unsupported codec!");
@@ -144,6 +375,7 @@ namespace screenshare::video::network {
 		}
 
 		screenshare::video::handleAVResult(avcodec_parameters_to_context(mCodecContext.get(), codecParameters), "failed to copy codec params to codec context");
+		configureDecoder(mCodecContext.get(), decoderConfig);
 		screenshare::video::handleAVResult(avcodec_open2(mCodecContext.get(), codec, nullptr), "failed to open codec through avcodec_open2");
 	}
 
@@ -151,40 +383,116 @@ namespace screenshare::video::network {
 		return mCodecContext.get();
 	}
 
+	void PacketReceiver::setMessageHandler(MessageHandler messageHandler) {
+		mMessageHandler = std::move(messageHandler);
+	}
+
+	void PacketReceiver::setProtocolVersion(std::uint32_t version) {
+		mProtocolVersion = version;
+	}
+
+	std::size_t PacketReceiver::bufferedBytes() const {
+		return mFrameReader.buffered();
+	}
+
+	void PacketReceiver::discardBuffered() {
+		mFrameReader.consume(mFrameReader.buffered());
+	}
+
 	boost::system::error_code PacketReceiver::receive(boost::asio::ip::tcp::socket& socket,
 													  AVPacket* packet,
 													  PacketHeader& header) {
-		AVPacketSerialized packetSerialized;
-		boost::system::error_code error;
+		while (true) {
+			protocol::FrameHeader frameHeader;
+			if (auto error = mFrameReader.readHeader(socket, frameHeader)) {
+				return error;
+			}
 
-		boost::asio::read(
-			socket,
-			boost::asio::buffer(reinterpret_cast<uint8_t*>(&packetSerialized), sizeof(packetSerialized)),
-			error
-		);
+			// Skip messages this receiver does not handle, which keeps older clients compatible with newer servers.
+			if (frameHeader.type != protocol::MessageType::Packet) {
+				if (!mMessageHandler) {
+					if (auto error = mFrameReader.skip(socket, frameHeader.size)) {
+						return error;
+					}
 
-		if (error) {
-			return error;
-		}
+					continue;
+				}
+
+				if (auto error = mFrameReader.fill(socket, frameHeader.size)) {
+					return error;
+				}
+
+				protocol::MessageReader payload(mFrameReader.data(), frameHeader.size);
+				mMessageHandler(frameHeader, payload);
+				mFrameReader.consume(frameHeader.size);
+				continue;
+			}
+
+			auto headerSize = std::min(frameHeader.size, MAX_PACKET_HEADER_SIZE);
+			if (auto error = mFrameReader.fill(socket, headerSize)) {
+				return error;
+			}
+
+			AVPacket packetFields {};
+			std::size_t packetSize = 0;
+			protocol::MessageReader reader(mFrameReader.data(), headerSize);
+			if (!readPacketHeader(reader, frameHeader.size, mProtocolVersion, header, &packetFields, packetSize)) {
+				return protocol::makeProtocolError();
+			}
+
+			mFrameReader.consume(reader.position());
+
+			preparePacket(packet, packetFields, packetSize);
+			if (auto error = mFrameReader.read(socket, packet->data, packetSize)) {
+				return error;
+			}
 
-		if (packet->buf == nullptr || packetSerialized.packet.size > packet->buf->size) {
-			av_new_packet(packet, packetSerialized.packet.size);
-			packet->data = packet->buf->data;
+			return {};
 		}
+	}
 
-		boost::asio::read(
-			socket,
-			boost::asio::buffer(packet->data, packetSerialized.packet.size),
-			error
-		);
+	TcpPacketSource::TcpPacketSource(boost::asio::ip::tcp::socket& socket, PacketReceiver& packetReceiver)
+		: mSocket(socket),
+		  mPacketReceiver(packetReceiver) {
 
-		header = packetSerialized.header;
+	}
+
+	std::size_t PacketSource::bufferedBytes() const {
+		return 0;
+	}
 
-		auto buf = packet->buf;
-		*packet = packetSerialized.packet;
-		packet->buf = buf;
-		packet->data = packet->buf->data;
+	boost::system::error_code TcpPacketSource::receive(AVPacket* packet, PacketHeader& header) {
+		return mPacketReceiver.receive(mSocket, packet, header);
+	}
+
+	std::size_t TcpPacketSource::bufferedBytes() const {
+		boost::system::error_code error;
+		return mSocket.available(error) + mPacketReceiver.bufferedBytes();
+	}
+
+	bool readPacketFrame(const std::uint8_t* data,
+						 std::size_t size,
+						 std::uint32_t version,
+						 AVPacket* packet,
+						 PacketHeader& header) {
+		protocol::FrameHeader frameHeader;
+		std::size_t frameHeaderSize = 0;
+		auto status = protocol::parseFrameHeader(data, size, frameHeader, frameHeaderSize);
+		if (status != protocol::ParseStatus::Complete
+			|| frameHeader.type != protocol::MessageType::Packet
+			|| frameHeaderSize + frameHeader.size != size) {
+			return false;
+		}
+
+		AVPacket packetFields {};
+		std::size_t packetSize = 0;
+		protocol::MessageReader reader(data + frameHeaderSize, frameHeader.size);
+		if (!readPacketHeader(reader, frameHeader.size, version, header, &packetFields, packetSize)) {
+			return false;
+		}
 
-		return {};
+		preparePacket(packet, packetFields, packetSize);
+		std::memcpy(packet->data, data + frameHeaderSize + reader.position(), packetSize);
+		return true;
 	}
 }
\ No newline at end of file
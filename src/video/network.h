@@ -1,6 +1,7 @@
 #pragma once
 #include <memory>
 #include <array>
+#include <functional>
 #include <iostream>
 #include <optional>
 
@@ -8,6 +9,8 @@
 #include <boost/asio.hpp>
 
 #include "common.h"
+#include "decoder.h"
+#include "protocol.h"
 #include "../misc/time_measurement.h"
 
 namespace screenshare::video::network {
@@ -15,34 +18,133 @@ namespace screenshare::video::network {
 		AVRational timeBase { 0, 0 };
 	};
 
-	boost::system::error_code sendAVCodecParameters(boost::asio::ip::tcp::socket& socket, AVCodecContext* codecContext);
-
+	/**
+	 * Server side of the handshake, in two steps: the client hello is received first, so that the server can look up the
+	 * session it resumes, and is then answered with the negotiated protocol and the codec parameters.
+	 */
+	boost::asio::awaitable<boost::system::error_code> receiveClientHello(
+		boost::asio::ip::tcp::socket& socket,
+		protocol::ClientHello& clientHello
+	);
+
+	/**
+	 * The offer holds the capabilities of the server together with the session values sent to the client
+	 */
+	boost::asio::awaitable<boost::system::error_code> answerClientHello(
+		boost::asio::ip::tcp::socket& socket,
+		const AVCodecParameters* codecParameters,
+		AVRational timeBase,
+		const protocol::ClientHello& clientHello,
+		const protocol::ServerHello& offer,
+		protocol::ServerHello& serverHello
+	);
+
+	/**
+	 * Client side of the handshake
+	 */
 	class AVCodecParametersReceiver {
 	private:
+		protocol::ServerHello mServerHello;
 		CustomCodecParameters mCustomCodecParameters;
 		AVCodecParameters mCodecParameters {};
 		std::unique_ptr<std::uint8_t[]> mCodecExtraData;
 	public:
-		explicit AVCodecParametersReceiver(boost::asio::ip::tcp::socket& socket);
+		explicit AVCodecParametersReceiver(
+			boost::asio::ip::tcp::socket& socket,
+			protocol::Capabilities capabilities = protocol::capabilityBit(protocol::Capability::RemoteInput)
+		);
+
+		AVCodecParametersReceiver(boost::asio::ip::tcp::socket& socket, const protocol::ClientHello& clientHello);
 
 		AVCodecParameters* codecParameters();
 
 		AVRational timeBase() const;
+
+		const protocol::ServerHello& serverHello() const;
+	};
+
+	/**
+	 * How long each stage on the server took for a packet, in microseconds of the monotonic clock. Carried as durations
+	 * before the send time, so they need no clock synchronization.
+	 */
+	struct ServerStageTimes {
+		std::uint32_t capture = 0; // Grabbing the screen
+		std::uint32_t convert = 0; // Converting to the pixel format of the encoder
+		std::uint32_t encode = 0; // From the frame being sent to the encoder until the packet came out
+	};
+
+	/**
+	 * Optional fields at the end of a packet header, each written as its tag followed by its length prefixed value.
+	 * Readers skip the fields they do not know.
+	 */
+	enum class PacketHeaderField : std::uint8_t {
+		ReferencePts = 1, // Left out when it is the previous packet
+		StageTimes
 	};
 
 	struct PacketHeader {
 		std::int64_t encoderPts = 0;
+		std::int64_t referencePts = -1; // Encoder pts of the last packet before this one that is not disposable
 		std::timespec sendTime {};
+		std::optional<ServerStageTimes> stageTimes; // Not known for streams from older servers
 
 		PacketHeader() = default;
 		explicit PacketHeader(std::int64_t encoderPts);
 	};
 
-	struct AVPacketSerialized {
-		PacketHeader header;
-		AVPacket packet = {};
+	/**
+	 * Upper bound of an encoded packet header, with room for optional fields added later
+	 */
+	constexpr std::size_t MAX_PACKET_HEADER_SIZE = 256;
+
+	/**
+	 * Writes the header in the format of the given protocol version. Headers of version 1 are a fixed list of fields.
+	 */
+	void writePacketHeader(
+		protocol::MessageWriter& writer,
+		const PacketHeader& header,
+		const AVPacket* packet,
+		std::uint32_t version = protocol::PROTOCOL_VERSION
+	);
+
+	/**
+	 * Reads a header from the start of a packet frame of the given size, which tells where the optional fields end
+	 */
+	bool readPacketHeader(
+		protocol::MessageReader& reader,
+		std::size_t frameSize,
+		std::uint32_t version,
+		PacketHeader& header,
+		AVPacket* packet,
+		std::size_t& packetSize
+	);
+
+	/**
+	 * An encoded packet together with its serialized header, shared by every client it is queued for
+	 */
+	struct EncodedPacket {
+		std::unique_ptr<AVPacket, AVPacketDeleter> packet;
+		std::int64_t encoderPts;
+		protocol::MessageWriter headerWriter;
+		std::shared_ptr<const EncodedPacket> legacyPacket; // With the header of version 1, sharing the packet data
+
+		EncodedPacket(const PacketHeader& header, const AVPacket* packet);
+		EncodedPacket(const PacketHeader& header, const AVPacket* packet, std::uint32_t version);
+
+		bool isKeyframe() const;
+		bool isDisposable() const;
+		std::size_t size() const;
+
+		std::array<boost::asio::const_buffer, 2> buffers() const;
 	};
 
+	using EncodedPacketPtr = std::shared_ptr<const EncodedPacket>;
+
+	/**
+	 * Returns the packet as sent to clients of the given protocol version
+	 */
+	const EncodedPacketPtr& packetForVersion(const EncodedPacketPtr& packet, std::uint32_t version);
+
 	class PacketSender {
 	public:
 		boost::system::error_code send(
@@ -52,8 +154,8 @@ namespace screenshare::video::network {
 		);
 
 		struct AsyncResult {
-			AVPacketSerialized packetSerialized {};
-			std::array<boost::asio::mutable_buffers_1, 2> buffers;
+			protocol::MessageWriter headerWriter;
+			std::array<boost::asio::const_buffer, 2> buffers;
 
 			boost::system::error_code error;
 			std::atomic<bool> done = false;
@@ -71,17 +173,83 @@ namespace screenshare::video::network {
 	};
 
 	class PacketReceiver {
+	public:
+		using MessageHandler = std::function<void (const protocol::FrameHeader& header, protocol::MessageReader& payload)>;
 	private:
 		std::unique_ptr<AVCodecContext, AVCodecContextDeleter> mCodecContext;
+		protocol::FrameReader mFrameReader;
+		MessageHandler mMessageHandler;
+		std::uint32_t mProtocolVersion = protocol::PROTOCOL_VERSION;
 	public:
-		explicit PacketReceiver(AVCodecParameters* codecParameters);
+		/**
+		 * Creates a receiver without a decoder, for forwarding packets as they are
+		 */
+		PacketReceiver();
+		explicit PacketReceiver(AVCodecParameters* codecParameters, const DecoderConfig& decoderConfig = {});
 
 		AVCodecContext* codecContext();
 
+		/**
+		 * Sets the handler of the messages received in between packets, which are otherwise skipped
+		 */
+		void setMessageHandler(MessageHandler messageHandler);
+
+		/**
+		 * Sets the version negotiated with the server, which decides the format of the packet headers
+		 */
+		void setProtocolVersion(std::uint32_t version);
+
+		/**
+		 * Bytes read from the socket but not yet consumed
+		 */
+		std::size_t bufferedBytes() const;
+
+		/**
+		 * Discards what is buffered from a previous connection, while keeping the decoder
+		 */
+		void discardBuffered();
+
 		boost::system::error_code receive(
 			boost::asio::ip::tcp::socket& socket,
 			AVPacket* packet,
 			PacketHeader& header
 		);
 	};
+
+	/**
+	 * A source of received packets, independent of the transport they arrive over
+	 */
+	class PacketSource {
+	public:
+		virtual ~PacketSource() = default;
+
+		virtual boost::system::error_code receive(AVPacket* packet, PacketHeader& header) = 0;
+
+		/**
+		 * Bytes received but not yet taken out as packets, as far as the transport can tell
+		 */
+		virtual std::size_t bufferedBytes() const;
+	};
+
+	class TcpPacketSource : public PacketSource {
+	private:
+		boost::asio::ip::tcp::socket& mSocket;
+		PacketReceiver& mPacketReceiver;
+	public:
+		TcpPacketSource(boost::asio::ip::tcp::socket& socket, PacketReceiver& packetReceiver);
+
+		boost::system::error_code receive(AVPacket* packet, PacketHeader& header) override;
+		std::size_t bufferedBytes() const override;
+	};
+
+	/**
+	 * Parses a complete packet frame, as sent by the packet sender, from memory
+	 */
+	bool readPacketFrame(
+		const std::uint8_t* data,
+		std::size_t size,
+		std::uint32_t version,
+		AVPacket* packet,
+		PacketHeader& header
+	);
 }
\ No newline at end of file
@@ -0,0 +1,648 @@
+#include "protocol.h"
+
+#include <cstring>
+
+namespace screenshare::video::protocol {
+	namespace {
+		std::size_t writeVarUIntTo(std::uint8_t* destination, std::uint64_t value) {
+			std::size_t size = 0;
+			while (value >= 0x80) {
+				destination[size++] = (std::uint8_t)(value | 0x80);
+				value >>= 7;
+			}
+
+			destination[size++] = (std::uint8_t)value;
+			return size;
+		}
+
+		std::uint64_t zigZagEncode(std::int64_t value) {
+			return ((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63);
+		}
+
+		std::int64_t zigZagDecode(std::uint64_t value) {
+			return (std::int64_t)(value >> 1) ^ -(std::int64_t)(value & 1);
+		}
+	}
+
+	MessageWriter::MessageWriter(MessageType type)
+		: mType(type) {
+		mBuffer.reserve(MAX_FRAME_HEADER_SIZE + 64);
+		reset(type);
+	}
+
+	void MessageWriter::reset(MessageType type) {
+		mType = type;
+		mBuffer.resize(MAX_FRAME_HEADER_SIZE);
+		mFrameBegin = MAX_FRAME_HEADER_SIZE;
+	}
+
+	void MessageWriter::writeUInt8(std::uint8_t value) {
+		mBuffer.push_back(value);
+	}
+
+	void MessageWriter::writeVarUInt(std::uint64_t value) {
+		std::uint8_t encoded[10];
+		auto size = writeVarUIntTo(encoded, value);
+		mBuffer.insert(mBuffer.end(), encoded, encoded + size);
+	}
+
+	void MessageWriter::writeVarInt(std::int64_t value) {
+		writeVarUInt(zigZagEncode(value));
+	}
+
+	void MessageWriter::writeRational(AVRational value) {
+		writeVarInt(value.num);
+		writeVarInt(value.den);
+	}
+
+	void MessageWriter::writeDouble(double value) {
+		std::uint64_t bits = 0;
+		std::memcpy(&bits, &value, sizeof(bits));
+		for (int i = 0; i < 8; i++) {
+			mBuffer.push_back((std::uint8_t)(bits >> (8 * i)));
+		}
+	}
+
+	void MessageWriter::writeBytes(const std::uint8_t* data, std::size_t size) {
+		writeVarUInt(size);
+		mBuffer.insert(mBuffer.end(), data, data + size);
+	}
+
+	std::size_t MessageWriter::beginBytes() {
+		// Room for the size of a short field, which is all a field usually needs
+		mBuffer.push_back(0);
+		return mBuffer.size();
+	}
+
+	void MessageWriter::endBytes(std::size_t begin) {
+		std::uint8_t encoded[10];
+		auto size = writeVarUIntTo(encoded, mBuffer.size() - begin);
+		if (size > 1) {
+			mBuffer.insert(mBuffer.begin() + (std::ptrdiff_t)begin, encoded + 1, encoded + size);
+		}
+
+		std::memcpy(mBuffer.data() + begin - 1, encoded, size);
+	}
+
+	std::size_t MessageWriter::payloadSize() const {
+		return mBuffer.size() - MAX_FRAME_HEADER_SIZE;
+	}
+
+	void MessageWriter::finish(std::size_t trailingSize) {
+		std::uint8_t header[MAX_FRAME_HEADER_SIZE];
+		header[0] = (std::uint8_t)mType;
+		auto headerSize = 1 + writeVarUIntTo(header + 1, payloadSize() + trailingSize);
+
+		mFrameBegin = MAX_FRAME_HEADER_SIZE - headerSize;
+		std::memcpy(mBuffer.data() + mFrameBegin, header, headerSize);
+	}
+
+	boost::asio::const_buffer MessageWriter::buffer() const {
+		return boost::asio::buffer(mBuffer.data() + mFrameBegin, mBuffer.size() - mFrameBegin);
+	}
+
+	MessageReader::MessageReader(const std::uint8_t* data, std::size_t size)
+		: mData(data), mSize(size) {
+
+	}
+
+	std::uint8_t MessageReader::readUInt8() {
+		if (mPosition >= mSize) {
+			mFailed = true;
+			return 0;
+		}
+
+		return mData[mPosition++];
+	}
+
+	std::uint64_t MessageReader::readVarUInt() {
+		std::uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (mPosition >= mSize) {
+				mFailed = true;
+				return 0;
+			}
+
+			auto current = mData[mPosition++];
+			value |= (std::uint64_t)(current & 0x7F) << shift;
+			if ((current & 0x80) == 0) {
+				return value;
+			}
+		}
+
+		mFailed = true;
+		return 0;
+	}
+
+	std::int64_t MessageReader::readVarInt() {
+		return zigZagDecode(readVarUInt());
+	}
+
+	AVRational MessageReader::readRational() {
+		AVRational value {};
+		value.num = (int)readVarInt();
+		value.den = (int)readVarInt();
+		return value;
+	}
+
+	double MessageReader::readDouble() {
+		if (remaining() < 8) {
+			mFailed = true;
+			return 0.0;
+		}
+
+		std::uint64_t bits = 0;
+		for (int i = 0; i < 8; i++) {
+			bits |= (std::uint64_t)mData[mPosition++] << (8 * i);
+		}
+
+		double value = 0.0;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	const std::uint8_t* MessageReader::readBytes(std::size_t& size) {
+		size = readVarUInt();
+		if (mFailed || size > remaining()) {
+			mFailed = true;
+			size = 0;
+			return nullptr;
+		}
+
+		auto data = mData + mPosition;
+		mPosition += size;
+		return data;
+	}
+
+	std::size_t MessageReader::position() const {
+		return mPosition;
+	}
+
+	std::size_t MessageReader::remaining() const {
+		return mSize - mPosition;
+	}
+
+	bool MessageReader::failed() const {
+		return mFailed;
+	}
+
+	ParseStatus parseFrameHeader(const std::uint8_t* data, std::size_t size, FrameHeader& header, std::size_t& headerSize) {
+		if (size < 2) {
+			return ParseStatus::Incomplete;
+		}
+
+		std::uint64_t payloadSize = 0;
+		for (std::size_t i = 1; i < MAX_FRAME_HEADER_SIZE; i++) {
+			if (i >= size) {
+				return ParseStatus::Incomplete;
+			}
+
+			payloadSize |= (std::uint64_t)(data[i] & 0x7F) << (7 * (i - 1));
+			if ((data[i] & 0x80) == 0) {
+				if (payloadSize > MAX_FRAME_SIZE) {
+					return ParseStatus::Invalid;
+				}
+
+				header.type = (MessageType)data[0];
+				header.size = (std::size_t)payloadSize;
+				headerSize = i + 1;
+				return ParseStatus::Complete;
+			}
+		}
+
+		return ParseStatus::Invalid;
+	}
+
+	boost::system::error_code makeProtocolError() {
+		return boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+	}
+
+	boost::system::error_code readFrame(boost::asio::ip::tcp::socket& socket,
+										FrameHeader& header,
+										std::vector<std::uint8_t>& payload) {
+		std::uint8_t headerBuffer[MAX_FRAME_HEADER_SIZE];
+		std::size_t headerBuffered = 0;
+		std::size_t headerSize = 0;
+
+		// Read one byte at a time after the first two, so that no bytes of the next frame are consumed.
+		boost::system::error_code error;
+		std::size_t toRead = 2;
+		while (true) {
+			boost::asio::read(socket, boost::asio::buffer(headerBuffer + headerBuffered, toRead), error);
+			if (error) {
+				return error;
+			}
+
+			headerBuffered += toRead;
+			auto status = parseFrameHeader(headerBuffer, headerBuffered, header, headerSize);
+			if (status == ParseStatus::Complete) {
+				break;
+			} else if (status == ParseStatus::Invalid) {
+				return makeProtocolError();
+			}
+
+			toRead = 1;
+		}
+
+		payload.resize(header.size);
+		boost::asio::read(socket, boost::asio::buffer(payload), error);
+		return error;
+	}
+
+	boost::asio::awaitable<boost::system::error_code> asyncReadFrame(boost::asio::ip::tcp::socket& socket,
+																	 FrameHeader& header,
+																	 std::vector<std::uint8_t>& payload) {
+		std::uint8_t headerBuffer[MAX_FRAME_HEADER_SIZE];
+		std::size_t headerBuffered = 0;
+		std::size_t headerSize = 0;
+
+		boost::system::error_code error;
+		std::size_t toRead = 2;
+		while (true) {
+			co_await boost::asio::async_read(
+				socket,
+				boost::asio::buffer(headerBuffer + headerBuffered, toRead),
+				boost::asio::redirect_error(boost::asio::use_awaitable, error)
+			);
+			if (error) {
+				co_return error;
+			}
+
+			headerBuffered += toRead;
+			auto status = parseFrameHeader(headerBuffer, headerBuffered, header, headerSize);
+			if (status == ParseStatus::Complete) {
+				break;
+			} else if (status == ParseStatus::Invalid) {
+				co_return makeProtocolError();
+			}
+
+			toRead = 1;
+		}
+
+		payload.resize(header.size);
+		co_await boost::asio::async_read(socket, boost::asio::buffer(payload), boost::asio::redirect_error(boost::asio::use_awaitable, error));
+		co_return error;
+	}
+
+	FrameReader::FrameReader(std::size_t bufferSize)
+		: mBuffer(bufferSize) {
+
+	}
+
+	void FrameReader::compact() {
+		if (mBegin > 0) {
+			std::memmove(mBuffer.data(), mBuffer.data() + mBegin, mEnd - mBegin);
+			mEnd -= mBegin;
+			mBegin = 0;
+		}
+	}
+
+	void FrameReader::reserve(std::size_t size) {
+		if (mBegin + size > mBuffer.size()) {
+			compact();
+		}
+
+		if (size > mBuffer.size()) {
+			mBuffer.resize(size);
+		}
+	}
+
+	boost::system::error_code FrameReader::readSome(boost::asio::ip::tcp::socket& socket) {
+		boost::system::error_code error;
+		auto size = socket.read_some(prepare(), error);
+		commit(size);
+		return error;
+	}
+
+	const std::uint8_t* FrameReader::data() const {
+		return mBuffer.data() + mBegin;
+	}
+
+	std::size_t FrameReader::buffered() const {
+		return mEnd - mBegin;
+	}
+
+	void FrameReader::consume(std::size_t size) {
+		mBegin += std::min(size, buffered());
+		if (mBegin == mEnd) {
+			mBegin = 0;
+			mEnd = 0;
+		}
+	}
+
+	boost::asio::mutable_buffer FrameReader::prepare() {
+		if (mEnd == mBuffer.size()) {
+			compact();
+		}
+
+		if (mEnd == mBuffer.size()) {
+			mBuffer.resize(mBuffer.size() * 2);
+		}
+
+		return boost::asio::buffer(mBuffer.data() + mEnd, mBuffer.size() - mEnd);
+	}
+
+	void FrameReader::commit(std::size_t size) {
+		mEnd += size;
+	}
+
+	bool FrameReader::nextFrame(FrameHeader& header, MessageReader& payload, boost::system::error_code& error) {
+		std::size_t headerSize = 0;
+		auto status = parseFrameHeader(data(), buffered(), header, headerSize);
+		if (status == ParseStatus::Invalid) {
+			error = makeProtocolError();
+			return false;
+		}
+
+		if (status == ParseStatus::Incomplete || buffered() < headerSize + header.size) {
+			if (status == ParseStatus::Complete) {
+				reserve(headerSize + header.size);
+			}
+
+			return false;
+		}
+
+		payload = MessageReader(data() + headerSize, header.size);
+		consume(headerSize + header.size);
+		return true;
+	}
+
+	boost::system::error_code FrameReader::readHeader(boost::asio::ip::tcp::socket& socket, FrameHeader& header) {
+		while (true) {
+			std::size_t headerSize = 0;
+			auto status = parseFrameHeader(data(), buffered(), header, headerSize);
+			if (status == ParseStatus::Complete) {
+				consume(headerSize);
+				return {};
+			} else if (status == ParseStatus::Invalid) {
+				return makeProtocolError();
+			}
+
+			if (auto error = readSome(socket)) {
+				return error;
+			}
+		}
+	}
+
+	boost::system::error_code FrameReader::fill(boost::asio::ip::tcp::socket& socket, std::size_t size) {
+		reserve(size);
+		while (buffered() < size) {
+			if (auto error = readSome(socket)) {
+				return error;
+			}
+		}
+
+		return {};
+	}
+
+	boost::system::error_code FrameReader::read(boost::asio::ip::tcp::socket& socket, std::uint8_t* data, std::size_t size) {
+		auto fromBuffer = std::min(size, buffered());
+		std::memcpy(data, this->data(), fromBuffer);
+		consume(fromBuffer);
+
+		boost::system::error_code error;
+		if (fromBuffer < size) {
+			boost::asio::read(socket, boost::asio::buffer(data + fromBuffer, size - fromBuffer), error);
+		}
+
+		return error;
+	}
+
+	boost::system::error_code FrameReader::skip(boost::asio::ip::tcp::socket& socket, std::size_t size) {
+		while (size > 0) {
+			if (buffered() == 0) {
+				if (auto error = readSome(socket)) {
+					return error;
+				}
+			}
+
+			auto skipped = std::min(size, buffered());
+			consume(skipped);
+			size -= skipped;
+		}
+
+		return {};
+	}
+
+	void writeClientHello(MessageWriter& writer, const ClientHello& clientHello) {
+		writer.writeVarUInt(PROTOCOL_MAGIC);
+		writer.writeVarUInt(clientHello.version);
+		writer.writeVarUInt(clientHello.minVersion);
+		writer.writeVarUInt(clientHello.capabilities);
+
+		if (hasCapability(clientHello.capabilities, Capability::Resumption)) {
+			writer.writeVarUInt(clientHello.resumeToken);
+			writer.writeVarInt(clientHello.lastDecodedPts);
+		}
+	}
+
+	bool readClientHello(MessageReader& reader, ClientHello& clientHello) {
+		if (reader.readVarUInt() != PROTOCOL_MAGIC) {
+			return false;
+		}
+
+		clientHello.version = (std::uint32_t)reader.readVarUInt();
+		clientHello.minVersion = (std::uint32_t)reader.readVarUInt();
+		clientHello.capabilities = reader.readVarUInt();
+
+		if (hasCapability(clientHello.capabilities, Capability::Resumption)) {
+			clientHello.resumeToken = reader.readVarUInt();
+			clientHello.lastDecodedPts = reader.readVarInt();
+		}
+
+		return !reader.failed();
+	}
+
+	void writeServerHello(MessageWriter& writer, const ServerHello& serverHello) {
+		writer.writeVarUInt(PROTOCOL_MAGIC);
+		writer.writeUInt8((std::uint8_t)serverHello.status);
+		writer.writeVarUInt(serverHello.version);
+		writer.writeVarUInt(serverHello.capabilities);
+		writer.writeVarUInt(serverHello.sessionId);
+
+		if (hasCapability(serverHello.capabilities, Capability::Multicast)) {
+			writer.writeBytes(reinterpret_cast<const std::uint8_t*>(serverHello.multicastAddress.data()), serverHello.multicastAddress.size());
+			writer.writeVarUInt(serverHello.multicastPort);
+			if (serverHello.version >= MULTICAST_KEY_VERSION) {
+				writer.writeVarUInt(serverHello.multicastKey);
+			}
+		}
+
+		if (hasCapability(serverHello.capabilities, Capability::SharedMemory)) {
+			writer.writeBytes(reinterpret_cast<const std::uint8_t*>(serverHello.sharedMemoryName.data()), serverHello.sharedMemoryName.size());
+		}
+
+		if (hasCapability(serverHello.capabilities, Capability::Resumption)) {
+			writer.writeVarUInt(serverHello.resumeToken);
+			writer.writeUInt8(serverHello.resumed ? 1 : 0);
+		}
+	}
+
+	bool readServerHello(MessageReader& reader, ServerHello& serverHello) {
+		if (reader.readVarUInt() != PROTOCOL_MAGIC) {
+			return false;
+		}
+
+		serverHello.status = (HandshakeStatus)reader.readUInt8();
+		serverHello.version = (std::uint32_t)reader.readVarUInt();
+		serverHello.capabilities = reader.readVarUInt();
+		serverHello.sessionId = reader.readVarUInt();
+
+		if (hasCapability(serverHello.capabilities, Capability::Multicast)) {
+			std::size_t addressSize = 0;
+			auto address = reader.readBytes(addressSize);
+			if (address != nullptr) {
+				serverHello.multicastAddress.assign(reinterpret_cast<const char*>(address), addressSize);
+			}
+
+			serverHello.multicastPort = (std::uint16_t)reader.readVarUInt();
+			if (serverHello.version >= MULTICAST_KEY_VERSION) {
+				serverHello.multicastKey = reader.readVarUInt();
+			}
+		}
+
+		if (hasCapability(serverHello.capabilities, Capability::SharedMemory)) {
+			std::size_t nameSize = 0;
+			auto name = reader.readBytes(nameSize);
+			if (name != nullptr) {
+				serverHello.sharedMemoryName.assign(reinterpret_cast<const char*>(name), nameSize);
+			}
+		}
+
+		if (hasCapability(serverHello.capabilities, Capability::Resumption)) {
+			serverHello.resumeToken = reader.readVarUInt();
+			serverHello.resumed = reader.readUInt8() != 0;
+		}
+
+		return !reader.failed();
+	}
+
+	void writeRecoveryRequest(MessageWriter& writer, const RecoveryRequest& recoveryRequest) {
+		writer.writeVarInt(recoveryRequest.lastDecodedPts);
+		writer.writeUInt8(recoveryRequest.keyframe ? 1 : 0);
+	}
+
+	bool readRecoveryRequest(MessageReader& reader, RecoveryRequest& recoveryRequest) {
+		recoveryRequest.lastDecodedPts = reader.readVarInt();
+		recoveryRequest.keyframe = reader.remaining() > 0 && reader.readUInt8() != 0;
+		return !reader.failed();
+	}
+
+	void writeClockSync(MessageWriter& writer, const ClockSync& clockSync) {
+		writer.writeVarInt(clockSync.clientSendTime);
+		writer.writeVarInt(clockSync.serverReceiveTime);
+		writer.writeVarInt(clockSync.serverSendTime);
+	}
+
+	bool readClockSync(MessageReader& reader, ClockSync& clockSync) {
+		clockSync.clientSendTime = reader.readVarInt();
+		clockSync.serverReceiveTime = reader.readVarInt();
+		clockSync.serverSendTime = reader.readVarInt();
+		return !reader.failed();
+	}
+
+	void writeReceiverReport(MessageWriter& writer, const ReceiverReport& receiverReport) {
+		writer.writeVarUInt(receiverReport.framesReceived);
+		writer.writeVarUInt(receiverReport.framesDecoded);
+		writer.writeVarUInt(receiverReport.decodeErrors);
+		writer.writeVarUInt(receiverReport.gaps);
+		writer.writeDouble(receiverReport.averageDecodeTime);
+		writer.writeDouble(receiverReport.averageLatency);
+		writer.writeDouble(receiverReport.maxLatency);
+		writer.writeVarUInt(receiverReport.bufferedBytes);
+	}
+
+	bool readReceiverReport(MessageReader& reader, ReceiverReport& receiverReport) {
+		receiverReport.framesReceived = reader.readVarUInt();
+		receiverReport.framesDecoded = reader.readVarUInt();
+		receiverReport.decodeErrors = reader.readVarUInt();
+		receiverReport.gaps = reader.readVarUInt();
+		receiverReport.averageDecodeTime = reader.readDouble();
+		receiverReport.averageLatency = reader.readDouble();
+		receiverReport.maxLatency = reader.readDouble();
+		receiverReport.bufferedBytes = reader.readVarUInt();
+		return !reader.failed();
+	}
+
+	ServerHello negotiate(const ClientHello& clientHello, Capabilities serverCapabilities) {
+		ServerHello serverHello;
+		serverHello.version = std::min(clientHello.version, PROTOCOL_VERSION);
+		if (serverHello.version < clientHello.minVersion || serverHello.version < MIN_PROTOCOL_VERSION) {
+			serverHello.status = HandshakeStatus::UnsupportedVersion;
+			return serverHello;
+		}
+
+		serverHello.capabilities = clientHello.capabilities & serverCapabilities;
+
+		// These transports share one serialized stream between every client, which only has the current packet headers
+		if (serverHello.version < OPTIONAL_FIELDS_VERSION) {
+			serverHello.capabilities &= ~(capabilityBit(Capability::UdpTransport)
+				| capabilityBit(Capability::Multicast)
+				| capabilityBit(Capability::SharedMemory));
+		}
+
+		return serverHello;
+	}
+
+	void writeCodecParameters(MessageWriter& writer, const AVCodecParameters* codecParameters) {
+		writer.writeVarInt(codecParameters->codec_type);
+		writer.writeVarUInt(codecParameters->codec_id);
+		writer.writeVarUInt(codecParameters->codec_tag);
+		writer.writeVarInt(codecParameters->format);
+		writer.writeVarInt(codecParameters->bit_rate);
+		writer.writeVarInt(codecParameters->bits_per_coded_sample);
+		writer.writeVarInt(codecParameters->bits_per_raw_sample);
+		writer.writeVarInt(codecParameters->profile);
+		writer.writeVarInt(codecParameters->level);
+		writer.writeVarInt(codecParameters->width);
+		writer.writeVarInt(codecParameters->height);
+		writer.writeRational(codecParameters->sample_aspect_ratio);
+		writer.writeVarInt(codecParameters->field_order);
+		writer.writeVarInt(codecParameters->color_range);
+		writer.writeVarInt(codecParameters->color_primaries);
+		writer.writeVarInt(codecParameters->color_trc);
+		writer.writeVarInt(codecParameters->color_space);
+		writer.writeVarInt(codecParameters->chroma_location);
+		writer.writeVarInt(codecParameters->video_delay);
+		writer.writeBytes(codecParameters->extradata, codecParameters->extradata_size);
+	}
+
+	bool readCodecParameters(MessageReader& reader,
+							 AVCodecParameters* codecParameters,
+							 std::unique_ptr<std::uint8_t[]>& extraData) {
+		codecParameters->codec_type = (AVMediaType)reader.readVarInt();
+		codecParameters->codec_id = (AVCodecID)reader.readVarUInt();
+		codecParameters->codec_tag = (std::uint32_t)reader.readVarUInt();
+		codecParameters->format = (int)reader.readVarInt();
+		codecParameters->bit_rate = reader.readVarInt();
+		codecParameters->bits_per_coded_sample = (int)reader.readVarInt();
+		codecParameters->bits_per_raw_sample = (int)reader.readVarInt();
+		codecParameters->profile = (int)reader.readVarInt();
+		codecParameters->level = (int)reader.readVarInt();
+		codecParameters->width = (int)reader.readVarInt();
+		codecParameters->height = (int)reader.readVarInt();
+		codecParameters->sample_aspect_ratio = reader.readRational();
+		codecParameters->field_order = (AVFieldOrder)reader.readVarInt();
+		codecParameters->color_range = (AVColorRange)reader.readVarInt();
+		codecParameters->color_primaries = (AVColorPrimaries)reader.readVarInt();
+		codecParameters->color_trc = (AVColorTransferCharacteristic)reader.readVarInt();
+		codecParameters->color_space = (AVColorSpace)reader.readVarInt();
+		codecParameters->chroma_location = (AVChromaLocation)reader.readVarInt();
+		codecParameters->video_delay = (int)reader.readVarInt();
+
+		std::size_t extraDataSize = 0;
+		auto extraDataPtr = reader.readBytes(extraDataSize);
+		if (reader.failed()) {
+			return false;
+		}
+
+		// Decoders may read past the end of the extra data, so it has to be padded.
+		extraData = std::make_unique<std::uint8_t[]>(extraDataSize + AV_INPUT_BUFFER_PADDING_SIZE);
+		std::memcpy(extraData.get(), extraDataPtr, extraDataSize);
+		std::memset(extraData.get() + extraDataSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+		codecParameters->extradata = extraData.get();
+		codecParameters->extradata_size = (int)extraDataSize;
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/system/error_code.hpp>
+#include <boost/asio.hpp>
+
+#include "common.h"
+
+namespace screenshare::video::protocol {
+	constexpr std::uint32_t PROTOCOL_MAGIC = 0x53435348; // "SCSH"
+	// 2: packet headers end with optional fields, which readers skip when they do not know them, so that fields can be
+	// added without a new version. Clients of version 1 are still served their own packet headers over TCP.
+	// Multicast datagrams end with a key given in the server hello.
+	constexpr std::uint32_t PROTOCOL_VERSION = 2;
+	constexpr std::uint32_t MIN_PROTOCOL_VERSION = 1;
+	constexpr std::uint32_t OPTIONAL_FIELDS_VERSION = 2;
+	constexpr std::uint32_t MULTICAST_KEY_VERSION = 2;
+
+	/**
+	 * Every message is sent as a frame: [type: u8][payload size: varint][payload]
+	 */
+	enum class MessageType : std::uint8_t {
+		ClientHello = 1,
+		ServerHello,
+		Packet,
+		ClientAction,
+		RecoveryRequest,
+		ClockSyncRequest,
+		ClockSyncResponse,
+		ReceiverReport
+	};
+
+	constexpr std::size_t MAX_FRAME_HEADER_SIZE = 1 + 10;
+	constexpr std::size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+	/**
+	 * Optional features negotiated during the handshake
+	 */
+	enum class Capability : std::uint64_t {
+		RemoteInput = 1 << 0,
+		UdpTransport = 1 << 1,
+		Recovery = 1 << 2,
+		Multicast = 1 << 3,
+		SharedMemory = 1 << 4,
+		ClockSync = 1 << 5,
+		ReceiverReports = 1 << 6,
+		Resumption = 1 << 7,
+		ExtendedInput = 1 << 8 // Key up and down, pointer motion and scrolling, in addition to key and button presses
+	};
+
+	using Capabilities = std::uint64_t;
+
+	constexpr Capabilities capabilityBit(Capability capability) {
+		return (Capabilities)capability;
+	}
+
+	constexpr bool hasCapability(Capabilities capabilities, Capability capability) {
+		return (capabilities & capabilityBit(capability)) != 0;
+	}
+
+	/**
+	 * Builds a single message frame. The payload is written after room reserved for the frame header,
+	 * so that the finished frame can be sent without any extra copy.
+	 */
+	class MessageWriter {
+	private:
+		MessageType mType;
+		std::vector<std::uint8_t> mBuffer;
+		std::size_t mFrameBegin = MAX_FRAME_HEADER_SIZE;
+	public:
+		explicit MessageWriter(MessageType type);
+
+		/**
+		 * Clears the payload and starts a new message of the given type
+		 */
+		void reset(MessageType type);
+
+		void writeUInt8(std::uint8_t value);
+		void writeVarUInt(std::uint64_t value);
+		void writeVarInt(std::int64_t value);
+		void writeRational(AVRational value);
+		void writeDouble(double value);
+		void writeBytes(const std::uint8_t* data, std::size_t size);
+
+		/**
+		 * Starts a length prefixed field, as written by writeBytes, whose size is only known once it has been written.
+		 * Returns what to pass to endBytes.
+		 */
+		std::size_t beginBytes();
+		void endBytes(std::size_t begin);
+
+		std::size_t payloadSize() const;
+
+		/**
+		 * Writes the frame header. The trailing size is the number of payload bytes that are sent separately after the buffer.
+		 */
+		void finish(std::size_t trailingSize = 0);
+
+		/**
+		 * Returns the finished frame (header + payload written so far)
+		 */
+		boost::asio::const_buffer buffer() const;
+	};
+
+	/**
+	 * Reads values from a message payload. Reading past the end marks the reader as failed.
+	 */
+	class MessageReader {
+	private:
+		const std::uint8_t* mData = nullptr;
+		std::size_t mSize = 0;
+		std::size_t mPosition = 0;
+		bool mFailed = false;
+	public:
+		MessageReader() = default;
+		MessageReader(const std::uint8_t* data, std::size_t size);
+
+		std::uint8_t readUInt8();
+		std::uint64_t readVarUInt();
+		std::int64_t readVarInt();
+		AVRational readRational();
+		double readDouble();
+		const std::uint8_t* readBytes(std::size_t& size);
+
+		std::size_t position() const;
+		std::size_t remaining() const;
+		bool failed() const;
+	};
+
+	struct FrameHeader {
+		MessageType type = MessageType::ClientHello;
+		std::size_t size = 0;
+	};
+
+	enum class ParseStatus {
+		Complete,
+		Incomplete,
+		Invalid
+	};
+
+	ParseStatus parseFrameHeader(const std::uint8_t* data, std::size_t size, FrameHeader& header, std::size_t& headerSize);
+
+	/**
+	 * Reads a complete frame without reading any bytes past it. Used for the handshake, before a buffered reader takes over.
+	 */
+	boost::system::error_code readFrame(
+		boost::asio::ip::tcp::socket& socket,
+		FrameHeader& header,
+		std::vector<std::uint8_t>& payload
+	);
+
+	boost::asio::awaitable<boost::system::error_code> asyncReadFrame(
+		boost::asio::ip::tcp::socket& socket,
+		FrameHeader& header,
+		std::vector<std::uint8_t>& payload
+	);
+
+	/**
+	 * Buffered frame reader, usable both with blocking reads and with async reads into prepare()/commit()
+	 */
+	class FrameReader {
+	private:
+		std::vector<std::uint8_t> mBuffer;
+		std::size_t mBegin = 0;
+		std::size_t mEnd = 0;
+
+		void compact();
+		void reserve(std::size_t size);
+		boost::system::error_code readSome(boost::asio::ip::tcp::socket& socket);
+	public:
+		explicit FrameReader(std::size_t bufferSize = 64 * 1024);
+
+		const std::uint8_t* data() const;
+		std::size_t buffered() const;
+		void consume(std::size_t size);
+
+		boost::asio::mutable_buffer prepare();
+		void commit(std::size_t size);
+
+		/**
+		 * Extracts the next frame if it is completely buffered. The payload is valid until the next call to prepare().
+		 */
+		bool nextFrame(FrameHeader& header, MessageReader& payload, boost::system::error_code& error);
+
+		boost::system::error_code readHeader(boost::asio::ip::tcp::socket& socket, FrameHeader& header);
+		boost::system::error_code fill(boost::asio::ip::tcp::socket& socket, std::size_t size);
+		boost::system::error_code read(boost::asio::ip::tcp::socket& socket, std::uint8_t* data, std::size_t size);
+		boost::system::error_code skip(boost::asio::ip::tcp::socket& socket, std::size_t size);
+	};
+
+	boost::system::error_code makeProtocolError();
+
+	struct ClientHello {
+		std::uint32_t version = PROTOCOL_VERSION;
+		std::uint32_t minVersion = MIN_PROTOCOL_VERSION;
+		Capabilities capabilities = 0;
+
+		// Sent with the resumption capability. When reconnecting, the token of the lost session and the last packet decoded.
+		std::uint64_t resumeToken = 0;
+		std::int64_t lastDecodedPts = -1;
+	};
+
+	enum class HandshakeStatus : std::uint8_t {
+		Ok = 0,
+		UnsupportedVersion
+	};
+
+	struct ServerHello {
+		HandshakeStatus status = HandshakeStatus::Ok;
+		std::uint32_t version = PROTOCOL_VERSION;
+		Capabilities capabilities = 0;
+		std::uint64_t sessionId = 0; // Identifies the client on secondary channels, such as the UDP transport
+
+		// Where the stream is sent when the multicast capability has been negotiated
+		std::string multicastAddress;
+		std::uint16_t multicastPort = 0;
+		std::uint64_t multicastKey = 0; // Ends every multicast datagram, as anyone can send to the group. 0 before version 2.
+
+		// Name of the segment the stream is written to when the shared memory capability has been negotiated
+		std::string sharedMemoryName;
+
+		// When the resumption capability has been negotiated, the token to resume the session with after losing the connection
+		std::uint64_t resumeToken = 0;
+		bool resumed = false; // The session of the token in the client hello continues
+	};
+
+	void writeClientHello(MessageWriter& writer, const ClientHello& clientHello);
+	bool readClientHello(MessageReader& reader, ClientHello& clientHello);
+
+	void writeServerHello(MessageWriter& writer, const ServerHello& serverHello);
+	bool readServerHello(MessageReader& reader, ServerHello& serverHello);
+
+	/**
+	 * Sent by a client that can no longer decode the stream, identifying the last packet it decoded correctly
+	 */
+	struct RecoveryRequest {
+		std::int64_t lastDecodedPts = -1; // Encoder pts, or -1 if nothing has been decoded yet
+
+		// Asks for a new keyframe instead of a replay, as relays do for their own clients. Left out by older clients.
+		bool keyframe = false;
+	};
+
+	void writeRecoveryRequest(MessageWriter& writer, const RecoveryRequest& recoveryRequest);
+	bool readRecoveryRequest(MessageReader& reader, RecoveryRequest& recoveryRequest);
+
+	/**
+	 * NTP style exchange for estimating the offset between the clocks of the client and the server. The client sends its
+	 * send time and the server answers with the same message after filling in its own times. Times are nanoseconds of the
+	 * realtime clock of the side taking them, the clock packets are stamped with.
+	 */
+	struct ClockSync {
+		std::int64_t clientSendTime = 0;
+		std::int64_t serverReceiveTime = 0;
+		std::int64_t serverSendTime = 0;
+	};
+
+	void writeClockSync(MessageWriter& writer, const ClockSync& clockSync);
+	bool readClockSync(MessageReader& reader, ClockSync& clockSync);
+
+	/**
+	 * Sent periodically by clients, describing how they keep up with the stream
+	 */
+	struct ReceiverReport {
+		// Totals since the client connected, so that rates can be computed from any two reports
+		std::uint64_t framesReceived = 0;
+		std::uint64_t framesDecoded = 0;
+		std::uint64_t decodeErrors = 0;
+		std::uint64_t gaps = 0; // Times packets were found to be missing
+
+		// Over the time since the previous report, in milliseconds
+		double averageDecodeTime = 0.0;
+		double averageLatency = 0.0; // From a packet being received until its frame is presented
+		double maxLatency = 0.0;
+
+		std::uint64_t bufferedBytes = 0; // Received but not yet taken out as packets
+	};
+
+	void writeReceiverReport(MessageWriter& writer, const ReceiverReport& receiverReport);
+	bool readReceiverReport(MessageReader& reader, ReceiverReport& receiverReport);
+
+	/**
+	 * Picks the highest version supported by both sides and the capabilities both sides support
+	 */
+	ServerHello negotiate(const ClientHello& clientHello, Capabilities serverCapabilities);
+
+	void writeCodecParameters(MessageWriter& writer, const AVCodecParameters* codecParameters);
+	bool readCodecParameters(
+		MessageReader& reader,
+		AVCodecParameters* codecParameters,
+		std::unique_ptr<std::uint8_t[]>& extraData
+	);
+}
\ No newline at end of file
@@ -0,0 +1,354 @@
+#include "shm.h"
+
+#include <climits>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace screenshare::video::shm {
+	namespace {
+		// The ring starts on its own cache line, so that the reader bookkeeping does not share one with packet data
+		constexpr std::size_t RING_OFFSET = 64;
+		static_assert(sizeof(SegmentHeader) <= RING_OFFSET);
+
+		constexpr std::size_t RECORD_HEADER_SIZE = 8;
+
+		std::uint64_t alignRecord(std::uint64_t size) {
+			return (size + 7) & ~(std::uint64_t)7;
+		}
+
+		std::string segmentName(std::string name) {
+			if (name.empty() || name[0] != '/') {
+				name = "/" + name;
+			}
+
+			return name;
+		}
+
+		std::runtime_error systemError(const std::string& message) {
+			return std::runtime_error(message + ": " + std::strerror(errno));
+		}
+
+		// Not private futexes, since the waiters are in other processes
+		long futexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected, const timespec* timeout) {
+			return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+		}
+
+		long futexWakeAll(std::atomic<std::uint32_t>& word) {
+			return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+		}
+
+		/**
+		 * If the segment with the given name belongs to a writer that has closed it, so that replacing it cannot disturb
+		 * a running server
+		 */
+		bool isClosedSegment(const std::string& name) {
+			auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+			if (fd < 0) {
+				return false;
+			}
+
+			struct stat status {};
+			if (fstat(fd, &status) < 0 || (std::size_t)status.st_size < RING_OFFSET) {
+				close(fd);
+				return false;
+			}
+
+			auto data = mmap(nullptr, RING_OFFSET, PROT_READ, MAP_SHARED, fd, 0);
+			close(fd);
+			if (data == MAP_FAILED) {
+				return false;
+			}
+
+			auto header = reinterpret_cast<const SegmentHeader*>(data);
+			auto closed = header->magic == SEGMENT_MAGIC
+				&& header->version == SEGMENT_VERSION
+				&& header->closed.load(std::memory_order_acquire) != 0;
+			munmap(data, RING_OFFSET);
+			return closed;
+		}
+	}
+
+	Segment::Segment(std::string name, std::size_t size)
+		: mName(segmentName(std::move(name))),
+		  mSize(size),
+		  mOwner(true) {
+		auto fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0 && errno == EEXIST) {
+			if (!isClosedSegment(mName)) {
+				throw std::runtime_error(
+					"Shared memory segment " + mName + " already exists. It is either used by another server, "
+					"or was left by one that did not shut down, in which case it has to be removed from /dev/shm."
+				);
+			}
+
+			shm_unlink(mName.c_str());
+			fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		}
+
+		if (fd < 0) {
+			throw systemError("Failed to create shared memory segment " + mName);
+		}
+
+		if (ftruncate(fd, (off_t)mSize) < 0) {
+			close(fd);
+			shm_unlink(mName.c_str());
+			throw systemError("Failed to resize shared memory segment " + mName);
+		}
+
+		mData = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mData == MAP_FAILED) {
+			mData = nullptr;
+			shm_unlink(mName.c_str());
+			throw systemError("Failed to map shared memory segment " + mName);
+		}
+	}
+
+	Segment::Segment(std::string name)
+		: mName(segmentName(std::move(name))) {
+		auto fd = shm_open(mName.c_str(), O_RDWR, 0);
+		if (fd < 0) {
+			throw systemError("Failed to open shared memory segment " + mName);
+		}
+
+		struct stat status {};
+		if (fstat(fd, &status) < 0 || (std::size_t)status.st_size < RING_OFFSET) {
+			close(fd);
+			throw std::runtime_error("Invalid shared memory segment " + mName);
+		}
+
+		mSize = (std::size_t)status.st_size;
+		mData = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mData == MAP_FAILED) {
+			mData = nullptr;
+			throw systemError("Failed to map shared memory segment " + mName);
+		}
+
+		auto segmentHeader = header();
+		if (segmentHeader->magic != SEGMENT_MAGIC
+			|| segmentHeader->version != SEGMENT_VERSION
+			|| segmentHeader->capacity > mSize - RING_OFFSET) {
+			munmap(mData, mSize);
+			throw std::runtime_error("Invalid shared memory segment " + mName);
+		}
+	}
+
+	Segment::~Segment() {
+		if (mData != nullptr) {
+			munmap(mData, mSize);
+		}
+
+		// Readers keep their mapping, so unlinking only stops new readers from opening a stale segment
+		if (mOwner) {
+			shm_unlink(mName.c_str());
+		}
+	}
+
+	SegmentHeader* Segment::header() const {
+		return reinterpret_cast<SegmentHeader*>(mData);
+	}
+
+	std::uint8_t* Segment::ring() const {
+		return reinterpret_cast<std::uint8_t*>(mData) + RING_OFFSET;
+	}
+
+	SharedMemoryWriter::SharedMemoryWriter(const SharedMemoryConfig& config)
+		: mSegment(config.name, RING_OFFSET + alignRecord(config.capacity)),
+		  mCapacity(alignRecord(config.capacity)) {
+		auto header = new (mSegment.header()) SegmentHeader {};
+		header->magic = SEGMENT_MAGIC;
+		header->version = SEGMENT_VERSION;
+		header->capacity = mCapacity;
+		header->keyframePosition.store(NO_POSITION);
+	}
+
+	SharedMemoryWriter::~SharedMemoryWriter() {
+		auto header = mSegment.header();
+		header->closed.store(1, std::memory_order_release);
+		header->sequence.fetch_add(1);
+		futexWakeAll(header->sequence);
+	}
+
+	void SharedMemoryWriter::write(const network::EncodedPacket& packet) {
+		auto header = mSegment.header();
+		auto ring = mSegment.ring();
+
+		auto buffers = packet.buffers();
+		auto frameSize = buffers[0].size() + buffers[1].size();
+		auto recordSize = alignRecord(RECORD_HEADER_SIZE + frameSize);
+		if (recordSize > mCapacity / 2) {
+			std::cout << "Packet of " << frameSize << " bytes does not fit in the shared memory ring" << std::endl;
+			return;
+		}
+
+		// Records are never split, so a record that does not fit before the end of the ring starts over at the beginning.
+		auto position = header->writePosition.load(std::memory_order_relaxed);
+		auto offset = position % mCapacity;
+		auto start = position;
+		if (mCapacity - offset < recordSize) {
+			start += mCapacity - offset;
+		}
+
+		// Readers compare against the reserved position after copying, to find out if the record changed beneath them.
+		header->reservedPosition.store(start + recordSize, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		if (start != position) {
+			std::memcpy(ring + offset, &RECORD_WRAP, sizeof(RECORD_WRAP));
+		}
+
+		auto record = ring + start % mCapacity;
+		auto size = (std::uint32_t)frameSize;
+		auto flags = packet.isKeyframe() ? RECORD_FLAG_KEYFRAME : 0;
+		std::memcpy(record, &size, sizeof(size));
+		std::memcpy(record + sizeof(size), &flags, sizeof(flags));
+
+		auto data = record + RECORD_HEADER_SIZE;
+		for (auto& buffer : buffers) {
+			std::memcpy(data, buffer.data(), buffer.size());
+			data += buffer.size();
+		}
+
+		header->writePosition.store(start + recordSize, std::memory_order_release);
+		if (packet.isKeyframe()) {
+			header->keyframePosition.store(start, std::memory_order_release);
+		}
+
+		// The system call is only made when someone is actually sleeping
+		header->sequence.fetch_add(1);
+		if (header->waiters.load() > 0) {
+			futexWakeAll(header->sequence);
+		}
+	}
+
+	SharedMemoryPacketSource::SharedMemoryPacketSource(const std::string& name)
+		: mSegment(name),
+		  mCapacity(mSegment.header()->capacity),
+		  mReadPosition(0) {
+		skipToKeyframe();
+	}
+
+	void SharedMemoryPacketSource::setProtocolVersion(std::uint32_t version) {
+		mProtocolVersion = version;
+	}
+
+	bool SharedMemoryPacketSource::overwritten(std::uint64_t position) const {
+		return mSegment.header()->reservedPosition.load(std::memory_order_relaxed) > position + mCapacity;
+	}
+
+	void SharedMemoryPacketSource::skipToKeyframe() {
+		auto header = mSegment.header();
+
+		// Starts at the latest keyframe when it is still in the ring, otherwise waits for the next one.
+		auto writePosition = header->writePosition.load(std::memory_order_acquire);
+		auto keyframePosition = header->keyframePosition.load(std::memory_order_acquire);
+		if (keyframePosition != NO_POSITION && !overwritten(keyframePosition)) {
+			mReadPosition = keyframePosition;
+		} else {
+			mReadPosition = writePosition;
+		}
+
+		mWaitingForKeyframe = true;
+	}
+
+	bool SharedMemoryPacketSource::waitForData() {
+		auto header = mSegment.header();
+
+		header->waiters.fetch_add(1);
+		auto sequence = header->sequence.load();
+
+		auto hasData = header->writePosition.load(std::memory_order_acquire) != mReadPosition
+			|| header->closed.load(std::memory_order_acquire) != 0;
+		if (!hasData) {
+			// Woken up for every packet, the timeout only guards against a writer that went away without closing.
+			timespec timeout { 0, 100 * 1000 * 1000 };
+			futexWait(header->sequence, sequence, &timeout);
+		}
+
+		header->waiters.fetch_sub(1);
+		return header->writePosition.load(std::memory_order_acquire) != mReadPosition;
+	}
+
+	boost::system::error_code SharedMemoryPacketSource::receive(AVPacket* packet, network::PacketHeader& header) {
+		auto segmentHeader = mSegment.header();
+		auto ring = mSegment.ring();
+
+		while (true) {
+			auto closed = segmentHeader->closed.load(std::memory_order_acquire) != 0;
+			if (segmentHeader->writePosition.load(std::memory_order_acquire) == mReadPosition) {
+				if (closed) {
+					return boost::asio::error::eof;
+				}
+
+				waitForData();
+				continue;
+			}
+
+			if (overwritten(mReadPosition)) {
+				mLappedCount++;
+				skipToKeyframe();
+				continue;
+			}
+
+			auto offset = mReadPosition % mCapacity;
+			std::uint32_t size = 0;
+			std::uint32_t flags = 0;
+			std::memcpy(&size, ring + offset, sizeof(size));
+			if (size == RECORD_WRAP) {
+				mReadPosition += mCapacity - offset;
+				continue;
+			}
+
+			std::memcpy(&flags, ring + offset + sizeof(size), sizeof(flags));
+			auto isKeyframe = (flags & RECORD_FLAG_KEYFRAME) != 0;
+			auto valid = size <= mCapacity - offset - RECORD_HEADER_SIZE;
+
+			// The packet is copied out of the ring, since the writer never waits for readers and may reuse the space.
+			auto parsed = false;
+			if (valid && (!mWaitingForKeyframe || isKeyframe)) {
+				parsed = network::readPacketFrame(ring + offset + RECORD_HEADER_SIZE, size, mProtocolVersion, packet, header);
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (overwritten(mReadPosition)) {
+				mLappedCount++;
+				skipToKeyframe();
+				continue;
+			}
+
+			if (!valid) {
+				return protocol::makeProtocolError();
+			}
+
+			mReadPosition += alignRecord(RECORD_HEADER_SIZE + size);
+			if (mWaitingForKeyframe && !isKeyframe) {
+				continue;
+			}
+
+			if (!parsed) {
+				return protocol::makeProtocolError();
+			}
+
+			mWaitingForKeyframe = false;
+			return {};
+		}
+	}
+
+	std::size_t SharedMemoryPacketSource::bufferedBytes() const {
+		// Written but not yet read, which includes the padding at the end of the ring when wrapping
+		auto writePosition = mSegment.header()->writePosition.load(std::memory_order_acquire);
+		return writePosition > mReadPosition ? (std::size_t)(writePosition - mReadPosition) : 0;
+	}
+
+	std::uint64_t SharedMemoryPacketSource::lappedCount() const {
+		return mLappedCount;
+	}
+}
\ No newline at end of file
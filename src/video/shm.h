@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "network.h"
+
+namespace screenshare::video::shm {
+	constexpr std::uint32_t SEGMENT_MAGIC = 0x53485353;
+	constexpr std::uint32_t SEGMENT_VERSION = 1;
+
+	constexpr std::uint32_t RECORD_FLAG_KEYFRAME = 1 << 0;
+	constexpr std::uint32_t RECORD_WRAP = UINT32_MAX; // Size of a record marking that the rest of the ring is unused
+	constexpr std::uint64_t NO_POSITION = UINT64_MAX;
+
+	/**
+	 * Start of the shared memory segment, followed by the ring of packet records.
+	 * Each record is [size: u32][flags: u32][packet frame], aligned to eight bytes.
+	 */
+	struct SegmentHeader {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint64_t capacity;
+
+		// Positions count bytes written in total, so the offset in the ring is the position modulo the capacity.
+		std::atomic<std::uint64_t> reservedPosition; // Bytes from here on might be in the middle of being written
+		std::atomic<std::uint64_t> writePosition;
+		std::atomic<std::uint64_t> keyframePosition; // Latest keyframe, where new readers start
+
+		// Futex word, incremented for every packet and when the writer closes
+		std::atomic<std::uint32_t> sequence;
+		std::atomic<std::uint32_t> waiters;
+		std::atomic<std::uint32_t> closed;
+	};
+
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free);
+
+	struct SharedMemoryConfig {
+		std::string name; // Empty disables the shared memory transport
+		std::size_t capacity = 32 * 1024 * 1024;
+	};
+
+	/**
+	 * A mapping of a named shared memory segment
+	 */
+	class Segment {
+	private:
+		std::string mName;
+		void* mData = nullptr;
+		std::size_t mSize = 0;
+		bool mOwner = false;
+	public:
+		Segment(std::string name, std::size_t size); // Creates the segment, replacing a segment with the same name only if its writer closed it
+		explicit Segment(std::string name); // Opens an existing segment
+		~Segment();
+
+		Segment(const Segment&) = delete;
+		Segment& operator=(const Segment&) = delete;
+
+		SegmentHeader* header() const;
+		std::uint8_t* ring() const;
+	};
+
+	/**
+	 * Writes every packet once into the ring, to be read by any number of readers on the same host.
+	 * Readers that fall a full ring behind lose packets rather than slowing down the writer.
+	 */
+	class SharedMemoryWriter {
+	private:
+		Segment mSegment;
+		std::uint64_t mCapacity;
+	public:
+		explicit SharedMemoryWriter(const SharedMemoryConfig& config);
+		~SharedMemoryWriter();
+
+		SharedMemoryWriter(const SharedMemoryWriter&) = delete;
+		SharedMemoryWriter& operator=(const SharedMemoryWriter&) = delete;
+
+		void write(const network::EncodedPacket& packet);
+	};
+
+	class SharedMemoryPacketSource : public network::PacketSource {
+	private:
+		Segment mSegment;
+		std::uint64_t mCapacity;
+		std::uint64_t mReadPosition;
+		bool mWaitingForKeyframe = true;
+		std::uint64_t mLappedCount = 0;
+		std::uint32_t mProtocolVersion = protocol::PROTOCOL_VERSION;
+
+		bool overwritten(std::uint64_t position) const;
+		void skipToKeyframe();
+		bool waitForData();
+	public:
+		explicit SharedMemoryPacketSource(const std::string& name);
+
+		/**
+		 * Sets the version negotiated with the server, which decides the format of the packet headers
+		 */
+		void setProtocolVersion(std::uint32_t version);
+
+		boost::system::error_code receive(AVPacket* packet, network::PacketHeader& header) override;
+		std::size_t bufferedBytes() const override;
+
+		/**
+		 * The number of times the reader fell a full ring behind and skipped to the next keyframe
+		 */
+		std::uint64_t lappedCount() const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,774 @@
+#include "udp.h"
+#include "../misc/network.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace screenshare::video::udp {
+	namespace {
+		// Gaps larger than this are treated as a stream reset rather than loss
+		constexpr std::uint64_t MAX_SEQUENCE_GAP = 1024;
+		// How far back datagrams are kept for parity recovery
+		constexpr std::uint64_t RECOVERY_WINDOW = 4096;
+
+		constexpr std::size_t SESSION_HEADER_SIZE = 10;
+		constexpr std::size_t MAX_NACKS_PER_DATAGRAM = (MAX_DATAGRAM_SIZE - SESSION_HEADER_SIZE - 2) / 8;
+
+		void putUInt16(std::uint8_t* data, std::uint16_t value) {
+			data[0] = (std::uint8_t)value;
+			data[1] = (std::uint8_t)(value >> 8);
+		}
+
+		void putUInt64(std::uint8_t* data, std::uint64_t value) {
+			for (std::size_t i = 0; i < 8; i++) {
+				data[i] = (std::uint8_t)(value >> (8 * i));
+			}
+		}
+
+		std::uint16_t getUInt16(const std::uint8_t* data) {
+			return (std::uint16_t)(data[0] | (data[1] << 8));
+		}
+
+		std::uint64_t getUInt64(const std::uint8_t* data) {
+			std::uint64_t value = 0;
+			for (std::size_t i = 0; i < 8; i++) {
+				value |= (std::uint64_t)data[i] << (8 * i);
+			}
+
+			return value;
+		}
+
+		/**
+		 * The part of a data datagram covered by parity: everything but the sequence number, plus the fragment size
+		 */
+		std::vector<std::uint8_t> protectedRegion(const std::uint8_t* datagram, std::size_t size) {
+			auto fragmentSize = size - DATA_HEADER_SIZE;
+
+			std::vector<std::uint8_t> region(PROTECTED_HEADER_SIZE + fragmentSize);
+			region[0] = datagram[1];
+			std::memcpy(region.data() + 1, datagram + 10, 12);
+			putUInt16(region.data() + 13, (std::uint16_t)fragmentSize);
+			std::memcpy(region.data() + PROTECTED_HEADER_SIZE, datagram + DATA_HEADER_SIZE, fragmentSize);
+			return region;
+		}
+
+		void xorInto(std::vector<std::uint8_t>& target, const std::uint8_t* data, std::size_t size) {
+			if (target.size() < size) {
+				target.resize(size, 0);
+			}
+
+			for (std::size_t i = 0; i < size; i++) {
+				target[i] ^= data[i];
+			}
+		}
+
+		Datagram makeSessionDatagram(DatagramType type, std::uint64_t sessionId, std::size_t payloadSize) {
+			Datagram datagram(SESSION_HEADER_SIZE + payloadSize);
+			datagram[0] = (std::uint8_t)type;
+			datagram[1] = 0;
+			putUInt64(datagram.data() + 2, sessionId);
+			return datagram;
+		}
+	}
+
+	Packetizer::Packetizer(FecConfig fec, std::size_t historySize)
+		: mFec(fec),
+		  mHistory(historySize) {
+
+	}
+
+	std::vector<DatagramPtr> Packetizer::packetize(const network::EncodedPacket& packet) {
+		auto buffers = packet.buffers();
+		auto totalSize = packet.size();
+		auto fragmentCount = (totalSize + MAX_FRAGMENT_SIZE - 1) / MAX_FRAGMENT_SIZE;
+		if (fragmentCount > UINT16_MAX) {
+			throw std::runtime_error("Packet too large for the UDP transport.");
+		}
+
+		auto frameId = mNextFrameId++;
+		std::uint8_t flags = packet.isKeyframe() ? FRAME_FLAG_KEYFRAME : 0;
+
+		std::vector<DatagramPtr> datagrams;
+		datagrams.reserve(fragmentCount + (mFec.groupSize > 0 ? fragmentCount / mFec.groupSize + 1 : 0));
+
+		std::size_t bufferIndex = 0;
+		std::size_t bufferOffset = 0;
+		for (std::size_t fragmentIndex = 0; fragmentIndex < fragmentCount; fragmentIndex++) {
+			auto fragmentSize = std::min(MAX_FRAGMENT_SIZE, totalSize - fragmentIndex * MAX_FRAGMENT_SIZE);
+			auto sequence = mNextSequence++;
+
+			auto datagram = std::make_shared<Datagram>(DATA_HEADER_SIZE + fragmentSize);
+			auto data = datagram->data();
+			data[0] = (std::uint8_t)DatagramType::Data;
+			data[1] = flags;
+			putUInt64(data + 2, sequence);
+			putUInt64(data + 10, frameId);
+			putUInt16(data + 18, (std::uint16_t)fragmentIndex);
+			putUInt16(data + 20, (std::uint16_t)fragmentCount);
+
+			// The fragment might span the header and payload buffers of the packet.
+			auto fragment = data + DATA_HEADER_SIZE;
+			auto toCopy = fragmentSize;
+			while (toCopy > 0) {
+				auto& buffer = buffers[bufferIndex];
+				auto size = std::min(toCopy, buffer.size() - bufferOffset);
+				std::memcpy(fragment, (const std::uint8_t*)buffer.data() + bufferOffset, size);
+				fragment += size;
+				toCopy -= size;
+				bufferOffset += size;
+
+				if (bufferOffset == buffer.size()) {
+					bufferIndex++;
+					bufferOffset = 0;
+				}
+			}
+
+			mHistory[sequence % mHistory.size()] = datagram;
+			datagrams.push_back(datagram);
+
+			if (mFec.groupSize > 0) {
+				addToParity(*datagram);
+				if (mParityCount == mFec.groupSize) {
+					datagrams.push_back(finishParity());
+				}
+			}
+		}
+
+		// Groups never span frames, so the tail of a frame can be recovered without waiting for the next one.
+		if (mParityCount > 0) {
+			datagrams.push_back(finishParity());
+		}
+
+		return datagrams;
+	}
+
+	void Packetizer::addToParity(const Datagram& datagram) {
+		if (mParityCount == 0) {
+			mParity.clear();
+			mParityFirstSequence = getUInt64(datagram.data() + 2);
+		}
+
+		auto region = protectedRegion(datagram.data(), datagram.size());
+		xorInto(mParity, region.data(), region.size());
+		mParityCount++;
+	}
+
+	DatagramPtr Packetizer::finishParity() {
+		auto datagram = std::make_shared<Datagram>(PARITY_HEADER_SIZE + mParity.size());
+		auto data = datagram->data();
+		data[0] = (std::uint8_t)DatagramType::Parity;
+		data[1] = 0;
+		putUInt64(data + 2, mParityFirstSequence);
+		putUInt16(data + 10, (std::uint16_t)mParityCount);
+		putUInt16(data + 12, (std::uint16_t)mParity.size());
+		std::memcpy(data + PARITY_HEADER_SIZE, mParity.data(), mParity.size());
+
+		mParityCount = 0;
+		return datagram;
+	}
+
+	DatagramPtr Packetizer::find(std::uint64_t sequence) const {
+		auto& datagram = mHistory[sequence % mHistory.size()];
+		if (datagram && getUInt64(datagram->data() + 2) == sequence) {
+			return datagram;
+		}
+
+		return {};
+	}
+
+	Reassembler::Reassembler(ReassemblerConfig config)
+		: mConfig(config) {
+
+	}
+
+	void Reassembler::add(const std::uint8_t* datagram, std::size_t size) {
+		if (size < 1) {
+			return;
+		}
+
+		switch ((DatagramType)datagram[0]) {
+			case DatagramType::Data: {
+				if (size <= DATA_HEADER_SIZE) {
+					return;
+				}
+
+				auto region = protectedRegion(datagram, size);
+				addData(getUInt64(datagram + 2), region.data(), region.size(), true);
+				break;
+			}
+			case DatagramType::Parity:
+				addParity(datagram, size);
+				break;
+			default:
+				break;
+		}
+	}
+
+	void Reassembler::addData(std::uint64_t sequence, const std::uint8_t* region, std::size_t regionSize, bool storeRegion) {
+		auto timeNow = Clock::now();
+
+		if (!mSequenceStarted || sequence >= mNextSequence) {
+			if (mSequenceStarted && sequence - mNextSequence <= MAX_SEQUENCE_GAP) {
+				for (auto missing = mNextSequence; missing < sequence; missing++) {
+					mMissing[missing] = { timeNow, {} };
+				}
+			}
+
+			mSequenceStarted = true;
+			mNextSequence = sequence + 1;
+		} else if (mMissing.erase(sequence) == 0) {
+			// Duplicate, or arrived after being given up on
+			return;
+		}
+
+		auto flags = region[0];
+		auto frameId = getUInt64(region + 1);
+		auto fragmentIndex = getUInt16(region + 9);
+		auto fragmentCount = getUInt16(region + 11);
+		auto fragmentSize = getUInt16(region + 13);
+		if (fragmentCount == 0 || fragmentIndex >= fragmentCount || PROTECTED_HEADER_SIZE + fragmentSize != regionSize) {
+			return;
+		}
+
+		if (storeRegion) {
+			mProtectedRegions[sequence].assign(region, region + regionSize);
+		}
+
+		if (!mStarted) {
+			mStarted = true;
+			mNextFrameId = frameId;
+		}
+
+		if (frameId >= mNextFrameId) {
+			auto& frame = mFrames[frameId];
+			if (frame.fragments.empty()) {
+				frame.flags = flags;
+				frame.fragments.resize(fragmentCount);
+				frame.present.resize(fragmentCount, false);
+				frame.firstArrival = timeNow;
+			}
+
+			if (fragmentIndex < frame.fragments.size() && !frame.present[fragmentIndex]) {
+				frame.fragments[fragmentIndex].assign(region + PROTECTED_HEADER_SIZE, region + regionSize);
+				frame.present[fragmentIndex] = true;
+				frame.received++;
+			}
+		}
+
+		auto group = mParityGroups.upper_bound(sequence);
+		if (group != mParityGroups.begin()) {
+			group--;
+			if (sequence < group->first + group->second.count) {
+				tryRecover(group->first);
+			}
+		}
+	}
+
+	void Reassembler::addParity(const std::uint8_t* datagram, std::size_t size) {
+		if (size < PARITY_HEADER_SIZE) {
+			return;
+		}
+
+		auto firstSequence = getUInt64(datagram + 2);
+		auto count = getUInt16(datagram + 10);
+		auto regionSize = getUInt16(datagram + 12);
+		if (count == 0 || PARITY_HEADER_SIZE + regionSize != size) {
+			return;
+		}
+
+		if (mSequenceStarted && firstSequence + RECOVERY_WINDOW < mNextSequence) {
+			return;
+		}
+
+		auto& group = mParityGroups[firstSequence];
+		group.count = count;
+		group.parity.assign(datagram + PARITY_HEADER_SIZE, datagram + size);
+		tryRecover(firstSequence);
+	}
+
+	void Reassembler::tryRecover(std::uint64_t firstSequence) {
+		auto groupIterator = mParityGroups.find(firstSequence);
+		if (groupIterator == mParityGroups.end()) {
+			return;
+		}
+
+		auto& group = groupIterator->second;
+
+		std::optional<std::uint64_t> missingSequence;
+		for (auto sequence = firstSequence; sequence < firstSequence + group.count; sequence++) {
+			if (!mProtectedRegions.contains(sequence)) {
+				if (missingSequence) {
+					// XOR parity can only restore a single loss per group
+					return;
+				}
+
+				missingSequence = sequence;
+			}
+		}
+
+		if (!missingSequence) {
+			mParityGroups.erase(groupIterator);
+			return;
+		}
+
+		auto region = std::move(group.parity);
+		for (auto sequence = firstSequence; sequence < firstSequence + group.count; sequence++) {
+			if (sequence != *missingSequence) {
+				auto& other = mProtectedRegions[sequence];
+				xorInto(region, other.data(), other.size());
+			}
+		}
+
+		mParityGroups.erase(groupIterator);
+
+		if (region.size() < PROTECTED_HEADER_SIZE) {
+			return;
+		}
+
+		auto regionSize = PROTECTED_HEADER_SIZE + getUInt16(region.data() + 13);
+		if (regionSize > region.size()) {
+			return;
+		}
+
+		mRecoveredDatagrams++;
+		addData(*missingSequence, region.data(), regionSize, true);
+	}
+
+	std::optional<std::vector<std::uint8_t>> Reassembler::nextFrame() {
+		prune();
+
+		while (mStarted) {
+			auto timeNow = Clock::now();
+
+			// After a loss, jump straight to the first complete keyframe instead of waiting out the frames before it.
+			if (mWaitingForKeyframe) {
+				for (auto& [frameId, frame] : mFrames) {
+					if ((frame.flags & FRAME_FLAG_KEYFRAME) && frame.received == frame.fragments.size()) {
+						mSkippedFrames += frameId - mNextFrameId;
+						mFrames.erase(mFrames.begin(), mFrames.find(frameId));
+						mNextFrameId = frameId;
+						break;
+					}
+				}
+			}
+
+			auto frameIterator = mFrames.find(mNextFrameId);
+			if (frameIterator != mFrames.end() && frameIterator->second.received == frameIterator->second.fragments.size()) {
+				auto frame = std::move(frameIterator->second);
+				mFrames.erase(frameIterator);
+				mNextFrameId++;
+
+				if (mWaitingForKeyframe) {
+					if (!(frame.flags & FRAME_FLAG_KEYFRAME)) {
+						mSkippedFrames++;
+						continue;
+					}
+
+					mWaitingForKeyframe = false;
+				}
+
+				std::size_t size = 0;
+				for (auto& fragment : frame.fragments) {
+					size += fragment.size();
+				}
+
+				std::vector<std::uint8_t> data;
+				data.reserve(size);
+				for (auto& fragment : frame.fragments) {
+					data.insert(data.end(), fragment.begin(), fragment.end());
+				}
+
+				return data;
+			}
+
+			// The frame is incomplete, or none of it has arrived while later frames have.
+			Clock::time_point firstArrival;
+			if (frameIterator != mFrames.end()) {
+				firstArrival = frameIterator->second.firstArrival;
+			} else if (!mFrames.empty()) {
+				firstArrival = mFrames.begin()->second.firstArrival;
+			} else {
+				return {};
+			}
+
+			if (timeNow - firstArrival < mConfig.deadline) {
+				return {};
+			}
+
+			if (frameIterator != mFrames.end()) {
+				mFrames.erase(frameIterator);
+			}
+
+			mNextFrameId++;
+			mSkippedFrames++;
+			mWaitingForKeyframe = true;
+		}
+
+		return {};
+	}
+
+	std::vector<std::uint64_t> Reassembler::collectNacks() {
+		auto timeNow = Clock::now();
+
+		std::vector<std::uint64_t> nacks;
+		for (auto iterator = mMissing.begin(); iterator != mMissing.end();) {
+			auto& missing = iterator->second;
+			if (timeNow - missing.detected > mConfig.deadline) {
+				iterator = mMissing.erase(iterator);
+				continue;
+			}
+
+			auto due = missing.lastNack == Clock::time_point {}
+				? timeNow - missing.detected >= mConfig.nackDelay
+				: timeNow - missing.lastNack >= mConfig.nackInterval;
+
+			if (due) {
+				nacks.push_back(iterator->first);
+				missing.lastNack = timeNow;
+			}
+
+			iterator++;
+		}
+
+		return nacks;
+	}
+
+	void Reassembler::prune() {
+		if (mNextSequence < RECOVERY_WINDOW) {
+			return;
+		}
+
+		auto oldest = mNextSequence - RECOVERY_WINDOW;
+		mProtectedRegions.erase(mProtectedRegions.begin(), mProtectedRegions.lower_bound(oldest));
+		mParityGroups.erase(mParityGroups.begin(), mParityGroups.lower_bound(oldest));
+	}
+
+	std::uint64_t Reassembler::recoveredDatagrams() const {
+		return mRecoveredDatagrams;
+	}
+
+	std::uint64_t Reassembler::skippedFrames() const {
+		return mSkippedFrames;
+	}
+
+	std::size_t Reassembler::bufferedBytes() const {
+		std::size_t size = 0;
+		for (auto& [frameId, frame] : mFrames) {
+			for (auto& fragment : frame.fragments) {
+				size += fragment.size();
+			}
+		}
+
+		return size;
+	}
+
+	LossInjector::LossInjector(LossInjectorConfig config)
+		: mConfig(config),
+		  mRandom(std::random_device()()) {
+
+	}
+
+	bool LossInjector::enabled() const {
+		return mConfig.lossRate > 0.0 || mConfig.delay.count() > 0 || mConfig.jitter.count() > 0;
+	}
+
+	std::optional<std::chrono::microseconds> LossInjector::next() {
+		if (std::uniform_real_distribution<double>(0.0, 1.0)(mRandom) < mConfig.lossRate) {
+			return {};
+		}
+
+		auto delay = std::chrono::duration<double, std::micro>(mConfig.delay).count();
+		if (mConfig.jitter.count() > 0) {
+			auto jitter = std::chrono::duration<double, std::micro>(mConfig.jitter).count();
+			delay += std::uniform_real_distribution<double>(-jitter, jitter)(mRandom);
+		}
+
+		return std::chrono::microseconds((std::int64_t)std::max(delay, 0.0));
+	}
+
+	Datagram makeNack(std::uint64_t sessionId, const std::vector<std::uint64_t>& sequences) {
+		auto count = std::min(sequences.size(), MAX_NACKS_PER_DATAGRAM);
+
+		auto datagram = makeSessionDatagram(DatagramType::Nack, sessionId, 2 + 8 * count);
+		putUInt16(datagram.data() + SESSION_HEADER_SIZE, (std::uint16_t)count);
+		for (std::size_t i = 0; i < count; i++) {
+			putUInt64(datagram.data() + SESSION_HEADER_SIZE + 2 + 8 * i, sequences[i]);
+		}
+
+		return datagram;
+	}
+
+	Datagram makeRegister(std::uint64_t sessionId) {
+		return makeSessionDatagram(DatagramType::Register, sessionId, 0);
+	}
+
+	bool parseSessionDatagram(const std::uint8_t* data, std::size_t size, DatagramType& type, std::uint64_t& sessionId) {
+		if (size < SESSION_HEADER_SIZE) {
+			return false;
+		}
+
+		type = (DatagramType)data[0];
+		if (type != DatagramType::Nack && type != DatagramType::Register) {
+			return false;
+		}
+
+		sessionId = getUInt64(data + 2);
+		return true;
+	}
+
+	UdpSender::UdpSender(const boost::asio::any_io_executor& executor, boost::asio::ip::udp::endpoint bind, const UdpTransportConfig& config)
+		: mSocket(executor, bind),
+		  mPacketizer(config.fec),
+		  mLossInjector(config.lossInjector),
+		  mMulticastGroup(config.multicast.group),
+		  mMulticastKey(misc::randomToken()) {
+		putUInt64(mMulticastTrailer.data(), mMulticastKey);
+		if (mMulticastGroup) {
+			mSocket.set_option(boost::asio::ip::multicast::hops(config.multicast.hops));
+			mSocket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+
+			if (config.multicast.outboundInterface && config.multicast.outboundInterface->is_v4()) {
+				mSocket.set_option(boost::asio::ip::multicast::outbound_interface(config.multicast.outboundInterface->to_v4()));
+			}
+		}
+	}
+
+	boost::asio::ip::udp::socket& UdpSender::socket() {
+		return mSocket;
+	}
+
+	std::vector<DatagramPtr> UdpSender::packetize(const network::EncodedPacket& packet) {
+		return mPacketizer.packetize(packet);
+	}
+
+	void UdpSender::send(const std::vector<DatagramPtr>& datagrams, const boost::asio::ip::udp::endpoint& endpoint) {
+		for (auto& datagram : datagrams) {
+			sendTo(datagram, endpoint);
+		}
+	}
+
+	void UdpSender::sendMulticast(const std::vector<DatagramPtr>& datagrams) {
+		if (mMulticastGroup) {
+			for (auto& datagram : datagrams) {
+				sendTo(datagram, *mMulticastGroup, true);
+			}
+		}
+	}
+
+	const std::optional<boost::asio::ip::udp::endpoint>& UdpSender::multicastGroup() const {
+		return mMulticastGroup;
+	}
+
+	std::uint64_t UdpSender::multicastKey() const {
+		return mMulticastKey;
+	}
+
+	void UdpSender::retransmit(const std::uint8_t* nack, std::size_t size, const boost::asio::ip::udp::endpoint& endpoint) {
+		if (size < SESSION_HEADER_SIZE + 2) {
+			return;
+		}
+
+		auto count = std::min<std::size_t>(getUInt16(nack + SESSION_HEADER_SIZE), (size - SESSION_HEADER_SIZE - 2) / 8);
+		for (std::size_t i = 0; i < count; i++) {
+			if (auto datagram = mPacketizer.find(getUInt64(nack + SESSION_HEADER_SIZE + 2 + 8 * i))) {
+				sendTo(datagram, endpoint);
+			}
+		}
+	}
+
+	void UdpSender::sendTo(DatagramPtr datagram, const boost::asio::ip::udp::endpoint& endpoint, bool multicast) {
+		// The key is sent from the buffer of the sender, so that datagrams shared with unicast clients are not copied
+		std::array<boost::asio::const_buffer, 2> buffers {
+			boost::asio::buffer(*datagram),
+			boost::asio::buffer(mMulticastTrailer.data(), multicast ? mMulticastTrailer.size() : 0)
+		};
+
+		if (mLossInjector.enabled()) {
+			auto delay = mLossInjector.next();
+			if (!delay) {
+				return;
+			}
+
+			if (delay->count() > 0) {
+				auto timer = std::make_shared<boost::asio::steady_timer>(mSocket.get_executor(), *delay);
+				timer->async_wait([this, timer, datagram, buffers, endpoint](boost::system::error_code error) {
+					if (!error) {
+						mSocket.async_send_to(
+							buffers,
+							endpoint,
+							[datagram](boost::system::error_code, std::size_t) {}
+						);
+					}
+				});
+				return;
+			}
+		}
+
+		mSocket.async_send_to(
+			buffers,
+			endpoint,
+			[datagram](boost::system::error_code, std::size_t) {}
+		);
+	}
+
+	void UdpSender::start(DatagramHandler datagramHandler) {
+		mDatagramHandler = std::move(datagramHandler);
+		receive();
+	}
+
+	void UdpSender::receive() {
+		mSocket.async_receive_from(
+			boost::asio::buffer(mReceiveBuffer),
+			mReceiveEndpoint,
+			[this](boost::system::error_code error, std::size_t size) {
+				if (error == boost::asio::error::operation_aborted) {
+					return;
+				}
+
+				// Errors such as ICMP port unreachable from a client that went away do not affect the others.
+				if (!error) {
+					mDatagramHandler(mReceiveEndpoint, mReceiveBuffer.data(), size);
+				}
+
+				receive();
+			}
+		);
+	}
+
+	UdpPacketSource::Receiver::Receiver(boost::asio::io_context& ioContext)
+		: socket(ioContext) {
+
+	}
+
+	UdpPacketSource::UdpPacketSource(boost::asio::ip::udp::endpoint serverEndpoint,
+									 std::uint64_t sessionId,
+									 ReassemblerConfig reassemblerConfig)
+		: mUnicast(mIOContext),
+		  mServerEndpoint(serverEndpoint),
+		  mSessionId(sessionId),
+		  mReassembler(reassemblerConfig) {
+		mUnicast.socket.open(serverEndpoint.protocol());
+		mUnicast.socket.bind(boost::asio::ip::udp::endpoint(serverEndpoint.protocol(), 0));
+		startReceive(mUnicast);
+
+		sendDatagram(makeRegister(mSessionId));
+	}
+
+	UdpPacketSource::UdpPacketSource(boost::asio::ip::udp::endpoint serverEndpoint,
+									 std::uint64_t sessionId,
+									 boost::asio::ip::udp::endpoint multicastGroup,
+									 std::uint64_t multicastKey,
+									 boost::asio::ip::address interfaceAddress,
+									 ReassemblerConfig reassemblerConfig)
+		: UdpPacketSource(serverEndpoint, sessionId, reassemblerConfig) {
+		mMulticastKey = multicastKey;
+		mMulticast = std::make_unique<Receiver>(mIOContext);
+		mMulticast->multicast = true;
+
+		// Several viewers on the same host all bind the group port
+		auto& socket = mMulticast->socket;
+		socket.open(multicastGroup.protocol());
+		socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+		socket.bind(boost::asio::ip::udp::endpoint(multicastGroup.protocol(), multicastGroup.port()));
+
+		if (multicastGroup.address().is_v4() && interfaceAddress.is_v4()) {
+			socket.set_option(boost::asio::ip::multicast::join_group(multicastGroup.address().to_v4(), interfaceAddress.to_v4()));
+		} else {
+			socket.set_option(boost::asio::ip::multicast::join_group(multicastGroup.address()));
+		}
+
+		startReceive(*mMulticast);
+	}
+
+	void UdpPacketSource::setProtocolVersion(std::uint32_t version) {
+		mProtocolVersion = version;
+	}
+
+	boost::system::error_code UdpPacketSource::receive(AVPacket* packet, network::PacketHeader& header) {
+		while (true) {
+			if (auto frame = mReassembler.nextFrame()) {
+				if (!network::readPacketFrame(frame->data(), frame->size(), mProtocolVersion, packet, header)) {
+					return protocol::makeProtocolError();
+				}
+
+				return {};
+			}
+
+			auto nacks = mReassembler.collectNacks();
+			for (std::size_t offset = 0; offset < nacks.size(); offset += MAX_NACKS_PER_DATAGRAM) {
+				std::vector<std::uint64_t> batch(
+					nacks.begin() + (std::ptrdiff_t)offset,
+					nacks.begin() + (std::ptrdiff_t)std::min(nacks.size(), offset + MAX_NACKS_PER_DATAGRAM)
+				);
+				sendDatagram(makeNack(mSessionId, batch));
+			}
+
+			// Registration is repeated, quickly until the stream starts and then as a keep-alive for NAT mappings.
+			auto registerInterval = mReceivedData ? std::chrono::milliseconds(5000) : std::chrono::milliseconds(200);
+			if (std::chrono::steady_clock::now() - mLastRegister >= registerInterval) {
+				sendDatagram(makeRegister(mSessionId));
+			}
+
+			if (auto error = receiveDatagrams(std::chrono::milliseconds(5))) {
+				return error;
+			}
+		}
+	}
+
+	std::size_t UdpPacketSource::bufferedBytes() const {
+		return mReassembler.bufferedBytes();
+	}
+
+	void UdpPacketSource::sendDatagram(const Datagram& datagram) {
+		if (datagram[0] == (std::uint8_t)DatagramType::Register) {
+			mLastRegister = std::chrono::steady_clock::now();
+		}
+
+		boost::system::error_code error;
+		mUnicast.socket.send_to(boost::asio::buffer(datagram), mServerEndpoint, 0, error);
+	}
+
+	void UdpPacketSource::startReceive(Receiver& receiver) {
+		receiver.socket.async_receive_from(
+			boost::asio::buffer(receiver.buffer),
+			receiver.sender,
+			[this, &receiver](boost::system::error_code error, std::size_t size) {
+				if (error) {
+					mReceiveError = error;
+					return;
+				}
+
+				// Multicast datagrams are sent from the outbound interface of the server, which need not be the address connected to,
+				// so they are told apart by their key instead. Servers without keys can only be checked by their port.
+				auto fromServer = receiver.sender == mServerEndpoint && size <= MAX_DATAGRAM_SIZE;
+				if (receiver.multicast && mMulticastKey != 0) {
+					fromServer = size >= MULTICAST_KEY_SIZE
+						&& getUInt64(receiver.buffer.data() + size - MULTICAST_KEY_SIZE) == mMulticastKey;
+					size -= fromServer ? MULTICAST_KEY_SIZE : 0;
+				} else if (receiver.multicast) {
+					fromServer = receiver.sender.port() == mServerEndpoint.port() && size <= MAX_DATAGRAM_SIZE;
+				}
+
+				if (fromServer) {
+					mReassembler.add(receiver.buffer.data(), size);
+					mReceivedData = true;
+				}
+
+				startReceive(receiver);
+			}
+		);
+	}
+
+	boost::system::error_code UdpPacketSource::receiveDatagrams(std::chrono::milliseconds timeout) {
+		if (mIOContext.stopped()) {
+			mIOContext.restart();
+		}
+
+		// Waits for the first datagram, then handles whatever else has already arrived.
+		if (mIOContext.run_one_for(timeout) > 0) {
+			mIOContext.poll();
+		}
+
+		return mReceiveError;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,293 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "network.h"
+
+namespace screenshare::video::udp {
+	/**
+	 * Datagrams are kept below the common internet MTU (minus IP and UDP headers)
+	 */
+	constexpr std::size_t MAX_DATAGRAM_SIZE = 1200;
+
+	// Multicast datagrams end with the key of the stream, since anyone on the network can send to the group
+	constexpr std::size_t MULTICAST_KEY_SIZE = 8;
+
+	enum class DatagramType : std::uint8_t {
+		Data = 1,
+		Parity,
+		Nack,
+		Register
+	};
+
+	// [type: u8][flags: u8][sequence: u64][frame id: u64][fragment index: u16][fragment count: u16][fragment]
+	constexpr std::size_t DATA_HEADER_SIZE = 22;
+	// [type: u8][reserved: u8][first sequence: u64][count: u16][region size: u16][xor of protected regions]
+	constexpr std::size_t PARITY_HEADER_SIZE = 14;
+	// Everything of a data datagram but the sequence number, plus the fragment size: [flags][frame id][index][count][size][fragment]
+	constexpr std::size_t PROTECTED_HEADER_SIZE = 15;
+	constexpr std::size_t MAX_FRAGMENT_SIZE = MAX_DATAGRAM_SIZE - PARITY_HEADER_SIZE - PROTECTED_HEADER_SIZE;
+
+	constexpr std::uint8_t FRAME_FLAG_KEYFRAME = 1 << 0;
+
+	using Datagram = std::vector<std::uint8_t>;
+	using DatagramPtr = std::shared_ptr<const Datagram>;
+
+	struct FecConfig {
+		std::size_t groupSize = 0; // One XOR parity datagram per group of data datagrams, 0 disables FEC
+	};
+
+	/**
+	 * Splits packet frames into sequence numbered datagrams and keeps the most recent ones for retransmission
+	 */
+	class Packetizer {
+	private:
+		FecConfig mFec;
+		std::uint64_t mNextSequence = 0;
+		std::uint64_t mNextFrameId = 0;
+		std::vector<DatagramPtr> mHistory;
+
+		std::vector<std::uint8_t> mParity;
+		std::uint64_t mParityFirstSequence = 0;
+		std::size_t mParityCount = 0;
+
+		void addToParity(const Datagram& datagram);
+		DatagramPtr finishParity();
+	public:
+		explicit Packetizer(FecConfig fec, std::size_t historySize = 4096);
+
+		std::vector<DatagramPtr> packetize(const network::EncodedPacket& packet);
+
+		DatagramPtr find(std::uint64_t sequence) const;
+	};
+
+	struct ReassemblerConfig {
+		std::chrono::milliseconds deadline { 150 }; // How long an incomplete frame is waited for
+		std::chrono::milliseconds nackDelay { 5 }; // Reordering allowance before a gap is requested again
+		std::chrono::milliseconds nackInterval { 20 };
+	};
+
+	/**
+	 * Collects datagrams into complete frames, delivered in order. Lost datagrams are recovered using parity when possible,
+	 * otherwise requested again until the frame deadline passes, after which the stream resumes at the next keyframe.
+	 */
+	class Reassembler {
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct PendingFrame {
+			std::uint8_t flags = 0;
+			std::vector<std::vector<std::uint8_t>> fragments;
+			std::vector<bool> present;
+			std::size_t received = 0;
+			Clock::time_point firstArrival;
+		};
+
+		struct MissingDatagram {
+			Clock::time_point detected;
+			Clock::time_point lastNack;
+		};
+
+		struct ParityGroup {
+			std::size_t count = 0;
+			std::vector<std::uint8_t> parity;
+		};
+
+		ReassemblerConfig mConfig;
+
+		bool mStarted = false;
+		bool mWaitingForKeyframe = true;
+		std::uint64_t mNextFrameId = 0;
+		std::map<std::uint64_t, PendingFrame> mFrames;
+
+		bool mSequenceStarted = false;
+		std::uint64_t mNextSequence = 0;
+		std::map<std::uint64_t, MissingDatagram> mMissing;
+		std::map<std::uint64_t, std::vector<std::uint8_t>> mProtectedRegions;
+		std::map<std::uint64_t, ParityGroup> mParityGroups;
+
+		std::uint64_t mRecoveredDatagrams = 0;
+		std::uint64_t mSkippedFrames = 0;
+
+		void addData(std::uint64_t sequence, const std::uint8_t* region, std::size_t regionSize, bool storeRegion);
+		void addParity(const std::uint8_t* datagram, std::size_t size);
+		void tryRecover(std::uint64_t firstSequence);
+		void prune();
+	public:
+		explicit Reassembler(ReassemblerConfig config = {});
+
+		void add(const std::uint8_t* datagram, std::size_t size);
+
+		/**
+		 * Returns the next complete frame in order, skipping frames that missed their deadline
+		 */
+		std::optional<std::vector<std::uint8_t>> nextFrame();
+
+		/**
+		 * Returns the sequence numbers that should be requested again now
+		 */
+		std::vector<std::uint64_t> collectNacks();
+
+		std::uint64_t recoveredDatagrams() const;
+		std::uint64_t skippedFrames() const;
+
+		/**
+		 * Bytes of the fragments held for frames that are not yet complete or not yet in turn
+		 */
+		std::size_t bufferedBytes() const;
+	};
+
+	struct LossInjectorConfig {
+		double lossRate = 0.0;
+		std::chrono::milliseconds delay { 0 };
+		std::chrono::milliseconds jitter { 0 };
+	};
+
+	/**
+	 * Simulates a lossy network inside the process, for testing on loopback
+	 */
+	class LossInjector {
+	private:
+		LossInjectorConfig mConfig;
+		std::mt19937 mRandom;
+	public:
+		explicit LossInjector(LossInjectorConfig config);
+
+		bool enabled() const;
+
+		/**
+		 * Returns the delay to apply to the next datagram, or nothing if it should be dropped
+		 */
+		std::optional<std::chrono::microseconds> next();
+	};
+
+	struct MulticastConfig {
+		std::optional<boost::asio::ip::udp::endpoint> group;
+		std::optional<boost::asio::ip::address> outboundInterface; // Use the loopback address to test on a single host
+		int hops = 1;
+	};
+
+	struct UdpTransportConfig {
+		bool enabled = false;
+		FecConfig fec;
+		LossInjectorConfig lossInjector;
+		MulticastConfig multicast;
+	};
+
+	Datagram makeNack(std::uint64_t sessionId, const std::vector<std::uint64_t>& sequences);
+	Datagram makeRegister(std::uint64_t sessionId);
+
+	/**
+	 * Server side of the UDP transport
+	 */
+	class UdpSender {
+	public:
+		using DatagramHandler = std::function<void (const boost::asio::ip::udp::endpoint& sender, const std::uint8_t* data, std::size_t size)>;
+	private:
+		boost::asio::ip::udp::socket mSocket;
+		Packetizer mPacketizer;
+		LossInjector mLossInjector;
+		std::optional<boost::asio::ip::udp::endpoint> mMulticastGroup;
+		std::uint64_t mMulticastKey;
+		std::array<std::uint8_t, MULTICAST_KEY_SIZE> mMulticastTrailer {};
+
+		std::array<std::uint8_t, MAX_DATAGRAM_SIZE> mReceiveBuffer {};
+		boost::asio::ip::udp::endpoint mReceiveEndpoint;
+		DatagramHandler mDatagramHandler;
+
+		void sendTo(DatagramPtr datagram, const boost::asio::ip::udp::endpoint& endpoint, bool multicast = false);
+		void receive();
+	public:
+		UdpSender(const boost::asio::any_io_executor& executor, boost::asio::ip::udp::endpoint bind, const UdpTransportConfig& config);
+
+		boost::asio::ip::udp::socket& socket();
+
+		std::vector<DatagramPtr> packetize(const network::EncodedPacket& packet);
+		void send(const std::vector<DatagramPtr>& datagrams, const boost::asio::ip::udp::endpoint& endpoint);
+
+		/**
+		 * Sends the datagrams once to the multicast group, if one is configured
+		 */
+		void sendMulticast(const std::vector<DatagramPtr>& datagrams);
+		const std::optional<boost::asio::ip::udp::endpoint>& multicastGroup() const;
+
+		/**
+		 * The key multicast datagrams end with, which clients are given over their TCP connection
+		 */
+		std::uint64_t multicastKey() const;
+
+		void retransmit(const std::uint8_t* nack, std::size_t size, const boost::asio::ip::udp::endpoint& endpoint);
+
+		void start(DatagramHandler datagramHandler);
+	};
+
+	bool parseSessionDatagram(const std::uint8_t* data, std::size_t size, DatagramType& type, std::uint64_t& sessionId);
+
+	/**
+	 * Client side of the UDP transport. Retransmissions and control datagrams always use unicast, while the stream
+	 * itself is either sent directly to the client or to a multicast group the client has joined.
+	 */
+	class UdpPacketSource : public network::PacketSource {
+	private:
+		struct Receiver {
+			boost::asio::ip::udp::socket socket;
+			std::array<std::uint8_t, MAX_DATAGRAM_SIZE + MULTICAST_KEY_SIZE> buffer {};
+			boost::asio::ip::udp::endpoint sender;
+			bool multicast = false;
+
+			explicit Receiver(boost::asio::io_context& ioContext);
+		};
+
+		boost::asio::io_context mIOContext;
+		Receiver mUnicast;
+		std::unique_ptr<Receiver> mMulticast;
+		boost::asio::ip::udp::endpoint mServerEndpoint;
+		std::uint64_t mSessionId;
+		std::uint64_t mMulticastKey = 0;
+
+		Reassembler mReassembler;
+		boost::system::error_code mReceiveError;
+		std::chrono::steady_clock::time_point mLastRegister;
+		bool mReceivedData = false;
+		std::uint32_t mProtocolVersion = protocol::PROTOCOL_VERSION;
+
+		void sendDatagram(const Datagram& datagram);
+		void startReceive(Receiver& receiver);
+		boost::system::error_code receiveDatagrams(std::chrono::milliseconds timeout);
+	public:
+		UdpPacketSource(
+			boost::asio::ip::udp::endpoint serverEndpoint,
+			std::uint64_t sessionId,
+			ReassemblerConfig reassemblerConfig = {}
+		);
+
+		/**
+		 * Receives the stream from the given multicast group, joined on the interface with the given address. Datagrams
+		 * from the group must end with the given key, unless it is 0 for servers that do not send one.
+		 */
+		UdpPacketSource(
+			boost::asio::ip::udp::endpoint serverEndpoint,
+			std::uint64_t sessionId,
+			boost::asio::ip::udp::endpoint multicastGroup,
+			std::uint64_t multicastKey,
+			boost::asio::ip::address interfaceAddress,
+			ReassemblerConfig reassemblerConfig = {}
+		);
+
+		/**
+		 * Sets the version negotiated with the server, which decides the format of the packet headers
+		 */
+		void setProtocolVersion(std::uint32_t version);
+
+		boost::system::error_code receive(AVPacket* packet, network::PacketHeader& header) override;
+		std::size_t bufferedBytes() const override;
+	};
+}
\ No newline at end of file